@@ -41,11 +41,153 @@
 
 #define min(x,y) ((x)<(y)?(x):(y))
 
+// The items are kept in a list sorted by key, for conf_find and conf_save,
+// and indexed by a hash table for the getters.
+// Writers are serialized by the mutex. The getters don't lock: the table is
+// replaced with a single atomic pointer store when it grows or items get removed,
+// and the replaced values, items and tables are kept in a garbage list,
+// until no getter is running.
+
+typedef struct {
+    uint32_t hash;
+    DB_conf_item_t *item;
+} conf_slot_t;
+
+typedef struct {
+    size_t size; // power of 2
+    size_t used;
+    conf_slot_t slots[1];
+} conf_table_t;
+
+typedef struct conf_garbage_s {
+    struct conf_garbage_s *next;
+    void *ptr;
+} conf_garbage_t;
+
+#define CONF_TABLE_MIN_SIZE 1024
+// rebuild the table bigger when more than 50% slots are used
+#define CONF_TABLE_MAX_LOAD_NUM 1
+#define CONF_TABLE_MAX_LOAD_DEN 2
+
 static DB_conf_item_t *conf_items;
+static conf_table_t *conf_table;
+static conf_garbage_t *conf_garbage;
+static int conf_readers; // number of getters running without the lock
 static int changed;
 static uintptr_t mutex;
 static int disable_saving;
 
+// case insensitive, to match the strcasecmp key comparison
+static uint32_t
+conf_get_hash (const char *key) {
+    uint32_t h = 2166136261u;
+    for (const uint8_t *p = (const uint8_t *)key; *p; p++) {
+        uint8_t c = *p;
+        if (c >= 'A' && c <= 'Z') {
+            c += 'a' - 'A';
+        }
+        h = (h ^ c) * 16777619u;
+    }
+    return h;
+}
+
+// Must be called with the mutex held.
+// Frees the garbage if no getter is running, otherwise leaves it for the next call.
+static void
+conf_collect_garbage (void) {
+    if (!conf_garbage || __atomic_load_n (&conf_readers, __ATOMIC_SEQ_CST)) {
+        return;
+    }
+    conf_garbage_t *next;
+    for (conf_garbage_t *g = conf_garbage; g; g = next) {
+        next = g->next;
+        free (g->ptr);
+        free (g);
+    }
+    conf_garbage = NULL;
+}
+
+// Must be called with the mutex held, after the pointer was unpublished
+static void
+conf_retire (void *ptr) {
+    if (!ptr) {
+        return;
+    }
+    conf_garbage_t *g = malloc (sizeof (conf_garbage_t));
+    g->ptr = ptr;
+    g->next = conf_garbage;
+    conf_garbage = g;
+}
+
+// Must be called with the mutex held
+static void
+conf_table_insert (conf_table_t *t, DB_conf_item_t *item, uint32_t h) {
+    size_t mask = t->size - 1;
+    size_t i = h & mask;
+    while (t->slots[i].item) {
+        i = (i + 1) & mask;
+    }
+    t->slots[i].hash = h;
+    __atomic_store_n (&t->slots[i].item, item, __ATOMIC_RELEASE);
+    t->used++;
+}
+
+// Must be called with the mutex held.
+// Builds a new table from the item list, and publishes it.
+static void
+conf_table_rebuild (size_t count) {
+    size_t size = CONF_TABLE_MIN_SIZE;
+    while (count * CONF_TABLE_MAX_LOAD_DEN >= size * CONF_TABLE_MAX_LOAD_NUM) {
+        size *= 2;
+    }
+    conf_table_t *t = calloc (1, sizeof (conf_table_t) + (size-1) * sizeof (conf_slot_t));
+    t->size = size;
+    for (DB_conf_item_t *it = conf_items; it; it = it->next) {
+        conf_table_insert (t, it, conf_get_hash (it->key));
+    }
+    conf_table_t *old = conf_table;
+    __atomic_store_n (&conf_table, t, __ATOMIC_SEQ_CST);
+    conf_retire (old);
+}
+
+// Lock-free lookup, safe to call concurrently with writers,
+// between conf_read_begin and conf_read_end
+static DB_conf_item_t *
+conf_table_find (const char *key) {
+    conf_table_t *t = __atomic_load_n (&conf_table, __ATOMIC_SEQ_CST);
+    if (!t) {
+        return NULL;
+    }
+    uint32_t h = conf_get_hash (key);
+    size_t mask = t->size - 1;
+    for (size_t i = h & mask; ; i = (i + 1) & mask) {
+        conf_slot_t *slot = &t->slots[i];
+        DB_conf_item_t *item = __atomic_load_n (&slot->item, __ATOMIC_ACQUIRE);
+        if (!item) {
+            return NULL;
+        }
+        if (slot->hash == h && !strcasecmp (key, item->key)) {
+            return item;
+        }
+    }
+}
+
+static void
+conf_read_begin (void) {
+    __atomic_add_fetch (&conf_readers, 1, __ATOMIC_SEQ_CST);
+}
+
+static void
+conf_read_end (void) {
+    __atomic_sub_fetch (&conf_readers, 1, __ATOMIC_SEQ_CST);
+}
+
+static const char *
+conf_read_value (const char *key) {
+    DB_conf_item_t *item = conf_table_find (key);
+    return item ? __atomic_load_n (&item->value, __ATOMIC_SEQ_CST) : NULL;
+}
+
 void
 conf_init (void) {
     mutex = mutex_create ();
@@ -70,6 +212,9 @@ conf_free (void) {
         conf_item_free (it);
     }
     conf_items = NULL;
+    free (conf_table);
+    conf_table = NULL;
+    conf_collect_garbage ();
     changed = 0;
     mutex_free (mutex);
     mutex = 0;
@@ -220,17 +365,13 @@ conf_item_free (DB_conf_item_t *it) {
 
 const char *
 conf_get_str_fast (const char *key, const char *def) {
-    for (DB_conf_item_t *it = conf_items; it; it = it->next) {
-        if (!strcasecmp (key, it->key)) {
-            return it->value;
-        }
-    }
-    return def;
+    const char *value = conf_read_value (key);
+    return value ? value : def;
 }
 
 void
 conf_get_str (const char *key, const char *def, char *buffer, int buffer_size) {
-    conf_lock ();
+    conf_read_begin ();
     const char *out = conf_get_str_fast (key, def);
     if (out) {
         size_t n = strlen (out)+1;
@@ -241,33 +382,33 @@ conf_get_str (const char *key, const char *def, char *buffer, int buffer_size) {
     else {
         *buffer = 0;
     }
-    conf_unlock ();
+    conf_read_end ();
 }
 
 float
 conf_get_float (const char *key, float def) {
-    conf_lock ();
-    const char *v = conf_get_str_fast (key, NULL);
+    conf_read_begin ();
+    const char *v = conf_read_value (key);
     float res = v ? atof (v) : def;
-    conf_unlock ();
+    conf_read_end ();
     return res;
 }
 
 int
 conf_get_int (const char *key, int def) {
-    conf_lock ();
-    const char *v = conf_get_str_fast (key, NULL);
+    conf_read_begin ();
+    const char *v = conf_read_value (key);
     int res = v ? atoi (v) : def;
-    conf_unlock ();
+    conf_read_end ();
     return res;
 }
 
 int64_t
 conf_get_int64 (const char *key, int64_t def) {
-    conf_lock ();
-    const char *v = conf_get_str_fast (key, NULL);
+    conf_read_begin ();
+    const char *v = conf_read_value (key);
     int64_t res = v ? atoll (v) : def;
-    conf_unlock ();
+    conf_read_end ();
     return res;
 }
 
@@ -285,30 +426,33 @@ conf_find (const char *group, DB_conf_item_t *prev) {
 void
 conf_set_str (const char *key, const char *val) {
     conf_lock ();
-    DB_conf_item_t *prev = NULL;
-    for (DB_conf_item_t *it = conf_items; it; it = it->next) {
-        int cmp = strcasecmp (key, it->key);
-        if (!cmp) {
-            if (!strcmp (it->value, val)) {
-                conf_unlock ();
-                return;
-            }
-            free (it->value);
-            it->value = strdup (val);
+    DB_conf_item_t *it = conf_table_find (key);
+    if (it) {
+        if (!val || !strcmp (it->value, val)) {
             conf_unlock ();
-            changed = 1;
             return;
         }
-        else if (cmp < 0) {
-            break;
-        }
-        prev = it;
+        char *old = it->value;
+        __atomic_store_n (&it->value, strdup (val), __ATOMIC_SEQ_CST);
+        conf_retire (old);
+        conf_collect_garbage ();
+        conf_unlock ();
+        changed = 1;
+        return;
     }
     if (!val) {
         conf_unlock ();
         return;
     }
-    DB_conf_item_t *it = malloc (sizeof (DB_conf_item_t));
+
+    DB_conf_item_t *prev = NULL;
+    for (DB_conf_item_t *i = conf_items; i; i = i->next) {
+        if (strcasecmp (key, i->key) < 0) {
+            break;
+        }
+        prev = i;
+    }
+    it = malloc (sizeof (DB_conf_item_t));
     memset (it, 0, sizeof (DB_conf_item_t));
     it->key = strdup (key);
     it->value = strdup (val);
@@ -322,6 +466,14 @@ conf_set_str (const char *key, const char *val) {
         it->next = conf_items;
         conf_items = it;
     }
+
+    if (!conf_table || (conf_table->used + 1) * CONF_TABLE_MAX_LOAD_DEN >= conf_table->size * CONF_TABLE_MAX_LOAD_NUM) {
+        conf_table_rebuild (conf_table ? conf_table->used + 1 : 1);
+    }
+    else {
+        conf_table_insert (conf_table, it, conf_get_hash (key));
+    }
+    conf_collect_garbage ();
     conf_unlock ();
 }
 
@@ -367,10 +519,16 @@ conf_remove_items (const char *key) {
             break;
         }
     }
+    if (!it) {
+        conf_unlock ();
+        return;
+    }
     DB_conf_item_t *next = NULL;
+    DB_conf_item_t *removed = it;
+    DB_conf_item_t *removed_tail = it;
     while (it) {
         next = it->next;
-        conf_item_free (it);
+        removed_tail = it;
         it = next;
         if (!it || strncasecmp (key, it->key, l)) {
             break;
@@ -382,6 +540,21 @@ conf_remove_items (const char *key) {
     else {
         conf_items = next;
     }
+    removed_tail->next = NULL;
+
+    // the getters may still see the removed items until the new table is published
+    size_t count = 0;
+    for (DB_conf_item_t *i = conf_items; i; i = i->next) {
+        count++;
+    }
+    conf_table_rebuild (count);
+    for (it = removed; it; it = next) {
+        next = it->next;
+        conf_retire (it->key);
+        conf_retire (it->value);
+        conf_retire (it);
+    }
+    conf_collect_garbage ();
     conf_unlock ();
 }
 
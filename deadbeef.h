@@ -71,6 +71,7 @@ extern "C" {
 // that there's a better replacement in the newer deadbeef versions.
 
 // api version history:
+// 1.11 -- deadbeef-1.8.1
 // 1.10 -- deadbeef-1.8.0
 // 1.9 -- deadbeef-0.7.2
 // 1.8 -- deadbeef-0.7.0
@@ -95,7 +96,7 @@ extern "C" {
 // 0.1 -- deadbeef-0.2.0
 
 #define DB_API_VERSION_MAJOR 1
-#define DB_API_VERSION_MINOR 10
+#define DB_API_VERSION_MINOR 11
 
 #if defined(__clang__)
 
@@ -441,6 +442,11 @@ enum {
     DB_EV_FOCUS_SELECTION = 24, 
 #endif
 
+#if (DDB_API_LEVEL >= 11)
+    // Used internally to run the job completion callbacks on the main thread, plugins should ignore it.
+    DB_EV_JOBSCOMPLETED = 25,
+#endif
+
     // -----------------
     // structured events
 
@@ -615,6 +621,19 @@ typedef struct ddb_file_found_data_s {
 } ddb_file_found_data_t;
 #endif
 
+// since 1.11
+#if (DDB_API_LEVEL >= 11)
+// Job priorities, see job_submit
+enum {
+    DDB_JOB_PRIORITY_LOW = 0, // background maintenance, e.g. cache cleanup
+    DDB_JOB_PRIORITY_NORMAL = 1,
+    DDB_JOB_PRIORITY_HIGH = 2, // the user is waiting for the result
+};
+
+// Cancellation token, shared by a group of jobs, see job_submit
+typedef struct ddb_cancellation_token_s ddb_cancellation_token_t;
+#endif
+
 // context for title formatting interpreter
 typedef struct {
     int _size; // must be set to sizeof(tf_context_t)
@@ -1454,6 +1473,51 @@ typedef struct {
     // this should be called by plugins to prevent running cuesheet code at a wrong time.
     int (*plt_is_loading_cue) (ddb_playlist_t *plt);
 #endif
+
+#if (DDB_API_LEVEL >= 11)
+    ////// Job pool APIs available from 1.11+ //////
+
+    // The job pool is a shared, size-bounded set of worker threads,
+    // which should be used instead of starting a thread for each background task.
+
+    // Returns a new token with refcount 1
+    ddb_cancellation_token_t *(*cancellation_token_alloc) (void);
+
+    void (*cancellation_token_ref) (ddb_cancellation_token_t *token);
+
+    void (*cancellation_token_unref) (ddb_cancellation_token_t *token);
+
+    // Cancels all jobs submitted with the token.
+    // The queued jobs are dropped without running, and the running ones
+    // are expected to check cancellation_token_is_cancelled, and return early.
+    void (*cancellation_token_cancel) (ddb_cancellation_token_t *token);
+
+    // Returns 1 if the token was cancelled, or the player is shutting down.
+    // token can be NULL, to only check for the shutdown.
+    int (*cancellation_token_is_cancelled) (ddb_cancellation_token_t *token);
+
+    // Queues a job, which runs `work` on one of the pool threads.
+    // The jobs with higher priority run first, see DDB_JOB_PRIORITY_*.
+    // `completion` is optional, and is called on the main thread after `work` returned,
+    // with cancelled=1 if the token was cancelled, in which case `work` might not have been called.
+    // `token` is optional, and is passed to `work`.
+    // Returns 0 on success, or -1 if the job can't be queued, e.g. during shutdown, in which case nothing is called.
+    int (*job_submit) (int priority, ddb_cancellation_token_t *token, void (*work) (void *ctx, ddb_cancellation_token_t *token), void (*completion) (void *ctx, int cancelled), void *ctx);
+
+    // Waits until all jobs submitted with the token have finished,
+    // and then calls their pending completion callbacks on the calling thread.
+    // Typically used together with cancellation_token_cancel in plugin.stop.
+    // Must not be called from a job.
+    void (*job_wait) (ddb_cancellation_token_t *token);
+
+    // Same as cond_wait, but the mutex must be locked by the caller (once), and is locked when the function returns.
+    // This allows to check the condition and wait atomically, so that no signal is missed in between.
+    int (*cond_wait_locked) (uintptr_t cond, uintptr_t mutex);
+
+    // Same as cond_wait_locked, but returns after timeout_ms milliseconds at most.
+    // Returns 0 if the cond was signalled, or ETIMEDOUT.
+    int (*cond_wait_timeout_locked) (uintptr_t cond, uintptr_t mutex, int timeout_ms);
+#endif
 } DB_functions_t;
 
 // NOTE: an item placement must be selected like this
@@ -383,42 +383,49 @@ streamer_dsp_init (void) {
 
 
 int
-dsp_apply (ddb_waveformat_t *input_fmt, char *input, int inputsize,
-           ddb_waveformat_t *out_fmt, char **out_bytes, int *out_numbytes, float *out_dsp_ratio) {
-
-    *out_dsp_ratio = 1;
+dsp_can_bypass (ddb_waveformat_t *input_fmt) {
+    if (!dsp_on) {
+        return 1;
+    }
 
     ddb_waveformat_t dspfmt;
     memcpy (&dspfmt, input_fmt, sizeof (ddb_waveformat_t));
     dspfmt.bps = 32;
     dspfmt.is_float = 1;
 
-    int can_bypass = 0;
-    if (dsp_on) {
-        // check if DSP can be passed through
-        ddb_dsp_context_t *dsp = dsp_chain;
-        while (dsp) {
-            if (dsp->enabled) {
-                if (dsp->plugin->plugin.api_vminor >= 1) {
-                    if (!dsp->plugin->can_bypass || !dsp->plugin->can_bypass (dsp, &dspfmt)) {
-                        break;
-                    }
-                }
-                else {
-                    break;
+    // check if DSP can be passed through
+    ddb_dsp_context_t *dsp = dsp_chain;
+    while (dsp) {
+        if (dsp->enabled) {
+            if (dsp->plugin->plugin.api_vminor >= 1) {
+                if (!dsp->plugin->can_bypass || !dsp->plugin->can_bypass (dsp, &dspfmt)) {
+                    return 0;
                 }
             }
-            dsp = dsp->next;
-        }
-        if (!dsp) {
-            can_bypass = 1;
+            else {
+                return 0;
+            }
         }
+        dsp = dsp->next;
     }
+    return 1;
+}
 
-    if (!dsp_on || can_bypass) {
+int
+dsp_apply (ddb_waveformat_t *input_fmt, char *input, int inputsize,
+           ddb_waveformat_t *out_fmt, char **out_bytes, int *out_numbytes, float *out_dsp_ratio) {
+
+    *out_dsp_ratio = 1;
+
+    if (dsp_can_bypass (input_fmt)) {
         return 0;
     }
 
+    ddb_waveformat_t dspfmt;
+    memcpy (&dspfmt, input_fmt, sizeof (ddb_waveformat_t));
+    dspfmt.bps = 32;
+    dspfmt.is_float = 1;
+
     int inputsamplesize = input_fmt->channels * input_fmt->bps / 8;
 
     // convert to float, pass through streamer DSP chain
@@ -53,6 +53,10 @@ streamer_set_dsp_chain_real (ddb_dsp_context_t *chain);
 ddb_dsp_context_t *
 dsp_clone (ddb_dsp_context_t *from);
 
+// Returns 1 if the DSP chain leaves data in the given format unchanged
+int
+dsp_can_bypass (ddb_waveformat_t *input_fmt);
+
 int
 dsp_apply (ddb_waveformat_t *input_fmt, char *input, int inputsize,
            ddb_waveformat_t *out_fmt, char **out_bytes, int *out_numbytes, float *out_dsp_ratio);
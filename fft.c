@@ -24,24 +24,31 @@
 #  include <config.h>
 #endif
 #include "deadbeef.h"
+#include "fft.h"
 #include <math.h>
 #include <complex.h>
-
-#define N (DDB_FREQ_BANDS * 2)
-
-static float hamming[N];              /* hamming window, scaled to sum to 1 */
-static int reversed[N];               /* bit-reversal table */
-static float complex roots[N / 2];    /* N-th roots of unity */
-static int generated = 0;
-static float LOGN; /* log N (base 2) */
-
-/* Reverse the order of the lowest LOGN bits in an integer. */
-
-static int bit_reverse (int x)
+#include <stdlib.h>
+
+// Real-input FFT: the N real samples are packed into N/2 complex values,
+// transformed with an N/2-point complex FFT, and then split into the spectrum of the real input.
+// All tables are computed once per size, when the fft_t is allocated.
+struct fft_s {
+    int size;               /* N, number of input samples */
+    int half;               /* N / 2, size of the complex transform */
+    float *hamming;         /* hamming window */
+    int *reversed;          /* bit-reversal table for the complex transform */
+    float complex *roots;   /* (N/2)-th roots of unity */
+    float complex *twiddle; /* N-th roots of unity, used to split the spectrum */
+    float complex *a;       /* work buffer */
+};
+
+/* Reverse the order of the lowest logn bits in an integer. */
+
+static int bit_reverse (int x, int logn)
 {
     int y = 0;
 
-    for (int n = LOGN; n --; )
+    for (int n = logn; n --; )
     {
         y = (y << 1) | (x & 1);
         x >>= 1;
@@ -50,38 +57,63 @@ static int bit_reverse (int x)
     return y;
 }
 
-#ifndef HAVE_LOG2
-static inline float log2(float x) {return (float)log(x)/M_LN2;}
-#endif
+fft_t *
+fft_alloc (int size) {
+    if (size < 4 || (size & (size - 1))) {
+        return NULL;
+    }
+
+    fft_t *fft = calloc (1, sizeof (fft_t));
+    fft->size = size;
+    fft->half = size / 2;
+    fft->hamming = malloc (size * sizeof (float));
+    fft->reversed = malloc (fft->half * sizeof (int));
+    fft->roots = malloc (fft->half / 2 * sizeof (float complex));
+    fft->twiddle = malloc ((fft->half + 1) * sizeof (float complex));
+    fft->a = malloc (fft->half * sizeof (float complex));
+
+    int logn = 0;
+    while ((1 << logn) < fft->half) {
+        logn++;
+    }
 
-/* Generate lookup tables. */
+    for (int n = 0; n < size; n ++)
+        fft->hamming[n] = 1 - 0.85 * cosf (2 * M_PI * n / size);
+    for (int n = 0; n < fft->half; n ++)
+        fft->reversed[n] = bit_reverse (n, logn);
+    for (int n = 0; n < fft->half / 2; n ++)
+        fft->roots[n] = cexpf (2 * M_PI * I * n / fft->half);
+    for (int n = 0; n <= fft->half; n ++)
+        fft->twiddle[n] = cexpf (2 * M_PI * I * n / size);
 
-static void generate_tables (void)
-{
-    if (generated)
-        return;
-
-    LOGN = log2(N);
-    for (int n = 0; n < N; n ++)
-        hamming[n] = 1 - 0.85 * cosf (2 * M_PI * n / N);
-    for (int n = 0; n < N; n ++)
-        reversed[n] = bit_reverse (n);
-    for (int n = 0; n < N / 2; n ++)
-        roots[n] = cexpf (2 * M_PI * I * n / N);
-
-    generated = 1;
+    return fft;
 }
 
-static void do_fft (float complex a[N])
+void
+fft_free (fft_t *fft) {
+    free (fft->hamming);
+    free (fft->reversed);
+    free (fft->roots);
+    free (fft->twiddle);
+    free (fft->a);
+    free (fft);
+}
+
+int
+fft_get_size (fft_t *fft) {
+    return fft->size;
+}
+
+static void do_fft (float complex *a, const float complex *roots, int size)
 {
     int half = 1;       /* (2^s)/2 */
-    int inv = N / 2;    /* N/(2^s) */
+    int inv = size / 2; /* size/(2^s) */
 
     /* loop through steps */
     while (inv)
     {
         /* loop through groups */
-        for (int g = 0; g < N; g += half << 1)
+        for (int g = 0; g < size; g += half << 1)
         {
             /* loop through butterflies */
             for (int b = 0, r = 0; b < half; b ++, r += inv)
@@ -99,18 +131,26 @@ static void do_fft (float complex a[N])
 }
 
 void
-calc_freq (float *data, float *freq) {
-    generate_tables ();
-
+fft_calc_freq (fft_t *fft, const float *data, float *freq) {
     // fft code shamelessly stolen from audacious
     // thanks, John
-    float complex a[N];
-    for (int n = 0; n < N; n ++) {
-        a[reversed[n]] = data[n] * hamming[n];
-    }
-    do_fft(a);
+    const int N = fft->size;
+    const int M = fft->half;
+    float complex *a = fft->a;
 
-    for (int n = 0; n < N / 2 - 1; n ++)
-        freq[n] = 2 * cabsf (a[1 + n]) / N;
-    freq[N / 2 - 1] = cabsf(a[N / 2]) / N;
+    // even samples go to the real part, odd samples to the imaginary part
+    for (int n = 0; n < M; n ++) {
+        a[fft->reversed[n]] = data[2*n] * fft->hamming[2*n] + I * (data[2*n+1] * fft->hamming[2*n+1]);
+    }
+    do_fft (a, fft->roots, M);
+
+    // split into the transforms of the even and odd samples, and combine them
+    for (int k = 1; k <= M; k ++) {
+        float complex z = a[k % M];
+        float complex zc = conjf (a[(M - k) % M]);
+        float complex even = (z + zc) * 0.5f;
+        float complex odd = (z - zc) * (-0.5f * I);
+        float complex x = even + fft->twiddle[k] * odd;
+        freq[k - 1] = (k < M ? 2 : 1) * cabsf (x) / N;
+    }
 }
@@ -20,6 +20,17 @@
 #ifndef AUDACIOUS_FFT_H
 #define AUDACIOUS_FFT_H
 
-void calc_freq (const float data[512], float freq[256]);
+typedef struct fft_s fft_t;
+
+// size is the number of input samples, and must be a power of 2, at least 4
+fft_t *fft_alloc (int size);
+
+void fft_free (fft_t *fft);
+
+int fft_get_size (fft_t *fft);
+
+// data contains fft_get_size() samples,
+// freq receives fft_get_size()/2 magnitudes, starting from the first non-DC band
+void fft_calc_freq (fft_t *fft, const float *data, float *freq);
 
 #endif
@@ -0,0 +1,393 @@
+/*
+    DeaDBeeF -- the music player
+    Copyright (C) 2009-2018 Alexey Yakovenko and other contributors
+
+    This software is provided 'as-is', without any express or implied
+    warranty.  In no event will the authors be held liable for any damages
+    arising from the use of this software.
+
+    Permission is granted to anyone to use this software for any purpose,
+    including commercial applications, and to alter it and redistribute it
+    freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source distribution.
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/prctl.h>
+#endif
+#include "jobpool.h"
+#include "threading.h"
+#include "messagepump.h"
+#include "conf.h"
+
+//#define trace(...) { fprintf(stderr, __VA_ARGS__); }
+#define trace(fmt,...)
+
+#define JOBPOOL_MAX_THREADS 32
+#define JOBPOOL_NUM_PRIORITIES (DDB_JOB_PRIORITY_HIGH+1)
+
+struct ddb_cancellation_token_s {
+    int refc;
+    int cancelled;
+    int active; // number of queued and running jobs, protected by the pool mutex
+};
+
+typedef struct job_s {
+    ddb_cancellation_token_t *token;
+    void (*work) (void *ctx, ddb_cancellation_token_t *token);
+    void (*completion) (void *ctx, int cancelled);
+    void *ctx;
+    int cancelled;
+    struct job_s *next;
+} job_t;
+
+typedef struct {
+    job_t *head;
+    job_t *tail;
+} job_list_t;
+
+static uintptr_t _mutex;
+static uintptr_t _work_cond; // signalled when a job is queued
+static uintptr_t _done_cond; // signalled when a job is finished
+
+// All jobs are in a single queue per priority, which the workers pick from.
+// The jobs are coarse-grained (file and network I/O, decoding whole tracks),
+// so contention on the queue lock is negligible.
+static job_list_t _queues[JOBPOOL_NUM_PRIORITIES];
+static int _num_queued;
+static job_list_t _completed;
+
+static intptr_t _threads[JOBPOOL_MAX_THREADS];
+static int _num_threads;
+static int _max_threads;
+static int _idle_threads; // waiting for a job, and not signalled yet
+static int _wakeups; // signalled, which the waiting threads didn't take yet
+static int _terminate;
+
+static void
+job_list_append (job_list_t *list, job_t *job) {
+    job->next = NULL;
+    if (list->tail) {
+        list->tail->next = job;
+    }
+    else {
+        list->head = job;
+    }
+    list->tail = job;
+}
+
+static void
+job_free (job_t *job) {
+    if (job->token) {
+        cancellation_token_unref (job->token);
+    }
+    free (job);
+}
+
+// Must be called with the mutex locked
+static job_t *
+jobpool_dequeue (void) {
+    for (int i = JOBPOOL_NUM_PRIORITIES-1; i >= 0; i--) {
+        job_t *job = _queues[i].head;
+        if (job) {
+            _queues[i].head = job->next;
+            if (!_queues[i].head) {
+                _queues[i].tail = NULL;
+            }
+            _num_queued--;
+            return job;
+        }
+    }
+    return NULL;
+}
+
+// Must be called with the mutex locked
+static void
+jobpool_finish_job (job_t *job, int cancelled) {
+    if (job->token) {
+        job->token->active--;
+    }
+    cond_broadcast (_done_cond);
+
+    if (!job->completion) {
+        job_free (job);
+        return;
+    }
+
+    job->cancelled = cancelled;
+    int was_empty = _completed.head == NULL;
+    job_list_append (&_completed, job);
+    if (was_empty && !_terminate) {
+        messagepump_push (DB_EV_JOBSCOMPLETED, 0, 0, 0);
+    }
+}
+
+static void
+jobpool_worker (void *unused) {
+#if defined(__linux__) && !defined(ANDROID)
+    prctl (PR_SET_NAME, "deadbeef-job", 0, 0, 0, 0);
+#endif
+    mutex_lock (_mutex);
+    for (;;) {
+        job_t *job = NULL;
+        while (!_terminate && !(job = jobpool_dequeue ())) {
+            // the signalling thread takes this thread out of _idle_threads, so that the next job starts a new thread,
+            // if it comes before this one wakes up
+            _idle_threads++;
+            do {
+                cond_wait_locked (_work_cond, _mutex);
+            } while (!_wakeups && !_terminate);
+            if (_wakeups) {
+                _wakeups--;
+            }
+            else {
+                _idle_threads--;
+            }
+        }
+        if (!job) {
+            break;
+        }
+
+        int cancelled = cancellation_token_is_cancelled (job->token);
+        if (!cancelled) {
+            mutex_unlock (_mutex);
+            job->work (job->ctx, job->token);
+            cancelled = cancellation_token_is_cancelled (job->token);
+            mutex_lock (_mutex);
+        }
+        jobpool_finish_job (job, cancelled);
+    }
+    mutex_unlock (_mutex);
+}
+
+// Calls the completion callbacks of the finished jobs with the token, or all of them if token is NULL
+static void
+jobpool_run_completions_for_token (ddb_cancellation_token_t *token) {
+    job_list_t run = {0};
+
+    mutex_lock (_mutex);
+    job_t *prev = NULL;
+    job_t *job = _completed.head;
+    while (job) {
+        job_t *next = job->next;
+        if (!token || job->token == token) {
+            if (prev) {
+                prev->next = next;
+            }
+            else {
+                _completed.head = next;
+            }
+            if (_completed.tail == job) {
+                _completed.tail = prev;
+            }
+            job_list_append (&run, job);
+        }
+        else {
+            prev = job;
+        }
+        job = next;
+    }
+    mutex_unlock (_mutex);
+
+    for (job = run.head; job; ) {
+        job_t *next = job->next;
+        job->completion (job->ctx, job->cancelled);
+        job_free (job);
+        job = next;
+    }
+}
+
+void
+jobpool_init (void) {
+    _mutex = mutex_create ();
+    _work_cond = cond_create ();
+    _done_cond = cond_create ();
+    __atomic_store_n (&_terminate, 0, __ATOMIC_SEQ_CST);
+
+    _max_threads = conf_get_int ("jobpool.threads", 0);
+    if (_max_threads <= 0) {
+        long ncpu = sysconf (_SC_NPROCESSORS_ONLN);
+        _max_threads = ncpu > 2 ? (int)ncpu : 2;
+    }
+    if (_max_threads > JOBPOOL_MAX_THREADS) {
+        _max_threads = JOBPOOL_MAX_THREADS;
+    }
+}
+
+void
+jobpool_free (void) {
+    if (!_mutex) {
+        return;
+    }
+    mutex_lock (_mutex);
+    __atomic_store_n (&_terminate, 1, __ATOMIC_SEQ_CST);
+    job_t *job;
+    while ((job = jobpool_dequeue ())) {
+        jobpool_finish_job (job, 1);
+    }
+    cond_broadcast (_work_cond);
+    mutex_unlock (_mutex);
+
+    for (int i = 0; i < _num_threads; i++) {
+        thread_join (_threads[i]);
+        _threads[i] = 0;
+    }
+    _num_threads = 0;
+    _idle_threads = 0;
+    _wakeups = 0;
+
+    jobpool_run_completions_for_token (NULL);
+
+    cond_free (_work_cond);
+    _work_cond = 0;
+    cond_free (_done_cond);
+    _done_cond = 0;
+    mutex_free (_mutex);
+    _mutex = 0;
+}
+
+void
+jobpool_run_completions (void) {
+    if (_mutex) {
+        jobpool_run_completions_for_token (NULL);
+    }
+}
+
+ddb_cancellation_token_t *
+cancellation_token_alloc (void) {
+    ddb_cancellation_token_t *token = calloc (1, sizeof (ddb_cancellation_token_t));
+    token->refc = 1;
+    return token;
+}
+
+void
+cancellation_token_ref (ddb_cancellation_token_t *token) {
+    __atomic_add_fetch (&token->refc, 1, __ATOMIC_SEQ_CST);
+}
+
+void
+cancellation_token_unref (ddb_cancellation_token_t *token) {
+    if (__atomic_sub_fetch (&token->refc, 1, __ATOMIC_SEQ_CST) == 0) {
+        free (token);
+    }
+}
+
+void
+cancellation_token_cancel (ddb_cancellation_token_t *token) {
+    __atomic_store_n (&token->cancelled, 1, __ATOMIC_SEQ_CST);
+    if (!_mutex) {
+        return;
+    }
+
+    // drop the queued jobs right away, instead of waiting for a free worker
+    mutex_lock (_mutex);
+    for (int i = 0; i < JOBPOOL_NUM_PRIORITIES; i++) {
+        job_t *prev = NULL;
+        job_t *job = _queues[i].head;
+        while (job) {
+            job_t *next = job->next;
+            if (job->token == token) {
+                if (prev) {
+                    prev->next = next;
+                }
+                else {
+                    _queues[i].head = next;
+                }
+                if (_queues[i].tail == job) {
+                    _queues[i].tail = prev;
+                }
+                _num_queued--;
+                jobpool_finish_job (job, 1);
+            }
+            else {
+                prev = job;
+            }
+            job = next;
+        }
+    }
+    mutex_unlock (_mutex);
+}
+
+int
+cancellation_token_is_cancelled (ddb_cancellation_token_t *token) {
+    if (__atomic_load_n (&_terminate, __ATOMIC_SEQ_CST)) {
+        return 1;
+    }
+    return token && __atomic_load_n (&token->cancelled, __ATOMIC_SEQ_CST);
+}
+
+int
+jobpool_submit (int priority, ddb_cancellation_token_t *token, void (*work) (void *ctx, ddb_cancellation_token_t *token), void (*completion) (void *ctx, int cancelled), void *ctx) {
+    if (!work || !_mutex) {
+        return -1;
+    }
+    if (priority < DDB_JOB_PRIORITY_LOW) {
+        priority = DDB_JOB_PRIORITY_LOW;
+    }
+    else if (priority > DDB_JOB_PRIORITY_HIGH) {
+        priority = DDB_JOB_PRIORITY_HIGH;
+    }
+
+    job_t *job = calloc (1, sizeof (job_t));
+    job->work = work;
+    job->completion = completion;
+    job->ctx = ctx;
+    job->token = token;
+    if (token) {
+        cancellation_token_ref (token);
+    }
+
+    mutex_lock (_mutex);
+    if (_terminate) {
+        mutex_unlock (_mutex);
+        job_free (job);
+        return -1;
+    }
+    if (token) {
+        token->active++;
+    }
+    job_list_append (&_queues[priority], job);
+    _num_queued++;
+
+    // wake up an idle thread, or start a new one if there are none
+    if (_idle_threads) {
+        _idle_threads--;
+        _wakeups++;
+        cond_signal (_work_cond);
+    }
+    else if (_num_threads < _max_threads) {
+        intptr_t tid = thread_start (jobpool_worker, NULL);
+        if (tid) {
+            _threads[_num_threads++] = tid;
+            trace ("jobpool: started worker %d\n", _num_threads);
+        }
+    }
+    mutex_unlock (_mutex);
+    return 0;
+}
+
+void
+jobpool_wait (ddb_cancellation_token_t *token) {
+    if (!token || !_mutex) {
+        return;
+    }
+    mutex_lock (_mutex);
+    while (token->active > 0) {
+        cond_wait_locked (_done_cond, _mutex);
+    }
+    mutex_unlock (_mutex);
+
+    jobpool_run_completions_for_token (token);
+}
@@ -0,0 +1,66 @@
+/*
+    DeaDBeeF -- the music player
+    Copyright (C) 2009-2018 Alexey Yakovenko and other contributors
+
+    This software is provided 'as-is', without any express or implied
+    warranty.  In no event will the authors be held liable for any damages
+    arising from the use of this software.
+
+    Permission is granted to anyone to use this software for any purpose,
+    including commercial applications, and to alter it and redistribute it
+    freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source distribution.
+*/
+
+#ifndef jobpool_h
+#define jobpool_h
+
+#include "deadbeef.h"
+
+// Shared worker threads for the background jobs of the core and plugins.
+// See the job_submit description in deadbeef.h for details.
+
+void
+jobpool_init (void);
+
+// Cancels the queued jobs, waits for the running ones,
+// and calls all pending completion callbacks on the calling thread.
+void
+jobpool_free (void);
+
+// Calls the pending completion callbacks, must be called on the main thread
+// when DB_EV_JOBSCOMPLETED is received.
+void
+jobpool_run_completions (void);
+
+ddb_cancellation_token_t *
+cancellation_token_alloc (void);
+
+void
+cancellation_token_ref (ddb_cancellation_token_t *token);
+
+void
+cancellation_token_unref (ddb_cancellation_token_t *token);
+
+void
+cancellation_token_cancel (ddb_cancellation_token_t *token);
+
+int
+cancellation_token_is_cancelled (ddb_cancellation_token_t *token);
+
+int
+jobpool_submit (int priority, ddb_cancellation_token_t *token, void (*work) (void *ctx, ddb_cancellation_token_t *token), void (*completion) (void *ctx, int cancelled), void *ctx);
+
+void
+jobpool_wait (ddb_cancellation_token_t *token);
+
+#endif /* jobpool_h */
@@ -85,6 +85,8 @@
 #include "playqueue.h"
 #include "tf.h"
 #include "logger.h"
+#include "jobpool.h"
+#include "metacache.h"
 #include "scriptable/scriptable.h"
 #include "scriptable/scriptable_dsp.h"
 #include "scriptable/scriptable_encoder.h"
@@ -806,6 +808,14 @@ player_mainloop (void) {
                         streamer_set_seek (p1 / 1000.f);
                     }
                     break;
+                case DB_EV_JOBSCOMPLETED:
+                    jobpool_run_completions ();
+                    break;
+                case DB_EV_PLAYLISTCHANGED:
+                    if (p1 == DDB_PLAYLIST_CHANGE_CONTENT) {
+                        streamer_notify_playlist_changed ();
+                    }
+                    break;
                 }
             }
             if (msg >= DB_EV_FIRST && ctx) {
@@ -926,6 +936,9 @@ main_cleanup_and_quit (void) {
     // stop receiving messages from outside
     server_close ();
 
+    // finish the background jobs while the plugin code is still loaded
+    jobpool_free ();
+
     // plugins might still hold references to playitems,
     // and query configuration in background
     // so unload everything 1st before final cleanup
@@ -936,6 +949,14 @@ main_cleanup_and_quit (void) {
     pl_free (); // may access conf_*
     conf_free ();
 
+    metacache_stats_t mcstats;
+    metacache_get_stats (&mcstats);
+    trace ("metacache: %d strings, %d inserts, %d lookups, %d buckets, load factor %.2f, probe length avg %.2f max %d\n", (int)mcstats.n_strings, (int)mcstats.n_inserts, (int)mcstats.n_lookups, (int)mcstats.n_buckets, mcstats.load_factor, mcstats.avg_probe_length, (int)mcstats.max_probe_length);
+    metacache_free ();
+
+    int mp_queued, mp_coalesced, mp_dropped;
+    messagepump_get_counters (&mp_queued, &mp_coalesced, &mp_dropped);
+    trace ("messagepump: %d queued, %d coalesced, %d dropped\n", mp_queued, mp_coalesced, mp_dropped);
     trace ("messagepump_free\n");
     messagepump_free ();
     trace ("plug_cleanup\n");
@@ -1286,6 +1307,7 @@ main (int argc, char *argv[]) {
     volume_set_db (conf_get_float ("playback.volume", 0)); // volume need to be initialized before plugins start
 
     messagepump_init (); // required to push messages while handling commandline
+    jobpool_init ();
     if (plug_load_all ()) { // required to add files to playlist from commandline
         exit (-1);
     }
@@ -32,19 +32,45 @@
 #include "threading.h"
 #include "playlist.h"
 
+// Multi-producer single-consumer queue, with lock-free push and pop.
+// The messages are linked in an intrusive queue, starting with a stub node.
+// The nodes are allocated in chunks which are never freed until messagepump_free,
+// and recycled through a free list, whose head is tagged against the ABA problem.
+// Pushing an event identical to one which is still waiting in the queue is a no-op,
+// see messagepump_coalesce.
+
 typedef struct message_s {
     uint32_t id;
     uintptr_t ctx;
     uint32_t p1;
     uint32_t p2;
-    struct message_s *next;
+    uintptr_t key; // ctx, or the track of the event, used for coalescing
+    struct message_s *next; // next message in the queue
+    uint32_t index; // 1-based index of the node in the chunks
+    uint32_t free_next; // index of the next node in the free list, 0 if none
+    uint32_t seq; // odd while the fields are being written, see messagepump_coalesce
+    int pending; // 1 while the message is queued and not yet popped
 } message_t;
 
-enum { MAX_MESSAGES = 100 };
-static message_t pool[MAX_MESSAGES];
-static message_t *mfree;
-static message_t *mqueue;
-static message_t *mqtail;
+#define MESSAGE_CHUNK_BITS 8
+#define MESSAGE_CHUNK_SIZE (1<<MESSAGE_CHUNK_BITS)
+#define MAX_MESSAGE_CHUNKS 4096 // up to 1M queued messages
+
+#define COALESCE_SLOTS 256
+
+static message_t *chunks[MAX_MESSAGE_CHUNKS];
+static uint32_t num_chunks;
+static uint64_t free_head; // tag in the upper 32 bits, node index in the lower
+static message_t stub;
+static message_t *mqhead = &stub; // last pushed message, producers side
+static message_t *mqtail = &stub; // first message, consumer side
+static message_t *coalesce_slots[COALESCE_SLOTS]; // last pushed message per coalescing key hash
+
+static int queued;
+static int waiting;
+static int coalesced;
+static int dropped;
+
 static uintptr_t mutex;
 static uintptr_t cond;
 
@@ -59,12 +85,168 @@ messagepump_init (void) {
     return 0;
 }
 
+static message_t *
+message_at (uint32_t index) {
+    message_t *chunk = __atomic_load_n (&chunks[(index-1) >> MESSAGE_CHUNK_BITS], __ATOMIC_ACQUIRE);
+    return &chunk[(index-1) & (MESSAGE_CHUNK_SIZE-1)];
+}
+
+static void
+message_free_push (message_t *msg) {
+    uint64_t head = __atomic_load_n (&free_head, __ATOMIC_ACQUIRE);
+    uint64_t newhead;
+    do {
+        __atomic_store_n (&msg->free_next, (uint32_t)head, __ATOMIC_RELAXED);
+        newhead = ((head >> 32) + 1) << 32 | msg->index;
+    } while (!__atomic_compare_exchange_n (&free_head, &head, newhead, 1, __ATOMIC_RELEASE, __ATOMIC_ACQUIRE));
+}
+
+// allocates a new chunk, returns its first node, and puts the others to the free list
+static message_t *
+message_alloc_chunk (void) {
+    uint32_t c = __atomic_fetch_add (&num_chunks, 1, __ATOMIC_RELAXED);
+    if (c >= MAX_MESSAGE_CHUNKS) {
+        __atomic_fetch_sub (&num_chunks, 1, __ATOMIC_RELAXED);
+        return NULL;
+    }
+    message_t *chunk = calloc (MESSAGE_CHUNK_SIZE, sizeof (message_t));
+    if (!chunk) {
+        __atomic_fetch_sub (&num_chunks, 1, __ATOMIC_RELAXED);
+        return NULL;
+    }
+    for (int i = 0; i < MESSAGE_CHUNK_SIZE; i++) {
+        chunk[i].index = (c << MESSAGE_CHUNK_BITS) + i + 1;
+    }
+    __atomic_store_n (&chunks[c], chunk, __ATOMIC_RELEASE);
+    for (int i = 1; i < MESSAGE_CHUNK_SIZE; i++) {
+        message_free_push (&chunk[i]);
+    }
+    return &chunk[0];
+}
+
+static message_t *
+message_alloc (void) {
+    uint64_t head = __atomic_load_n (&free_head, __ATOMIC_ACQUIRE);
+    for (;;) {
+        uint32_t index = (uint32_t)head;
+        if (!index) {
+            return message_alloc_chunk ();
+        }
+        // the node may be taken by another thread meanwhile, then the tag check fails
+        message_t *msg = message_at (index);
+        uint32_t next = __atomic_load_n (&msg->free_next, __ATOMIC_RELAXED);
+        uint64_t newhead = ((head >> 32) + 1) << 32 | next;
+        if (__atomic_compare_exchange_n (&free_head, &head, newhead, 1, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE)) {
+            return msg;
+        }
+    }
+}
+
+static void
+message_enqueue (message_t *msg) {
+    __atomic_store_n (&msg->next, NULL, __ATOMIC_RELAXED);
+    message_t *prev = __atomic_exchange_n (&mqhead, msg, __ATOMIC_ACQ_REL);
+    __atomic_store_n (&prev->next, msg, __ATOMIC_RELEASE);
+}
+
+// Consumer only. Returns NULL if the queue is empty,
+// or while a producer is in the middle of linking a message.
+static message_t *
+message_dequeue (void) {
+    message_t *tail = mqtail;
+    message_t *next = __atomic_load_n (&tail->next, __ATOMIC_ACQUIRE);
+    if (tail == &stub) {
+        if (!next) {
+            return NULL;
+        }
+        mqtail = tail = next;
+        next = __atomic_load_n (&next->next, __ATOMIC_ACQUIRE);
+    }
+    if (next) {
+        mqtail = next;
+        return tail;
+    }
+    if (tail != __atomic_load_n (&mqhead, __ATOMIC_ACQUIRE)) {
+        return NULL;
+    }
+    message_enqueue (&stub);
+    next = __atomic_load_n (&tail->next, __ATOMIC_ACQUIRE);
+    if (next) {
+        mqtail = next;
+        return tail;
+    }
+    return NULL;
+}
+
+// Events which only tell that some state has changed,
+// so that handling one of several identical ones is enough.
+static uintptr_t
+messagepump_coalesce_key (uint32_t id, uintptr_t ctx, int *coalescable) {
+    switch (id) {
+    case DB_EV_CONFIGCHANGED:
+    case DB_EV_PLAYLISTCHANGED:
+    case DB_EV_VOLUMECHANGED:
+    case DB_EV_ACTIONSCHANGED:
+    case DB_EV_DSPCHAINCHANGED:
+    case DB_EV_SELCHANGED:
+    case DB_EV_JOBSCOMPLETED:
+        *coalescable = 1;
+        return ctx;
+    case DB_EV_TRACKINFOCHANGED:
+        *coalescable = 1;
+        return ctx ? (uintptr_t)((ddb_event_track_t *)ctx)->track : 0;
+    }
+    *coalescable = 0;
+    return 0;
+}
+
+static message_t **
+messagepump_coalesce_slot (uint32_t id, uintptr_t key, uint32_t p1, uint32_t p2) {
+    uint64_t h = ((uint64_t)key >> 4) * 0x9e3779b97f4a7c15ULL;
+    h ^= ((uint64_t)id << 32 | p1) * 0xff51afd7ed558ccdULL;
+    h ^= (uint64_t)p2 * 0xc4ceb9fe1a85ec53ULL;
+    return &coalesce_slots[(h >> 32) & (COALESCE_SLOTS-1)];
+}
+
+// Returns 1 if an identical message is queued, and not yet popped.
+// The slot may point to a node which was recycled meanwhile, so the fields are
+// read with a sequence check, and then the node is confirmed to be still pending
+// with a CAS, which the consumer synchronizes with when taking the message.
+static int
+messagepump_coalesce (message_t **slot, uint32_t id, uintptr_t key, uint32_t p1, uint32_t p2) {
+    message_t *m = __atomic_load_n (slot, __ATOMIC_ACQUIRE);
+    if (!m) {
+        return 0;
+    }
+    uint32_t seq = __atomic_load_n (&m->seq, __ATOMIC_ACQUIRE);
+    if (seq & 1) {
+        return 0;
+    }
+    int match = __atomic_load_n (&m->id, __ATOMIC_RELAXED) == id
+        && __atomic_load_n (&m->key, __ATOMIC_RELAXED) == key
+        && __atomic_load_n (&m->p1, __ATOMIC_RELAXED) == p1
+        && __atomic_load_n (&m->p2, __ATOMIC_RELAXED) == p2;
+    __atomic_thread_fence (__ATOMIC_ACQUIRE);
+    if (!match || __atomic_load_n (&m->seq, __ATOMIC_RELAXED) != seq) {
+        return 0;
+    }
+    int expected = 1;
+    if (!__atomic_compare_exchange_n (&m->pending, &expected, 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        return 0;
+    }
+    // the node could have been reused for a different message before the CAS
+    return __atomic_load_n (&m->seq, __ATOMIC_ACQUIRE) == seq;
+}
+
 void
 messagepump_free () {
     mutex_lock (mutex);
 
     // this helps catching any ref leaks caused by messages sent at exit
-    for (message_t *m = mqueue; m; m = m->next) {
+    for (message_t *m = mqtail; m; m = m->next) {
+        if (m == &stub) {
+            continue;
+        }
         switch (m->id) {
         case DB_EV_SONGCHANGED:
         case DB_EV_SONGSTARTED:
@@ -84,77 +266,108 @@ messagepump_free () {
 
 static void
 messagepump_reset (void) {
-    mqueue = NULL;
-    mfree = NULL;
-    mqtail = NULL;
-    memset (pool, 0, sizeof (pool));
-    for (int i = 0; i < MAX_MESSAGES; i++) {
-        pool[i].next = mfree;
-        mfree = &pool[i];
+    for (int i = 0; i < MAX_MESSAGE_CHUNKS && chunks[i]; i++) {
+        free (chunks[i]);
+        chunks[i] = NULL;
     }
+    num_chunks = 0;
+    free_head = 0;
+    memset (&stub, 0, sizeof (stub));
+    mqhead = mqtail = &stub;
+    memset (coalesce_slots, 0, sizeof (coalesce_slots));
+    queued = 0;
+    coalesced = 0;
+    dropped = 0;
 }
 
 int
 messagepump_push (uint32_t id, uintptr_t ctx, uint32_t p1, uint32_t p2) {
-    if (!mfree) {
-        //fprintf (stderr, "WARNING: message queue is full! message ignored (%d %p %d %d)\n", id, (void*)ctx, p1, p2);
+    int coalescable;
+    uintptr_t key = messagepump_coalesce_key (id, ctx, &coalescable);
+    message_t **slot = NULL;
+    if (coalescable) {
+        slot = messagepump_coalesce_slot (id, key, p1, p2);
+        if (messagepump_coalesce (slot, id, key, p1, p2)) {
+            if (id >= DB_EV_FIRST && ctx) {
+                messagepump_event_free ((ddb_event_t *)ctx);
+            }
+            __atomic_fetch_add (&coalesced, 1, __ATOMIC_RELAXED);
+            return 0;
+        }
+    }
+
+    message_t *msg = message_alloc ();
+    if (!msg) {
         if (id >= DB_EV_FIRST && ctx) {
             messagepump_event_free ((ddb_event_t *)ctx);
         }
+        __atomic_fetch_add (&dropped, 1, __ATOMIC_RELAXED);
         return -1;
     }
-    mutex_lock (mutex);
-    message_t *msg = mfree;
-    mfree = mfree->next;
-    if (mqtail) {
-        mqtail->next = msg;
-    }
-    mqtail = msg;
-    if (!mqueue) {
-        mqueue = msg;
-    }
 
-    msg->next = NULL;
-    msg->id = id;
+    __atomic_fetch_add (&msg->seq, 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence (__ATOMIC_RELEASE);
+    __atomic_store_n (&msg->id, id, __ATOMIC_RELAXED);
+    __atomic_store_n (&msg->key, key, __ATOMIC_RELAXED);
+    __atomic_store_n (&msg->p1, p1, __ATOMIC_RELAXED);
+    __atomic_store_n (&msg->p2, p2, __ATOMIC_RELAXED);
     msg->ctx = ctx;
-    msg->p1 = p1;
-    msg->p2 = p2;
-    mutex_unlock (mutex);
-    cond_signal (cond);
+    __atomic_store_n (&msg->pending, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add (&msg->seq, 1, __ATOMIC_RELEASE);
+
+    if (slot) {
+        __atomic_store_n (slot, msg, __ATOMIC_RELEASE);
+    }
+
+    __atomic_fetch_add (&queued, 1, __ATOMIC_SEQ_CST);
+    message_enqueue (msg);
+
+    if (__atomic_load_n (&waiting, __ATOMIC_SEQ_CST)) {
+        mutex_lock (mutex);
+        cond_signal (cond);
+        mutex_unlock (mutex);
+    }
     return 0;
 }
 
 void
 messagepump_wait (void) {
-    cond_wait (cond, mutex);
+    mutex_lock (mutex);
+    __atomic_store_n (&waiting, 1, __ATOMIC_SEQ_CST);
+    while (!__atomic_load_n (&queued, __ATOMIC_SEQ_CST)) {
+        cond_wait_locked (cond, mutex);
+    }
+    __atomic_store_n (&waiting, 0, __ATOMIC_SEQ_CST);
     mutex_unlock (mutex);
 }
 
 int
 messagepump_pop (uint32_t *id, uintptr_t *ctx, uint32_t *p1, uint32_t *p2) {
-    mutex_lock (mutex);
-    if (!mqueue) {
-        mutex_unlock (mutex);
+    message_t *msg = message_dequeue ();
+    if (!msg) {
         return -1;
     }
-    *id = mqueue->id;
-    *ctx = mqueue->ctx;
-    *p1 = mqueue->p1;
-    *p2 = mqueue->p2;
-    message_t *next = mqueue->next;
-    mqueue->next = mfree;
-    mfree = mqueue;
-    mqueue = next;
-    if (!mqueue) {
-        mqtail = NULL;
-    }
-    mutex_unlock (mutex);
+    // after this, identical events are queued again, rather than coalesced into this one
+    __atomic_exchange_n (&msg->pending, 0, __ATOMIC_ACQ_REL);
+    *id = msg->id;
+    *ctx = msg->ctx;
+    *p1 = msg->p1;
+    *p2 = msg->p2;
+    __atomic_fetch_sub (&queued, 1, __ATOMIC_SEQ_CST);
+    message_free_push (msg);
     return 0;
 }
 
 int
 messagepump_hasmessages (void) {
-    return mqueue ? 1 : 0;
+    return __atomic_load_n (&queued, __ATOMIC_SEQ_CST) ? 1 : 0;
+}
+
+void
+messagepump_get_counters (int *queued_count, int *coalesced_count, int *dropped_count) {
+    *queued_count = __atomic_load_n (&queued, __ATOMIC_RELAXED);
+    *coalesced_count = __atomic_load_n (&coalesced, __ATOMIC_RELAXED);
+    *dropped_count = __atomic_load_n (&dropped, __ATOMIC_RELAXED);
 }
 
 ddb_event_t *
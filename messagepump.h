@@ -40,4 +40,9 @@ ddb_event_t *messagepump_event_alloc (uint32_t id);
 void messagepump_event_free (ddb_event_t *ev);
 int messagepump_push_event (ddb_event_t *ev, uint32_t p1, uint32_t p2);
 
+// queued: number of messages waiting in the queue
+// coalesced: number of events which were merged into identical queued ones
+// dropped: number of messages which couldn't be queued
+void messagepump_get_counters (int *queued, int *coalesced, int *dropped);
+
 #endif // __MESSAGEPUMP_H
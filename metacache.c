@@ -28,79 +28,246 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <sched.h>
 #include "metacache.h"
 
+// The cache is an open-addressed, linear-probing hash table of interned strings.
+// Writers (add/remove) are serialized by a spinlock, while readers (get) never lock:
+// each slot goes through empty -> live -> tombstone exactly once per table,
+// and a grown or compacted table is published with a single atomic pointer store.
+// The replaced tables are kept in a retired list, until no reader is running.
+
 typedef struct metacache_str_s {
-    struct metacache_str_s *next;
+    uint64_t hash;
     size_t value_length;
-    uint32_t refcount;
+    uint32_t refcount; // must be at str-5, see metacache_ref
     char cmpidx; // positive means "equals", negative means "notequals"
     char str[1];
 } metacache_str_t;
 
 typedef struct {
-//    uint32_t hash;
-    metacache_str_t *chain;
-} metacache_hash_t;
+    uint64_t hash;
+    metacache_str_t *data;
+} metacache_slot_t;
+
+typedef struct metacache_table_s {
+    struct metacache_table_s *retired_next;
+    size_t size; // power of 2
+    size_t used; // live strings + tombstones
+    metacache_slot_t slots[1];
+} metacache_table_t;
+
+#define INITIAL_SIZE 4096
+// grow (or compact) when live+tombstones exceed 70% of the slots
+#define MAX_LOAD_NUM 7
+#define MAX_LOAD_DEN 10
 
-#define HASH_SIZE 4096
+#define TOMBSTONE ((metacache_str_t *)(uintptr_t)1)
 
-static metacache_hash_t hash[HASH_SIZE];
+// count the lookups for metacache_get_stats, costs an atomic add per lookup
+#define COUNT_LOOKUPS 0
 
-static uint32_t
-metacache_get_hash_sdbm (const char *str, size_t len) {
-    uint32_t hash = 0;
-    int c;
+static metacache_table_t *table;
+static metacache_table_t *retired_tables;
+static int readers; // number of lookups running without the lock
+static int writer_lock;
 
-    const char *end = str+len;
+static size_t n_strings = 0;
+static size_t n_inserts = 0;
+#if COUNT_LOOKUPS
+static size_t n_lookups = 0;
+#endif
+static size_t n_resizes = 0;
+
+static void
+metacache_lock (void) {
+    while (__atomic_test_and_set (&writer_lock, __ATOMIC_ACQUIRE)) {
+        sched_yield ();
+    }
+}
+
+static void
+metacache_unlock (void) {
+    __atomic_clear (&writer_lock, __ATOMIC_RELEASE);
+}
+
+static inline uint64_t
+_read64 (const char *p) {
+    uint64_t v;
+    memcpy (&v, p, 8);
+    return v;
+}
+
+static inline uint64_t
+_fmix64 (uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+// Word-at-a-time multiplicative hash, processing 8 bytes per step
+static uint64_t
+metacache_get_hash (const char *str, size_t len) {
+    const uint64_t m = 0x9e3779b97f4a7c15ULL;
+    uint64_t h = len * m;
+    const char *end = str + (len & ~(size_t)7);
 
     while (str < end) {
-        c = *str++;
-        hash = c + (hash << 6) + (hash << 16) - hash;
+        uint64_t k = _read64 (str) * m;
+        k ^= k >> 29;
+        h = (h ^ k) * m;
+        str += 8;
     }
 
-    return hash;
+    size_t tail = len & 7;
+    if (tail) {
+        uint64_t k = 0;
+        memcpy (&k, str, tail);
+        k *= m;
+        k ^= k >> 29;
+        h = (h ^ k) * m;
+    }
+
+    return _fmix64 (h);
+}
+
+static metacache_table_t *
+metacache_table_alloc (size_t size) {
+    metacache_table_t *t = calloc (1, sizeof (metacache_table_t) + (size-1) * sizeof (metacache_slot_t));
+    t->size = size;
+    return t;
 }
 
+// Lock-free lookup, safe to call concurrently with writers
 static metacache_str_t *
-metacache_find_in_bucket (uint32_t h, const char *value, size_t len) {
-    metacache_hash_t *bucket = &hash[h];
-    metacache_str_t *chain = bucket->chain;
-    while (chain) {
-        if (chain->value_length == len && !memcmp (chain->str, value, len)) {
-            return chain;
+metacache_find (metacache_table_t *t, uint64_t h, const char *value, size_t len) {
+    if (!t) {
+        return NULL;
+    }
+    size_t mask = t->size - 1;
+    for (size_t i = h & mask; ; i = (i + 1) & mask) {
+        metacache_slot_t *slot = &t->slots[i];
+        metacache_str_t *data = __atomic_load_n (&slot->data, __ATOMIC_ACQUIRE);
+        if (!data) {
+            return NULL;
+        }
+        if (data != TOMBSTONE
+            && slot->hash == h
+            && data->value_length == len
+            && !memcmp (data->str, value, len)) {
+            return data;
+        }
+    }
+}
+
+// Must be called with writer lock held
+static size_t
+metacache_find_slot_idx (metacache_table_t *t, uint64_t h, const char *value, size_t len) {
+    size_t mask = t->size - 1;
+    for (size_t i = h & mask; ; i = (i + 1) & mask) {
+        metacache_slot_t *slot = &t->slots[i];
+        metacache_str_t *data = slot->data;
+        if (!data) {
+            return (size_t)-1;
         }
-        chain = chain->next;
+        if (data != TOMBSTONE
+            && slot->hash == h
+            && data->value_length == len
+            && !memcmp (data->str, value, len)) {
+            return i;
+        }
+    }
+}
+
+// Must be called with writer lock held.
+// Tombstones are never reused, so that a slot content never changes under a concurrent reader.
+static void
+metacache_table_insert (metacache_table_t *t, metacache_str_t *data) {
+    size_t mask = t->size - 1;
+    size_t i = data->hash & mask;
+    while (t->slots[i].data) {
+        i = (i + 1) & mask;
+    }
+    t->slots[i].hash = data->hash;
+    __atomic_store_n (&t->slots[i].data, data, __ATOMIC_RELEASE);
+    t->used++;
+}
+
+// Must be called with writer lock held.
+// Frees the retired tables if no reader is running, otherwise leaves them for the next call.
+static void
+metacache_free_retired (void) {
+    if (!retired_tables || __atomic_load_n (&readers, __ATOMIC_SEQ_CST)) {
+        return;
+    }
+    while (retired_tables) {
+        metacache_table_t *next = retired_tables->retired_next;
+        free (retired_tables);
+        retired_tables = next;
     }
-    return NULL;
 }
 
-static int n_strings = 0;
-static int n_inserts = 0;
-static int n_buckets = 0;
+// Must be called with writer lock held
+static void
+metacache_reserve_slot (void) {
+    if (!table) {
+        __atomic_store_n (&table, metacache_table_alloc (INITIAL_SIZE), __ATOMIC_RELEASE);
+        return;
+    }
+
+    if ((table->used + 1) * MAX_LOAD_DEN <= table->size * MAX_LOAD_NUM) {
+        return;
+    }
+
+    // grow if live strings take at least half of the table, otherwise only drop the tombstones
+    size_t size = table->size;
+    if (n_strings * 2 >= size) {
+        size *= 2;
+    }
+
+    metacache_table_t *t = metacache_table_alloc (size);
+    for (size_t i = 0; i < table->size; i++) {
+        metacache_str_t *data = table->slots[i].data;
+        if (data && data != TOMBSTONE) {
+            metacache_table_insert (t, data);
+        }
+    }
+
+    metacache_table_t *old = table;
+    __atomic_store_n (&table, t, __ATOMIC_SEQ_CST);
+    old->retired_next = retired_tables;
+    retired_tables = old;
+    n_resizes++;
+}
 
 const char *
 metacache_add_value (const char *value, size_t len) {
-    //    printf ("n_strings=%d, n_inserts=%d, n_buckets=%d\n", n_strings, n_inserts, n_buckets);
-    uint32_t h = metacache_get_hash_sdbm (value, len);
-    metacache_str_t *data = metacache_find_in_bucket (h & (HASH_SIZE-1), value, len);
+    uint64_t h = metacache_get_hash (value, len);
+
+    metacache_lock ();
     n_inserts++;
+    metacache_free_retired ();
+    metacache_str_t *data = metacache_find (table, h, value, len);
     if (data) {
-        data->refcount++;
+        __atomic_add_fetch (&data->refcount, 1, __ATOMIC_RELAXED);
+        metacache_unlock ();
         return data->str;
     }
-    metacache_hash_t *bucket = &hash[h & (HASH_SIZE-1)];
-    if (!bucket->chain) {
-        n_buckets++;
-    }
+
+    metacache_reserve_slot ();
+
     data = malloc (sizeof (metacache_str_t) + len);
     memset (data, 0, sizeof (metacache_str_t) + len);
+    data->hash = h;
     data->refcount = 1;
     memcpy (data->str, value, len);
     data->value_length = len;
-    data->next = bucket->chain;
-    bucket->chain = data;
+    metacache_table_insert (table, data);
     n_strings++;
+    metacache_unlock ();
     return data->str;
 }
 
@@ -111,27 +278,24 @@ metacache_add_string (const char *str) {
 
 void
 metacache_remove_value (const char *value, size_t valuesize) {
-    uint32_t h = metacache_get_hash_sdbm (value, valuesize);
-    metacache_hash_t *bucket = &hash[h & (HASH_SIZE-1)];
-    metacache_str_t *chain = bucket->chain;
-    metacache_str_t *prev = NULL;
-    while (chain) {
-        if (chain->value_length == valuesize && !memcmp (chain->str, value, valuesize)) {
-            chain->refcount--;
-            if (chain->refcount == 0) {
-                if (prev) {
-                    prev->next = chain->next;
-                }
-                else {
-                    bucket->chain = chain->next;
-                }
-                free (chain);
-            }
-            break;
+    uint64_t h = metacache_get_hash (value, valuesize);
+
+    metacache_lock ();
+    if (!table) {
+        metacache_unlock ();
+        return;
+    }
+    size_t idx = metacache_find_slot_idx (table, h, value, valuesize);
+    if (idx != (size_t)-1) {
+        metacache_str_t *data = table->slots[idx].data;
+        if (__atomic_sub_fetch (&data->refcount, 1, __ATOMIC_ACQ_REL) == 0) {
+            __atomic_store_n (&table->slots[idx].data, TOMBSTONE, __ATOMIC_RELEASE);
+            n_strings--;
+            free (data);
         }
-        prev = chain;
-        chain = chain->next;
     }
+    metacache_free_retired ();
+    metacache_unlock ();
 }
 
 void
@@ -142,13 +306,13 @@ metacache_remove_string (const char *str) {
 void
 metacache_ref (const char *str) {
     uint32_t *refc = (uint32_t *)(str-5);
-    (*refc)++;
+    __atomic_add_fetch (refc, 1, __ATOMIC_RELAXED);
 }
 
 void
 metacache_unref (const char *str) {
     uint32_t *refc = (uint32_t *)(str-5);
-    (*refc)--;
+    __atomic_sub_fetch (refc, 1, __ATOMIC_RELAXED);
 }
 
 const char *
@@ -158,13 +322,72 @@ metacache_get_string (const char *str) {
 
 const char *
 metacache_get_value (const char *value, size_t len) {
-    uint32_t h = metacache_get_hash_sdbm (value, len);
-    metacache_str_t *data = metacache_find_in_bucket (h & (HASH_SIZE-1), value, len);
-    n_inserts++;
+    uint64_t h = metacache_get_hash (value, len);
+    // a table loaded after the increment is not freed before the decrement
+    __atomic_add_fetch (&readers, 1, __ATOMIC_SEQ_CST);
+    metacache_table_t *t = __atomic_load_n (&table, __ATOMIC_SEQ_CST);
+    metacache_str_t *data = metacache_find (t, h, value, len);
     if (data) {
-        data->refcount++;
-        return data->str;
+        __atomic_add_fetch (&data->refcount, 1, __ATOMIC_RELAXED);
+    }
+    __atomic_sub_fetch (&readers, 1, __ATOMIC_SEQ_CST);
+#if COUNT_LOOKUPS
+    __atomic_add_fetch (&n_lookups, 1, __ATOMIC_RELAXED);
+#endif
+
+    return data ? data->str : NULL;
+}
+
+void
+metacache_get_stats (metacache_stats_t *stats) {
+    memset (stats, 0, sizeof (metacache_stats_t));
+
+    metacache_lock ();
+    stats->n_strings = n_strings;
+    stats->n_inserts = n_inserts;
+#if COUNT_LOOKUPS
+    stats->n_lookups = __atomic_load_n (&n_lookups, __ATOMIC_RELAXED);
+#endif
+    stats->n_resizes = n_resizes;
+    if (table) {
+        size_t total_probe = 0;
+        size_t mask = table->size - 1;
+        stats->n_buckets = table->size;
+        for (size_t i = 0; i < table->size; i++) {
+            metacache_str_t *data = table->slots[i].data;
+            if (!data) {
+                continue;
+            }
+            if (data == TOMBSTONE) {
+                stats->n_tombstones++;
+                continue;
+            }
+            // number of slots visited by a successful lookup of this string
+            size_t probe = ((i - (data->hash & mask)) & mask) + 1;
+            total_probe += probe;
+            if (probe > stats->max_probe_length) {
+                stats->max_probe_length = probe;
+            }
+        }
+        stats->load_factor = (float)table->used / table->size;
+        if (n_strings) {
+            stats->avg_probe_length = (float)total_probe / n_strings;
+        }
     }
+    metacache_unlock ();
+}
 
-    return NULL;
+void
+metacache_free (void) {
+    metacache_lock ();
+    while (retired_tables) {
+        metacache_table_t *next = retired_tables->retired_next;
+        free (retired_tables);
+        retired_tables = next;
+    }
+    if (table && !n_strings) {
+        free (table);
+        table = NULL;
+    }
+    metacache_unlock ();
 }
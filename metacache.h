@@ -27,11 +27,26 @@
 #ifndef __METACACHE_H
 #define __METACACHE_H
 
+#include <stddef.h>
+
+typedef struct {
+    size_t n_strings; // number of unique strings currently in the cache
+    size_t n_inserts; // number of add calls since startup
+    size_t n_lookups; // number of get calls since startup, 0 unless COUNT_LOOKUPS is enabled in metacache.c
+    size_t n_buckets; // current hash table capacity
+    size_t n_tombstones; // slots of removed strings, dropped on the next resize
+    size_t n_resizes; // number of times the table was grown or compacted
+    float load_factor; // (strings + tombstones) / buckets
+    float avg_probe_length; // average number of slots visited by a successful lookup
+    size_t max_probe_length; // worst case number of slots visited by a successful lookup
+} metacache_stats_t;
+
 // Adds a new NULL-terminated string, or finds an existing one
 const char *
 metacache_add_string (const char *str);
 
-// Returns an existing NULL-terminated string, or NULL if it doesn't exist
+// Returns an existing NULL-terminated string, or NULL if it doesn't exist.
+// Lookups don't take any locks, and can run concurrently with adding/removing other strings.
 const char *
 metacache_get_string (const char *str);
 
@@ -59,4 +74,13 @@ metacache_ref (const char *str);
 void
 metacache_unref (const char *str);
 
+// Fills in the hash table statistics
+void
+metacache_get_stats (metacache_stats_t *stats);
+
+// Frees the remaining retired hash tables, and the current one if it's empty.
+// Must be called after all strings are released, when no lookups can run.
+void
+metacache_free (void);
+
 #endif
@@ -0,0 +1,117 @@
+/*
+    DeaDBeeF -- the music player
+    Copyright (C) 2009-2018 Alexey Yakovenko and other contributors
+
+    This software is provided 'as-is', without any express or implied
+    warranty.  In no event will the authors be held liable for any damages
+    arising from the use of this software.
+
+    Permission is granted to anyone to use this software for any purpose,
+    including commercial applications, and to alter it and redistribute it
+    freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source distribution.
+*/
+
+#import <XCTest/XCTest.h>
+#include <pthread.h>
+#include "conf.h"
+
+#define NUM_READERS 3
+#define NUM_KEYS 200
+
+@interface ConfTests : XCTestCase
+
+@end
+
+typedef struct {
+    int stop;
+    long reads;
+} reader_ctx_t;
+
+static void *
+_reader_thread (void *ctx) {
+    reader_ctx_t *reader = ctx;
+    char key[100];
+    while (!__atomic_load_n (&reader->stop, __ATOMIC_RELAXED)) {
+        for (int i = 0; i < NUM_KEYS; i++) {
+            snprintf (key, sizeof (key), "conftest.key%d", i);
+            conf_get_int (key, 0);
+        }
+        reader->reads += NUM_KEYS;
+    }
+    return NULL;
+}
+
+@implementation ConfTests
+
+- (void)setUp {
+    [super setUp];
+    char key[100];
+    for (int i = 0; i < NUM_KEYS; i++) {
+        snprintf (key, sizeof (key), "conftest.key%d", i);
+        conf_set_int (key, i);
+    }
+}
+
+- (void)tearDown {
+    conf_remove_items ("conftest.");
+    [super tearDown];
+}
+
+- (void)test_GetInt_KeyWithDifferentCase_ReturnsValue {
+    XCTAssertEqual (conf_get_int ("ConfTest.Key42", -1), 42);
+}
+
+- (void)test_RemoveItems_ItemsNotFoundAndOthersKept {
+    conf_remove_items ("conftest.key1");
+    XCTAssertEqual (conf_get_int ("conftest.key1", -1), -1);
+    XCTAssertEqual (conf_get_int ("conftest.key15", -1), -1);
+    XCTAssertEqual (conf_get_int ("conftest.key2", -1), 2);
+
+    int count = 0;
+    conf_lock ();
+    for (DB_conf_item_t *it = conf_find ("conftest.", NULL); it; it = conf_find ("conftest.", it)) {
+        count++;
+    }
+    conf_unlock ();
+    XCTAssertEqual (count, NUM_KEYS - 111); // key1, key10..19, key100..199
+}
+
+// getter latency, while other threads read and a writer keeps changing the values
+- (void)test_GetIntWithConcurrentReadersAndWriter_Performance {
+    reader_ctx_t readers[NUM_READERS] = {0};
+    pthread_t tids[NUM_READERS];
+    for (int i = 0; i < NUM_READERS; i++) {
+        pthread_create (&tids[i], NULL, _reader_thread, &readers[i]);
+    }
+
+    [self measureBlock:^{
+        char key[100];
+        for (int n = 0; n < 100000; n++) {
+            int i = n % NUM_KEYS;
+            snprintf (key, sizeof (key), "conftest.key%d", i);
+            if (!(n % 100)) {
+                conf_set_int (key, n);
+            }
+            else {
+                conf_get_int (key, 0);
+            }
+        }
+    }];
+
+    for (int i = 0; i < NUM_READERS; i++) {
+        __atomic_store_n (&readers[i].stop, 1, __ATOMIC_RELAXED);
+        pthread_join (tids[i], NULL);
+    }
+}
+
+@end
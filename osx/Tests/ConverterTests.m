@@ -0,0 +1,251 @@
+/*
+    DeaDBeeF -- the music player
+    Copyright (C) 2009-2018 Alexey Yakovenko and other contributors
+
+    This software is provided 'as-is', without any express or implied
+    warranty.  In no event will the authors be held liable for any damages
+    arising from the use of this software.
+
+    Permission is granted to anyone to use this software for any purpose,
+    including commercial applications, and to alter it and redistribute it
+    freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source distribution.
+*/
+
+#import <XCTest/XCTest.h>
+#include <unistd.h>
+#include "deadbeef.h"
+#include "playlist.h"
+#include "plugins.h"
+#include "threading.h"
+#include "fakein.h"
+#include "../../plugins/converter/converter.h"
+
+#define NUM_JOBS 8
+#define NUM_PATHS 2
+
+typedef struct {
+    uintptr_t mutex;
+    ddb_converter_job_t *jobs;
+
+    // job indexes, in the order the jobs were started
+    int started[NUM_JOBS];
+    int num_started;
+
+    int is_running[NUM_JOBS];
+    int running;
+    int max_running;
+    int running_per_path[NUM_PATHS];
+    int max_running_per_path;
+
+    // the job index for which prepare returns 1 or -1, or -1
+    int skip_job;
+    int cancel_job;
+
+    // set when the first job finishes
+    int *pabort;
+} batch_log_t;
+
+static int
+_job_index (batch_log_t *log, ddb_converter_job_t *job) {
+    return (int)(job - log->jobs);
+}
+
+static int
+_prepare (ddb_converter_job_t *job, void *user_data) {
+    batch_log_t *log = user_data;
+    int idx = _job_index (log, job);
+    if (idx == log->skip_job) {
+        return 1;
+    }
+    if (idx == log->cancel_job) {
+        return -1;
+    }
+    return 0;
+}
+
+static void
+_state_changed (ddb_converter_job_t *job, void *user_data) {
+    batch_log_t *log = user_data;
+    int idx = _job_index (log, job);
+    int path = idx % NUM_PATHS;
+
+    mutex_lock (log->mutex);
+    if (job->state == DDB_CONVERTER_JOB_RUNNING) {
+        log->started[log->num_started++] = idx;
+        log->is_running[idx] = 1;
+        log->running++;
+        log->running_per_path[path]++;
+        if (log->running > log->max_running) {
+            log->max_running = log->running;
+        }
+        if (log->running_per_path[path] > log->max_running_per_path) {
+            log->max_running_per_path = log->running_per_path[path];
+        }
+    }
+    else {
+        // the skipped and cancelled jobs may finish without starting
+        if (log->is_running[idx]) {
+            log->is_running[idx] = 0;
+            log->running--;
+            log->running_per_path[path]--;
+        }
+        if (log->pabort) {
+            *log->pabort = 1;
+        }
+    }
+    mutex_unlock (log->mutex);
+}
+
+@interface ConverterTests : XCTestCase {
+    ddb_converter_t *_converter;
+    playlist_t *_plt;
+    char _outdir[PATH_MAX];
+    char _outpaths[NUM_PATHS][PATH_MAX];
+    ddb_encoder_preset_t _encoder_preset;
+    ddb_converter_settings_t _settings;
+    ddb_converter_job_t _jobs[NUM_JOBS];
+    batch_log_t _log;
+}
+
+@end
+
+@implementation ConverterTests
+
+- (void)setUp {
+    [super setUp];
+
+    extern DB_plugin_t * fakein_load (DB_functions_t *api);
+    plug_init_plugin (fakein_load, NULL);
+    DB_plugin_t *fakein = fakein_load (plug_get_api ());
+    plug_register_in (fakein);
+
+    _converter = (ddb_converter_t *)plug_get_for_id ("converter");
+    XCTAssert (_converter != NULL);
+
+    snprintf (_outdir, sizeof (_outdir), "%s/ddbconvtestXXXXXX", getenv ("TMPDIR") ? getenv ("TMPDIR") : "/tmp");
+    XCTAssert (mkdtemp (_outdir) != NULL);
+    for (int i = 0; i < NUM_PATHS; i++) {
+        snprintf (_outpaths[i], sizeof (_outpaths[i]), "%s/out%d.wav", _outdir, i);
+    }
+
+    // write the decoded signal to a wav file, without an external encoder
+    memset (&_encoder_preset, 0, sizeof (_encoder_preset));
+    _encoder_preset.ext = "wav";
+    _encoder_preset.encoder = "";
+    _encoder_preset.method = DDB_ENCODER_METHOD_FILE;
+
+    memset (&_settings, 0, sizeof (_settings));
+    _settings.output_bps = 16;
+    _settings.encoder_preset = &_encoder_preset;
+
+    // the jobs alternate between the output paths
+    _plt = plt_alloc ("testplt");
+    DB_playItem_t *after = NULL;
+    memset (_jobs, 0, sizeof (_jobs));
+    for (int i = 0; i < NUM_JOBS; i++) {
+        after = deadbeef->plt_insert_file2 (0, (ddb_playlist_t *)_plt, after, "/sine.fake", NULL, NULL, NULL);
+        _jobs[i].it = after;
+        _jobs[i].outpath = _outpaths[i % NUM_PATHS];
+    }
+
+    memset (&_log, 0, sizeof (_log));
+    _log.mutex = mutex_create ();
+    _log.jobs = _jobs;
+    _log.skip_job = -1;
+    _log.cancel_job = -1;
+
+    // slow down decoding, to make the jobs overlap
+    fakein_set_sleep (200);
+}
+
+- (void)tearDown {
+    fakein_set_sleep (0);
+    mutex_free (_log.mutex);
+    plt_unref (_plt);
+    for (int i = 0; i < NUM_PATHS; i++) {
+        unlink (_outpaths[i]);
+    }
+    rmdir (_outdir);
+
+    [super tearDown];
+}
+
+- (void)test_ConvertBatch_SameOutputPath_RunsOneAtATimeInOrder {
+    int failed = _converter->convert_batch (&_settings, _jobs, NUM_JOBS, 4, _prepare, _state_changed, &_log, NULL);
+
+    XCTAssertEqual (failed, 0);
+    for (int i = 0; i < NUM_JOBS; i++) {
+        XCTAssertEqual (_jobs[i].state, DDB_CONVERTER_JOB_DONE);
+        XCTAssertEqual (_jobs[i].result, 0);
+    }
+    XCTAssertEqual (_log.num_started, NUM_JOBS);
+
+    // the jobs with different output paths run in parallel
+    XCTAssertGreaterThan (_log.max_running, 1);
+    XCTAssertEqual (_log.max_running_per_path, 1);
+
+    // and the ones with the same output path in their original order
+    for (int path = 0; path < NUM_PATHS; path++) {
+        int prev = -1;
+        for (int i = 0; i < _log.num_started; i++) {
+            int idx = _log.started[i];
+            if (idx % NUM_PATHS != path) {
+                continue;
+            }
+            XCTAssertGreaterThan (idx, prev);
+            prev = idx;
+        }
+    }
+
+    XCTAssertEqual (fakein_get_num_instances (), 0);
+}
+
+- (void)test_ConvertBatch_PrepareSkipsAndCancels_SetsJobStates {
+    _log.skip_job = 1;
+    _log.cancel_job = 3;
+
+    int failed = _converter->convert_batch (&_settings, _jobs, NUM_JOBS, 1, _prepare, _state_changed, &_log, NULL);
+
+    XCTAssertEqual (failed, 0);
+    XCTAssertEqual (_jobs[0].state, DDB_CONVERTER_JOB_DONE);
+    XCTAssertEqual (_jobs[1].state, DDB_CONVERTER_JOB_SKIPPED);
+    XCTAssertEqual (_jobs[2].state, DDB_CONVERTER_JOB_DONE);
+    for (int i = 3; i < NUM_JOBS; i++) {
+        XCTAssertEqual (_jobs[i].state, DDB_CONVERTER_JOB_CANCELLED);
+    }
+    XCTAssertEqual (fakein_get_num_instances (), 0);
+}
+
+- (void)test_ConvertBatch_Abort_CancelsQueuedJobs {
+    int abort = 0;
+    _log.pabort = &abort;
+
+    // the jobs blocked by the same output path must not wait forever for the cancelled ones
+    int failed = _converter->convert_batch (&_settings, _jobs, NUM_JOBS, 4, _prepare, _state_changed, &_log, &abort);
+
+    XCTAssertEqual (failed, 0);
+    int done = 0;
+    for (int i = 0; i < NUM_JOBS; i++) {
+        if (_jobs[i].state == DDB_CONVERTER_JOB_DONE) {
+            done++;
+        }
+        else {
+            XCTAssertEqual (_jobs[i].state, DDB_CONVERTER_JOB_CANCELLED);
+        }
+    }
+    XCTAssertGreaterThan (done, 0);
+    XCTAssertLessThan (done, NUM_JOBS);
+    XCTAssertEqual (fakein_get_num_instances (), 0);
+}
+
+@end
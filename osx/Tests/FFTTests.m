@@ -0,0 +1,125 @@
+/*
+    DeaDBeeF -- the music player
+    Copyright (C) 2009-2018 Alexey Yakovenko and other contributors
+
+    This software is provided 'as-is', without any express or implied
+    warranty.  In no event will the authors be held liable for any damages
+    arising from the use of this software.
+
+    Permission is granted to anyone to use this software for any purpose,
+    including commercial applications, and to alter it and redistribute it
+    freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source distribution.
+*/
+
+#import <XCTest/XCTest.h>
+#include <math.h>
+#include <complex.h>
+#include "deadbeef.h"
+#include "fft.h"
+
+#define N (DDB_FREQ_BANDS * 2)
+
+// The complex FFT which was used before fft_calc_freq, as the reference
+static void
+_reference_calc_freq (const float *data, float *freq) {
+    int logn = 0;
+    while ((1 << logn) < N) {
+        logn++;
+    }
+
+    static float complex a[N];
+    for (int n = 0; n < N; n ++) {
+        int r = 0;
+        for (int x = n, i = logn; i --; x >>= 1) {
+            r = (r << 1) | (x & 1);
+        }
+        float hamming = 1 - 0.85 * cosf (2 * M_PI * n / N);
+        a[r] = data[n] * hamming;
+    }
+
+    int half = 1;
+    int inv = N / 2;
+    while (inv) {
+        for (int g = 0; g < N; g += half << 1) {
+            for (int b = 0, r = 0; b < half; b ++, r += inv) {
+                float complex even = a[g + b];
+                float complex odd = cexpf (2 * M_PI * I * r / N) * a[g + half + b];
+                a[g + b] = even + odd;
+                a[g + half + b] = even - odd;
+            }
+        }
+        half <<= 1;
+        inv >>= 1;
+    }
+
+    for (int n = 0; n < N / 2 - 1; n ++)
+        freq[n] = 2 * cabsf (a[1 + n]) / N;
+    freq[N / 2 - 1] = cabsf (a[N / 2]) / N;
+}
+
+@interface FFTTests : XCTestCase
+
+@end
+
+@implementation FFTTests
+
+- (void)test_CalcFreq_MatchesComplexFFT {
+    static float data[N];
+    static float freq[N/2];
+    static float expected[N/2];
+
+    // a few tones, a DC offset, and some deterministic noise
+    uint32_t seed = 12345;
+    for (int n = 0; n < N; n++) {
+        seed = seed * 1664525 + 1013904223;
+        float noise = (float)(seed >> 8) / (1 << 24) - 0.5f;
+        data[n] = 0.1f
+            + 0.5f * sinf (2 * M_PI * 440 * n / 44100)
+            + 0.25f * sinf (2 * M_PI * 5000 * n / 44100 + 1)
+            + 0.1f * cosf (2 * M_PI * (N/2) * n / N)
+            + 0.05f * noise;
+    }
+
+    fft_t *fft = fft_alloc (N);
+    XCTAssert (fft != NULL);
+    XCTAssertEqual (fft_get_size (fft), N);
+    fft_calc_freq (fft, data, freq);
+    fft_free (fft);
+
+    _reference_calc_freq (data, expected);
+
+    float max_expected = 0;
+    for (int i = 0; i < N/2; i++) {
+        max_expected = fmaxf (max_expected, expected[i]);
+    }
+    XCTAssertGreaterThan (max_expected, 0.1f);
+
+    int mismatches = 0;
+    for (int i = 0; i < N/2; i++) {
+        if (fabsf (freq[i] - expected[i]) > 1e-4f * max_expected) {
+            if (!mismatches) {
+                XCTFail (@"Band %d: %f, expected %f", i, freq[i], expected[i]);
+            }
+            mismatches++;
+        }
+    }
+    XCTAssertEqual (mismatches, 0);
+}
+
+- (void)test_Alloc_InvalidSize_ReturnsNULL {
+    XCTAssert (fft_alloc (0) == NULL);
+    XCTAssert (fft_alloc (2) == NULL);
+    XCTAssert (fft_alloc (1000) == NULL);
+}
+
+@end
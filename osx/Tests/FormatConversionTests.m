@@ -93,4 +93,101 @@
     XCTAssert(outsamples[3] == 0x4000, @"sample3 is %d", outsamples[3]);
 }
 
+
+- (void)testConvertFloatToInt16Stereo_SimdMatchesScalar {
+    static float samples[4099*2];
+    static int16_t scalar[4099*2];
+    static int16_t simd[4099*2];
+    for (int i = 0; i < 4099*2; i++) {
+        samples[i] = (i % 1001) / 400.f - 1.25f; // includes values to be clipped
+    }
+
+    ddb_waveformat_t inputfmt = {
+        .bps = 32,
+        .is_float = 1,
+        .channels = 2,
+        .samplerate = 44100,
+        .channelmask = DDB_SPEAKER_FRONT_LEFT|DDB_SPEAKER_FRONT_RIGHT
+    };
+
+    ddb_waveformat_t outputfmt = {
+        .bps = 16,
+        .channels = 2,
+        .samplerate = 44100,
+        .channelmask = DDB_SPEAKER_FRONT_LEFT|DDB_SPEAKER_FRONT_RIGHT
+    };
+
+    pcm_simd_set_enabled (0);
+    pcm_convert (&inputfmt, (char *)samples, &outputfmt, (char *)scalar, sizeof (samples));
+    pcm_simd_set_enabled (1);
+    pcm_convert (&inputfmt, (char *)samples, &outputfmt, (char *)simd, sizeof (samples));
+    XCTAssert(!memcmp (scalar, simd, sizeof (scalar)));
+}
+
+- (void)testConvertInt16ToFloatWithGain_ScaledAndClipped {
+    int16_t samples[4] = { 0x1000, -0x2000, 0x6000, -0x8000 };
+    float outsamples[4] = { 0, 0, 0, 0 };
+
+    ddb_waveformat_t inputfmt = {
+        .bps = 16,
+        .channels = 2,
+        .samplerate = 44100,
+        .channelmask = DDB_SPEAKER_FRONT_LEFT|DDB_SPEAKER_FRONT_RIGHT
+    };
+
+    ddb_waveformat_t outputfmt = {
+        .bps = 32,
+        .is_float = 1,
+        .channels = 2,
+        .samplerate = 44100,
+        .channelmask = DDB_SPEAKER_FRONT_LEFT|DDB_SPEAKER_FRONT_RIGHT
+    };
+
+    int res = pcm_convert_with_gain (&inputfmt, (char *)samples, &outputfmt, (char *)outsamples, sizeof (samples), 2.f);
+    XCTAssert(res == 16, @"The result is %d", res);
+    XCTAssert(outsamples[0] == 0.25f, @"sample0 is %f", outsamples[0]);
+    XCTAssert(outsamples[1] == -0.5f, @"sample1 is %f", outsamples[1]);
+    XCTAssert(outsamples[2] == 1.f, @"sample2 is %f", outsamples[2]);
+    XCTAssert(outsamples[3] == -1.f, @"sample3 is %f", outsamples[3]);
+}
+
+- (void)_measureConvertInt16ToFloatWithSimd:(int)enabled {
+    static int16_t samples[16384];
+    static float outsamples[16384];
+    for (int i = 0; i < 16384; i++) {
+        samples[i] = (int16_t)(i * 7919);
+    }
+
+    ddb_waveformat_t inputfmt = {
+        .bps = 16,
+        .channels = 2,
+        .samplerate = 44100,
+        .channelmask = DDB_SPEAKER_FRONT_LEFT|DDB_SPEAKER_FRONT_RIGHT
+    };
+
+    ddb_waveformat_t outputfmt = {
+        .bps = 32,
+        .is_float = 1,
+        .channels = 2,
+        .samplerate = 44100,
+        .channelmask = DDB_SPEAKER_FRONT_LEFT|DDB_SPEAKER_FRONT_RIGHT
+    };
+
+    pcm_simd_set_enabled (enabled);
+    [self measureBlock:^{
+        for (int i = 0; i < 100; i++) {
+            pcm_convert (&inputfmt, (char *)samples, &outputfmt, (char *)outsamples, sizeof (samples));
+        }
+    }];
+    pcm_simd_set_enabled (1);
+}
+
+- (void)testConvertInt16ToFloat_Scalar_Performance {
+    [self _measureConvertInt16ToFloatWithSimd:0];
+}
+
+- (void)testConvertInt16ToFloat_Simd_Performance {
+    [self _measureConvertInt16ToFloatWithSimd:1];
+}
+
 @end
@@ -0,0 +1,154 @@
+/*
+    DeaDBeeF -- the music player
+    Copyright (C) 2009-2018 Alexey Yakovenko and other contributors
+
+    This software is provided 'as-is', without any express or implied
+    warranty.  In no event will the authors be held liable for any damages
+    arising from the use of this software.
+
+    Permission is granted to anyone to use this software for any purpose,
+    including commercial applications, and to alter it and redistribute it
+    freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source distribution.
+*/
+
+#import <XCTest/XCTest.h>
+#include <unistd.h>
+#include "jobpool.h"
+#include "messagepump.h"
+
+#define NUM_JOBS 100
+
+typedef struct {
+    int works;
+    int completions;
+    int cancelled;
+} counters_t;
+
+static void
+_counting_work (void *ctx, ddb_cancellation_token_t *token) {
+    counters_t *counters = ctx;
+    usleep (1000);
+    __atomic_add_fetch (&counters->works, 1, __ATOMIC_SEQ_CST);
+}
+
+static void
+_counting_completion (void *ctx, int cancelled) {
+    counters_t *counters = ctx;
+    counters->completions++;
+    if (cancelled) {
+        counters->cancelled++;
+    }
+}
+
+static int _second_job_started;
+static int _first_job_saw_second;
+
+// waits until the second job is running, which needs another thread
+static void
+_waiting_work (void *ctx, ddb_cancellation_token_t *token) {
+    for (int i = 0; i < 2000 && !__atomic_load_n (&_second_job_started, __ATOMIC_SEQ_CST); i++) {
+        usleep (1000);
+    }
+    _first_job_saw_second = __atomic_load_n (&_second_job_started, __ATOMIC_SEQ_CST);
+}
+
+static void
+_signalling_work (void *ctx, ddb_cancellation_token_t *token) {
+    __atomic_store_n (&_second_job_started, 1, __ATOMIC_SEQ_CST);
+}
+
+@interface JobPoolTests : XCTestCase
+
+@end
+
+@implementation JobPoolTests
+
+- (void)setUp {
+    [super setUp];
+    messagepump_init ();
+    jobpool_init ();
+}
+
+- (void)tearDown {
+    jobpool_free ();
+    [super tearDown];
+}
+
+- (void)test_SubmitAndWait_RunsAllWorkAndCompletions {
+    counters_t counters = {0};
+    ddb_cancellation_token_t *token = cancellation_token_alloc ();
+
+    for (int i = 0; i < NUM_JOBS; i++) {
+        XCTAssert (!jobpool_submit (i % 3, token, _counting_work, _counting_completion, &counters));
+    }
+    jobpool_wait (token);
+    cancellation_token_unref (token);
+
+    XCTAssertEqual (counters.works, NUM_JOBS);
+    XCTAssertEqual (counters.completions, NUM_JOBS);
+    XCTAssertEqual (counters.cancelled, 0);
+}
+
+- (void)test_TwoJobsWithOneIdleThread_RunConcurrently {
+    // leaves one idle thread in the pool
+    counters_t counters = {0};
+    ddb_cancellation_token_t *token = cancellation_token_alloc ();
+    jobpool_submit (DDB_JOB_PRIORITY_NORMAL, token, _counting_work, NULL, &counters);
+    jobpool_wait (token);
+    usleep (10000);
+
+    // the idle thread was signalled for the first job, so the second one needs a new thread
+    _second_job_started = 0;
+    _first_job_saw_second = 0;
+    jobpool_submit (DDB_JOB_PRIORITY_NORMAL, token, _waiting_work, NULL, NULL);
+    jobpool_submit (DDB_JOB_PRIORITY_NORMAL, token, _signalling_work, NULL, NULL);
+    jobpool_wait (token);
+    cancellation_token_unref (token);
+
+    XCTAssertTrue (_first_job_saw_second);
+}
+
+- (void)test_CancelToken_DropsQueuedJobsAndCompletesAll {
+    counters_t counters = {0};
+    ddb_cancellation_token_t *token = cancellation_token_alloc ();
+
+    for (int i = 0; i < NUM_JOBS; i++) {
+        jobpool_submit (DDB_JOB_PRIORITY_NORMAL, token, _counting_work, _counting_completion, &counters);
+    }
+    cancellation_token_cancel (token);
+    jobpool_wait (token);
+    XCTAssert (cancellation_token_is_cancelled (token));
+    cancellation_token_unref (token);
+
+    XCTAssertLessThan (counters.works, NUM_JOBS);
+    XCTAssertEqual (counters.completions, NUM_JOBS);
+    XCTAssertGreaterThan (counters.cancelled, 0);
+}
+
+- (void)test_Free_CompletesQueuedJobsAsCancelled {
+    counters_t counters = {0};
+
+    for (int i = 0; i < NUM_JOBS; i++) {
+        jobpool_submit (DDB_JOB_PRIORITY_LOW, NULL, _counting_work, _counting_completion, &counters);
+    }
+    jobpool_free ();
+
+    XCTAssertLessThan (counters.works, NUM_JOBS);
+    XCTAssertEqual (counters.completions, NUM_JOBS);
+    XCTAssertGreaterThan (counters.cancelled, 0);
+    XCTAssertEqual (jobpool_submit (DDB_JOB_PRIORITY_LOW, NULL, _counting_work, _counting_completion, &counters), -1);
+
+    jobpool_init ();
+}
+
+@end
@@ -0,0 +1,366 @@
+/*
+    DeaDBeeF -- the music player
+    Copyright (C) 2009-2018 Alexey Yakovenko and other contributors
+
+    This software is provided 'as-is', without any express or implied
+    warranty.  In no event will the authors be held liable for any damages
+    arising from the use of this software.
+
+    Permission is granted to anyone to use this software for any purpose,
+    including commercial applications, and to alter it and redistribute it
+    freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source distribution.
+*/
+
+#import <XCTest/XCTest.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <unistd.h>
+#include "deadbeef.h"
+#include "conf.h"
+#include "playlist.h"
+#include "plugins.h"
+#include "threading.h"
+#include "../../common.h"
+
+extern DB_plugin_t *listenbrainz_load (DB_functions_t *api);
+
+#define GOOD_TOKEN "goodtoken"
+
+// Minimal submit-listens endpoint:
+// 401 for a wrong token, 400 for a batch with a listen named REJECT,
+// `fail_status` for the next `fail_count` requests, otherwise 200
+typedef struct {
+    int fd;
+    int port;
+    intptr_t tid;
+    int terminate;
+    uintptr_t mutex;
+
+    // protected by mutex
+    int fail_status;
+    int fail_count;
+    int requests;
+    int accepted; // number of listens accepted with 200
+    char accepted_names[1000]; // the names of the accepted listens, comma separated
+} test_server_t;
+
+static test_server_t server;
+
+static int
+send_all (int fd, const void *data, size_t size) {
+    const char *p = data;
+    while (size > 0) {
+        ssize_t res = send (fd, p, size, 0);
+        if (res <= 0) {
+            return -1;
+        }
+        p += res;
+        size -= res;
+    }
+    return 0;
+}
+
+static int
+server_handle_request (const char *headers, const char *body) {
+    if (!strstr (headers, "Authorization: Token " GOOD_TOKEN "\r\n")) {
+        return 401;
+    }
+    if (server.fail_count > 0) {
+        server.fail_count--;
+        return server.fail_status;
+    }
+    if (strstr (body, "\"track_name\":\"REJECT\"")) {
+        return 400;
+    }
+    for (const char *p = strstr (body, "\"track_name\":\""); p; p = strstr (p, "\"track_name\":\"")) {
+        p += strlen ("\"track_name\":\"");
+        const char *end = strchr (p, '"');
+        size_t len = strlen (server.accepted_names);
+        snprintf (server.accepted_names + len, sizeof (server.accepted_names) - len, "%.*s,", (int)(end - p), p);
+        server.accepted++;
+    }
+    return 200;
+}
+
+static void
+server_connection (int fd) {
+    char request[0x10000];
+    size_t len = 0;
+    char *body = NULL;
+    size_t content_length = 0;
+    while (len < sizeof (request) - 1) {
+        ssize_t res = recv (fd, request + len, sizeof (request) - 1 - len, 0);
+        if (res <= 0) {
+            break;
+        }
+        len += res;
+        request[len] = 0;
+        if (!body) {
+            char *end = strstr (request, "\r\n\r\n");
+            if (end) {
+                body = end + 4;
+                const char *cl = strcasestr (request, "\r\nContent-Length:");
+                content_length = cl ? strtoul (cl + strlen ("\r\nContent-Length:"), NULL, 10) : 0;
+            }
+        }
+        if (body && request + len - body >= (ssize_t)content_length) {
+            break;
+        }
+    }
+    if (!body) {
+        close (fd);
+        return;
+    }
+    body[-2] = 0;
+
+    mutex_lock (server.mutex);
+    server.requests++;
+    int status = server_handle_request (request, body);
+    mutex_unlock (server.mutex);
+
+    char header[200];
+    snprintf (header, sizeof (header), "HTTP/1.1 %d Status\r\nContent-Length: 2\r\nConnection: close\r\n\r\n{}", status);
+    send_all (fd, header, strlen (header));
+    close (fd);
+}
+
+static void
+server_thread (void *ctx) {
+    while (!__atomic_load_n (&server.terminate, __ATOMIC_SEQ_CST)) {
+        struct pollfd pfd = { .fd = server.fd, .events = POLLIN };
+        if (poll (&pfd, 1, 50) <= 0) {
+            continue;
+        }
+        int fd = accept (server.fd, NULL, NULL);
+        if (fd >= 0) {
+            server_connection (fd);
+        }
+    }
+}
+
+static int
+server_start (void) {
+    memset (&server, 0, sizeof (server));
+    server.mutex = mutex_create ();
+
+    server.fd = socket (AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr = {0};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+    socklen_t addrlen = sizeof (addr);
+    if (bind (server.fd, (struct sockaddr *)&addr, addrlen) || listen (server.fd, 16) || getsockname (server.fd, (struct sockaddr *)&addr, &addrlen)) {
+        close (server.fd);
+        return -1;
+    }
+    server.port = ntohs (addr.sin_port);
+    server.tid = thread_start (server_thread, NULL);
+    return 0;
+}
+
+static void
+server_stop (void) {
+    __atomic_store_n (&server.terminate, 1, __ATOMIC_SEQ_CST);
+    thread_join (server.tid);
+    close (server.fd);
+    mutex_free (server.mutex);
+}
+
+static int
+server_get_requests (void) {
+    mutex_lock (server.mutex);
+    int requests = server.requests;
+    mutex_unlock (server.mutex);
+    return requests;
+}
+
+// waits until the server accepted the number of listens, returns NO on timeout
+static BOOL
+server_wait_accepted (int count) {
+    for (int i = 0; i < 500; i++) {
+        mutex_lock (server.mutex);
+        int accepted = server.accepted;
+        mutex_unlock (server.mutex);
+        if (accepted >= count) {
+            return YES;
+        }
+        usleep (10000);
+    }
+    return NO;
+}
+
+@interface ListenBrainzTests : XCTestCase {
+    char _prev_confdir[PATH_MAX];
+    char _queue_path[PATH_MAX];
+    char _pos_path[PATH_MAX];
+    DB_plugin_t *_plugin;
+}
+
+@end
+
+@implementation ListenBrainzTests
+
+- (void)setUp {
+    [super setUp];
+
+    XCTAssertEqual (server_start (), 0);
+
+    // the journal is kept in the config dir
+    strcpy (_prev_confdir, dbconfdir);
+    snprintf (dbconfdir, sizeof (dbconfdir), "%s/listenbrainz_test_%d", NSTemporaryDirectory().UTF8String, (int)getpid ());
+    mkdir (dbconfdir, 0755);
+    snprintf (_queue_path, sizeof (_queue_path), "%s/listenbrainz_queue", dbconfdir);
+    snprintf (_pos_path, sizeof (_pos_path), "%s/listenbrainz_queue.pos", dbconfdir);
+
+    char url[100];
+    snprintf (url, sizeof (url), "http://127.0.0.1:%d", server.port);
+    conf_set_str ("listenbrainz.scrobbler_url", url);
+    conf_set_str ("listenbrainz.usertoken", GOOD_TOKEN);
+    conf_set_int ("listenbrainz.enable", 1);
+
+    _plugin = listenbrainz_load (plug_get_api ());
+}
+
+- (void)tearDown {
+    _plugin->stop ();
+    server_stop ();
+
+    unlink (_queue_path);
+    unlink (_pos_path);
+    rmdir (dbconfdir);
+    strcpy (dbconfdir, _prev_confdir);
+    conf_remove_items ("listenbrainz.");
+
+    [super tearDown];
+}
+
+- (void)writeJournal:(const char *)names pos:(long)pos {
+    FILE *fp = fopen (_queue_path, "wb");
+    char *copy = strdup (names);
+    for (char *name = strtok (copy, ","); name; name = strtok (NULL, ",")) {
+        fprintf (fp, "{\"listened_at\":1500000000,\"track_metadata\":{\"artist_name\":\"artist\",\"track_name\":\"%s\"}}\n", name);
+    }
+    free (copy);
+    fclose (fp);
+
+    if (pos) {
+        fp = fopen (_pos_path, "wt");
+        fprintf (fp, "%ld\n", pos);
+        fclose (fp);
+    }
+}
+
+- (BOOL)journalExists {
+    return access (_queue_path, F_OK) == 0;
+}
+
+// the journal is deleted after the last listen was accepted, returns NO on timeout
+- (BOOL)waitForJournalDeleted {
+    for (int i = 0; i < 500; i++) {
+        if (![self journalExists]) {
+            return YES;
+        }
+        usleep (10000);
+    }
+    return NO;
+}
+
+- (void)test_Journal_SubmittedInOneBatchAndDeleted {
+    [self writeJournal:"one,two,three" pos:0];
+    _plugin->start ();
+
+    XCTAssert ([self waitForJournalDeleted]);
+    _plugin->stop ();
+
+    XCTAssertEqual (server_get_requests (), 1);
+    XCTAssertEqual (strcmp (server.accepted_names, "one,two,three,"), 0);
+}
+
+- (void)test_RejectedBatch_ResentOneByOne_DropsBadListen {
+    [self writeJournal:"one,REJECT,three" pos:0];
+    _plugin->start ();
+
+    XCTAssert ([self waitForJournalDeleted]);
+    _plugin->stop ();
+
+    // the batch, then each listen separately
+    XCTAssertEqual (server_get_requests (), 4);
+    XCTAssertEqual (strcmp (server.accepted_names, "one,three,"), 0);
+}
+
+- (void)test_InvalidToken_KeepsJournal_NotRetriedRightAway {
+    conf_set_str ("listenbrainz.usertoken", "badtoken");
+    [self writeJournal:"one" pos:0];
+    _plugin->start ();
+
+    for (int i = 0; i < 500 && server_get_requests () < 1; i++) {
+        usleep (10000);
+    }
+    usleep (500000);
+    _plugin->stop ();
+
+    XCTAssertEqual (server_get_requests (), 1);
+    XCTAssertEqual (server.accepted, 0);
+    XCTAssert ([self journalExists]);
+}
+
+- (void)test_ServerError_RetriedAfterDelayWithoutNewEvents {
+    conf_set_int ("listenbrainz.retry_delay", 1);
+    mutex_lock (server.mutex);
+    server.fail_status = 503;
+    server.fail_count = 1;
+    mutex_unlock (server.mutex);
+    _plugin->start ();
+
+    playItem_t *it = pl_item_alloc ();
+    pl_add_meta (it, "artist", "artist");
+    pl_add_meta (it, "title", "live");
+    plt_set_item_duration (NULL, it, 300);
+    ddb_event_trackchange_t ev = {
+        .ev.event = DB_EV_SONGCHANGED,
+        .from = (DB_playItem_t *)it,
+        .playtime = 300,
+        .started_timestamp = 1500000000,
+    };
+    _plugin->message (DB_EV_SONGCHANGED, (uintptr_t)&ev, 0, 0);
+
+    // the thread must wake up by itself when the retry delay has passed
+    XCTAssert (server_wait_accepted (1));
+    XCTAssert ([self waitForJournalDeleted]);
+    _plugin->stop ();
+    pl_item_unref (it);
+
+    XCTAssertEqual (server_get_requests (), 2);
+    XCTAssertEqual (strcmp (server.accepted_names, "live,"), 0);
+}
+
+- (void)test_JournalReplay_StartsAtSavedPosition {
+    [self writeJournal:"one,two,three" pos:0];
+    // skip the first line, as if it was submitted before a restart
+    FILE *fp = fopen (_queue_path, "rb");
+    char line[1000];
+    fgets (line, sizeof (line), fp);
+    fclose (fp);
+    [self writeJournal:"one,two,three" pos:(long)strlen (line)];
+    _plugin->start ();
+
+    XCTAssert ([self waitForJournalDeleted]);
+    _plugin->stop ();
+
+    XCTAssertEqual (server_get_requests (), 1);
+    XCTAssertEqual (strcmp (server.accepted_names, "two,three,"), 0);
+}
+
+@end
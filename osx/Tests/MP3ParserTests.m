@@ -201,4 +201,46 @@
     XCTAssertLessThan(info.valid_packets, info.npackets);
 }
 
+- (void)test_VBRFullScan_BuildsSeekIndex {
+    mp3info_t info;
+    mp3_seekindex_t index = {0};
+    char path[PATH_MAX];
+    snprintf (path, sizeof (path), "%s/TestData/mp3parser/vbr_rhytm_30sec.mp3", dbplugindir);
+    DB_FILE *fp = vfs_fopen (path);
+    int64_t fsize = vfs_fgetlength(fp);
+    int res = mp3_parse_file_indexed (&info, 0, fp, fsize, 0, 0, -1, &index);
+    XCTAssert (!res);
+    XCTAssertEqual(index.count, (890 + MP3_SEEKINDEX_INTERVAL - 1) / MP3_SEEKINDEX_INTERVAL);
+    for (int i = 1; i < index.count; i++) {
+        XCTAssertGreaterThan(index.points[i].offs, index.points[i-1].offs);
+        XCTAssertEqual(index.points[i].sample - index.points[i-1].sample, MP3_SEEKINDEX_INTERVAL * 1152);
+    }
+    mp3_seekindex_free (&index);
+}
+
+- (void)test_SeekWithIndex_FindsSamePacketAsSeekFromStart {
+    mp3info_t info;
+    mp3_seekindex_t index = {0};
+    char path[PATH_MAX];
+    snprintf (path, sizeof (path), "%s/TestData/mp3parser/vbr_rhytm_30sec_lamehdr.mp3", dbplugindir);
+    DB_FILE *fp = vfs_fopen (path);
+    int64_t fsize = vfs_fgetlength(fp);
+    int res = mp3_parse_file_indexed (&info, 0, fp, fsize, 0, 0, -1, &index);
+    XCTAssert (!res);
+
+    int64_t samples[] = { 500000, 1000000, 100000, 750000 };
+    for (int i = 0; i < sizeof (samples) / sizeof (samples[0]); i++) {
+        mp3info_t expected;
+        res = mp3_parse_file (&expected, 0, fp, fsize, 0, 0, samples[i]);
+        XCTAssert (!res);
+        res = mp3_parse_file_indexed (&info, 0, fp, fsize, 0, 0, samples[i], &index);
+        XCTAssert (!res);
+        XCTAssertEqual(info.packet_offs, expected.packet_offs);
+        XCTAssertEqual(info.pcmsample, expected.pcmsample);
+    }
+    // the seeks past the initial scan have extended the index
+    XCTAssertGreaterThan(index.count, 4);
+    mp3_seekindex_free (&index);
+}
+
 @end
@@ -0,0 +1,294 @@
+/*
+    DeaDBeeF -- the music player
+    Copyright (C) 2009-2018 Alexey Yakovenko and other contributors
+
+    This software is provided 'as-is', without any express or implied
+    warranty.  In no event will the authors be held liable for any damages
+    arising from the use of this software.
+
+    Permission is granted to anyone to use this software for any purpose,
+    including commercial applications, and to alter it and redistribute it
+    freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source distribution.
+*/
+
+#import <XCTest/XCTest.h>
+#include <sys/stat.h>
+#include <ftw.h>
+#include <unistd.h>
+#include "deadbeef.h"
+#include "conf.h"
+#include "playlist.h"
+#include "plugins.h"
+#include "fakein.h"
+#include "../../common.h"
+#include "../../plugins/medialib/medialib.h"
+
+extern DB_plugin_t *medialib_load (DB_functions_t *api);
+
+static int
+_rm_entry (const char *path, const struct stat *st, int flag, struct FTW *ftw) {
+    return remove (path);
+}
+
+static void
+_rm_tree (const char *path) {
+    nftw (path, _rm_entry, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+static void
+_write_file (const char *path, const char *data) {
+    FILE *fp = fopen (path, "ab");
+    fputs (data, fp);
+    fclose (fp);
+}
+
+static int _num_changed_events;
+
+static void
+_listener (int event, void *user_data) {
+    if (event == DDB_MEDIALIB_EVENT_CHANGED) {
+        __atomic_add_fetch (&_num_changed_events, 1, __ATOMIC_SEQ_CST);
+    }
+}
+
+@interface MedialibTests : XCTestCase {
+    char _prev_confdir[PATH_MAX];
+    char _confdir[PATH_MAX];
+    char _libdir[PATH_MAX];
+    ddb_medialib_plugin_t *_medialib;
+}
+
+@end
+
+@implementation MedialibTests
+
+- (void)setUp {
+    [super setUp];
+
+    extern DB_plugin_t * fakein_load (DB_functions_t *api);
+    plug_init_plugin (fakein_load, NULL);
+    DB_plugin_t *fakein = fakein_load (plug_get_api ());
+    plug_register_in (fakein);
+
+    // the library and the signatures are saved in the config dir
+    snprintf (_confdir, sizeof (_confdir), "%s/ddbmlconfXXXXXX", NSTemporaryDirectory().UTF8String);
+    XCTAssert (mkdtemp (_confdir) != NULL);
+    strcpy (_prev_confdir, dbconfdir);
+    strcpy (dbconfdir, _confdir);
+
+    snprintf (_libdir, sizeof (_libdir), "%s/ddbmllibXXXXXX", NSTemporaryDirectory().UTF8String);
+    XCTAssert (mkdtemp (_libdir) != NULL);
+    conf_set_str ("medialib.path", _libdir);
+
+    _num_changed_events = 0;
+    _medialib = (ddb_medialib_plugin_t *)medialib_load (plug_get_api ());
+}
+
+- (void)tearDown {
+    _rm_tree (_libdir);
+    _rm_tree (_confdir);
+    strcpy (dbconfdir, _prev_confdir);
+    conf_remove_items ("medialib.");
+
+    [super tearDown];
+}
+
+- (void)createFile:(const char *)name data:(const char *)data {
+    char path[PATH_MAX];
+    snprintf (path, sizeof (path), "%s/%s", _libdir, name);
+    char *slash = strrchr (path, '/');
+    *slash = 0;
+    mkdir (path, 0755);
+    *slash = '/';
+    _write_file (path, data);
+}
+
+// starts the plugin, and waits for the initial scan to finish
+- (void)startLibrary {
+    _medialib->plugin.plugin.start ();
+    _medialib->add_listener (_listener, NULL);
+    _medialib->plugin.plugin.connect ();
+    for (int i = 0; i < 500 && _medialib->scanner_state () == DDB_MEDIALIB_STATE_SCANNING; i++) {
+        usleep (10000);
+    }
+    XCTAssertNotEqual (_medialib->scanner_state (), DDB_MEDIALIB_STATE_SCANNING);
+}
+
+// returns the library file names relative to the library folder, sorted and comma separated
+- (void)getTracks:(char *)out size:(size_t)size {
+    int count;
+    DB_playItem_t **tracks = _medialib->get_tracks (&count);
+    char names[100][100];
+    for (int i = 0; i < count && i < 100; i++) {
+        const char *uri = pl_find_meta ((playItem_t *)tracks[i], ":URI");
+        snprintf (names[i], sizeof (names[i]), "%s", uri + strlen (_libdir) + 1);
+        pl_item_unref ((playItem_t *)tracks[i]);
+    }
+    free (tracks);
+    qsort (names, count, sizeof (names[0]), (int (*)(const void *, const void *))strcmp);
+    *out = 0;
+    for (int i = 0; i < count; i++) {
+        size_t l = strlen (out);
+        snprintf (out + l, size - l, "%s,", names[i]);
+    }
+}
+
+// waits until the library contains exactly the expected tracks, returns NO on timeout
+- (BOOL)waitForTracks:(const char *)expected {
+    char tracks[1000];
+    for (int i = 0; i < 300; i++) {
+        [self getTracks:tracks size:sizeof (tracks)];
+        if (!strcmp (tracks, expected)) {
+            return YES;
+        }
+        usleep (50000);
+    }
+    return NO;
+}
+
+// waits until the number of files read by the scanner reaches the count, returns NO on timeout
+- (BOOL)waitForInserts:(int)count {
+    for (int i = 0; i < 300 && fakein_get_num_inserts () < count; i++) {
+        usleep (50000);
+    }
+    return fakein_get_num_inserts () >= count;
+}
+
+- (void)runWatchTest {
+    conf_set_int ("medialib.watch", 1);
+    conf_set_int ("medialib.watch_poll_interval", 1);
+    [self createFile:"a/1.fake" data:"1"];
+    [self startLibrary];
+    XCTAssertEqual (_medialib->scanner_state (), DDB_MEDIALIB_STATE_WATCHING);
+    XCTAssertEqual (fakein_get_num_inserts (), 1);
+    int events = _num_changed_events;
+
+    // the polled folders are compared by mtime, which has one second precision
+    sleep (1);
+
+    // a new file, and a new folder
+    [self createFile:"a/2.fake" data:"2"];
+    [self createFile:"b/3.fake" data:"3"];
+    XCTAssert ([self waitForTracks:"a/1.fake,a/2.fake,b/3.fake,"]);
+    XCTAssertGreaterThan (_num_changed_events, events);
+    events = _num_changed_events;
+    int inserts = fakein_get_num_inserts ();
+
+    sleep (1);
+
+    // a file replaced by a new version, the way the tag editors save them
+    char path[PATH_MAX];
+    char tmppath[PATH_MAX];
+    snprintf (path, sizeof (path), "%s/b/3.fake", _libdir);
+    snprintf (tmppath, sizeof (tmppath), "%s/b/.3.fake.tmp", _libdir);
+    _write_file (tmppath, "new version");
+    rename (tmppath, path);
+    XCTAssert ([self waitForInserts:inserts + 1]);
+    XCTAssert ([self waitForTracks:"a/1.fake,a/2.fake,b/3.fake,"]);
+    XCTAssertGreaterThan (_num_changed_events, events);
+    events = _num_changed_events;
+
+    sleep (1);
+
+    // a deleted file, and a deleted folder
+    snprintf (path, sizeof (path), "%s/a/2.fake", _libdir);
+    unlink (path);
+    snprintf (path, sizeof (path), "%s/b", _libdir);
+    _rm_tree (path);
+    XCTAssert ([self waitForTracks:"a/1.fake,"]);
+    XCTAssertGreaterThan (_num_changed_events, events);
+
+    _medialib->plugin.plugin.stop ();
+    XCTAssertEqual (_medialib->scanner_state (), DDB_MEDIALIB_STATE_IDLE);
+
+    // the changes were saved
+    conf_set_int ("medialib.watch", 0);
+    inserts = fakein_get_num_inserts ();
+    [self startLibrary];
+    char tracks[1000];
+    [self getTracks:tracks size:sizeof (tracks)];
+    _medialib->plugin.plugin.stop ();
+    XCTAssertEqual (strcmp (tracks, "a/1.fake,"), 0);
+    XCTAssertEqual (fakein_get_num_inserts (), inserts);
+}
+
+- (void)test_Watch_CreateModifyDelete_LibraryUpdated {
+    [self runWatchTest];
+}
+
+- (void)test_WatchWithoutNotifications_CreateModifyDelete_LibraryUpdatedByPolling {
+    // no folder gets a watch, all of them are polled
+    conf_set_int ("medialib.watch_limit", 0);
+    [self runWatchTest];
+}
+
+- (void)test_Rescan_UnchangedFolders_NotReadAgain {
+    [self createFile:"a/1.fake" data:"1"];
+    [self createFile:"a/2.fake" data:"2"];
+    [self createFile:"b/3.fake" data:"3"];
+    char tracks[1000];
+
+    // the first scan reads everything
+    [self startLibrary];
+    [self getTracks:tracks size:sizeof (tracks)];
+    _medialib->plugin.plugin.stop ();
+    XCTAssertEqual (strcmp (tracks, "a/1.fake,a/2.fake,b/3.fake,"), 0);
+    XCTAssertEqual (fakein_get_num_inserts (), 3);
+    XCTAssertEqual (_num_changed_events, 1);
+
+    // nothing has changed, the library is loaded from disk
+    [self startLibrary];
+    [self getTracks:tracks size:sizeof (tracks)];
+    _medialib->plugin.plugin.stop ();
+    XCTAssertEqual (strcmp (tracks, "a/1.fake,a/2.fake,b/3.fake,"), 0);
+    XCTAssertEqual (fakein_get_num_inserts (), 3);
+    XCTAssertEqual (_num_changed_events, 1);
+
+    // only the folder with the modified file is read again
+    [self createFile:"b/3.fake" data:"more data"];
+    [self startLibrary];
+    [self getTracks:tracks size:sizeof (tracks)];
+    _medialib->plugin.plugin.stop ();
+    XCTAssertEqual (strcmp (tracks, "a/1.fake,a/2.fake,b/3.fake,"), 0);
+    XCTAssertEqual (fakein_get_num_inserts (), 4);
+    XCTAssertEqual (_num_changed_events, 2);
+}
+
+- (void)test_Rescan_RemovedFolder_TracksRemovedWithoutReading {
+    [self createFile:"a/1.fake" data:"1"];
+    [self createFile:"b/2.fake" data:"2"];
+    char tracks[1000];
+
+    [self startLibrary];
+    _medialib->plugin.plugin.stop ();
+    XCTAssertEqual (fakein_get_num_inserts (), 2);
+
+    char path[PATH_MAX];
+    snprintf (path, sizeof (path), "%s/a", _libdir);
+    _rm_tree (path);
+
+    [self startLibrary];
+    [self getTracks:tracks size:sizeof (tracks)];
+    _medialib->plugin.plugin.stop ();
+    XCTAssertEqual (strcmp (tracks, "b/2.fake,"), 0);
+    XCTAssertEqual (fakein_get_num_inserts (), 2);
+
+    // the removal was saved
+    [self startLibrary];
+    [self getTracks:tracks size:sizeof (tracks)];
+    _medialib->plugin.plugin.stop ();
+    XCTAssertEqual (strcmp (tracks, "b/2.fake,"), 0);
+    XCTAssertEqual (fakein_get_num_inserts (), 2);
+}
+
+@end
@@ -0,0 +1,229 @@
+/*
+    DeaDBeeF -- the music player
+    Copyright (C) 2009-2018 Alexey Yakovenko and other contributors
+
+    This software is provided 'as-is', without any express or implied
+    warranty.  In no event will the authors be held liable for any damages
+    arising from the use of this software.
+
+    Permission is granted to anyone to use this software for any purpose,
+    including commercial applications, and to alter it and redistribute it
+    freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source distribution.
+*/
+
+#import <XCTest/XCTest.h>
+#include "messagepump.h"
+#include "playlist.h"
+#include "threading.h"
+
+#define NUM_PRODUCERS 4
+#define NUM_MESSAGES_PER_PRODUCER 50000
+#define MAX_QUEUED_MESSAGES (4096*256)
+
+// not a coalescable message, p1 and p2 are passed through as is
+#define TEST_MESSAGE DB_EV_NEXT
+
+typedef struct {
+    int producer;
+} producer_t;
+
+static void
+_producer_thread (void *ctx) {
+    producer_t *producer = ctx;
+    for (int i = 0; i < NUM_MESSAGES_PER_PRODUCER; i++) {
+        messagepump_push (TEST_MESSAGE, 0, producer->producer, i);
+    }
+}
+
+static int
+_pop_all (void) {
+    int count = 0;
+    uint32_t id, p1, p2;
+    uintptr_t ctx;
+    while (messagepump_pop (&id, &ctx, &p1, &p2) != -1) {
+        if (id >= DB_EV_FIRST && ctx) {
+            messagepump_event_free ((ddb_event_t *)ctx);
+        }
+        count++;
+    }
+    return count;
+}
+
+static void
+_push_trackinfochanged (playItem_t *it) {
+    ddb_event_track_t *ev = (ddb_event_track_t *)messagepump_event_alloc (DB_EV_TRACKINFOCHANGED);
+    ev->track = (DB_playItem_t *)it;
+    pl_item_ref (it);
+    messagepump_push_event ((ddb_event_t *)ev, 0, 0);
+}
+
+@interface MessagePumpTests : XCTestCase
+
+@end
+
+@implementation MessagePumpTests
+
+- (void)setUp {
+    [super setUp];
+    messagepump_init ();
+}
+
+- (void)tearDown {
+    _pop_all ();
+    messagepump_free ();
+    [super tearDown];
+}
+
+- (void)test_PushAndPop_ReturnsMessagesInOrder {
+    for (int i = 0; i < 1000; i++) {
+        XCTAssertEqual (messagepump_push (TEST_MESSAGE, i, i, i*2), 0);
+    }
+
+    for (int i = 0; i < 1000; i++) {
+        uint32_t id, p1, p2;
+        uintptr_t ctx;
+        XCTAssertEqual (messagepump_pop (&id, &ctx, &p1, &p2), 0);
+        XCTAssertEqual (id, TEST_MESSAGE);
+        XCTAssertEqual (ctx, i);
+        XCTAssertEqual (p1, i);
+        XCTAssertEqual (p2, i*2);
+    }
+    uint32_t id, p1, p2;
+    uintptr_t ctx;
+    XCTAssertEqual (messagepump_pop (&id, &ctx, &p1, &p2), -1);
+}
+
+- (void)test_ConcurrentProducers_ReceivesAllMessagesInPerProducerOrder {
+    producer_t producers[NUM_PRODUCERS];
+    intptr_t tids[NUM_PRODUCERS];
+    for (int i = 0; i < NUM_PRODUCERS; i++) {
+        producers[i].producer = i;
+        tids[i] = thread_start (_producer_thread, &producers[i]);
+    }
+
+    int next[NUM_PRODUCERS] = {0};
+    int total = 0;
+    int bad_order = 0;
+    while (total < NUM_PRODUCERS * NUM_MESSAGES_PER_PRODUCER) {
+        uint32_t id, p1, p2;
+        uintptr_t ctx;
+        if (messagepump_pop (&id, &ctx, &p1, &p2) == -1) {
+            messagepump_wait ();
+            continue;
+        }
+        XCTAssertEqual (id, TEST_MESSAGE);
+        XCTAssertLessThan (p1, NUM_PRODUCERS);
+        if (p2 != next[p1]) {
+            bad_order++;
+        }
+        next[p1] = p2 + 1;
+        total++;
+    }
+
+    for (int i = 0; i < NUM_PRODUCERS; i++) {
+        thread_join (tids[i]);
+        XCTAssertEqual (next[i], NUM_MESSAGES_PER_PRODUCER);
+    }
+    XCTAssertEqual (bad_order, 0);
+    XCTAssertEqual (_pop_all (), 0);
+
+    int queued, coalesced, dropped;
+    messagepump_get_counters (&queued, &coalesced, &dropped);
+    XCTAssertEqual (queued, 0);
+    XCTAssertEqual (dropped, 0);
+}
+
+- (void)test_SameStateChange_CoalescedUntilPopped {
+    messagepump_push (DB_EV_PLAYLISTCHANGED, 0, DDB_PLAYLIST_CHANGE_CONTENT, 0);
+    messagepump_push (DB_EV_PLAYLISTCHANGED, 0, DDB_PLAYLIST_CHANGE_CONTENT, 0);
+    messagepump_push (DB_EV_PLAYLISTCHANGED, 0, DDB_PLAYLIST_CHANGE_CONTENT, 0);
+
+    int queued, coalesced, dropped;
+    messagepump_get_counters (&queued, &coalesced, &dropped);
+    XCTAssertEqual (queued, 1);
+    XCTAssertEqual (coalesced, 2);
+    XCTAssertEqual (_pop_all (), 1);
+
+    // the queued message was popped, so the next one is queued again
+    messagepump_push (DB_EV_PLAYLISTCHANGED, 0, DDB_PLAYLIST_CHANGE_CONTENT, 0);
+    XCTAssertEqual (_pop_all (), 1);
+}
+
+- (void)test_StateChangesWithDifferentCtxOrParams_NotCoalesced {
+    messagepump_push (DB_EV_PLAYLISTCHANGED, 1, DDB_PLAYLIST_CHANGE_CONTENT, 0);
+    messagepump_push (DB_EV_PLAYLISTCHANGED, 2, DDB_PLAYLIST_CHANGE_CONTENT, 0);
+    messagepump_push (DB_EV_PLAYLISTCHANGED, 1, DDB_PLAYLIST_CHANGE_SELECTION, 0);
+    messagepump_push (DB_EV_CONFIGCHANGED, 1, DDB_PLAYLIST_CHANGE_CONTENT, 0);
+
+    int queued, coalesced, dropped;
+    messagepump_get_counters (&queued, &coalesced, &dropped);
+    XCTAssertEqual (queued, 4);
+    XCTAssertEqual (coalesced, 0);
+    XCTAssertEqual (_pop_all (), 4);
+}
+
+- (void)test_TrackInfoChanged_CoalescedPerTrack {
+    playItem_t *it1 = pl_item_alloc ();
+    playItem_t *it2 = pl_item_alloc ();
+
+    _push_trackinfochanged (it1);
+    _push_trackinfochanged (it1);
+    _push_trackinfochanged (it2);
+    _push_trackinfochanged (it1);
+    _push_trackinfochanged (it2);
+
+    int queued, coalesced, dropped;
+    messagepump_get_counters (&queued, &coalesced, &dropped);
+    XCTAssertEqual (queued, 2);
+    XCTAssertEqual (coalesced, 3);
+
+    // the coalesced events are freed right away
+    XCTAssertEqual (it1->_refc, 2);
+    XCTAssertEqual (it2->_refc, 2);
+
+    XCTAssertEqual (_pop_all (), 2);
+    XCTAssertEqual (it1->_refc, 1);
+    XCTAssertEqual (it2->_refc, 1);
+
+    pl_item_unref (it1);
+    pl_item_unref (it2);
+}
+
+- (void)test_PushOverCapacity_DropsAndCountsMessage {
+    for (int i = 0; i < MAX_QUEUED_MESSAGES; i++) {
+        if (messagepump_push (TEST_MESSAGE, 0, i, 0)) {
+            XCTFail (@"Message %d was dropped", i);
+            break;
+        }
+    }
+
+    // the event of a dropped message is freed
+    playItem_t *it = pl_item_alloc ();
+    _push_trackinfochanged (it);
+    XCTAssertEqual (it->_refc, 1);
+    XCTAssertEqual (messagepump_push (TEST_MESSAGE, 0, 0, 0), -1);
+
+    int queued, coalesced, dropped;
+    messagepump_get_counters (&queued, &coalesced, &dropped);
+    XCTAssertEqual (queued, MAX_QUEUED_MESSAGES);
+    XCTAssertEqual (dropped, 2);
+
+    // the nodes are recycled after popping
+    XCTAssertEqual (_pop_all (), MAX_QUEUED_MESSAGES);
+    XCTAssertEqual (messagepump_push (TEST_MESSAGE, 0, 0, 0), 0);
+    XCTAssertEqual (_pop_all (), 1);
+
+    pl_item_unref (it);
+}
+
+@end
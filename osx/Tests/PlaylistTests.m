@@ -10,6 +10,9 @@
 #include "deadbeef.h"
 #include "../../common.h"
 #include "playlist.h"
+#include "pltmeta.h"
+#include "sort.h"
+#include "conf.h"
 
 @interface PlaylistTest : XCTestCase
 
@@ -59,4 +62,186 @@
     plt_unref (plt);
 }
 
+- (void)test_ItemIndexAfterInsertAndRemove_MatchesLinkedList {
+    playlist_t *plt = plt_alloc("test");
+    playItem_t *items[10];
+
+    for (int i = 0; i < 10; i++) {
+        items[i] = pl_item_alloc();
+        plt_insert_item(plt, plt->tail[PL_MAIN], items[i]);
+    }
+
+    XCTAssertEqual(plt_get_item_idx(plt, items[5], PL_MAIN), 5);
+
+    playItem_t *it = pl_item_alloc();
+    plt_insert_item(plt, items[2], it);
+    plt_remove_item(plt, items[0]);
+
+    XCTAssertEqual(plt_get_item_idx(plt, it, PL_MAIN), 2);
+    XCTAssertEqual(plt_get_item_idx(plt, items[5], PL_MAIN), 5);
+    XCTAssertEqual(plt_get_item_idx(plt, items[0], PL_MAIN), -1);
+
+    playItem_t *found = plt_get_item_for_idx(plt, 2, PL_MAIN);
+    XCTAssertTrue(found == it);
+    pl_item_unref(found);
+
+    XCTAssertTrue(plt_get_item_for_idx(plt, 10, PL_MAIN) == NULL);
+
+    for (int i = 0; i < 10; i++) {
+        pl_item_unref(items[i]);
+    }
+    pl_item_unref(it);
+    plt_unref (plt);
+}
+
+- (void)test_SaveAndLoadDBPL_PreservesItemsAndMetadata {
+    playlist_t *plt = plt_alloc("test");
+    playItem_t *it = pl_item_alloc_init("/path/to/file.mp3", "stdmpg");
+    const char values[] = "artist1\0artist2";
+    pl_add_meta_full(it, "artist", values, sizeof(values));
+    pl_add_meta(it, "title", "title");
+    pl_item_set_startsample(it, 0x100000000LL);
+    plt_insert_item(plt, NULL, it);
+    plt_add_meta(plt, "key", "value");
+
+    char path[PATH_MAX];
+    snprintf (path, sizeof (path), "%s/test.dbpl", NSTemporaryDirectory().UTF8String);
+    XCTAssertEqual(plt_save(plt, NULL, NULL, path, NULL, NULL, NULL), 0);
+
+    playlist_t *loaded = plt_alloc("loaded");
+    plt_load(loaded, NULL, path, NULL, NULL, NULL);
+    unlink (path);
+
+    XCTAssertEqual(loaded->count[PL_MAIN], 1);
+    playItem_t *loaded_it = loaded->head[PL_MAIN];
+    XCTAssertTrue(!strcmp(pl_find_meta(loaded_it, ":URI"), "/path/to/file.mp3"));
+    XCTAssertTrue(!strcmp(pl_find_meta(loaded_it, "title"), "title"));
+    DB_metaInfo_t *m = pl_meta_for_key(loaded_it, "artist");
+    XCTAssertEqual(m->valuesize, sizeof(values));
+    XCTAssertTrue(!memcmp(m->value, values, sizeof(values)));
+    XCTAssertEqual(pl_item_get_startsample(loaded_it), 0x100000000LL);
+    XCTAssertTrue(!strcmp(plt_find_meta(loaded, "key"), "value"));
+
+    pl_item_unref(it);
+    plt_unref (plt);
+    plt_unref (loaded);
+}
+
+- (void)test_SortByTitle_NumericAndCaseInsensitiveOrder {
+    playlist_t *plt = plt_alloc("test");
+    const char *titles[] = { "10 b", "2 a", "B", "a", "10 A" };
+    playItem_t *items[5];
+
+    for (int i = 0; i < 5; i++) {
+        items[i] = pl_item_alloc();
+        pl_add_meta(items[i], "title", titles[i]);
+        plt_insert_item(plt, plt->tail[PL_MAIN], items[i]);
+        pl_item_unref(items[i]);
+    }
+
+    plt_sort_v2(plt, PL_MAIN, -1, "%title%", DDB_SORT_ASCENDING);
+
+    const char *expected[] = { "2 a", "10 A", "10 b", "a", "B" };
+    playItem_t *it = plt->head[PL_MAIN];
+    for (int i = 0; i < 5; i++, it = it->next[PL_MAIN]) {
+        XCTAssertTrue(!strcmp(pl_find_meta(it, "title"), expected[i]), @"%d: %s", i, pl_find_meta(it, "title"));
+    }
+
+    plt_unref (plt);
+}
+
+- (void)test_RefineSearch_FiltersPreviousResults {
+    playlist_t *plt = plt_alloc("test");
+    const char *titles[] = { "Value1", "value2", "other" };
+
+    for (int i = 0; i < 3; i++) {
+        playItem_t *it = pl_item_alloc();
+        pl_add_meta(it, "title", titles[i]);
+        plt_insert_item(plt, plt->tail[PL_MAIN], it);
+        pl_item_unref(it);
+    }
+
+    plt_search_process2(plt, "val", 0);
+    XCTAssertEqual(plt->count[PL_SEARCH], 2);
+
+    plt_search_process2(plt, "value2", 0);
+    XCTAssertEqual(plt->count[PL_SEARCH], 1);
+    XCTAssertTrue(!strcmp(pl_find_meta(plt->head[PL_SEARCH], "title"), "value2"));
+
+    plt_unref (plt);
+}
+
+- (void)test_RefineSearchAfterMetadataChange_FindsChangedItem {
+    playlist_t *plt = plt_alloc("test");
+    playItem_t *it1 = pl_item_alloc();
+    playItem_t *it2 = pl_item_alloc();
+    pl_add_meta(it1, "title", "value1");
+    pl_add_meta(it2, "title", "other");
+    plt_insert_item(plt, NULL, it1);
+    plt_insert_item(plt, it1, it2);
+
+    plt_search_process2(plt, "val", 0);
+    XCTAssertEqual(plt->count[PL_SEARCH], 1);
+
+    pl_replace_meta(it2, "title", "VALUE2");
+    plt_search_process2(plt, "value", 0);
+    XCTAssertEqual(plt->count[PL_SEARCH], 2);
+    XCTAssertTrue(plt->tail[PL_SEARCH] == it2);
+
+    pl_item_unref(it1);
+    pl_item_unref(it2);
+    plt_unref (plt);
+}
+
+
+- (void)test_InsertNestedDirWithScanThreads_MatchesSerialOrder {
+    NSFileManager *fm = [NSFileManager defaultManager];
+    NSString *root = [NSTemporaryDirectory() stringByAppendingPathComponent:@"nested_dir_test"];
+    [fm removeItemAtPath:root error:nil];
+
+    char src[PATH_MAX];
+    snprintf (src, sizeof (src), "%s/TestData/chirp-1sec.mp3", dbplugindir);
+    NSString *srcPath = [NSString stringWithUTF8String:src];
+    NSArray<NSString *> *files = @[
+        @"1.mp3",
+        @"a/2.mp3",
+        @"a/b/3.mp3",
+        @"a/b/c/4.mp3",
+        @"a/b/c/5.mp3",
+        @"a/d/6.mp3",
+        @"e/7.mp3",
+        @"e/f/g/8.mp3",
+    ];
+    for (NSString *file in files) {
+        NSString *path = [root stringByAppendingPathComponent:file];
+        [fm createDirectoryAtPath:[path stringByDeletingLastPathComponent] withIntermediateDirectories:YES attributes:nil error:nil];
+        XCTAssertTrue([fm copyItemAtPath:srcPath toPath:path error:nil]);
+    }
+
+    int prev_threads = conf_get_int ("add_folders_threads", 1);
+
+    conf_set_int ("add_folders_threads", 1);
+    playlist_t *serial = plt_alloc("serial");
+    plt_insert_dir2(0, serial, NULL, root.UTF8String, NULL, NULL, NULL);
+
+    conf_set_int ("add_folders_threads", 4);
+    playlist_t *parallel = plt_alloc("parallel");
+    plt_insert_dir2(0, parallel, NULL, root.UTF8String, NULL, NULL, NULL);
+
+    conf_set_int ("add_folders_threads", prev_threads);
+    [fm removeItemAtPath:root error:nil];
+
+    XCTAssertEqual(serial->count[PL_MAIN], (int)files.count);
+    XCTAssertEqual(parallel->count[PL_MAIN], serial->count[PL_MAIN]);
+    playItem_t *s = serial->head[PL_MAIN];
+    playItem_t *p = parallel->head[PL_MAIN];
+    for (; s && p; s = s->next[PL_MAIN], p = p->next[PL_MAIN]) {
+        XCTAssertTrue(!strcmp(pl_find_meta(s, ":URI"), pl_find_meta(p, ":URI")), @"%s != %s", pl_find_meta(s, ":URI"), pl_find_meta(p, ":URI"));
+    }
+    XCTAssertTrue(s == NULL && p == NULL);
+
+    plt_unref (serial);
+    plt_unref (parallel);
+}
+
 @end
@@ -136,6 +136,27 @@ wait_until_stopped (void) {
     }
 }
 
+// waits until fakein has initialized the number of decoders, returns NO on timeout
+static BOOL
+wait_for_inits (int count) {
+    for (int i = 0; i < 5000; i++) {
+        if (fakein_get_num_inits () >= count) {
+            return YES;
+        }
+        usleep (1000);
+    }
+    return NO;
+}
+
+static BOOL
+is_streaming (DB_playItem_t *it) {
+    playItem_t *streaming_track = streamer_get_streaming_track ();
+    if (streaming_track) {
+        pl_item_unref (streaming_track);
+    }
+    return streaming_track == (playItem_t *)it;
+}
+
 @interface StreamerTest : XCTestCase {
     DB_plugin_t *_fakein;
     DB_output_t *_fakeout;
@@ -203,6 +224,118 @@ wait_until_stopped (void) {
     XCTAssert (count_played = 2);
 }
 
+- (void)test_Play2TracksWithPreload_FreesAllDecoders {
+    conf_set_int ("streamer.preload_seconds", 10);
+    streamer_configchanged ();
+
+    playlist_t *plt = plt_alloc ("testplt");
+    DB_playItem_t *_sinewave = deadbeef->plt_insert_file2 (0, (ddb_playlist_t *)plt, NULL, "/sine.fake", NULL, NULL, NULL);
+    deadbeef->plt_insert_file2 (0, (ddb_playlist_t *)plt, _sinewave, "/square.fake", NULL, NULL, NULL);
+
+    plt_set_curr (plt);
+
+    // slow down streaming, to see the second track opened while the first one is streaming
+    fakein_set_sleep (1000);
+    streamer_set_nextsong (0, 0);
+    streamer_yield ();
+
+    XCTAssert (wait_for_inits (2));
+    XCTAssert (is_streaming (_sinewave));
+    fakein_set_sleep (0);
+
+    wait_until_stopped ();
+
+    plt_set_curr (NULL);
+    deadbeef->plt_unref ((ddb_playlist_t *)plt);
+
+    conf_remove_items ("streamer.preload_seconds");
+    streamer_configchanged ();
+
+    XCTAssert (count_played == 2);
+    // the preloaded decoder was used, instead of opening the second track again
+    XCTAssertEqual (fakein_get_num_inits (), 2);
+    XCTAssertEqual (fakein_get_num_unread_freed (), 0);
+    XCTAssert (fakein_get_num_instances () == 0);
+}
+
+- (void)test_PreloadThenQueueAnotherTrack_DiscardsPreloaded {
+    conf_set_int ("streamer.preload_seconds", 10);
+    streamer_configchanged ();
+
+    playlist_t *plt = plt_alloc ("testplt");
+    DB_playItem_t *_sinewave = deadbeef->plt_insert_file2 (0, (ddb_playlist_t *)plt, NULL, "/sine.fake", NULL, NULL, NULL);
+    DB_playItem_t *_squarewave = deadbeef->plt_insert_file2 (0, (ddb_playlist_t *)plt, _sinewave, "/square.fake", NULL, NULL, NULL);
+    DB_playItem_t *_queued = deadbeef->plt_insert_file2 (0, (ddb_playlist_t *)plt, _squarewave, "/queued.fake", NULL, NULL, NULL);
+
+    plt_set_curr (plt);
+
+    fakein_set_sleep (1000);
+    streamer_set_nextsong (0, 0);
+    streamer_yield ();
+
+    // the square wave is preloaded, then replaced by the queued track
+    XCTAssert (wait_for_inits (2));
+    XCTAssert (is_streaming (_sinewave));
+    deadbeef->playqueue_push (_queued);
+    XCTAssert (wait_for_inits (3));
+    XCTAssert (is_streaming (_sinewave));
+    XCTAssertEqual (fakein_get_num_unread_freed (), 1);
+    fakein_set_sleep (0);
+
+    wait_until_stopped ();
+
+    plt_set_curr (NULL);
+    deadbeef->plt_unref ((ddb_playlist_t *)plt);
+
+    conf_remove_items ("streamer.preload_seconds");
+    streamer_configchanged ();
+
+    // the queued track is the last one in the playlist, so the square wave is never played
+    XCTAssert (count_played == 2);
+    XCTAssertEqual (fakein_get_num_inits (), 3);
+    XCTAssertEqual (fakein_get_num_unread_freed (), 1);
+    XCTAssert (fakein_get_num_instances () == 0);
+}
+
+- (void)test_PreloadThenInsertNextTrack_DiscardsPreloaded {
+    conf_set_int ("streamer.preload_seconds", 10);
+    streamer_configchanged ();
+
+    playlist_t *plt = plt_alloc ("testplt");
+    DB_playItem_t *_sinewave = deadbeef->plt_insert_file2 (0, (ddb_playlist_t *)plt, NULL, "/sine.fake", NULL, NULL, NULL);
+    deadbeef->plt_insert_file2 (0, (ddb_playlist_t *)plt, _sinewave, "/square.fake", NULL, NULL, NULL);
+
+    plt_set_curr (plt);
+
+    fakein_set_sleep (1000);
+    streamer_set_nextsong (0, 0);
+    streamer_yield ();
+
+    // the square wave is preloaded, then replaced by the inserted track
+    XCTAssert (wait_for_inits (2));
+    XCTAssert (is_streaming (_sinewave));
+    deadbeef->plt_insert_file2 (0, (ddb_playlist_t *)plt, _sinewave, "/inserted.fake", NULL, NULL, NULL);
+    plt_modified (plt);
+    XCTAssert (wait_for_inits (3));
+    XCTAssert (is_streaming (_sinewave));
+    XCTAssertEqual (fakein_get_num_unread_freed (), 1);
+    fakein_set_sleep (0);
+
+    wait_until_stopped ();
+
+    plt_set_curr (NULL);
+    deadbeef->plt_unref ((ddb_playlist_t *)plt);
+
+    conf_remove_items ("streamer.preload_seconds");
+    streamer_configchanged ();
+
+    // the square wave is opened again after the inserted track
+    XCTAssert (count_played == 3);
+    XCTAssertEqual (fakein_get_num_inits (), 4);
+    XCTAssertEqual (fakein_get_num_unread_freed (), 1);
+    XCTAssert (fakein_get_num_instances () == 0);
+}
+
 // This test is a complicated
 // Given two tracks A and B
 // Start track A
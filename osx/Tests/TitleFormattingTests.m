@@ -2318,4 +2318,66 @@ static DB_output_t fake_out = {
     XCTAssert(!strcmp (buffer, "\t   hello  \t"), @"The actual output is: %s", buffer);
 }
 
+- (void)test_CachedResult_MetadataChanged_ReturnsNewValue {
+    pl_replace_meta (it, "title", "Title1");
+    char *bc = tf_compile("%title%");
+    tf_eval (&ctx, bc, buffer, sizeof (buffer));
+    XCTAssert(!strcmp (buffer, "Title1"), @"The actual output is: %s", buffer);
+    pl_replace_meta (it, "title", "Title2");
+    tf_eval (&ctx, bc, buffer, sizeof (buffer));
+    tf_free (bc);
+    XCTAssert(!strcmp (buffer, "Title2"), @"The actual output is: %s", buffer);
+}
+
+- (void)test_EvalPlaylist_TwoTracks_ReturnsResultForEachTrack {
+    playlist_t *plt = plt_alloc ("test");
+    playItem_t *it2 = pl_item_alloc_init ("testfile2.flac", "stdflac");
+    pl_replace_meta (it, "title", "Title1");
+    pl_replace_meta (it2, "title", "Title2");
+    plt_insert_item (plt, NULL, it);
+    plt_insert_item (plt, it, it2);
+
+    ctx.plt = (ddb_playlist_t *)plt;
+    ctx.iter = PL_MAIN;
+    char *bc = tf_compile("%title%");
+    char **out = NULL;
+    int count = tf_eval_playlist (&ctx, bc, sizeof (buffer), &out);
+    tf_free (bc);
+
+    XCTAssertEqual (count, 2);
+    XCTAssert(out != NULL);
+    XCTAssert(out[0] && !strcmp (out[0], "Title1"), @"The actual output is: %s", out[0]);
+    XCTAssert(out[1] && !strcmp (out[1], "Title2"), @"The actual output is: %s", out[1]);
+    XCTAssert(ctx.it == (ddb_playItem_t *)it);
+
+    for (int i = 0; i < count; i++) {
+        free (out[i]);
+    }
+    free (out);
+    pl_item_unref (it2);
+    plt_free (plt);
+}
+
+- (void)test_CachedResult_VolatileField_ReturnsNewValue {
+    playlist_t *plt = plt_alloc ("test");
+    playItem_t *it2 = pl_item_alloc_init ("testfile2.flac", "stdflac");
+    pl_replace_meta (it, "title", "Title1");
+    plt_insert_item (plt, NULL, it);
+
+    ctx.plt = (ddb_playlist_t *)plt;
+    ctx.iter = PL_MAIN;
+    char *bc = tf_compile("%title% %list_total%");
+    tf_eval (&ctx, bc, buffer, sizeof (buffer));
+    XCTAssert(!strcmp (buffer, "Title1 1"), @"The actual output is: %s", buffer);
+
+    // neither the track nor its metadata change, only the playlist
+    plt_insert_item (plt, it, it2);
+    tf_eval (&ctx, bc, buffer, sizeof (buffer));
+    tf_free (bc);
+    XCTAssert(!strcmp (buffer, "Title1 2"), @"The actual output is: %s", buffer);
+
+    pl_item_unref (it2);
+    plt_free (plt);
+}
+
 @end
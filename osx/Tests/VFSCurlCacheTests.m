@@ -0,0 +1,557 @@
+/*
+    DeaDBeeF -- the music player
+    Copyright (C) 2009-2018 Alexey Yakovenko and other contributors
+
+    This software is provided 'as-is', without any express or implied
+    warranty.  In no event will the authors be held liable for any damages
+    arising from the use of this software.
+
+    Permission is granted to anyone to use this software for any purpose,
+    including commercial applications, and to alter it and redistribute it
+    freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source distribution.
+*/
+
+#import <XCTest/XCTest.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include "conf.h"
+#include "vfs.h"
+#include "threading.h"
+#include "../../common.h"
+#include "../../plugins/vfs_curl/vfs_curl_cache.h"
+
+#define TEST_FILE_SIZE 1000000
+
+// Minimal HTTP server, which supports Range and If-Range, to test the vfs_curl disk cache
+typedef struct {
+    int fd;
+    int port;
+    intptr_t tid;
+    int terminate;
+    int connections; // number of running connection threads
+    uintptr_t mutex;
+
+    // protected by mutex
+    char etag[32];
+    int seed; // the content changes together with etag
+    int ignore_range;
+    int requests;
+    int range_requests;
+    int if_range_requests;
+    int full_responses;
+} test_server_t;
+
+static test_server_t server;
+
+static uint8_t
+test_byte (int seed, int64_t pos) {
+    return (uint8_t)((pos * 7 + seed) % 251);
+}
+
+static int
+send_all (int fd, const void *data, size_t size) {
+    const char *p = data;
+    while (size > 0) {
+        ssize_t res = send (fd, p, size, 0);
+        if (res <= 0) {
+            return -1;
+        }
+        p += res;
+        size -= res;
+    }
+    return 0;
+}
+
+// Returns the value of the header, or NULL
+static const char *
+find_header (const char *request, const char *name, char *value, size_t size) {
+    const char *line = strstr (request, "\r\n");
+    while (line && line[2] != '\r') {
+        line += 2;
+        const char *end = strstr (line, "\r\n");
+        size_t namelen = strlen (name);
+        if (!strncasecmp (line, name, namelen) && line[namelen] == ':') {
+            const char *v = line + namelen + 1;
+            while (*v == ' ') {
+                v++;
+            }
+            snprintf (value, size, "%.*s", (int)(end - v), v);
+            return value;
+        }
+        line = end;
+    }
+    return NULL;
+}
+
+static void
+server_connection (void *ctx) {
+    int fd = (int)(intptr_t)ctx;
+    char request[4096];
+    size_t len = 0;
+    while (len < sizeof (request) - 1) {
+        ssize_t res = recv (fd, request + len, sizeof (request) - 1 - len, 0);
+        if (res <= 0) {
+            break;
+        }
+        len += res;
+        request[len] = 0;
+        if (strstr (request, "\r\n\r\n")) {
+            break;
+        }
+    }
+    request[len] = 0;
+
+    char range[100];
+    char if_range[100];
+    int have_range = find_header (request, "Range", range, sizeof (range)) != NULL;
+    int have_if_range = find_header (request, "If-Range", if_range, sizeof (if_range)) != NULL;
+
+    mutex_lock (server.mutex);
+    char etag[32];
+    strcpy (etag, server.etag);
+    int seed = server.seed;
+    int partial = have_range && !server.ignore_range && (!have_if_range || !strcmp (if_range, etag));
+    server.requests++;
+    server.range_requests += have_range;
+    server.if_range_requests += have_if_range;
+    server.full_responses += !partial;
+    mutex_unlock (server.mutex);
+
+    int64_t start = 0;
+    int64_t end = TEST_FILE_SIZE - 1;
+    if (partial) {
+        long long a = 0, b = -1;
+        if (sscanf (range, "bytes=%lld-%lld", &a, &b) < 1) {
+            a = 0;
+        }
+        start = a;
+        if (b >= a && b < end) {
+            end = b;
+        }
+    }
+
+    char header[500];
+    if (partial && start >= TEST_FILE_SIZE) {
+        snprintf (header, sizeof (header), "HTTP/1.1 416 Range Not Satisfiable\r\nContent-Range: bytes */%d\r\nContent-Length: 0\r\nConnection: close\r\n\r\n", TEST_FILE_SIZE);
+        send_all (fd, header, strlen (header));
+    }
+    else {
+        if (partial) {
+            snprintf (header, sizeof (header), "HTTP/1.1 206 Partial Content\r\nContent-Range: bytes %lld-%lld/%d\r\n", (long long)start, (long long)end, TEST_FILE_SIZE);
+        }
+        else {
+            snprintf (header, sizeof (header), "HTTP/1.1 200 OK\r\n");
+        }
+        snprintf (header + strlen (header), sizeof (header) - strlen (header), "Content-Length: %lld\r\nETag: %s\r\nContent-Type: audio/mpeg\r\nConnection: close\r\n\r\n", (long long)(end - start + 1), etag);
+        if (!send_all (fd, header, strlen (header))) {
+            uint8_t chunk[0x10000];
+            for (int64_t pos = start; pos <= end; ) {
+                size_t n = (size_t)MIN ((int64_t)sizeof (chunk), end - pos + 1);
+                for (size_t i = 0; i < n; i++) {
+                    chunk[i] = test_byte (seed, pos + i);
+                }
+                if (send_all (fd, chunk, n)) {
+                    break;
+                }
+                pos += n;
+                // slow enough for the reader to catch up with the download
+                usleep (2000);
+            }
+        }
+    }
+    close (fd);
+    __atomic_sub_fetch (&server.connections, 1, __ATOMIC_SEQ_CST);
+}
+
+static void
+server_thread (void *ctx) {
+    while (!__atomic_load_n (&server.terminate, __ATOMIC_SEQ_CST)) {
+        struct pollfd pfd = { .fd = server.fd, .events = POLLIN };
+        if (poll (&pfd, 1, 50) <= 0) {
+            continue;
+        }
+        int fd = accept (server.fd, NULL, NULL);
+        if (fd < 0) {
+            continue;
+        }
+        __atomic_add_fetch (&server.connections, 1, __ATOMIC_SEQ_CST);
+        intptr_t tid = thread_start (server_connection, (void *)(intptr_t)fd);
+        thread_detach (tid);
+    }
+}
+
+static int
+server_start (void) {
+    memset (&server, 0, sizeof (server));
+    server.mutex = mutex_create ();
+    strcpy (server.etag, "\"v1\"");
+    server.seed = 1;
+
+    server.fd = socket (AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr = {0};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+    socklen_t addrlen = sizeof (addr);
+    if (bind (server.fd, (struct sockaddr *)&addr, addrlen) || listen (server.fd, 16) || getsockname (server.fd, (struct sockaddr *)&addr, &addrlen)) {
+        close (server.fd);
+        return -1;
+    }
+    server.port = ntohs (addr.sin_port);
+    server.tid = thread_start (server_thread, NULL);
+    return 0;
+}
+
+static void
+server_stop (void) {
+    __atomic_store_n (&server.terminate, 1, __ATOMIC_SEQ_CST);
+    thread_join (server.tid);
+    while (__atomic_load_n (&server.connections, __ATOMIC_SEQ_CST) > 0) {
+        usleep (1000);
+    }
+    close (server.fd);
+    mutex_free (server.mutex);
+}
+
+// Waits until the requests of the closed streams are processed
+static void
+server_wait_idle (void) {
+    usleep (100000);
+    while (__atomic_load_n (&server.connections, __ATOMIC_SEQ_CST) > 0) {
+        usleep (1000);
+    }
+}
+
+static void
+server_reset_counters (void) {
+    mutex_lock (server.mutex);
+    server.requests = 0;
+    server.range_requests = 0;
+    server.if_range_requests = 0;
+    server.full_responses = 0;
+    mutex_unlock (server.mutex);
+}
+
+// Reads size bytes at pos, and compares them with the expected content
+static int
+read_and_check (DB_FILE *fp, int seed, int64_t pos, size_t size) {
+    uint8_t *buffer = malloc (size);
+    size_t rd = vfs_fread (buffer, 1, size, fp);
+    int res = rd == size;
+    for (size_t i = 0; i < rd && res; i++) {
+        res = buffer[i] == test_byte (seed, pos + i);
+    }
+    free (buffer);
+    return res;
+}
+
+static int
+read_head_and_tail (const char *url, int seed) {
+    DB_FILE *fp = vfs_fopen (url);
+    if (!fp) {
+        return 0;
+    }
+    int res = read_and_check (fp, seed, 0, 4096)
+        && !vfs_fseek (fp, -4096, SEEK_END)
+        && read_and_check (fp, seed, TEST_FILE_SIZE - 4096, 4096);
+    vfs_fclose (fp);
+    return res;
+}
+
+@interface VFSCurlCacheTests : XCTestCase {
+    char _cachedir[PATH_MAX];
+    char _prev_cachedir[PATH_MAX];
+}
+
+@end
+
+@implementation VFSCurlCacheTests
+
+- (void)setUp {
+    [super setUp];
+    signal (SIGPIPE, SIG_IGN);
+
+    snprintf (_cachedir, sizeof (_cachedir), "%s/vfs_curl_cache_test_%d", NSTemporaryDirectory().UTF8String, (int)getpid ());
+    strcpy (_prev_cachedir, dbcachedir);
+    strcpy (dbcachedir, _cachedir);
+    conf_set_int ("vfs_curl.cache", 1);
+
+    XCTAssertEqual (server_start (), 0);
+}
+
+- (void)tearDown {
+    server_stop ();
+
+    conf_set_int ("vfs_curl.cache", 0);
+    strcpy (dbcachedir, _prev_cachedir);
+    [[NSFileManager defaultManager] removeItemAtPath:[NSString stringWithUTF8String:_cachedir] error:nil];
+    [super tearDown];
+}
+
+- (void)test_AddRange_MergesOverlappingAndAdjacentRanges {
+    vfs_curl_cache_t cache = {0};
+    cache.length = 1000;
+
+    vfs_curl_cache_add_range (&cache, 500, 600);
+    vfs_curl_cache_add_range (&cache, 100, 200);
+    vfs_curl_cache_add_range (&cache, 800, 900);
+    XCTAssertEqual (cache.nranges, 3);
+    XCTAssertEqual (cache.ranges[0].start, 100);
+    XCTAssertEqual (cache.ranges[1].start, 500);
+    XCTAssertEqual (cache.ranges[2].start, 800);
+
+    // adjacent
+    vfs_curl_cache_add_range (&cache, 200, 250);
+    XCTAssertEqual (cache.nranges, 3);
+    XCTAssertEqual (cache.ranges[0].end, 250);
+
+    // overlaps two ranges
+    vfs_curl_cache_add_range (&cache, 550, 850);
+    XCTAssertEqual (cache.nranges, 2);
+    XCTAssertEqual (cache.ranges[1].start, 500);
+    XCTAssertEqual (cache.ranges[1].end, 900);
+
+    // empty range is ignored
+    vfs_curl_cache_add_range (&cache, 300, 300);
+    XCTAssertEqual (cache.nranges, 2);
+
+    // covers everything
+    vfs_curl_cache_add_range (&cache, 0, 1000);
+    XCTAssertEqual (cache.nranges, 1);
+    XCTAssertEqual (cache.ranges[0].start, 0);
+    XCTAssertEqual (cache.ranges[0].end, 1000);
+
+    free (cache.ranges);
+}
+
+- (void)test_FindGap_ReturnsFirstMissingRangeAfterPos {
+    vfs_curl_cache_t cache = {0};
+    cache.length = 1000;
+    vfs_curl_cache_add_range (&cache, 0, 100);
+    vfs_curl_cache_add_range (&cache, 300, 400);
+
+    int64_t start, end;
+    XCTAssertEqual (vfs_curl_cache_find_gap (&cache, 0, &start, &end), 0);
+    XCTAssertEqual (start, 100);
+    XCTAssertEqual (end, 300);
+
+    XCTAssertEqual (vfs_curl_cache_find_gap (&cache, 150, &start, &end), 0);
+    XCTAssertEqual (start, 150);
+    XCTAssertEqual (end, 300);
+
+    XCTAssertEqual (vfs_curl_cache_find_gap (&cache, 350, &start, &end), 0);
+    XCTAssertEqual (start, 400);
+    XCTAssertEqual (end, 1000);
+
+    XCTAssertEqual (vfs_curl_cache_find_gap (&cache, 1000, &start, &end), -1);
+
+    vfs_curl_cache_add_range (&cache, 400, 1000);
+    XCTAssertEqual (vfs_curl_cache_find_gap (&cache, 350, &start, &end), -1);
+    XCTAssertEqual (vfs_curl_cache_find_gap (&cache, 0, &start, &end), 0);
+    XCTAssertFalse (vfs_curl_cache_is_complete (&cache));
+
+    vfs_curl_cache_add_range (&cache, 100, 300);
+    XCTAssertTrue (vfs_curl_cache_is_complete (&cache));
+
+    free (cache.ranges);
+}
+
+- (void)test_SaveAndLoadIndex_RestoresRangesAndValidators {
+    const char *url = "http://example.com/file.mp3";
+    vfs_curl_cache_t *cache = vfs_curl_cache_open (_cachedir, url);
+    XCTAssert (cache != NULL);
+    XCTAssertEqual (cache->nranges, 0);
+
+    vfs_curl_cache_reset (cache, 1000, "\"etag\"", "Mon, 01 Jan 2018 00:00:00 GMT");
+    uint8_t data[100];
+    memset (data, 0x55, sizeof (data));
+    XCTAssertEqual (vfs_curl_cache_write (cache, 0, data, sizeof (data)), 0);
+    XCTAssertEqual (vfs_curl_cache_write (cache, 900, data, sizeof (data)), 0);
+    XCTAssertEqual (vfs_curl_cache_write (cache, 950, data, sizeof (data)), -1); // past the end
+    vfs_curl_cache_close (cache, INT64_MAX);
+
+    cache = vfs_curl_cache_open (_cachedir, url);
+    XCTAssert (cache != NULL);
+    XCTAssertEqual (cache->length, 1000);
+    XCTAssertTrue (!strcmp (cache->etag, "\"etag\""));
+    XCTAssertTrue (!strcmp (cache->last_modified, "Mon, 01 Jan 2018 00:00:00 GMT"));
+    XCTAssertEqual (cache->nranges, 2);
+    XCTAssertEqual (vfs_curl_cache_avail (cache, 0), 100);
+    XCTAssertEqual (vfs_curl_cache_avail (cache, 950), 50);
+    XCTAssertEqual (vfs_curl_cache_avail (cache, 500), 0);
+
+    uint8_t buffer[100];
+    XCTAssertEqual (vfs_curl_cache_read (cache, 900, buffer, sizeof (buffer)), sizeof (buffer));
+    XCTAssertTrue (!memcmp (buffer, data, sizeof (data)));
+    vfs_curl_cache_close (cache, INT64_MAX);
+
+    // a different url doesn't get the index
+    cache = vfs_curl_cache_open (_cachedir, "http://example.com/other.mp3");
+    XCTAssertEqual (cache->nranges, 0);
+    XCTAssertEqual (cache->length, -1);
+    vfs_curl_cache_close (cache, INT64_MAX);
+}
+
+- (void)test_OpenTwice_SecondHandleDoesNotGetEntry {
+    const char *url = "http://example.com/file.mp3";
+    vfs_curl_cache_t *cache = vfs_curl_cache_open (_cachedir, url);
+    XCTAssert (cache != NULL);
+    vfs_curl_cache_reset (cache, 1000, "\"etag\"", NULL);
+    uint8_t data[100];
+    memset (data, 0x55, sizeof (data));
+    XCTAssertEqual (vfs_curl_cache_write (cache, 0, data, sizeof (data)), 0);
+
+    // the entry is in use
+    XCTAssert (vfs_curl_cache_open (_cachedir, url) == NULL);
+
+    vfs_curl_cache_close (cache, INT64_MAX);
+    cache = vfs_curl_cache_open (_cachedir, url);
+    XCTAssert (cache != NULL);
+    XCTAssertEqual (vfs_curl_cache_avail (cache, 0), 100);
+    vfs_curl_cache_close (cache, INT64_MAX);
+}
+
+- (void)test_Evict_OpenEntry_NotEvicted {
+    uint8_t data[100];
+    memset (data, 0x55, sizeof (data));
+
+    vfs_curl_cache_t *closed = vfs_curl_cache_open (_cachedir, "http://example.com/closed.mp3");
+    vfs_curl_cache_reset (closed, 1000, "\"etag\"", NULL);
+    XCTAssertEqual (vfs_curl_cache_write (closed, 0, data, sizeof (data)), 0);
+    vfs_curl_cache_close (closed, INT64_MAX);
+
+    vfs_curl_cache_t *in_use = vfs_curl_cache_open (_cachedir, "http://example.com/open.mp3");
+    vfs_curl_cache_reset (in_use, 1000, "\"etag\"", NULL);
+    XCTAssertEqual (vfs_curl_cache_write (in_use, 0, data, sizeof (data)), 0);
+    vfs_curl_cache_close (in_use, INT64_MAX);
+    in_use = vfs_curl_cache_open (_cachedir, "http://example.com/open.mp3");
+
+    // evicts everything, except the entries in use
+    vfs_curl_cache_t *other = vfs_curl_cache_open (_cachedir, "http://example.com/other.mp3");
+    vfs_curl_cache_close (other, 0);
+
+    vfs_curl_cache_close (in_use, INT64_MAX);
+    in_use = vfs_curl_cache_open (_cachedir, "http://example.com/open.mp3");
+    XCTAssertEqual (vfs_curl_cache_avail (in_use, 0), 100);
+    vfs_curl_cache_close (in_use, INT64_MAX);
+
+    closed = vfs_curl_cache_open (_cachedir, "http://example.com/closed.mp3");
+    XCTAssertEqual (closed->nranges, 0);
+    vfs_curl_cache_close (closed, INT64_MAX);
+}
+
+- (void)test_HeadAndTailRead_ReplayValidatedWithIfRange {
+    char url[100];
+    snprintf (url, sizeof (url), "http://127.0.0.1:%d/file.mp3", server.port);
+
+    XCTAssertTrue (read_head_and_tail (url, 1));
+    server_wait_idle ();
+    XCTAssertGreaterThan (server.requests, 0);
+
+    // the second time everything needed is in the cache, the requests only validate it
+    server_reset_counters ();
+    XCTAssertTrue (read_head_and_tail (url, 1));
+    server_wait_idle ();
+    XCTAssertGreaterThan (server.requests, 0);
+    XCTAssertEqual (server.if_range_requests, server.requests);
+    XCTAssertEqual (server.full_responses, 0);
+}
+
+- (void)test_ChangedETag_CachedDataIsReplaced {
+    char url[100];
+    snprintf (url, sizeof (url), "http://127.0.0.1:%d/file.mp3", server.port);
+
+    XCTAssertTrue (read_head_and_tail (url, 1));
+    server_wait_idle ();
+
+    mutex_lock (server.mutex);
+    strcpy (server.etag, "\"v2\"");
+    server.seed = 2;
+    mutex_unlock (server.mutex);
+
+    server_reset_counters ();
+    XCTAssertTrue (read_head_and_tail (url, 2));
+    server_wait_idle ();
+    XCTAssertGreaterThan (server.full_responses, 0);
+}
+
+- (void)test_TwoHandles_ChangedETag_CachedDataOfFirstHandleUnchanged {
+    char url[100];
+    snprintf (url, sizeof (url), "http://127.0.0.1:%d/file.mp3", server.port);
+
+    DB_FILE *fp = vfs_fopen (url);
+    XCTAssert (fp != NULL);
+    XCTAssertTrue (read_and_check (fp, 1, 0, 4096));
+
+    mutex_lock (server.mutex);
+    strcpy (server.etag, "\"v2\"");
+    server.seed = 2;
+    mutex_unlock (server.mutex);
+
+    // the second handle reads the new version without the cache
+    DB_FILE *fp2 = vfs_fopen (url);
+    XCTAssert (fp2 != NULL);
+    XCTAssertTrue (read_and_check (fp2, 2, 0, 4096));
+    XCTAssertEqual (vfs_fseek (fp2, TEST_FILE_SIZE - 4096, SEEK_SET), 0);
+    XCTAssertTrue (read_and_check (fp2, 2, TEST_FILE_SIZE - 4096, 4096));
+    vfs_fclose (fp2);
+
+    // the data cached by the first handle was not replaced
+    XCTAssertEqual (vfs_fseek (fp, 0, SEEK_SET), 0);
+    XCTAssertTrue (read_and_check (fp, 1, 0, 4096));
+    vfs_fclose (fp);
+    server_wait_idle ();
+
+    // the old version in the cache is replaced after reopening
+    server_reset_counters ();
+    XCTAssertTrue (read_head_and_tail (url, 2));
+    server_wait_idle ();
+    XCTAssertGreaterThan (server.full_responses, 0);
+}
+
+- (void)test_ServerIgnoresRange_ReadsWithoutRestartingDownload {
+    char url[100];
+    snprintf (url, sizeof (url), "http://127.0.0.1:%d/norange.mp3", server.port);
+
+    // cache the head, while ranges are still supported
+    DB_FILE *fp = vfs_fopen (url);
+    XCTAssert (fp != NULL);
+    XCTAssertTrue (read_and_check (fp, 1, 0, 4096));
+    vfs_fclose (fp);
+    server_wait_idle ();
+
+    mutex_lock (server.mutex);
+    server.ignore_range = 1;
+    mutex_unlock (server.mutex);
+    server_reset_counters ();
+
+    fp = vfs_fopen (url);
+    XCTAssert (fp != NULL);
+    XCTAssertTrue (read_and_check (fp, 1, 0, 4096));
+    XCTAssertEqual (vfs_fseek (fp, TEST_FILE_SIZE/2, SEEK_SET), 0);
+    XCTAssertTrue (read_and_check (fp, 1, TEST_FILE_SIZE/2, 4096));
+    XCTAssertEqual (vfs_fseek (fp, -4096, SEEK_END), 0);
+    XCTAssertTrue (read_and_check (fp, 1, TEST_FILE_SIZE - 4096, 4096));
+    XCTAssertEqual (vfs_fseek (fp, 100000, SEEK_SET), 0);
+    XCTAssertTrue (read_and_check (fp, 1, 100000, 4096));
+    vfs_fclose (fp);
+    server_wait_idle ();
+
+    // every range request gets the whole file, it must be downloaded once
+    XCTAssertEqual (server.full_responses, 1);
+}
+
+@end
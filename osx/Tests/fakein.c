@@ -31,6 +31,10 @@
 
 #define FAKEIN_NUMSAMPLES 44100 * 5 // 5 sec
 static int _sleep;
+static int _num_instances;
+static int _num_inits;
+static int _num_unread_freed;
+static int _num_inserts;
 
 static DB_decoder_t plugin;
 static DB_functions_t *deadbeef;
@@ -51,6 +55,7 @@ fakein_open (uint32_t hints) {
     DB_fileinfo_t *_info = malloc (sizeof (fakein_info_t));
     fakein_info_t *info = (fakein_info_t *)_info;
     memset (info, 0, sizeof (fakein_info_t));
+    __atomic_add_fetch (&_num_instances, 1, __ATOMIC_SEQ_CST);
     return _info;
 }
 
@@ -72,6 +77,7 @@ fakein_init (DB_fileinfo_t *_info, DB_playItem_t *it) {
     info->endsample = FAKEIN_NUMSAMPLES - 1;
 
     info->samples = calloc (FAKEIN_NUMSAMPLES,  2 * sizeof (float));
+    __atomic_add_fetch (&_num_inits, 1, __ATOMIC_SEQ_CST);
 
     const char *type = deadbeef->pl_find_meta (it, "title");
     if (!strcmp (type, "sine")) {
@@ -99,8 +105,12 @@ fakein_free (DB_fileinfo_t *_info) {
     if (info) {
         if (info->samples) {
             free (info->samples);
+            if (!info->currentsample) {
+                __atomic_add_fetch (&_num_unread_freed, 1, __ATOMIC_SEQ_CST);
+            }
         }
         free (info);
+        __atomic_sub_fetch (&_num_instances, 1, __ATOMIC_SEQ_CST);
     }
 }
 
@@ -125,6 +135,7 @@ fakein_read (DB_fileinfo_t *_info, char *bytes, int size) {
     memcpy (bytes, info->samples + info->currentsample * 2, size);
 
     info->currentsample += nblocks;
+    _info->readpos = (float)(info->currentsample - info->startsample) / _info->fmt.samplerate;
     return size;
 }
 
@@ -145,12 +156,13 @@ fakein_seek (DB_fileinfo_t *_info, float time) {
 static DB_playItem_t *
 fakein_insert (ddb_playlist_t *plt, DB_playItem_t *after, const char *fname) {
     const char *ft = "fake";
+    __atomic_add_fetch (&_num_inserts, 1, __ATOMIC_SEQ_CST);
 
     // no cuesheet, prepare track for addition
     DB_playItem_t *it = deadbeef->pl_item_alloc_init (fname, plugin.plugin.id);
 
     deadbeef->pl_replace_meta (it, ":FILETYPE", ft);
-    deadbeef->plt_set_item_duration (plt, it, FAKEIN_NUMSAMPLES);
+    deadbeef->plt_set_item_duration (plt, it, (float)FAKEIN_NUMSAMPLES / 44100);
 
     char title[100];
     strcpy (title, fname);
@@ -184,6 +196,9 @@ static DB_decoder_t plugin = {
 DB_plugin_t *
 fakein_load (DB_functions_t *api) {
     deadbeef = api;
+    _num_inits = 0;
+    _num_unread_freed = 0;
+    _num_inserts = 0;
     return DB_PLUGIN (&plugin);
 }
 
@@ -191,3 +206,23 @@ void
 fakein_set_sleep (int sleep) {
     _sleep = sleep;
 }
+
+int
+fakein_get_num_instances (void) {
+    return __atomic_load_n (&_num_instances, __ATOMIC_SEQ_CST);
+}
+
+int
+fakein_get_num_inits (void) {
+    return __atomic_load_n (&_num_inits, __ATOMIC_SEQ_CST);
+}
+
+int
+fakein_get_num_unread_freed (void) {
+    return __atomic_load_n (&_num_unread_freed, __ATOMIC_SEQ_CST);
+}
+
+int
+fakein_get_num_inserts (void) {
+    return __atomic_load_n (&_num_inserts, __ATOMIC_SEQ_CST);
+}
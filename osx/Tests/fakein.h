@@ -28,4 +28,20 @@
 void
 fakein_set_sleep (int sleep);
 
+// number of currently open fileinfos
+int
+fakein_get_num_instances (void);
+
+// number of successfully initialized fileinfos, since the plugin was loaded
+int
+fakein_get_num_inits (void);
+
+// number of initialized fileinfos which were freed without reading anything, e.g. discarded preloads
+int
+fakein_get_num_unread_freed (void);
+
+// number of files added to playlists, since the plugin was loaded
+int
+fakein_get_num_inserts (void);
+
 #endif /* fakein_h */
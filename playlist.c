@@ -42,6 +42,10 @@
 #include <assert.h>
 #include <time.h>
 #include <sys/time.h>
+#include <fcntl.h>
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
 #ifndef __linux__
 #define _POSIX_C_SOURCE 1
 #endif
@@ -92,15 +96,224 @@
 //    removed legacy data used for compat with 0.4.4
 //    note: ddb-0.5.0 should keep using 1.2 playlist format
 //    1.3 support is designed for transition to ddb-0.6.0
+// 1.3->1.4 changelog:
+//    replaced per-field records with a string table and fixed-width track records,
+//    which are memory-mapped and interned in bulk on load (see dbpl_header_t)
 #define PLAYLIST_MAJOR_VER 1
-#define PLAYLIST_MINOR_VER 2
+#define PLAYLIST_MINOR_VER 4
 
-#if (PLAYLIST_MINOR_VER<2)
-#error writing playlists in format <1.2 is not supported
+#if (PLAYLIST_MINOR_VER<4)
+#error writing playlists in format <1.4 is not supported
 #endif
 
 #define min(x,y) ((x)<(y)?(x):(y))
 
+// DBPL 1.4 layout. All values are in native byte order, all sections are 8-byte aligned,
+// so that the whole file can be mapped and used in place:
+//   "DBPL", uint8 majorver, uint8 minorver, uint16 reserved
+//   dbpl_header_t
+//   dbpl_track_t tracks[track_count]
+//   dbpl_meta_t meta[meta_count] -- each track references a contiguous range
+//   dbpl_meta_t plt_meta[plt_meta_count]
+//   dbpl_string_t strings[string_count]
+//   char strtab[strtab_size] -- every string (or multivalue) is NULL-terminated
+typedef struct {
+    uint32_t track_count;
+    uint32_t meta_count;
+    uint32_t plt_meta_count;
+    uint32_t string_count;
+    uint32_t strtab_size;
+    uint32_t reserved;
+} dbpl_header_t;
+
+#define DBPL_TRACK_HAS_STARTSAMPLE64 1
+#define DBPL_TRACK_HAS_ENDSAMPLE64 2
+
+typedef struct {
+    int64_t startsample;
+    int64_t endsample;
+    float duration;
+    uint32_t flags;
+    uint32_t meta_first;
+    uint16_t meta_count;
+    uint16_t track_flags;
+} dbpl_track_t;
+
+typedef struct {
+    uint32_t key; // index in strings
+    uint32_t value; // index in strings
+} dbpl_meta_t;
+
+typedef struct {
+    uint32_t offset; // offset in strtab
+    uint32_t size; // including the terminating NULL
+} dbpl_string_t;
+
+// String table builder. Metadata strings are interned in the metacache,
+// so equal strings are deduplicated by pointer.
+typedef struct {
+    const char **slots; // open-addressed pointer set, power of 2 size
+    uint32_t *slot_ids;
+    size_t size;
+    const char **values; // unique strings by id
+    dbpl_string_t *strings;
+    uint32_t count;
+    uint32_t alloc;
+    uint32_t strtab_size;
+} dbpl_strtab_t;
+
+static void
+_dbpl_strtab_free (dbpl_strtab_t *tab) {
+    free (tab->slots);
+    free (tab->slot_ids);
+    free (tab->values);
+    free (tab->strings);
+}
+
+static void
+_dbpl_strtab_rehash (dbpl_strtab_t *tab, size_t size) {
+    free (tab->slots);
+    free (tab->slot_ids);
+    tab->slots = calloc (size, sizeof (const char *));
+    tab->slot_ids = malloc (size * sizeof (uint32_t));
+    tab->size = size;
+    for (uint32_t id = 0; id < tab->count; id++) {
+        size_t i = ((uintptr_t)tab->values[id] >> 3) & (size-1);
+        while (tab->slots[i]) {
+            i = (i + 1) & (size-1);
+        }
+        tab->slots[i] = tab->values[id];
+        tab->slot_ids[i] = id;
+    }
+}
+
+static uint32_t
+_dbpl_strtab_add (dbpl_strtab_t *tab, const char *value, uint32_t size) {
+    if ((tab->count + 1) * 2 > tab->size) {
+        _dbpl_strtab_rehash (tab, tab->size ? tab->size * 2 : 4096);
+    }
+    size_t i = ((uintptr_t)value >> 3) & (tab->size-1);
+    while (tab->slots[i]) {
+        if (tab->slots[i] == value) {
+            return tab->slot_ids[i];
+        }
+        i = (i + 1) & (tab->size-1);
+    }
+
+    if (tab->count == tab->alloc) {
+        tab->alloc = tab->alloc ? tab->alloc * 2 : 4096;
+        tab->values = realloc (tab->values, tab->alloc * sizeof (const char *));
+        tab->strings = realloc (tab->strings, tab->alloc * sizeof (dbpl_string_t));
+    }
+    uint32_t id = tab->count++;
+    tab->values[id] = value;
+    tab->strings[id].offset = tab->strtab_size;
+    tab->strings[id].size = size;
+    tab->strtab_size += size;
+    tab->slots[i] = value;
+    tab->slot_ids[i] = id;
+    return id;
+}
+
+static int
+_dbpl_meta_append (dbpl_meta_t **meta, uint32_t *count, uint32_t *alloc, dbpl_strtab_t *tab, DB_metaInfo_t *m, uint32_t valuesize) {
+    if (*count == *alloc) {
+        *alloc = *alloc ? *alloc * 2 : 4096;
+        *meta = realloc (*meta, *alloc * sizeof (dbpl_meta_t));
+        if (!*meta) {
+            return -1;
+        }
+    }
+    dbpl_meta_t *dm = &(*meta)[(*count)++];
+    dm->key = _dbpl_strtab_add (tab, m->key, (uint32_t)strlen (m->key) + 1);
+    dm->value = _dbpl_strtab_add (tab, m->value, valuesize);
+    return 0;
+}
+
+// Writes everything after the DBPL signature, must be called with pl_lock held
+static int
+_dbpl_write (playlist_t *plt, FILE *fp, int (*cb)(playItem_t *it, void *data), void *user_data) {
+    int res = -1;
+    dbpl_strtab_t tab;
+    memset (&tab, 0, sizeof (tab));
+    dbpl_header_t hdr;
+    memset (&hdr, 0, sizeof (hdr));
+    dbpl_meta_t *meta = NULL;
+    uint32_t meta_alloc = 0;
+    uint32_t plt_meta_first;
+
+    dbpl_track_t *tracks = calloc (plt->count[PL_MAIN] ? plt->count[PL_MAIN] : 1, sizeof (dbpl_track_t));
+    if (!tracks) {
+        return -1;
+    }
+
+    for (playItem_t *it = plt->head[PL_MAIN]; it; it = it->next[PL_MAIN]) {
+        if (cb) {
+            cb(it, user_data);
+        }
+        dbpl_track_t *t = &tracks[hdr.track_count++];
+        t->startsample = pl_item_get_startsample (it);
+        t->endsample = pl_item_get_endsample (it);
+        t->duration = it->_duration;
+        t->flags = it->_flags;
+        t->track_flags = (it->has_startsample64 ? DBPL_TRACK_HAS_STARTSAMPLE64 : 0)
+            | (it->has_endsample64 ? DBPL_TRACK_HAS_ENDSAMPLE64 : 0);
+        t->meta_first = hdr.meta_count;
+        for (DB_metaInfo_t *m = it->meta; m; m = m->next) {
+            if (m->key[0] == '_' || m->key[0] == '!' || !m->value) {
+                continue; // skip reserved names
+            }
+            if (t->meta_count == 0xffff) {
+                break;
+            }
+            if (_dbpl_meta_append (&meta, &hdr.meta_count, &meta_alloc, &tab, m, m->valuesize) < 0) {
+                goto out;
+            }
+            t->meta_count++;
+        }
+    }
+
+    // playlist metadata values are plain strings
+    plt_meta_first = hdr.meta_count;
+    for (DB_metaInfo_t *m = plt->meta; m; m = m->next) {
+        if (_dbpl_meta_append (&meta, &hdr.meta_count, &meta_alloc, &tab, m, (uint32_t)strlen (m->value) + 1) < 0) {
+            goto out;
+        }
+    }
+    hdr.plt_meta_count = hdr.meta_count - plt_meta_first;
+    hdr.meta_count = plt_meta_first;
+    hdr.string_count = tab.count;
+    hdr.strtab_size = tab.strtab_size;
+
+    uint8_t ver[4] = { PLAYLIST_MAJOR_VER, PLAYLIST_MINOR_VER, 0, 0 };
+    if (fwrite ("DBPL", 1, 4, fp) != 4
+        || fwrite (ver, 1, 4, fp) != 4
+        || fwrite (&hdr, sizeof (hdr), 1, fp) != 1) {
+        goto out;
+    }
+    if (hdr.track_count && fwrite (tracks, sizeof (dbpl_track_t), hdr.track_count, fp) != hdr.track_count) {
+        goto out;
+    }
+    uint32_t total_meta = hdr.meta_count + hdr.plt_meta_count;
+    if (total_meta && fwrite (meta, sizeof (dbpl_meta_t), total_meta, fp) != total_meta) {
+        goto out;
+    }
+    if (tab.count && fwrite (tab.strings, sizeof (dbpl_string_t), tab.count, fp) != tab.count) {
+        goto out;
+    }
+    for (uint32_t i = 0; i < tab.count; i++) {
+        if (fwrite (tab.values[i], 1, tab.strings[i].size, fp) != tab.strings[i].size) {
+            goto out;
+        }
+    }
+    res = 0;
+out:
+    free (tracks);
+    free (meta);
+    _dbpl_strtab_free (&tab);
+    return res;
+}
+
 static int playlists_count = 0;
 static playlist_t *playlists_head = NULL;
 static playlist_t *playlist = NULL; // current playlist
@@ -646,6 +859,7 @@ plt_modified (playlist_t *plt) {
     pl_lock ();
     plt->modification_idx++;
     pl_unlock ();
+    streamer_notify_playlist_changed ();
 }
 
 int
@@ -674,6 +888,12 @@ plt_free (playlist_t *plt) {
         free (m);
     }
 
+    for (int iter = 0; iter < PL_MAX_ITERATORS; iter++) {
+        free (plt->index[iter]);
+    }
+
+    free (plt->search_text);
+
     free (plt);
     UNLOCK;
 }
@@ -856,6 +1076,169 @@ plt_insert_cue (playlist_t *plt, playItem_t *after, playItem_t *origin, int nums
 static playItem_t *
 plt_insert_dir_int (int visibility, playlist_t *playlist, DB_vfs_t *vfs, playItem_t *after, const char *dirname, int *pabort, int (*cb)(playItem_t *it, void *data), void *user_data);
 
+static inline void
+_dbpl_use_string (const char **interned, uint8_t *used, uint32_t idx) {
+    if (used[idx]) {
+        metacache_ref (interned[idx]);
+    }
+    used[idx] = 1;
+}
+
+// Loads a DBPL 1.4 file: maps it, interns every unique string once,
+// and links the metadata lists directly, without going through pl_add_meta.
+static playItem_t *
+_dbpl_load_mapped (playlist_t *plt, const char *fname) {
+    int fd = open (fname, O_RDONLY);
+    if (fd == -1) {
+        return NULL;
+    }
+    struct stat st;
+    if (fstat (fd, &st) || st.st_size < 8 + (off_t)sizeof (dbpl_header_t)) {
+        close (fd);
+        return NULL;
+    }
+    size_t size = (size_t)st.st_size;
+    const uint8_t *data = mmap (NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close (fd);
+    if (data == MAP_FAILED) {
+        trace ("plt_load: failed to map %s\n", fname);
+        return NULL;
+    }
+
+    playItem_t *last_added = NULL;
+    const char **interned = NULL;
+    uint8_t *used = NULL;
+
+    dbpl_header_t hdr;
+    memcpy (&hdr, data + 8, sizeof (hdr));
+    uint64_t total_meta = (uint64_t)hdr.meta_count + hdr.plt_meta_count;
+    uint64_t expected = 8 + sizeof (dbpl_header_t)
+        + (uint64_t)hdr.track_count * sizeof (dbpl_track_t)
+        + total_meta * sizeof (dbpl_meta_t)
+        + (uint64_t)hdr.string_count * sizeof (dbpl_string_t)
+        + hdr.strtab_size;
+    if (expected != size) {
+        trace ("plt_load: bad DBPL 1.4 section sizes\n");
+        goto out;
+    }
+
+    const dbpl_track_t *tracks = (const dbpl_track_t *)(data + 8 + sizeof (dbpl_header_t));
+    const dbpl_meta_t *meta = (const dbpl_meta_t *)(tracks + hdr.track_count);
+    const dbpl_string_t *strings = (const dbpl_string_t *)(meta + total_meta);
+    const char *strtab = (const char *)(strings + hdr.string_count);
+
+    interned = calloc (hdr.string_count ? hdr.string_count : 1, sizeof (const char *));
+    used = calloc (hdr.string_count ? hdr.string_count : 1, 1);
+    if (!interned || !used) {
+        goto out;
+    }
+    for (uint32_t i = 0; i < hdr.string_count; i++) {
+        if (strings[i].size == 0
+            || (uint64_t)strings[i].offset + strings[i].size > hdr.strtab_size
+            || strtab[strings[i].offset + strings[i].size - 1] != 0) {
+            trace ("plt_load: bad DBPL 1.4 string %d\n", i);
+            goto out;
+        }
+    }
+    for (uint64_t i = 0; i < total_meta; i++) {
+        if (meta[i].key >= hdr.string_count || meta[i].value >= hdr.string_count
+            || strlen (strtab + strings[meta[i].key].offset) + 1 != strings[meta[i].key].size) {
+            trace ("plt_load: bad DBPL 1.4 meta %d\n", (int)i);
+            goto out;
+        }
+    }
+
+    // the first use of every string takes over the reference from metacache_add_value,
+    // the following ones add a reference
+    for (uint32_t i = 0; i < hdr.string_count; i++) {
+        interned[i] = metacache_add_value (strtab + strings[i].offset, strings[i].size);
+    }
+
+    for (uint32_t i = 0; i < hdr.track_count; i++) {
+        const dbpl_track_t *t = &tracks[i];
+        if ((uint64_t)t->meta_first + t->meta_count > hdr.meta_count) {
+            trace ("plt_load: bad DBPL 1.4 track %d\n", i);
+            break;
+        }
+        playItem_t *it = pl_item_alloc ();
+        if (!it) {
+            break;
+        }
+        it->startsample64 = t->startsample;
+        it->startsample = t->startsample >= 0x7fffffff ? 0x7fffffff : (int32_t)t->startsample;
+        it->has_startsample64 = (t->track_flags & DBPL_TRACK_HAS_STARTSAMPLE64) ? 1 : 0;
+        it->endsample64 = t->endsample;
+        it->endsample = t->endsample >= 0x7fffffff ? 0x7fffffff : (int32_t)t->endsample;
+        it->has_endsample64 = (t->track_flags & DBPL_TRACK_HAS_ENDSAMPLE64) ? 1 : 0;
+        it->_duration = t->duration;
+        it->_flags = t->flags;
+
+        // stored in pl_add_meta order, so the list can be linked as is
+        DB_metaInfo_t *tail = NULL;
+        for (uint32_t m = t->meta_first; m < t->meta_first + t->meta_count; m++) {
+            DB_metaInfo_t *mi = calloc (1, sizeof (DB_metaInfo_t));
+            _dbpl_use_string (interned, used, meta[m].key);
+            _dbpl_use_string (interned, used, meta[m].value);
+            mi->key = interned[meta[m].key];
+            mi->value = interned[meta[m].value];
+            mi->valuesize = strings[meta[m].value].size;
+            if (tail) {
+                tail->next = mi;
+            }
+            else {
+                it->meta = mi;
+            }
+            tail = mi;
+        }
+
+        plt_insert_item (plt, plt->tail[PL_MAIN], it);
+        if (last_added) {
+            pl_item_unref (last_added);
+        }
+        last_added = it;
+    }
+
+    LOCK;
+    DB_metaInfo_t *plt_tail = plt->meta;
+    while (plt_tail && plt_tail->next) {
+        plt_tail = plt_tail->next;
+    }
+    for (uint64_t m = hdr.meta_count; m < total_meta; m++) {
+        // playlist metadata is released with metacache_remove_string
+        if (strlen (strtab + strings[meta[m].value].offset) + 1 != strings[meta[m].value].size) {
+            continue;
+        }
+        DB_metaInfo_t *mi = calloc (1, sizeof (DB_metaInfo_t));
+        _dbpl_use_string (interned, used, meta[m].key);
+        _dbpl_use_string (interned, used, meta[m].value);
+        mi->key = interned[meta[m].key];
+        mi->value = interned[meta[m].value];
+        if (plt_tail) {
+            plt_tail->next = mi;
+        }
+        else {
+            plt->meta = mi;
+        }
+        plt_tail = mi;
+    }
+    UNLOCK;
+
+    for (uint32_t i = 0; i < hdr.string_count; i++) {
+        if (!used[i]) {
+            metacache_remove_value (interned[i], strings[i].size);
+        }
+    }
+
+out:
+    free (interned);
+    free (used);
+    munmap ((void *)data, size);
+    if (last_added) {
+        pl_item_unref (last_added);
+    }
+    return last_added;
+}
+
 static playItem_t *
 plt_load_int (int visibility, playlist_t *plt, playItem_t *after, const char *fname, int *pabort, int (*cb)(playItem_t *it, void *data), void *user_data);
 
@@ -870,6 +1253,27 @@ fileadd_filter_test (ddb_file_found_data_t *data) {
     return 0;
 }
 
+// Reports an added track to the progress callback and to the file add listeners
+static void
+_plt_file_added (int visibility, playlist_t *playlist, playItem_t *inserted, int *pabort, int (*cb)(playItem_t *it, void *data), void *user_data) {
+    if (cb && cb (inserted, user_data) < 0) {
+        *pabort = 1;
+    }
+    if (file_add_listeners) {
+        ddb_fileadd_data_t d;
+        memset (&d, 0, sizeof (d));
+        d.visibility = visibility;
+        d.plt = (ddb_playlist_t *)playlist;
+        d.track = (ddb_playItem_t *)inserted;
+        for (ddb_fileadd_listener_t *l = file_add_listeners; l; l = l->next) {
+            if (pabort && l->callback (&d, l->user_data) < 0) {
+                *pabort = 1;
+                break;
+            }
+        }
+    }
+}
+
 static int
 is_relative_path (const char *fname) {
 #ifndef _WIN32
@@ -1034,7 +1438,7 @@ plt_insert_file_int (int visibility, playlist_t *playlist, playItem_t *after, co
                     if (!filter_done) {
                         ddb_file_found_data_t dt;
                         dt.filename = fname;
-                        dt.plt = (ddb_playlist_t *)playlist;
+                        dt.plt = (ddb_playlist_t *)(playlist->scan_target ? playlist->scan_target : playlist);
                         dt.is_dir = 0;
                         if (fileadd_filter_test (&dt) < 0) {
                             return NULL;
@@ -1046,21 +1450,8 @@ plt_insert_file_int (int visibility, playlist_t *playlist, playItem_t *after, co
 
                     playItem_t *inserted = (playItem_t *)decoders[i]->insert ((ddb_playlist_t *)playlist, DB_PLAYITEM (after), fname);
                     if (inserted != NULL) {
-                        if (cb && cb (inserted, user_data) < 0) {
-                            *pabort = 1;
-                        }
-                        if (file_add_listeners) {
-                            ddb_fileadd_data_t d;
-                            memset (&d, 0, sizeof (d));
-                            d.visibility = visibility;
-                            d.plt = (ddb_playlist_t *)playlist;
-                            d.track = (ddb_playItem_t *)inserted;
-                            for (ddb_fileadd_listener_t *l = file_add_listeners; l; l = l->next) {
-                                if (pabort && l->callback (&d, l->user_data) < 0) {
-                                    *pabort = 1;
-                                    break;
-                                }
-                            }
+                        if (!playlist->scan_target) {
+                            _plt_file_added (visibility, playlist, inserted, pabort, cb, user_data);
                         }
                         return inserted;
                     }
@@ -1074,7 +1465,7 @@ plt_insert_file_int (int visibility, playlist_t *playlist, playItem_t *after, co
                     if (!filter_done) {
                         ddb_file_found_data_t dt;
                         dt.filename = fname;
-                        dt.plt = (ddb_playlist_t *)playlist;
+                        dt.plt = (ddb_playlist_t *)(playlist->scan_target ? playlist->scan_target : playlist);
                         dt.is_dir = 0;
                         if (fileadd_filter_test (&dt) < 0) {
                             return NULL;
@@ -1085,21 +1476,8 @@ plt_insert_file_int (int visibility, playlist_t *playlist, playItem_t *after, co
                     file_recognized = 1;
                     playItem_t *inserted = (playItem_t *)decoders[i]->insert ((ddb_playlist_t *)playlist, DB_PLAYITEM (after), fname);
                     if (inserted != NULL) {
-                        if (cb && cb (inserted, user_data) < 0) {
-                            *pabort = 1;
-                        }
-                        if (file_add_listeners) {
-                            ddb_fileadd_data_t d;
-                            memset (&d, 0, sizeof (d));
-                            d.visibility = visibility;
-                            d.plt = (ddb_playlist_t *)playlist;
-                            d.track = (ddb_playItem_t *)inserted;
-                            for (ddb_fileadd_listener_t *l = file_add_listeners; l; l = l->next) {
-                                if (l->callback (&d, l->user_data) < 0) {
-                                    *pabort = 1;
-                                    break;
-                                }
-                            }
+                        if (!playlist->scan_target) {
+                            _plt_file_added (visibility, playlist, inserted, pabort, cb, user_data);
                         }
                         return inserted;
                     }
@@ -1181,49 +1559,24 @@ _get_fullname_and_dir (char *fullname, int sz, char *dir, int dirsz, DB_vfs_t *v
     #endif
 }
 
-static playItem_t *
-plt_insert_dir_int (int visibility, playlist_t *playlist, DB_vfs_t *vfs, playItem_t *after, const char *dirname, int *pabort, int (*cb)(playItem_t *it, void *data), void *user_data) {
-    if (!strncmp (dirname, "file://", 7)) {
-        dirname += 7;
-    }
-
-    if (is_relative_path (dirname)) {
-        return NULL;
-    }
-
-    #ifdef __MINGW32__
-    // replace backslashes with normal slashes
-    char dirname_conv[strlen(dirname)+1];
-    if (strchr(dirname, '\\')) {
-        trace ("plt_insert_dir_int: backslash(es) detected: %s\n", dirname);
-        strcpy (dirname_conv, dirname);
-        char *slash_p = dirname_conv;
-        while (slash_p = strchr(slash_p, '\\')) {
-            *slash_p = '/';
-            slash_p++;
-        }
-        dirname = dirname_conv;
-    }
-    // path should start with "X:/", not "/X:/", fixing to avoid file opening problems
-    if (dirname[0] == '/' && isalpha(dirname[1]) && dirname[2] == ':') {
-        dirname++;
-    }
-    #endif
-
+// Lists the directory in dirent_alphasort order, after checking the symlink setting and the file add filters.
+// Returns the number of entries, or -1 if the directory can't be added.
+static int
+_plt_scandir (playlist_t *playlist, DB_vfs_t *vfs, const char *dirname, struct dirent ***pnamelist) {
     if (!playlist->follow_symlinks && !vfs) {
         struct stat buf;
         lstat (dirname, &buf);
         if (S_ISLNK(buf.st_mode)) {
-            return NULL;
+            return -1;
         }
     }
 
     ddb_file_found_data_t dt;
     dt.filename = dirname;
-    dt.plt = (ddb_playlist_t *)playlist;
+    dt.plt = (ddb_playlist_t *)(playlist->scan_target ? playlist->scan_target : playlist);
     dt.is_dir = 1;
     if (fileadd_filter_test (&dt) < 0) {
-        return NULL;
+        return -1;
     }
 
     struct dirent **namelist = NULL;
@@ -1246,9 +1599,17 @@ plt_insert_dir_int (int visibility, playlist_t *playlist, DB_vfs_t *vfs, playIte
         if (namelist) {
             free (namelist);
         }
-        return NULL;	// not a dir or no read access
+        return -1;	// not a dir or no read access
     }
 
+    *pnamelist = namelist;
+    return n;
+}
+
+// Loads all cue files found in the directory listing.
+// The names of the loaded cue files, and of the files referenced by them, are cleared in the namelist.
+static playItem_t *
+_plt_insert_dir_cuesheets (playlist_t *playlist, DB_vfs_t *vfs, playItem_t *after, const char *dirname, struct dirent **namelist, int n, int *pabort) {
     // find all cue files in the folder
     int cuefiles[n];
     int ncuefiles = 0;
@@ -1273,7 +1634,6 @@ plt_insert_dir_int (int visibility, playlist_t *playlist, DB_vfs_t *vfs, playIte
     char fullname[PATH_MAX];
     char fulldir[PATH_MAX];
 
-    // try loading cuesheets first
     for (int c = 0; c < ncuefiles; c++) {
         int i = cuefiles[c];
         _get_fullname_and_dir (fullname, sizeof (fullname), fulldir, sizeof(fulldir), vfs, dirname, namelist[i]->d_name);
@@ -1289,6 +1649,259 @@ plt_insert_dir_int (int visibility, playlist_t *playlist, DB_vfs_t *vfs, playIte
         }
     }
 
+    return after;
+}
+
+// Parallel directory scanner.
+// Worker threads list the directories and read the files, each node adding its tracks to a private scratch playlist.
+// The calling thread walks the node tree depth-first in the listing order, and moves the tracks to the target playlist,
+// so the resulting order is the same as with the serial scan.
+typedef struct scan_node_s {
+    char *path;
+    int done;
+    playlist_t *items; // scratch playlist: loaded cuesheets for directories, decoded tracks for files
+    playItem_t *inserted; // the track returned by plt_insert_file_int, reported to cb and to the file add listeners
+    struct scan_node_s **children; // directory entries, in dirent_alphasort order
+    int nchildren;
+    struct scan_node_s *queue_next;
+} scan_node_t;
+
+typedef struct {
+    int visibility;
+    playlist_t *playlist;
+    uintptr_t mutex;
+    uintptr_t work_cond; // signaled when nodes are queued, or when stopping
+    uintptr_t done_cond; // signaled when a node is done
+    scan_node_t *queue_head;
+    scan_node_t *queue_tail;
+    int stop;
+} scan_ctx_t;
+
+static scan_node_t *
+_scan_node_alloc (const char *path) {
+    scan_node_t *node = calloc (1, sizeof (scan_node_t));
+    node->path = strdup (path);
+    return node;
+}
+
+static void
+_scan_node_free (scan_node_t *node) {
+    for (int i = 0; i < node->nchildren; i++) {
+        if (node->children[i]) {
+            _scan_node_free (node->children[i]);
+        }
+    }
+    free (node->children);
+    if (node->items) {
+        plt_unref (node->items);
+    }
+    free (node->path);
+    free (node);
+}
+
+// Reads a node into its scratch playlist, and queues its children if it's a directory.
+// Returns -1 if dir_only is set and the node is not a directory.
+static int
+_scan_node_process (scan_ctx_t *ctx, scan_node_t *node, int dir_only) {
+    playlist_t *items = plt_alloc ("scan");
+    items->follow_symlinks = ctx->playlist->follow_symlinks;
+    items->ignore_archives = ctx->playlist->ignore_archives;
+    items->scan_target = ctx->playlist;
+
+    struct dirent **namelist = NULL;
+    int n = _plt_scandir (items, NULL, node->path, &namelist);
+    if (n < 0) {
+        if (dir_only) {
+            plt_unref (items);
+            return -1;
+        }
+        node->inserted = plt_insert_file_int (ctx->visibility, items, NULL, node->path, NULL, NULL, NULL);
+    }
+    else {
+        _plt_insert_dir_cuesheets (items, NULL, NULL, node->path, namelist, n, &ctx->stop);
+
+        scan_node_t **children = calloc (n ? n : 1, sizeof (scan_node_t *));
+        int nchildren = 0;
+        char fullname[PATH_MAX];
+        for (int i = 0; i < n; i++) {
+            // no hidden files
+            if (namelist[i]->d_name[0] && namelist[i]->d_name[0] != '.') {
+                _get_fullname_and_dir (fullname, sizeof (fullname), NULL, 0, NULL, node->path, namelist[i]->d_name);
+                children[nchildren++] = _scan_node_alloc (fullname);
+            }
+            free (namelist[i]);
+        }
+        free (namelist);
+
+        mutex_lock (ctx->mutex);
+        node->children = children;
+        node->nchildren = nchildren;
+        for (int i = 0; i < nchildren; i++) {
+            if (ctx->queue_tail) {
+                ctx->queue_tail->queue_next = children[i];
+            }
+            else {
+                ctx->queue_head = children[i];
+            }
+            ctx->queue_tail = children[i];
+        }
+        cond_broadcast (ctx->work_cond);
+        mutex_unlock (ctx->mutex);
+    }
+
+    mutex_lock (ctx->mutex);
+    node->items = items;
+    node->done = 1;
+    cond_broadcast (ctx->done_cond);
+    mutex_unlock (ctx->mutex);
+    return 0;
+}
+
+static void
+_scan_worker (void *ctx_ptr) {
+    scan_ctx_t *ctx = ctx_ptr;
+    for (;;) {
+        mutex_lock (ctx->mutex);
+        while (!ctx->stop && !ctx->queue_head) {
+            cond_wait_locked (ctx->work_cond, ctx->mutex);
+        }
+        if (ctx->stop) {
+            mutex_unlock (ctx->mutex);
+            break;
+        }
+        scan_node_t *node = ctx->queue_head;
+        ctx->queue_head = node->queue_next;
+        if (!ctx->queue_head) {
+            ctx->queue_tail = NULL;
+        }
+        mutex_unlock (ctx->mutex);
+
+        _scan_node_process (ctx, node, 0);
+    }
+}
+
+// Waits for the node, and moves its tracks into the target playlist, followed by the tracks of its children.
+// Merged children are freed.
+static playItem_t *
+_scan_node_merge (scan_ctx_t *ctx, scan_node_t *node, playItem_t *after, int *pabort, int (*cb)(playItem_t *it, void *data), void *user_data) {
+    mutex_lock (ctx->mutex);
+    while (!node->done) {
+        cond_wait_locked (ctx->done_cond, ctx->mutex);
+    }
+    mutex_unlock (ctx->mutex);
+
+    playItem_t *it;
+    while ((it = node->items->head[PL_MAIN])) {
+        pl_item_ref (it);
+        plt_remove_item (node->items, it);
+        after = plt_insert_item (ctx->playlist, after, it);
+        pl_item_unref (it);
+    }
+
+    if (node->inserted) {
+        _plt_file_added (ctx->visibility, ctx->playlist, node->inserted, pabort, cb, user_data);
+    }
+
+    for (int i = 0; i < node->nchildren; i++) {
+        if (pabort && *pabort) {
+            break;
+        }
+        after = _scan_node_merge (ctx, node->children[i], after, pabort, cb, user_data);
+        _scan_node_free (node->children[i]);
+        node->children[i] = NULL;
+    }
+
+    return after;
+}
+
+static playItem_t *
+_plt_insert_dir_parallel (int visibility, playlist_t *playlist, playItem_t *after, const char *dirname, int *pabort, int (*cb)(playItem_t *it, void *data), void *user_data) {
+    scan_ctx_t ctx;
+    memset (&ctx, 0, sizeof (ctx));
+    ctx.visibility = visibility;
+    ctx.playlist = playlist;
+
+    // the top level is listed on the calling thread, to fail early if it's not a directory
+    scan_node_t *root = _scan_node_alloc (dirname);
+    ctx.mutex = mutex_create ();
+    ctx.work_cond = cond_create ();
+    ctx.done_cond = cond_create ();
+
+    playItem_t *res = NULL;
+    int nthreads = playlist->scan_threads;
+    intptr_t tids[nthreads];
+
+    if (_scan_node_process (&ctx, root, 1) < 0) {
+        nthreads = 0;
+        goto out;
+    }
+
+    for (int i = 0; i < nthreads; i++) {
+        tids[i] = thread_start (_scan_worker, &ctx);
+    }
+
+    res = _scan_node_merge (&ctx, root, after, pabort, cb, user_data);
+
+out:
+    mutex_lock (ctx.mutex);
+    ctx.stop = 1;
+    cond_broadcast (ctx.work_cond);
+    mutex_unlock (ctx.mutex);
+    for (int i = 0; i < nthreads; i++) {
+        thread_join (tids[i]);
+    }
+
+    _scan_node_free (root);
+    cond_free (ctx.work_cond);
+    cond_free (ctx.done_cond);
+    mutex_free (ctx.mutex);
+    return res;
+}
+
+static playItem_t *
+plt_insert_dir_int (int visibility, playlist_t *playlist, DB_vfs_t *vfs, playItem_t *after, const char *dirname, int *pabort, int (*cb)(playItem_t *it, void *data), void *user_data) {
+    if (!strncmp (dirname, "file://", 7)) {
+        dirname += 7;
+    }
+
+    if (is_relative_path (dirname)) {
+        return NULL;
+    }
+
+    #ifdef __MINGW32__
+    // replace backslashes with normal slashes
+    char dirname_conv[strlen(dirname)+1];
+    if (strchr(dirname, '\\')) {
+        trace ("plt_insert_dir_int: backslash(es) detected: %s\n", dirname);
+        strcpy (dirname_conv, dirname);
+        char *slash_p = dirname_conv;
+        while (slash_p = strchr(slash_p, '\\')) {
+            *slash_p = '/';
+            slash_p++;
+        }
+        dirname = dirname_conv;
+    }
+    // path should start with "X:/", not "/X:/", fixing to avoid file opening problems
+    if (dirname[0] == '/' && isalpha(dirname[1]) && dirname[2] == ':') {
+        dirname++;
+    }
+    #endif
+
+    if (!vfs && playlist->scan_threads > 1) {
+        return _plt_insert_dir_parallel (visibility, playlist, after, dirname, pabort, cb, user_data);
+    }
+
+    struct dirent **namelist = NULL;
+    int n = _plt_scandir (playlist, vfs, dirname, &namelist);
+    if (n < 0) {
+        return NULL;
+    }
+
+    // try loading cuesheets first
+    after = _plt_insert_dir_cuesheets (playlist, vfs, after, dirname, namelist, n, pabort);
+
+    char fullname[PATH_MAX];
+
     // load the rest of the files
     if (!pabort || !*pabort) {
         for (int i = 0; i < n; i++)
@@ -1333,10 +1946,13 @@ plt_insert_dir (playlist_t *playlist, playItem_t *after, const char *dirname, in
     int prev = playlist->ignore_archives;
     playlist->ignore_archives = conf_get_int ("ignore_archives", 1);
 
+    playlist->scan_threads = conf_get_int ("add_folders_threads", 1);
+
     playItem_t *ret = plt_insert_dir_int (0, playlist, NULL, after, dirname, pabort, cb, user_data);
 
     playlist->follow_symlinks = prev_sl;
     playlist->ignore_archives = prev;
+    playlist->scan_threads = 0;
 
     return ret;
 }
@@ -1392,6 +2008,10 @@ plt_remove_item (playlist_t *playlist, playItem_t *it) {
     LOCK;
     for (int iter = PL_MAIN; iter <= PL_SEARCH; iter++) {
         if (it->prev[iter] || it->next[iter] || playlist->head[iter] == it || playlist->tail[iter] == it) {
+            if (playlist->tail[iter] != it) {
+                // removing the tail keeps the index valid, since it's truncated by the count
+                playlist->index_valid[iter] = 0;
+            }
             playlist->count[iter]--;
         }
 
@@ -1476,20 +2096,73 @@ pl_getselcount (void) {
     return cnt;
 }
 
+static void
+plt_search_forget (playlist_t *playlist) {
+    free (playlist->search_text);
+    playlist->search_text = NULL;
+}
+
+void
+plt_index_invalidate (playlist_t *plt, int iter) {
+    plt->index_valid[iter] = 0;
+    if (iter == PL_MAIN) {
+        // the search results must be rebuilt in the new order
+        plt_search_forget (plt);
+    }
+}
+
+static void
+plt_index_reserve (playlist_t *plt, int iter, int size) {
+    if (size <= plt->index_size[iter]) {
+        return;
+    }
+    int newsize = plt->index_size[iter] ? plt->index_size[iter] : 256;
+    while (newsize < size) {
+        newsize *= 2;
+    }
+    plt->index[iter] = realloc (plt->index[iter], newsize * sizeof (playItem_t *));
+    plt->index_size[iter] = newsize;
+}
+
+// Rebuilds the row index if the list was modified since the last lookup.
+// Must be called with pl_lock held.
+static void
+plt_index_update (playlist_t *plt, int iter) {
+    if (plt->index_valid[iter]) {
+        return;
+    }
+    plt_index_reserve (plt, iter, plt->count[iter]);
+    int row = 0;
+    for (playItem_t *it = plt->head[iter]; it; it = it->next[iter], row++) {
+        plt_index_reserve (plt, iter, row+1);
+        plt->index[iter][row] = it;
+        it->row[iter] = row;
+    }
+    plt->index_valid[iter] = 1;
+}
+
+// Appends an item to a valid index, otherwise leaves it to be rebuilt on demand
+static void
+plt_index_append (playlist_t *plt, int iter, playItem_t *it) {
+    if (!plt->index_valid[iter]) {
+        return;
+    }
+    int row = plt->count[iter]-1;
+    plt_index_reserve (plt, iter, row+1);
+    plt->index[iter][row] = it;
+    it->row[iter] = row;
+}
+
 playItem_t *
 plt_get_item_for_idx (playlist_t *playlist, int idx, int iter) {
     LOCK;
-    playItem_t *it = playlist->head[iter];
-    while (idx--) {
-        if (!it) {
-            UNLOCK;
-            return NULL;
-        }
-        it = it->next[iter];
-    }
-    if (it) {
-        pl_item_ref (it);
+    if (idx < 0 || idx >= playlist->count[iter]) {
+        UNLOCK;
+        return NULL;
     }
+    plt_index_update (playlist, iter);
+    playItem_t *it = playlist->index[iter][idx];
+    pl_item_ref (it);
     UNLOCK;
     return it;
 }
@@ -1510,13 +2183,9 @@ pl_get_for_idx (int idx) {
 int
 plt_get_item_idx (playlist_t *playlist, playItem_t *it, int iter) {
     LOCK;
-    playItem_t *c = playlist->head[iter];
-    int idx = 0;
-    while (c && c != it) {
-        c = c->next[iter];
-        idx++;
-    }
-    if (!c) {
+    plt_index_update (playlist, iter);
+    int idx = it->row[iter];
+    if (idx < 0 || idx >= playlist->count[iter] || playlist->index[iter][idx] != it) {
         UNLOCK;
         return -1;
     }
@@ -1541,6 +2210,7 @@ playItem_t *
 plt_insert_item (playlist_t *playlist, playItem_t *after, playItem_t *it) {
     LOCK;
     pl_item_ref (it);
+    int append = after == playlist->tail[PL_MAIN];
     if (!after) {
         it->next[PL_MAIN] = playlist->head[PL_MAIN];
         it->prev[PL_MAIN] = NULL;
@@ -1564,8 +2234,15 @@ plt_insert_item (playlist_t *playlist, playItem_t *after, playItem_t *it) {
         }
     }
     it->in_playlist = 1;
+    plt_search_forget (playlist);
 
     playlist->count[PL_MAIN]++;
+    if (append) {
+        plt_index_append (playlist, PL_MAIN, it);
+    }
+    else {
+        playlist->index_valid[PL_MAIN] = 0;
+    }
 
     // shuffle
     playItem_t *prev = it->prev[PL_MAIN];
@@ -1638,6 +2315,7 @@ pl_item_alloc (void) {
     memset (it, 0, sizeof (playItem_t));
     it->_duration = -1;
     it->_refc = 1;
+    pl_item_touch (it);
     return it;
 }
 
@@ -1668,6 +2346,7 @@ pl_item_free (playItem_t *it) {
             free (m);
         }
 
+        free (it->search_text);
         free (it);
     }
     UNLOCK;
@@ -1766,177 +2445,15 @@ plt_save (playlist_t *plt, playItem_t *first, playItem_t *last, const char *fnam
 
     char tempfile[PATH_MAX];
     snprintf (tempfile, sizeof (tempfile), "%s.tmp", fname);
-    const char magic[] = "DBPL";
-    uint8_t majorver = PLAYLIST_MAJOR_VER;
-    uint8_t minorver = PLAYLIST_MINOR_VER;
     FILE *fp = fopen (tempfile, "w+b");
     if (!fp) {
         UNLOCK;
         return -1;
     }
-    if (fwrite (magic, 1, 4, fp) != 4) {
-        goto save_fail;
-    }
-    if (fwrite (&majorver, 1, 1, fp) != 1) {
-        goto save_fail;
-    }
-    if (fwrite (&minorver, 1, 1, fp) != 1) {
-        goto save_fail;
-    }
-    uint32_t cnt = plt->count[PL_MAIN];
-    if (fwrite (&cnt, 1, 4, fp) != 4) {
-        goto save_fail;
-    }
-    for (playItem_t *it = plt->head[PL_MAIN]; it; it = it->next[PL_MAIN]) {
-        uint16_t l;
-        uint8_t ll;
-        if (cb) {
-            cb(it, user_data);
-        }
-#if (PLAYLIST_MINOR_VER==2)
-        const char *fname = pl_find_meta_raw (it, ":URI");
-        l = strlen (fname);
-        if (fwrite (&l, 1, 2, fp) != 2) {
-            goto save_fail;
-        }
-        if (fwrite (fname, 1, l, fp) != l) {
-            goto save_fail;
-        }
-        const char *decoder_id = pl_find_meta_raw (it, ":DECODER");
-        if (decoder_id) {
-            ll = strlen (decoder_id);
-            if (fwrite (&ll, 1, 1, fp) != 1) {
-                goto save_fail;
-            }
-            if (fwrite (decoder_id, 1, ll, fp) != ll) {
-                goto save_fail;
-            }
-        }
-        else
-        {
-            ll = 0;
-            if (fwrite (&ll, 1, 1, fp) != 1) {
-                goto save_fail;
-            }
-        }
-        l = pl_find_meta_int (it, ":TRACKNUM", 0);
-        if (fwrite (&l, 1, 2, fp) != 2) {
-            goto save_fail;
-        }
-#endif
-        if (fwrite (&it->startsample, 1, 4, fp) != 4) {
-            goto save_fail;
-        }
-        if (fwrite (&it->endsample, 1, 4, fp) != 4) {
-            goto save_fail;
-        }
-        if (fwrite (&it->_duration, 1, 4, fp) != 4) {
-            goto save_fail;
-        }
-#if (PLAYLIST_MINOR_VER==2)
-        const char *filetype = pl_find_meta_raw (it, ":FILETYPE");
-        if (!filetype) {
-            filetype = "";
-        }
-        uint8_t ft = strlen (filetype);
-        if (fwrite (&ft, 1, 1, fp) != 1) {
-            goto save_fail;
-        }
-        if (ft) {
-            if (fwrite (filetype, 1, ft, fp) != ft) {
-                goto save_fail;
-            }
-        }
-        float rg_albumgain = pl_get_item_replaygain (it, DDB_REPLAYGAIN_ALBUMGAIN);
-        float rg_albumpeak = pl_get_item_replaygain (it, DDB_REPLAYGAIN_ALBUMPEAK);
-        float rg_trackgain = pl_get_item_replaygain (it, DDB_REPLAYGAIN_TRACKGAIN);
-        float rg_trackpeak = pl_get_item_replaygain (it, DDB_REPLAYGAIN_TRACKPEAK);
-        if (fwrite (&rg_albumgain, 1, 4, fp) != 4) {
-            goto save_fail;
-        }
-        if (fwrite (&rg_albumpeak, 1, 4, fp) != 4) {
-            goto save_fail;
-        }
-        if (fwrite (&rg_trackgain, 1, 4, fp) != 4) {
-            goto save_fail;
-        }
-        if (fwrite (&rg_trackpeak, 1, 4, fp) != 4) {
-            goto save_fail;
-        }
-#endif
-        if (fwrite (&it->_flags, 1, 4, fp) != 4) {
-            goto save_fail;
-        }
-
-        int16_t nm = 0;
-        DB_metaInfo_t *m;
-        for (m = it->meta; m; m = m->next) {
-            if (m->key[0] == '_' || m->key[0] == '!') {
-                continue; // skip reserved names
-            }
-            nm++;
-        }
-        if (fwrite (&nm, 1, 2, fp) != 2) {
-            goto save_fail;
-        }
-        for (m = it->meta; m; m = m->next) {
-            if (m->key[0] == '_' || m->key[0] == '!') {
-                continue; // skip reserved names
-            }
-
-            l = strlen (m->key);
-            if (fwrite (&l, 1, 2, fp) != 2) {
-                goto save_fail;
-            }
-            if (l) {
-                if (fwrite (m->key, 1, l, fp) != l) {
-                    goto save_fail;
-                }
-            }
-            l = m->valuesize-1;
-            if (fwrite (&l, 1, 2, fp) != 2) {
-                goto save_fail;
-            }
-            if (l) {
-                if (fwrite (m->value, 1, l, fp) != l) {
-                    goto save_fail;
-                }
-            }
-        }
-    }
-
-    // write playlist metadata
-    int16_t nm = 0;
-    DB_metaInfo_t *m;
-    for (m = plt->meta; m; m = m->next) {
-        nm++;
-    }
-    if (fwrite (&nm, 1, 2, fp) != 2) {
+    if (_dbpl_write (plt, fp, cb, user_data) < 0) {
         goto save_fail;
     }
 
-    for (m = plt->meta; m; m = m->next) {
-        uint16_t l;
-        l = strlen (m->key);
-        if (fwrite (&l, 1, 2, fp) != 2) {
-            goto save_fail;
-        }
-        if (l) {
-            if (fwrite (m->key, 1, l, fp) != l) {
-                goto save_fail;
-            }
-        }
-        l = strlen (m->value);
-        if (fwrite (&l, 1, 2, fp) != 2) {
-            goto save_fail;
-        }
-        if (l) {
-            if (fwrite (m->value, 1, l, fp) != l) {
-                goto save_fail;
-            }
-        }
-    }
-
     UNLOCK;
     fclose (fp);
     if (rename (tempfile, fname) != 0) {
@@ -2085,6 +2602,10 @@ plt_load_int (int visibility, playlist_t *plt, playItem_t *after, const char *fn
         trace ("bad minorver=%d\n", minorver);
         goto load_fail;
     }
+    if (minorver >= 4) {
+        fclose (fp);
+        return _dbpl_load_mapped (plt, fname);
+    }
     uint32_t cnt;
     if (fread (&cnt, 1, 4, fp) != 4) {
         goto load_fail;
@@ -3322,11 +3843,9 @@ plt_copy_items (playlist_t *to, int iter, playlist_t *from, playItem_t *before,
     }
 
     playItem_t **items = malloc (cnt * sizeof(playItem_t *));
+    plt_index_update (from, iter);
     for (int i = 0; i < cnt; i++) {
-        playItem_t *it = from->head[iter];
-        for (int idx = 0; it && idx < indices[i]; idx++) {
-            it = it->next[iter];
-        }
+        playItem_t *it = indices[i] < from->count[iter] ? from->index[iter][indices[i]] : NULL;
         items[i] = it;
         if (!it) {
             trace ("plt_copy_items: warning: item %d not found in source plt_to\n", indices[i]);
@@ -3361,12 +3880,16 @@ plt_search_reset_int (playlist_t *playlist, int clear_selection) {
     }
     playlist->tail[PL_SEARCH] = NULL;
     playlist->count[PL_SEARCH] = 0;
+    playlist->index_valid[PL_SEARCH] = 1; // empty index is trivially valid, and kept valid by appending
     UNLOCK;
 }
 
 void
 plt_search_reset (playlist_t *playlist) {
+    LOCK;
+    plt_search_forget (playlist);
     plt_search_reset_int (playlist, 1);
+    UNLOCK;
 }
 
 static void
@@ -3384,12 +3907,98 @@ _plsearch_append (playlist_t *plt, playItem_t *it, int select_results) {
         pl_set_selected_in_playlist(plt, it, 1);
     }
     plt->count[PL_SEARCH]++;
+    plt_index_append (plt, PL_SEARCH, it);
+}
+
+// Builds the text searched by plt_search_process2: the lowercase values of all
+// the searchable fields, separated by \0, so that a match can't span two values.
+// The text is kept with the track, and rebuilt after its metadata changes.
+static void
+pl_item_update_search_text (playItem_t *it) {
+    if (it->search_text && it->search_text_gen == it->modification_gen) {
+        return;
+    }
+
+    char *buf = NULL;
+    int alloc = 0;
+    int size = 0;
+
+    for (DB_metaInfo_t *m = it->meta; m; m = m->next) {
+        int is_uri = !strcmp (m->key, ":URI");
+        if ((m->key[0] == ':' && !is_uri) || m->key[0] == '_' || m->key[0] == '!') {
+            break;
+        }
+        if (!strcasecmp(m->key, "cuesheet") || !strcasecmp (m->key, "log")) {
+            continue;
+        }
+
+        const char *value = m->value;
+        const char *end = value + m->valuesize;
+
+        if (is_uri) {
+            value = strrchr (value, '/');
+            if (value) {
+                value++;
+            }
+            else {
+                value = m->value;
+            }
+        }
+
+        do {
+            int len = (int)strlen(value);
+            if (u8_valid(value, len, NULL)) {
+                const char *p = value;
+                for (;;) {
+                    // room for the longest lowercase char, and the terminator
+                    if (size + 10 > alloc) {
+                        alloc = alloc ? alloc * 2 : 256;
+                        buf = realloc (buf, alloc);
+                    }
+                    if (!*p) {
+                        break;
+                    }
+                    int32_t i = 0;
+                    u8_nextchar (p, &i);
+                    size += u8_tolower ((const int8_t *)p, i, buf + size);
+                    p += i;
+                }
+                buf[size++] = 0;
+            }
+            value += len+1;
+        } while (value < end);
+    }
+
+    free (it->search_text);
+    it->search_text = buf ? buf : strdup ("");
+    it->search_text_size = size;
+    it->search_text_gen = it->modification_gen;
+}
+
+// returns 1 if any of the searchable values of the track contains lc
+static int
+pl_item_search_text_match (playItem_t *it, const char *lc, int lclen) {
+    pl_item_update_search_text (it);
+    const char *p = it->search_text;
+    const char *end = p + it->search_text_size;
+    while (p < end) {
+        int len = (int)strlen (p);
+        const char *v = p;
+        const char *last = p + len - lclen;
+        while (v <= last && (v = memchr (v, *lc, last - v + 1))) {
+            if (!memcmp (v, lc, lclen)) {
+                return 1;
+            }
+            v++;
+        }
+        p += len + 1;
+    }
+    return 0;
 }
 
 void
 plt_search_process2 (playlist_t *playlist, const char *text, int select_results) {
     LOCK;
-    plt_search_reset_int (playlist, select_results);
 
     // convert text to lowercase, to save some cycles
     char lc[1000];
@@ -3411,68 +4020,61 @@ plt_search_process2 (playlist_t *playlist, const char *text, int select_results)
     }
     *out = 0;
 
-    int lc_is_valid_u8 = u8_valid (lc, (int)strlen (lc), NULL);
-
-    playlist->search_cmpidx++;
-    if (playlist->search_cmpidx > 127) {
-        playlist->search_cmpidx = 1;
+    int lclen = (int)(out - lc);
+    int lc_is_valid_u8 = u8_valid (lc, lclen, NULL);
+
+    // When the new text contains the previous one, e.g. while typing,
+    // only the previous results can match, unless the playlist was modified since.
+    playItem_t **prev_results = NULL;
+    int prev_count = 0;
+    if (playlist->search_text
+        && *playlist->search_text
+        && playlist->search_meta_gen == pl_get_modification_gen ()
+        && strstr (lc, playlist->search_text)) {
+        prev_count = playlist->count[PL_SEARCH];
+        if (prev_count) {
+            prev_results = malloc (prev_count * sizeof (playItem_t *));
+            int idx = 0;
+            for (playItem_t *it = playlist->head[PL_SEARCH]; it; it = it->next[PL_SEARCH]) {
+                prev_results[idx++] = it;
+            }
+        }
+    }
+    else {
+        prev_count = -1;
     }
 
-    for (playItem_t *it = playlist->head[PL_MAIN]; it; it = it->next[PL_MAIN]) {
-        if (select_results) {
+    plt_search_reset_int (playlist, select_results);
+
+    if (select_results) {
+        for (playItem_t *it = playlist->head[PL_MAIN]; it; it = it->next[PL_MAIN]) {
             pl_set_selected_in_playlist(playlist, it, 0);
         }
-        if (*text) {
-            DB_metaInfo_t *m = NULL;
-            for (m = it->meta; m; m = m->next) {
-                int is_uri = !strcmp (m->key, ":URI");
-                if ((m->key[0] == ':' && !is_uri) || m->key[0] == '_' || m->key[0] == '!') {
-                    break;
-                }
-                if (!strcasecmp(m->key, "cuesheet") || !strcasecmp (m->key, "log")) {
-                    continue;
-                }
-
-                const char *value = m->value;
-                const char *end = value + m->valuesize;
+    }
 
-                if (is_uri) {
-                    value = strrchr (value, '/');
-                    if (value) {
-                        value++;
-                    }
-                    else {
-                        value = m->value;
-                    }
+    if (*text && lc_is_valid_u8) {
+        if (prev_count >= 0) {
+            for (int i = 0; i < prev_count; i++) {
+                if (pl_item_search_text_match (prev_results[i], lc, lclen)) {
+                    _plsearch_append (playlist, prev_results[i], select_results);
                 }
-
-                char cmp = *(m->value-1);
-
-                if (abs (cmp) == playlist->search_cmpidx) { // string was already compared in this search
-                    if (cmp > 0) { // it's a match -- append to search results
-                        _plsearch_append (playlist, it, select_results);
-                        break;
-                    }
-                }
-                else {
-                    int match = -playlist->search_cmpidx; // assume no match
-                    do {
-                        int len = (int)strlen(value);
-                        if (lc_is_valid_u8 && u8_valid(value, len, NULL) && utfcasestr_fast (value, lc)) {
-                            _plsearch_append (playlist, it, select_results);
-                            match = playlist->search_cmpidx; // it's a match
-                            break;
-                        }
-                        value += len+1;
-                    } while (value < end);
-                    *((char *)m->value-1) = match;
-                    if (match > 0) {
-                        break;
-                    }
+            }
+        }
+        else {
+            for (playItem_t *it = playlist->head[PL_MAIN]; it; it = it->next[PL_MAIN]) {
+                if (pl_item_search_text_match (it, lc, lclen)) {
+                    _plsearch_append (playlist, it, select_results);
                 }
             }
         }
     }
+
+    free (prev_results);
+
+    plt_search_forget (playlist);
+    playlist->search_text = strdup (lc);
+    playlist->search_meta_gen = pl_get_modification_gen ();
+
     UNLOCK;
 }
 
@@ -3758,11 +4360,14 @@ plt_add_dir2 (int visibility, playlist_t *plt, const char *dirname, int (*callba
     int prev = plt->ignore_archives;
     plt->ignore_archives = conf_get_int ("ignore_archives", 1);
 
+    plt->scan_threads = conf_get_int ("add_folders_threads", 1);
+
     int abort = 0;
     playItem_t *it = plt_insert_dir_int (visibility, plt, NULL, plt->tail[PL_MAIN], dirname, &abort, callback, user_data);
 
     plt->ignore_archives = prev;
     plt->follow_symlinks = prev_sl;
+    plt->scan_threads = 0;
     if (it) {
         // pl_insert_file doesn't hold reference, don't unref here
         return 0;
@@ -3780,11 +4385,13 @@ plt_insert_dir2 (int visibility, playlist_t *plt, playItem_t *after, const char
     int prev_sl = plt->follow_symlinks;
     plt->follow_symlinks = conf_get_int ("add_folders_follow_symlinks", 0);
     plt->ignore_archives = conf_get_int ("ignore_archives", 1);
+    plt->scan_threads = conf_get_int ("add_folders_threads", 1);
 
     playItem_t *ret = plt_insert_dir_int (visibility, plt, NULL, after, dirname, pabort, callback, user_data);
 
     plt->follow_symlinks = prev_sl;
     plt->ignore_archives = 0;
+    plt->scan_threads = 0;
     return ret;
 }
 
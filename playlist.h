@@ -51,8 +51,13 @@ typedef struct playItem_s {
     float _duration;
     uint32_t _flags;
     int _refc;
+    uint32_t modification_gen; // unique value, changes with every metadata change, see pl_item_touch
+    char *search_text; // lowercase searchable values separated by \0, built by plt_search_process2
+    int search_text_size;
+    uint32_t search_text_gen; // modification_gen which search_text was built for
     struct playItem_s *next[PL_MAX_ITERATORS]; // next item in linked list
     struct playItem_s *prev[PL_MAX_ITERATORS]; // prev item in linked list
+    int32_t row[PL_MAX_ITERATORS]; // cached row in playlist, valid while the playlist index is valid
     struct DB_metaInfo_s *meta; // linked list storing metainfo
     unsigned selected : 1;
     unsigned played : 1; // mark as played in shuffle mode
@@ -72,6 +77,9 @@ typedef struct playlist_s {
     playItem_t *head[PL_MAX_ITERATORS]; // head of linked list
     playItem_t *tail[PL_MAX_ITERATORS]; // tail of linked list
     int current_row[PL_MAX_ITERATORS]; // current row (cursor)
+    playItem_t **index[PL_MAX_ITERATORS]; // items by row, rebuilt lazily after list changes
+    int index_size[PL_MAX_ITERATORS]; // allocated size of index
+    int index_valid[PL_MAX_ITERATORS]; // 1 if index matches the linked list
     int scroll;
     struct DB_metaInfo_s *meta; // linked list storing metainfo
     int refc;
@@ -80,7 +88,11 @@ typedef struct playlist_s {
     int64_t cue_numsamples;
     int cue_samplerate;
 
-    int search_cmpidx;
+    char *search_text; // lowercase text of the last search, NULL if its results can't be refined
+    uint32_t search_meta_gen; // pl_get_modification_gen at the time of the last search
+
+    int scan_threads; // number of threads used by plt_insert_dir, serial scan if <= 1
+    struct playlist_s *scan_target; // set in the scratch playlists of the parallel scanner, to the playlist which the files are added to
     
     unsigned fast_mode : 1;
     unsigned files_adding : 1;
@@ -109,6 +121,11 @@ pl_unlock (void);
 //void
 //plt_unlock (void);
 
+// marks the row index of the specified iterator as outdated;
+// must be called after relinking items without plt_insert_item / plt_remove_item
+void
+plt_index_invalidate (playlist_t *plt, int iter);
+
 // playlist management functions
 
 // it is highly recommended to access that from inside plt_lock/unlock block
@@ -320,6 +337,16 @@ pl_delete_meta (playItem_t *it, const char *key);
 void
 pl_delete_all_meta (playItem_t *it);
 
+// Assigns a new modification_gen to the track,
+// which invalidates the cached title formatting results for it.
+// Called by all functions which modify the metadata.
+void
+pl_item_touch (playItem_t *it);
+
+// returns the most recent modification_gen of any track
+uint32_t
+pl_get_modification_gen (void);
+
 // returns index of 1st deleted item
 int
 plt_delete_selected (playlist_t *plt);
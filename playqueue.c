@@ -29,6 +29,7 @@
 #include <string.h>
 #include "playqueue.h"
 #include "messagepump.h"
+#include "streamer.h"
 
 #define PLAYQUEUE_SIZE 100
 static playItem_t *playqueue[100];
@@ -57,6 +58,7 @@ playqueue_push (playItem_t *it) {
     pl_item_ref (it);
     playqueue[playqueue_count++] = it;
     pl_unlock ();
+    streamer_notify_playlist_changed ();
     playqueue_send_trackinfochanged (it);
     return 0;
 }
@@ -70,6 +72,7 @@ playqueue_clear (void) {
     }
     playqueue_count = 0;
     pl_unlock ();
+    streamer_notify_playlist_changed ();
     messagepump_push (DB_EV_PLAYLISTCHANGED, 0, DDB_PLAYLIST_CHANGE_PLAYQUEUE, 0);
 }
 
@@ -84,6 +87,7 @@ playqueue_pop (void) {
         playqueue_send_trackinfochanged (playqueue[0]);
         pl_item_unref (playqueue[0]);
         pl_unlock ();
+        streamer_notify_playlist_changed ();
         return;
     }
     playItem_t *it = playqueue[0];
@@ -91,6 +95,7 @@ playqueue_pop (void) {
     playqueue_count--;
     pl_item_unref (it);
     pl_unlock ();
+    streamer_notify_playlist_changed ();
     messagepump_push (DB_EV_PLAYLISTCHANGED, 0, DDB_PLAYLIST_CHANGE_PLAYQUEUE, 0);
 }
 
@@ -118,6 +123,7 @@ playqueue_remove (playItem_t *it) {
         }
     }
     pl_unlock ();
+    streamer_notify_playlist_changed ();
 }
 
 int
@@ -171,6 +177,7 @@ playqueue_remove_nth (int n) {
 
     pl_item_unref (it);
     pl_unlock ();
+    streamer_notify_playlist_changed ();
     messagepump_push (DB_EV_PLAYLISTCHANGED, 0, DDB_PLAYLIST_CHANGE_PLAYQUEUE, 0);
 }
 
@@ -191,5 +198,6 @@ playqueue_insert_at (int n, playItem_t *it) {
     pl_item_ref (it);
     playqueue_count++;
     pl_unlock ();
+    streamer_notify_playlist_changed ();
     messagepump_push (DB_EV_PLAYLISTCHANGED, 0, DDB_PLAYLIST_CHANGE_PLAYQUEUE, 0);
 }
@@ -34,6 +34,18 @@
 #define LOCK {pl_lock();}
 #define UNLOCK {pl_unlock();}
 
+static uint32_t _modification_gen;
+
+void
+pl_item_touch (playItem_t *it) {
+    it->modification_gen = __atomic_add_fetch (&_modification_gen, 1, __ATOMIC_RELAXED);
+}
+
+uint32_t
+pl_get_modification_gen (void) {
+    return __atomic_load_n (&_modification_gen, __ATOMIC_RELAXED);
+}
+
 DB_metaInfo_t *
 pl_meta_for_key_with_override (playItem_t *it, const char *key) {
     pl_ensure_lock ();
@@ -77,6 +89,7 @@ pl_meta_free_values (DB_metaInfo_t *meta) {
     meta->valuesize = 0;
 }
 
+// the caller sets the value, and calls pl_item_touch after that
 DB_metaInfo_t *
 pl_add_empty_meta_for_key (playItem_t *it, const char *key) {
     // check if it's already set
@@ -184,6 +197,7 @@ pl_add_meta_full (playItem_t *it, const char *key, const char *value, int values
     }
 
     _meta_set_value (meta, value, valuesize);
+    pl_item_touch (it);
 }
 
 void
@@ -247,6 +261,7 @@ pl_append_meta_full (playItem_t *it, const char *key, const char *value, int siz
 
     if (!m->value) {
         _meta_set_value (m, value, size);
+        pl_item_touch (it);
         pl_unlock ();
         return;
     }
@@ -263,6 +278,7 @@ pl_append_meta_full (playItem_t *it, const char *key, const char *value, int siz
     m->value = metacache_add_value (buf, buflen);
     m->valuesize = (int)buflen;
     free (buf);
+    pl_item_touch (it);
     pl_unlock ();
 }
 
@@ -282,6 +298,7 @@ pl_replace_meta (playItem_t *it, const char *key, const char *value) {
         int l = (int)strlen (value) + 1;
         m->value = metacache_add_value(value, l);
         m->valuesize = l;
+        pl_item_touch (it);
         UNLOCK;
         return;
     }
@@ -328,6 +345,7 @@ pl_delete_meta (playItem_t *it, const char *key) {
             metacache_remove_string (m->key);
             pl_meta_free_values(m);
             free (m);
+            pl_item_touch (it);
             break;
         }
         prev = m;
@@ -415,6 +433,7 @@ pl_delete_metadata (playItem_t *it, DB_metaInfo_t *meta) {
             metacache_remove_string (m->key);
             pl_meta_free_values(m);
             free (m);
+            pl_item_touch (it);
             break;
         }
         prev = m;
@@ -446,6 +465,7 @@ pl_delete_all_meta (playItem_t *it) {
         }
         m = next;
     }
+    pl_item_touch (it);
 
     // delete replaygain fields
     extern const char *ddb_internal_rg_keys[];
@@ -505,4 +525,5 @@ pl_add_meta_copy (playItem_t *it, DB_metaInfo_t *meta) {
 
     m->value = metacache_add_value (meta->value, meta->valuesize);
     m->valuesize = meta->valuesize;
+    pl_item_touch (it);
 }
@@ -59,6 +59,7 @@
 #include "playqueue.h"
 #include "sort.h"
 #include "logger.h"
+#include "jobpool.h"
 #include "replaygain.h"
 #ifdef __APPLE__
 #include "cocoautil.h"
@@ -499,6 +500,15 @@ static DB_functions_t deadbeef_api = {
     .junk_get_tag_offsets = junk_get_tag_offsets,
 
     .plt_is_loading_cue = (int (*)(ddb_playlist_t *))plt_is_loading_cue,
+    .cancellation_token_alloc = cancellation_token_alloc,
+    .cancellation_token_ref = cancellation_token_ref,
+    .cancellation_token_unref = cancellation_token_unref,
+    .cancellation_token_cancel = cancellation_token_cancel,
+    .cancellation_token_is_cancelled = cancellation_token_is_cancelled,
+    .job_submit = jobpool_submit,
+    .job_wait = jobpool_wait,
+    .cond_wait_locked = cond_wait_locked,
+    .cond_wait_timeout_locked = cond_wait_timeout_locked,
 
 };
 
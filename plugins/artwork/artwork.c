@@ -34,7 +34,6 @@
 #include <dirent.h>
 #include <unistd.h>
 #include <fnmatch.h>
-#include <pthread.h>
 #include <errno.h>
 #include <sys/stat.h>
 #ifdef __linux__
@@ -85,16 +84,63 @@ typedef struct cover_callback_s {
 // list of unique queries
 typedef struct cover_query_s {
     cover_callback_t *callbacks;
-    struct cover_query_s *next;
+    int priority; // DDB_ARTWORK_FLAG_PRIORITY was set on any of the callbacks
+    int running; // a worker is processing the query
+
+    // set when a worker takes the query from the local queue
+    char *filepath;
+    char *album;
+    char *artist;
+    char *cache_path;
+    char *key; // the lookup result is shared by all queries with the same key
+    int generation; // the value of lru_generation when the key was made
+
+    struct cover_query_s *next; // the next query in the same queue
+    struct cover_query_s *next_inflight;
 } cover_query_t;
 
-static cover_query_t *queue;
-static cover_query_t *queue_tail;
+typedef struct {
+    cover_query_t *head;
+    cover_query_t *tail;
+} query_queue_t;
+
+// Local folder scans and tag extraction are done by up to LOCAL_WORKER_COUNT jobs in the shared job pool,
+// queries which need a web lookup are then passed to a single network worker,
+// so that a slow server doesn't hold up the local lookups.
+// The network lane has only one thread, since there can be only one abortable http request.
+#define LOCAL_WORKER_COUNT 4
+
+static query_queue_t queue; // waiting for a local worker
+static query_queue_t net_queue; // waiting for the network worker
+static cover_query_t *inflight; // taken by a worker, including the queries in net_queue
 static int terminate;
-static intptr_t tid;
+static ddb_cancellation_token_t *local_token;
+static int local_jobs; // number of submitted local jobs
+static int local_running; // number of queries being processed by the local jobs
+static int reset_pending; // a local job is waiting for the others to finish, to reset the cache
+static intptr_t net_tid;
+static int net_busy;
 static uintptr_t queue_mutex;
 static uintptr_t queue_cond;
 
+// In-memory LRU of the found covers, to serve repeated queries without touching the disk.
+// Protected by queue_mutex.
+#define COVER_LRU_MAX_ITEMS 256
+#define COVER_LRU_MAX_BLOB_BYTES (32*1024*1024)
+
+typedef struct cover_lru_item_s {
+    char *key;
+    ddb_cover_info_t *cover;
+    struct cover_lru_item_s *prev;
+    struct cover_lru_item_s *next;
+} cover_lru_item_t;
+
+static cover_lru_item_t *lru_head; // most recently used
+static cover_lru_item_t *lru_tail;
+static int lru_count;
+static uint64_t lru_blob_bytes;
+static int lru_generation;
+
 #ifdef ANDROID
 #define DEFAULT_DISABLE_CACHE 1
 #define DEFAULT_SAVE_TO_MUSIC_FOLDERS 1
@@ -1003,9 +1049,206 @@ make_cache_path (const char *filepath, const char *album, const char *artist, ch
 static void
 query_free (cover_query_t *query)
 {
+    free (query->filepath);
+    free (query->album);
+    free (query->artist);
+    free (query->cache_path);
+    free (query->key);
     free (query);
 }
 
+static void
+queue_push (query_queue_t *q, cover_query_t *query) {
+    // priority queries go first, the most recent one at the head,
+    // since it is the most likely to be still visible
+    if (query->priority) {
+        query->next = q->head;
+        q->head = query;
+        if (!q->tail) {
+            q->tail = query;
+        }
+        return;
+    }
+    query->next = NULL;
+    if (q->tail) {
+        q->tail->next = query;
+    }
+    else {
+        q->head = query;
+    }
+    q->tail = query;
+}
+
+static cover_query_t *
+queue_pop (query_queue_t *q) {
+    cover_query_t *query = q->head;
+    if (query) {
+        q->head = query->next;
+        if (!q->head) {
+            q->tail = NULL;
+        }
+        query->next = NULL;
+    }
+    return query;
+}
+
+static void
+queue_remove (query_queue_t *q, cover_query_t *query) {
+    cover_query_t *prev = NULL;
+    for (cover_query_t *i = q->head; i; prev = i, i = i->next) {
+        if (i == query) {
+            if (prev) {
+                prev->next = i->next;
+            }
+            else {
+                q->head = i->next;
+            }
+            if (q->tail == i) {
+                q->tail = prev;
+            }
+            i->next = NULL;
+            return;
+        }
+    }
+}
+
+static void
+inflight_remove (cover_query_t *query) {
+    for (cover_query_t **i = &inflight; *i; i = &(*i)->next_inflight) {
+        if (*i == query) {
+            *i = query->next_inflight;
+            query->next_inflight = NULL;
+            return;
+        }
+    }
+}
+
+static cover_query_t *
+inflight_find (const char *key) {
+    for (cover_query_t *q = inflight; q; q = q->next_inflight) {
+        if (!strcmp (q->key, key)) {
+            return q;
+        }
+    }
+    return NULL;
+}
+
+static void
+cover_info_retain (ddb_cover_info_t *cover) {
+    __atomic_add_fetch (&cover->refc, 1, __ATOMIC_ACQ_REL);
+}
+
+static void
+cover_info_free (ddb_cover_info_t *cover) {
+    if (__atomic_sub_fetch (&cover->refc, 1, __ATOMIC_ACQ_REL) != 0) {
+        return;
+    }
+    if (cover->type) {
+        free (cover->type);
+    }
+    if (cover->filename) {
+        free (cover->filename);
+    }
+    if (cover->blob) {
+        free (cover->blob);
+    }
+    free (cover);
+}
+
+static void
+lru_remove (cover_lru_item_t *item) {
+    if (item->prev) {
+        item->prev->next = item->next;
+    }
+    else {
+        lru_head = item->next;
+    }
+    if (item->next) {
+        item->next->prev = item->prev;
+    }
+    else {
+        lru_tail = item->prev;
+    }
+    lru_count--;
+    lru_blob_bytes -= item->cover->blob_size;
+}
+
+static void
+lru_push_front (cover_lru_item_t *item) {
+    item->prev = NULL;
+    item->next = lru_head;
+    if (lru_head) {
+        lru_head->prev = item;
+    }
+    else {
+        lru_tail = item;
+    }
+    lru_head = item;
+    lru_count++;
+    lru_blob_bytes += item->cover->blob_size;
+}
+
+static void
+lru_item_free (cover_lru_item_t *item) {
+    cover_info_free (item->cover);
+    free (item->key);
+    free (item);
+}
+
+// returns a retained cover, or NULL
+static ddb_cover_info_t *
+lru_find (const char *key) {
+    for (cover_lru_item_t *item = lru_head; item; item = item->next) {
+        if (!strcmp (item->key, key)) {
+            if (item != lru_head) {
+                lru_remove (item);
+                lru_push_front (item);
+            }
+            cover_info_retain (item->cover);
+            return item->cover;
+        }
+    }
+    return NULL;
+}
+
+static void
+lru_insert (const char *key, ddb_cover_info_t *cover) {
+    if (cover->blob_size > COVER_LRU_MAX_BLOB_BYTES / 4) {
+        return;
+    }
+
+    for (cover_lru_item_t *item = lru_head; item; item = item->next) {
+        if (!strcmp (item->key, key)) {
+            return;
+        }
+    }
+
+    cover_lru_item_t *item = calloc (1, sizeof (cover_lru_item_t));
+    if (!item) {
+        return;
+    }
+    item->key = strdup (key);
+    item->cover = cover;
+    cover_info_retain (cover);
+    lru_push_front (item);
+
+    while (lru_count > COVER_LRU_MAX_ITEMS || lru_blob_bytes > COVER_LRU_MAX_BLOB_BYTES) {
+        cover_lru_item_t *last = lru_tail;
+        lru_remove (last);
+        lru_item_free (last);
+    }
+}
+
+static void
+lru_clear (void) {
+    while (lru_head) {
+        cover_lru_item_t *item = lru_head;
+        lru_remove (item);
+        lru_item_free (item);
+    }
+    lru_generation++;
+}
+
 static void
 cache_reset_callback (int error, ddb_cover_query_t *query, ddb_cover_info_t *cover) {
     /* All scaled artwork is now (including this second) obsolete */
@@ -1057,10 +1300,30 @@ queries_equal (ddb_cover_query_t *q1, ddb_cover_query_t *q2) {
     return 0;
 }
 
+static void
+fetcher_job (void *ctx, ddb_cancellation_token_t *token);
+
+// Must be called with queue_mutex locked.
+static void
+start_local_job (int priority) {
+    if (terminate || local_jobs >= LOCAL_WORKER_COUNT) {
+        return;
+    }
+    if (!deadbeef->job_submit (priority ? DDB_JOB_PRIORITY_HIGH : DDB_JOB_PRIORITY_NORMAL, local_token, fetcher_job, NULL, NULL)) {
+        local_jobs++;
+    }
+}
+
 static void
 enqueue_query (ddb_cover_query_t *new_query, const ddb_cover_callback_t cb)
 {
-    for (cover_query_t *q = queue; q; q = q->next) {
+    if (!cb) {
+        return;
+    }
+
+    int priority = (new_query->flags & DDB_ARTWORK_FLAG_PRIORITY) ? 1 : 0;
+
+    for (cover_query_t *q = queue.head; q; q = q->next) {
         if (queries_equal (new_query, q->callbacks->info)) {
             // append top existing pending query
             cover_callback_t **last_callback = &q->callbacks;
@@ -1069,53 +1332,67 @@ enqueue_query (ddb_cover_query_t *new_query, const ddb_cover_callback_t cb)
             }
             if (!*last_callback) {
                 *last_callback = new_query_callback (cb, new_query);
+                if (priority) {
+                    // the track has become visible again, move it to the front
+                    queue_remove (&queue, q);
+                    q->priority = 1;
+                    queue_push (&queue, q);
+                }
                 return;
             }
         }
     }
 
+    for (cover_query_t *q = inflight; q; q = q->next_inflight) {
+        if (q->callbacks && queries_equal (new_query, q->callbacks->info)) {
+            cover_callback_t **last_callback = &q->callbacks;
+            while (*last_callback) {
+                last_callback = & (*last_callback)->next;
+            }
+            *last_callback = new_query_callback (cb, new_query);
+            return;
+        }
+    }
+
     // add new query
     cover_query_t *q = calloc (1, sizeof (cover_query_t));
     if (q) {
         q->callbacks = new_query_callback (cb, new_query);
+        if (!q->callbacks) {
+            free (q);
+            return;
+        }
     }
 
     if (!q) {
-        if (cb) {
-            cb (-1, new_query, NULL);
-        }
-
+        cb (-1, new_query, NULL);
         return;
     }
 
-    if (queue_tail) {
-        queue_tail->next = q;
-    }
-    else {
-        queue = q;
-    }
-    queue_tail = q;
-    deadbeef->cond_signal (queue_cond);
+    q->priority = priority;
+    queue_push (&queue, q);
+    start_local_job (priority);
 }
 
-static char *filter_custom_mask = NULL;
-
-static int
-filter_custom (const struct dirent *f)
-{
 // FNM_CASEFOLD is not defined on solaris. On other platforms it is.
 // It should be safe to define it as FNM_INGORECASE if it isn't defined.
 #ifndef FNM_CASEFOLD
 #define FNM_CASEFOLD FNM_IGNORECASE
 #endif
-    return !fnmatch (filter_custom_mask, f->d_name, FNM_CASEFOLD);
+
+// The directory entries are filtered after scandir, instead of using a scandir selector,
+// since the selector can't receive the mask without a global, and the lookups run on multiple threads.
+static int
+filter_custom (const char *mask, const struct dirent *f)
+{
+    return !fnmatch (mask, f->d_name, FNM_CASEFOLD);
 }
 
 static int
-vfs_scan_results (struct dirent *entry, const char *container_uri, ddb_cover_info_t *cover)
+vfs_scan_results (const char *mask, struct dirent *entry, const char *container_uri, ddb_cover_info_t *cover)
 {
-    /* VFS container, double check the match in case scandir didn't implement filtering */
-    if (filter_custom (entry)) {
+    /* VFS container */
+    if (filter_custom (mask, entry)) {
         trace ("found cover %s in %s\n", entry->d_name, container_uri);
         size_t len = strlen (container_uri) + strlen(entry->d_name) + 2;
         cover->filename = malloc (len);
@@ -1127,81 +1404,78 @@ vfs_scan_results (struct dirent *entry, const char *container_uri, ddb_cover_inf
 }
 
 static int
-dir_scan_results (struct dirent **files, int files_count, const char *container, ddb_cover_info_t *cover)
+dir_scan_results (const char *mask, struct dirent *entry, const char *container, ddb_cover_info_t *cover)
 {
     /* Local file in a directory */
-    for (size_t i = 0; i < files_count; i++) {
-        trace ("found cover %s in local folder\n", files[0]->d_name);
-        size_t len = strlen (container) + strlen(files[i]->d_name) + 2;
-        cover->filename = malloc (len);
-        snprintf (cover->filename, len, "%s/%s", container, files[i]->d_name);
-        struct stat stat_struct;
-        if (!stat (cover->filename, &stat_struct) && S_ISREG (stat_struct.st_mode) && stat_struct.st_size > 0) {
-            return 0;
-        }
-        else {
-            free (cover->filename);
-            cover->filename = NULL;
-        }
+    if (!filter_custom (mask, entry)) {
+        return -1;
+    }
+    trace ("found cover %s in local folder\n", entry->d_name);
+    size_t len = strlen (container) + strlen(entry->d_name) + 2;
+    cover->filename = malloc (len);
+    snprintf (cover->filename, len, "%s/%s", container, entry->d_name);
+    struct stat stat_struct;
+    if (!stat (cover->filename, &stat_struct) && S_ISREG (stat_struct.st_mode) && stat_struct.st_size > 0) {
+        return 0;
     }
 
+    free (cover->filename);
+    cover->filename = NULL;
     return -1;
 }
 
+static void
+free_dir_entries (struct dirent **files, int files_count) {
+    for (size_t i = 0; i < files_count; i++) {
+        free (files[i]);
+    }
+    free (files);
+}
+
 static int
 scan_local_path (char *mask, const char *local_path, const char *uri, DB_vfs_t *vfsplug, ddb_cover_info_t *cover)
 {
-    filter_custom_mask = mask;
     struct dirent **files;
     int (* custom_scandir)(const char *, struct dirent ***, int (*)(const struct dirent *), int (*)(const struct dirent **, const struct dirent **));
     custom_scandir = vfsplug ? vfsplug->scandir : scandir;
-    int files_count = custom_scandir (local_path, &files, filter_custom, NULL);
+    int files_count = custom_scandir (local_path, &files, NULL, NULL);
     if (files_count > 0) {
         int err = -1;
-        if (uri) {
-            err = vfs_scan_results (files[0], uri, cover);
-        }
-        else {
-            err = dir_scan_results (files, files_count, local_path, cover);
-        }
-
-        for (size_t i = 0; i < files_count; i++) {
-            free (files[i]);
+        for (size_t i = 0; i < files_count && err; i++) {
+            if (uri) {
+                err = vfs_scan_results (mask, files[i], uri, cover);
+            }
+            else {
+                err = dir_scan_results (mask, files[i], local_path, cover);
+            }
         }
-        free (files);
 
+        free_dir_entries (files, files_count);
         return err;
     }
 
     return -1;
 }
 
-static const char *filter_strcasecmp_name = NULL;
-
-static int
-filter_strcasecmp (const struct dirent *f)
-{
-    return !strcasecmp (filter_strcasecmp_name, f->d_name);
-}
-
 // FIXME: this returns only one path that matches subfolder. Usually that's enough, but can be improved.
 static char *
 get_case_insensitive_path (const char *local_path, const char *subfolder, DB_vfs_t *vfsplug) {
-    filter_strcasecmp_name = subfolder;
     struct dirent **files;
     int (* custom_scandir)(const char *, struct dirent ***, int (*)(const struct dirent *), int (*)(const struct dirent **, const struct dirent **));
     custom_scandir = vfsplug ? vfsplug->scandir : scandir;
-    int files_count = custom_scandir (local_path, &files, filter_strcasecmp, NULL);
+    int files_count = custom_scandir (local_path, &files, NULL, NULL);
     if (files_count > 0) {
-        size_t l = strlen (local_path) + strlen (files[0]->d_name) + 2;
-        char *ret = malloc (l);
-        snprintf (ret, l, "%s/%s", local_path, files[0]->d_name);
-
+        char *ret = NULL;
         for (size_t i = 0; i < files_count; i++) {
-            free (files[i]);
+            if (!strcasecmp (subfolder, files[i]->d_name)) {
+                size_t l = strlen (local_path) + strlen (files[i]->d_name) + 2;
+                ret = malloc (l);
+                snprintf (ret, l, "%s/%s", local_path, files[i]->d_name);
+                break;
+            }
         }
-        free (files);
 
+        free_dir_entries (files, files_count);
         return ret;
     }
     return NULL;
@@ -1242,6 +1516,9 @@ local_image_file (const char *local_path, const char *uri, DB_vfs_t *vfsplug, dd
             path = get_case_insensitive_path (local_path, folder, vfsplug);
             folder += strlen (folder)+1;
         }
+        if (!path) {
+            continue;
+        }
         trace ("scanning %s for artwork\n", path);
         for (char *mask = filemask; mask < filemask_end; mask += strlen (mask)+1) {
             if (mask[0] && !scan_local_path (mask, path, uri, vfsplug, cover)) {
@@ -1776,22 +2053,27 @@ recheck_missing_artwork (const char *input_fname, const time_t placeholder_mtime
 }
 #endif
 
+static int
+web_lookups_enabled (void)
+{
+#ifdef USE_VFS_CURL
+    return artwork_enable_lfm || artwork_enable_mb || artwork_enable_aao || artwork_enable_wos;
+#else
+    return 0;
+#endif
+}
+
 // Behavior:
 // Local cover: path is returned
 // Found in cache: path is returned
 // Embedded cover: !cache_disabled ? save_to_cash&return_path : return blob
 // Web cover: save_to_local ? save_to_local&return_path : ( !cache_disabled ? save_to_cache&return_path : NOP )
+//
+// The lookup is split in two stages, process_local_query runs on the local workers,
+// and process_web_query on the network worker.
 static int
-process_query (const char *filepath, const char *album, const char *artist, ddb_cover_info_t *cover)
+process_local_query (const char *filepath, const char *cache_path, ddb_cover_info_t *cover)
 {
-    char cache_path_buf[PATH_MAX];
-    char *cache_path = NULL;
-
-    if (!artwork_disable_cache) {
-        cache_path = cache_path_buf;
-        make_cache_path (filepath, album, artist, cache_path, sizeof (cache_path_buf));
-    }
-
 #if 0
 #warning FIXME not needed during development; also this assumes that disk cache is used for everything
     /* Flood control, don't retry missing artwork for an hour unless something changes */
@@ -1859,6 +2141,12 @@ process_query (const char *filepath, const char *album, const char *artist, ddb_
 #endif
     }
 
+    return 0;
+}
+
+static int
+process_web_query (const char *filepath, char *album, const char *artist, const char *cache_path, ddb_cover_info_t *cover)
+{
     if (!cache_path) {
         return 0;
     }
@@ -1903,10 +2191,9 @@ process_query (const char *filepath, const char *album, const char *artist, ddb_
 static void
 send_query_callbacks (cover_callback_t *callback, ddb_cover_info_t *cover) {
     if (cover) {
-        cover->refc = 0;
         cover_callback_t *c = callback;
         while (c) {
-            cover->refc++;
+            cover_info_retain (cover);
             c = c->next;
         }
     }
@@ -1918,128 +2205,234 @@ send_query_callbacks (cover_callback_t *callback, ddb_cover_info_t *cover) {
     }
 }
 
-static cover_query_t *
-query_pop (void) {
-    cover_query_t *query = queue;
-    queue = queue ? queue->next : NULL;
-    if (!queue) {
-        queue_tail = NULL;
-    }
-    return query;
+// Detach all queued queries, the callbacks need to be called after unlocking queue_mutex.
+static cover_callback_t *
+queue_clear (void) {
+    cover_callback_t *callbacks = NULL;
+    cover_callback_t **tail = &callbacks;
+    cover_query_t *query;
+    while ((query = queue_pop (&queue)) || (query = queue_pop (&net_queue))) {
+        inflight_remove (query);
+        *tail = query->callbacks;
+        while (*tail) {
+            tail = &(*tail)->next;
+        }
+        query->callbacks = NULL;
+        query_free (query);
+    }
+    return callbacks;
 }
 
+// Fill in the query fields, which are needed for the lookup.
 static void
-queue_clear (void) {
-    while (queue) {
-        cover_query_t *next = queue->next;
-        send_query_callbacks (queue->callbacks, NULL);
-        query_free (queue);
-        queue = next;
+query_prepare (cover_query_t *query, ddb_playItem_t *track) {
+    deadbeef->pl_lock ();
+    query->filepath = strdup (deadbeef->pl_find_meta (track, ":URI"));
+    deadbeef->pl_unlock ();
+
+    char album[1000];
+    char artist[1000];
+    ddb_tf_context_t ctx;
+    memset (&ctx, 0, sizeof (ctx));
+    ctx._size = sizeof (ddb_tf_context_t);
+    ctx.it = track;
+    deadbeef->tf_eval (&ctx, album_tf, album, sizeof (album));
+    deadbeef->tf_eval (&ctx, artist_tf, artist, sizeof (artist));
+    query->album = strdup (album);
+    query->artist = strdup (artist);
+
+    if (!artwork_disable_cache) {
+        char cache_path[PATH_MAX];
+        if (!make_cache_path (query->filepath, album, artist, cache_path, sizeof (cache_path))) {
+            query->cache_path = strdup (cache_path);
+        }
     }
-    queue_tail = NULL;
+
+    // Same as the disk cache, the covers are shared by album/artist,
+    // but only within the same folder, since local covers are found per folder.
+    char *dir = strdup (query->filepath);
+    const char *dname = dirname (dir);
+    const char *key_album = *album ? album : query->filepath;
+    size_t len = strlen (dname) + strlen (key_album) + strlen (artist) + 3;
+    query->key = malloc (len);
+    snprintf (query->key, len, "%s\n%s\n%s", dname, key_album, artist);
+    free (dir);
 }
 
+// Must be called with queue_mutex locked, and returns with queue_mutex locked.
 static void
-cover_info_free (ddb_cover_info_t *cover) {
-    cover->refc--;
-    if (cover->refc != 0) {
-        return;
+query_finish (cover_query_t *query, ddb_cover_info_t *cover) {
+    inflight_remove (query);
+    if (cover && query->generation == lru_generation) {
+        lru_insert (query->key, cover);
     }
-    if (cover->type) {
-        free (cover->type);
+    cover_callback_t *callbacks = query->callbacks;
+    query->callbacks = NULL;
+    deadbeef->mutex_unlock (queue_mutex);
+
+    if (cover) {
+        trace ("artwork fetcher: cover art file found: %s\n", cover->filename);
     }
-    if (cover->filename) {
-        free (cover->filename);
+    else {
+        trace ("artwork fetcher: no cover art found\n");
     }
-    if (cover->blob) {
-        free (cover->blob);
+    send_query_callbacks (callbacks, cover);
+    query_free (query);
+
+    deadbeef->mutex_lock (queue_mutex);
+}
+
+// The query without a track is a barrier for cache reset, all covers found so far are obsolete.
+// The queries taken by the other local jobs before the barrier are finished first,
+// so that no cover found with the old settings is sent after the reset.
+// Called with queue_mutex locked, returns with queue_mutex locked.
+static void
+process_cache_reset (cover_query_t *query)
+{
+    reset_pending = 1;
+    while (local_running > 0) {
+        deadbeef->cond_wait_locked (queue_cond, queue_mutex);
+    }
+    lru_clear ();
+    deadbeef->mutex_unlock (queue_mutex);
+    send_query_callbacks (query->callbacks, NULL);
+    query->callbacks = NULL;
+    query_free (query);
+    deadbeef->mutex_lock (queue_mutex);
+    reset_pending = 0;
+
+    // the other local jobs have stopped, start them again if there's more work
+    for (int i = local_jobs; i < LOCAL_WORKER_COUNT && queue.head; i++) {
+        start_local_job (queue.head->priority);
     }
-    free (cover);
 }
 
+// Called with queue_mutex locked, returns with queue_mutex locked.
 static void
-fetcher_thread (void *none)
+process_local_queue_item (cover_query_t *query)
 {
-#ifdef __linux__
-    prctl (PR_SET_NAME, "deadbeef-artwork", 0, 0, 0, 0);
-#endif
+    ddb_playItem_t *track = query->callbacks->info->track;
 
-    /* Loop until external terminate command */
+    query->generation = lru_generation;
+    deadbeef->mutex_unlock (queue_mutex);
+    query_prepare (query, track);
     deadbeef->mutex_lock (queue_mutex);
-    while (!terminate) {
-        trace ("artwork fetcher: waiting for signal ...\n");
-        // FIXME: use deadbeef->cond_wait
-        pthread_cond_wait ((pthread_cond_t *)queue_cond, (pthread_mutex_t *)queue_mutex);
-        trace ("artwork fetcher: cond signalled, process queue\n");
 
-        /* Loop until queue is empty */
-        while (queue) {
-            deadbeef->mutex_unlock (queue_mutex);
+    ddb_cover_info_t *cover = lru_find (query->key);
+    if (cover) {
+        query_finish (query, cover);
+        deadbeef->mutex_unlock (queue_mutex);
+        cover_info_free (cover);
+        deadbeef->mutex_lock (queue_mutex);
+        return;
+    }
 
-            ddb_cover_query_t *info = queue->callbacks->info;
+    cover_query_t *same = inflight_find (query->key);
+    if (same) {
+        // the same cover is being looked up already, it will be sent to all the callbacks
+        cover_callback_t **last_callback = &same->callbacks;
+        while (*last_callback) {
+            last_callback = & (*last_callback)->next;
+        }
+        *last_callback = query->callbacks;
+        query->callbacks = NULL;
+        query_free (query);
+        return;
+    }
 
-            if (!info->track) {
-                deadbeef->mutex_lock (queue_mutex);
-                cover_query_t *query = query_pop ();
-                deadbeef->mutex_unlock (queue_mutex);
+    query->running = 1;
+    query->next_inflight = inflight;
+    inflight = query;
+    deadbeef->mutex_unlock (queue_mutex);
 
-                send_query_callbacks (query->callbacks, NULL);
-                query_free (query);
+    cover = calloc (sizeof (ddb_cover_info_t), 1);
+    cover->refc = 1;
 
-                /* Look for what to do next */
-                deadbeef->mutex_lock (queue_mutex);
-                continue;
-            }
+    int cover_found = process_local_query (query->filepath, query->cache_path, cover);
+    int need_web = !cover_found && query->cache_path && web_lookups_enabled ();
+    if (!cover_found && query->cache_path && !need_web) {
+        /* Touch placeholder */
+        write_file (query->cache_path, NULL, 0);
+    }
 
-            /* Process this query, hopefully writing a file into cache */
-            ddb_cover_info_t *cover = calloc (sizeof (ddb_cover_info_t), 1);
+    deadbeef->mutex_lock (queue_mutex);
+    query->running = 0;
+    if (need_web && query->callbacks && !terminate) {
+        queue_push (&net_queue, query);
+        deadbeef->cond_broadcast (queue_cond);
+    }
+    else if (need_web) {
+        // all callers cancelled the query, or the plugin is stopping
+        query_finish (query, NULL);
+    }
+    else {
+        query_finish (query, cover_found ? cover : NULL);
+    }
+    deadbeef->mutex_unlock (queue_mutex);
+    cover_info_free (cover);
+    deadbeef->mutex_lock (queue_mutex);
+}
 
-            if (!album_tf) {
-                album_tf = deadbeef->tf_compile ("%album%");
-            }
-            if (!artist_tf) {
-                artist_tf = deadbeef->tf_compile ("%artist%");
-            }
+// Processes the local queue until it's empty, a new job is started by the next query.
+static void
+fetcher_job (void *ctx, ddb_cancellation_token_t *token)
+{
+    deadbeef->mutex_lock (queue_mutex);
+    while (!terminate && !reset_pending && !deadbeef->cancellation_token_is_cancelled (token)) {
+        cover_query_t *query = queue_pop (&queue);
+        if (!query) {
+            break;
+        }
 
-            deadbeef->pl_lock ();
-            char *filepath = strdupa (deadbeef->pl_find_meta (info->track, ":URI"));
-            deadbeef->pl_unlock ();
+        if (!query->callbacks->info->track) {
+            process_cache_reset (query);
+            continue;
+        }
 
-            char album[1000];
-            char artist[1000];
-            ddb_tf_context_t ctx;
-            ctx._size = sizeof (ddb_tf_context_t);
-            ctx.it = info->track;
-            deadbeef->tf_eval (&ctx, album_tf, album, sizeof (album));
-            deadbeef->tf_eval (&ctx, artist_tf, artist, sizeof (artist));
-            
-            int cover_found = process_query (filepath, album, artist, cover);
+        local_running++;
+        process_local_queue_item (query);
+        local_running--;
+        if (reset_pending && !local_running) {
+            deadbeef->cond_broadcast (queue_cond);
+        }
+    }
+    local_jobs--;
+    deadbeef->mutex_unlock (queue_mutex);
+}
 
-            deadbeef->mutex_lock (queue_mutex);
-            cover_query_t *query = query_pop ();
-            deadbeef->mutex_unlock (queue_mutex);
+static void
+net_fetcher_thread (void *none)
+{
+#ifdef __linux__
+    prctl (PR_SET_NAME, "deadbeef-artnet", 0, 0, 0, 0);
+#endif
 
-            if (!query) {
-                break;
-            }
+    deadbeef->mutex_lock (queue_mutex);
+    while (!terminate) {
+        cover_query_t *query = queue_pop (&net_queue);
+        if (!query) {
+            deadbeef->cond_wait_locked (queue_cond, queue_mutex);
+            continue;
+        }
 
-            /* Make all the callbacks (and free the chain), with data if a file was written */
-            if (cover_found) {
-                trace ("artwork fetcher: cover art file found: %s\n", cover->filename);
-                send_query_callbacks (query->callbacks, cover);
-            }
-            else {
-                trace ("artwork fetcher: no cover art found\n");
-                send_query_callbacks (query->callbacks, NULL);
-            }
-            query_free (query);
+        query->running = 1;
+        net_busy = 1;
+        deadbeef->mutex_unlock (queue_mutex);
 
-            /* Look for what to do next */
-            deadbeef->mutex_lock (queue_mutex);
-        }
+        ddb_cover_info_t *cover = calloc (sizeof (ddb_cover_info_t), 1);
+        cover->refc = 1;
+        int cover_found = process_web_query (query->filepath, query->album, query->artist, query->cache_path, cover);
+
+        deadbeef->mutex_lock (queue_mutex);
+        net_busy = 0;
+        query->running = 0;
+        query_finish (query, cover_found ? cover : NULL);
+        deadbeef->mutex_unlock (queue_mutex);
+        cover_info_free (cover);
+        deadbeef->mutex_lock (queue_mutex);
     }
     deadbeef->mutex_unlock (queue_mutex);
-    trace ("artwork fetcher: terminate thread\n");
+    trace ("artwork network fetcher: terminate thread\n");
 }
 
 static void
@@ -2049,12 +2442,57 @@ cover_get (ddb_cover_query_t *query, ddb_cover_callback_t callback) {
     deadbeef->mutex_unlock (queue_mutex);
 }
 
+static cover_callback_t *
+query_cancel (cover_query_t *q, ddb_cover_query_t *info) {
+    for (cover_callback_t **c = &q->callbacks; *c; c = &(*c)->next) {
+        if ((*c)->info == info) {
+            cover_callback_t *callback = *c;
+            *c = callback->next;
+            callback->next = NULL;
+            return callback;
+        }
+    }
+    return NULL;
+}
+
+static void
+cover_cancel (ddb_cover_query_t *info) {
+    cover_callback_t *callback = NULL;
+    deadbeef->mutex_lock (queue_mutex);
+    for (cover_query_t *q = queue.head; q && !callback; q = q->next) {
+        callback = query_cancel (q, info);
+        if (callback && !q->callbacks) {
+            queue_remove (&queue, q);
+            query_free (q);
+            break;
+        }
+    }
+    for (cover_query_t *q = inflight; q && !callback; q = q->next_inflight) {
+        if (q->running) {
+            // being processed, the callback will be called with the result
+            continue;
+        }
+        // waiting for the network worker
+        callback = query_cancel (q, info);
+        if (callback && !q->callbacks) {
+            queue_remove (&net_queue, q);
+            inflight_remove (q);
+            query_free (q);
+            break;
+        }
+    }
+    deadbeef->mutex_unlock (queue_mutex);
+
+    send_query_callbacks (callback, NULL);
+}
+
 static void
 artwork_reset (void) {
     trace ("artwork: reset queue\n");
     deadbeef->mutex_lock (queue_mutex);
-    queue_clear ();
+    cover_callback_t *callbacks = queue_clear ();
     deadbeef->mutex_unlock (queue_mutex);
+    send_query_callbacks (callbacks, NULL);
 }
 
 static void
@@ -2239,22 +2677,33 @@ artwork_get_actions (DB_playItem_t *it)
 static int
 artwork_plugin_stop (void)
 {
-    if (tid) {
-        trace ("Stopping fetcher thread ... \n");
+    if (queue_mutex && queue_cond) {
+        trace ("Stopping fetcher threads ... \n");
         deadbeef->mutex_lock (queue_mutex);
-        queue_clear ();
+        cover_callback_t *callbacks = queue_clear ();
         terminate = 1;
-        deadbeef->cond_signal (queue_cond);
-        while (queue) {
+        deadbeef->cond_broadcast (queue_cond);
+        while (net_busy) {
             artwork_abort_http_request ();
             deadbeef->mutex_unlock (queue_mutex);
             usleep (10000);
             deadbeef->mutex_lock (queue_mutex);
         }
         deadbeef->mutex_unlock (queue_mutex);
-        deadbeef->thread_join (tid);
-        tid = 0;
-        trace ("Fetcher thread stopped\n");
+        send_query_callbacks (callbacks, NULL);
+        if (local_token) {
+            deadbeef->cancellation_token_cancel (local_token);
+            deadbeef->job_wait (local_token);
+            deadbeef->cancellation_token_unref (local_token);
+            local_token = NULL;
+        }
+        local_jobs = 0;
+        if (net_tid) {
+            deadbeef->thread_join (net_tid);
+            net_tid = 0;
+        }
+        lru_clear ();
+        trace ("Fetcher threads stopped\n");
     }
     if (queue_mutex) {
         deadbeef->mutex_free (queue_mutex);
@@ -2299,10 +2748,15 @@ artwork_plugin_start (void)
     terminate = 0;
     queue_mutex = deadbeef->mutex_create_nonrecursive ();
     queue_cond = deadbeef->cond_create ();
+    album_tf = deadbeef->tf_compile ("%album%");
+    artist_tf = deadbeef->tf_compile ("%artist%");
+    int started = 0;
     if (queue_mutex && queue_cond) {
-        tid = deadbeef->thread_start_low_priority (fetcher_thread, NULL);
+        local_token = deadbeef->cancellation_token_alloc ();
+        net_tid = deadbeef->thread_start_low_priority (net_fetcher_thread, NULL);
+        started = net_tid != 0;
     }
-    if (!tid) {
+    if (!started) {
         artwork_plugin_stop ();
         return -1;
     }
@@ -2384,6 +2838,7 @@ static ddb_artwork_plugin_t plugin = {
     .cover_get = cover_get,
     .reset = artwork_reset,
     .cover_info_free = cover_info_free,
+    .cancel = cover_cancel,
 };
 
 DB_plugin_t *
@@ -25,7 +25,7 @@
 #define __ARTWORK_H
 
 #define DDB_ARTWORK_MAJOR_VERSION 2
-#define DDB_ARTWORK_MINOR_VERSION 0
+#define DDB_ARTWORK_MINOR_VERSION 1
 
 // The flags below can be used in the `flags` member of the `ddb_cover_query_t` structure,
 // and can be OR'ed together.
@@ -47,6 +47,11 @@ enum {
 
     // Don't allow writing files to disk cache, even if the cache is enabled in the settings
     DDB_ARTWORK_FLAG_NO_CACHE = 0x00000004,
+
+    // The query is for an item which is currently visible, and should be processed before the others.
+    // The most recent priority query is processed first.
+    // Since artwork 2.1
+    DDB_ARTWORK_FLAG_PRIORITY = 0x00000008,
 };
 
 // This structure needs to be passed to cover_get.
@@ -112,6 +117,13 @@ typedef struct {
     // Free dynamically allocated data pointed by `cover`.
     void
     (*cover_info_free) (ddb_cover_info_t *cover);
+
+    // Cancel a query, which was passed to `cover_get`, e.g. when the item has been scrolled out of view.
+    // If the query hasn't been processed yet, its callback is called with an error before `cancel` returns.
+    // Otherwise the callback is called normally.
+    // Since artwork 2.1
+    void
+    (*cancel) (ddb_cover_query_t *query);
 } ddb_artwork_plugin_t;
 
 #endif /*__ARTWORK_H*/
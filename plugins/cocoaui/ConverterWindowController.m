@@ -47,11 +47,14 @@ static NSString *default_format = @"[%tracknumber%. ][%artist% - ]%title%";
     ddb_encoder_preset_t *_encoder_preset;
     ddb_dsp_preset_t *_dsp_preset;
     int _cancelled;
+    int _jobs_started;
     NSInteger _overwritePromptResult;
     BOOL _working;
     NSInteger _bypassSameFormatState;
     NSInteger _retagAfterCopyState;
 }
+- (int)prepareJob:(ddb_converter_job_t *)job;
+- (void)jobStarted:(ddb_converter_job_t *)job;
 @end
 
 static NSMutableArray *g_converterControllers;
@@ -708,8 +711,23 @@ static NSMutableArray *g_converterControllers;
     });
 }
 
+static int
+converter_job_prepare (ddb_converter_job_t *job, void *user_data) {
+    ConverterWindowController *ctl = (__bridge ConverterWindowController *)user_data;
+    return [ctl prepareJob:job];
+}
+
+static void
+converter_job_state_changed (ddb_converter_job_t *job, void *user_data) {
+    if (job->state == DDB_CONVERTER_JOB_RUNNING) {
+        ConverterWindowController *ctl = (__bridge ConverterWindowController *)user_data;
+        [ctl jobStarted:job];
+    }
+}
+
 - (void)converterWorker {
     deadbeef->background_job_increment ();
+    _jobs_started = 0;
 
     char root[2000] = "";
     size_t rootlen = 0;
@@ -756,57 +774,21 @@ static NSMutableArray *g_converterControllers;
         .rewrite_tags_after_copy = (_retagAfterCopyState == NSOnState),
     };
 
+    ddb_converter_job_t *jobs = calloc (_convert_items_count, sizeof (ddb_converter_job_t));
     for (int n = 0; n < _convert_items_count; n++) {
-        deadbeef->pl_lock ();
-        NSString *text = [NSString stringWithUTF8String:deadbeef->pl_find_meta (_convert_items[n], ":URI")];
-        deadbeef->pl_unlock ();
         char outpath[PATH_MAX];
         _converter_plugin->get_output_path2 (_convert_items[n], _convert_playlist, [_outfolder UTF8String], [_outfile UTF8String], _encoder_preset, _preserve_folder_structure, root, _write_to_source_folder, outpath, sizeof (outpath));
-        NSString *nsoutpath = [NSString stringWithUTF8String:outpath];
-
-        dispatch_async(dispatch_get_main_queue(), ^{
-            [_progressBar setDoubleValue:n];
-            [_progressText setStringValue:text];
-            [_progressOutText setStringValue:nsoutpath];
-            [_progressNumeric setStringValue:[NSString stringWithFormat:@"%d/%d", n+1, _convert_items_count]];
-        });
-
-        int skip = 0;
-        char *real_out = realpath(outpath, NULL);
-        if (real_out) {
-            skip = 1;
-            deadbeef->pl_lock();
-            char *real_in = realpath(deadbeef->pl_find_meta(_convert_items[n], ":URI"), NULL);
-            deadbeef->pl_unlock();
-            const int paths_match = real_in && !strcmp(real_in, real_out);
-            free(real_in);
-            free(real_out);
-            if (paths_match) {
-                fprintf (stderr, "converter: destination file is the same as source file, skipping\n");
-            }
-            else if (_overwrite_action == 2) {
-                unlink (outpath);
-                skip = 0;
-            }
-            else {
-                NSInteger result = [self overwritePrompt:[NSString stringWithUTF8String:outpath]];
-                if (result == NSAlertSecondButtonReturn) {
-                    unlink (outpath);
-                    skip = 0;
-                }
-                else if (result == NSAlertThirdButtonReturn) {
-                    _cancelled = YES;
-                }
-            }
-        }
+        jobs[n].it = _convert_items[n];
+        jobs[n].outpath = strdup (outpath);
+    }
 
-        if (!skip) {
-            _converter_plugin->convert2 (&settings, _convert_items[n], outpath, &_cancelled);
-        }
-        if (_cancelled) {
-            break;
-        }
+    _converter_plugin->convert_batch (&settings, jobs, _convert_items_count, 0, converter_job_prepare, converter_job_state_changed, (__bridge void *)self, &_cancelled);
+
+    for (int n = 0; n < _convert_items_count; n++) {
+        free ((char *)jobs[n].outpath);
     }
+    free (jobs);
+
     dispatch_async(dispatch_get_main_queue(), ^{
         [_progressPanel close];
         [self converterFinished:self withResult:1];
@@ -817,6 +799,54 @@ static NSMutableArray *g_converterControllers;
     _working = NO;
 }
 
+// called by the converter before converting each track, never concurrently
+- (int)prepareJob:(ddb_converter_job_t *)job {
+    int skip = 0;
+    char *real_out = realpath(job->outpath, NULL);
+    if (real_out) {
+        skip = 1;
+        deadbeef->pl_lock();
+        char *real_in = realpath(deadbeef->pl_find_meta(job->it, ":URI"), NULL);
+        deadbeef->pl_unlock();
+        const int paths_match = real_in && !strcmp(real_in, real_out);
+        free(real_in);
+        free(real_out);
+        if (paths_match) {
+            fprintf (stderr, "converter: destination file is the same as source file, skipping\n");
+        }
+        else if (_overwrite_action == 2) {
+            unlink (job->outpath);
+            skip = 0;
+        }
+        else {
+            NSInteger result = [self overwritePrompt:[NSString stringWithUTF8String:job->outpath]];
+            if (result == NSAlertSecondButtonReturn) {
+                unlink (job->outpath);
+                skip = 0;
+            }
+            else if (result == NSAlertThirdButtonReturn) {
+                skip = -1;
+            }
+        }
+    }
+    return skip;
+}
+
+- (void)jobStarted:(ddb_converter_job_t *)job {
+    deadbeef->pl_lock ();
+    NSString *text = [NSString stringWithUTF8String:deadbeef->pl_find_meta (job->it, ":URI")];
+    deadbeef->pl_unlock ();
+    NSString *nsoutpath = [NSString stringWithUTF8String:job->outpath];
+    int n = __atomic_add_fetch (&_jobs_started, 1, __ATOMIC_SEQ_CST);
+
+    dispatch_async(dispatch_get_main_queue(), ^{
+        [_progressBar setDoubleValue:n-1];
+        [_progressText setStringValue:text];
+        [_progressOutText setStringValue:nsoutpath];
+        [_progressNumeric setStringValue:[NSString stringWithFormat:@"%d/%d", n, _convert_items_count]];
+    });
+}
+
 - (NSInteger)overwritePrompt:(NSString *)path {
     _overwritePromptCondition = [[NSCondition alloc] init];
     dispatch_sync(dispatch_get_main_queue(), ^{
@@ -168,6 +168,8 @@ static void cover_loaded_callback (int error, ddb_cover_query_t *query, ddb_cove
 //    NSLog (@"! %@", hash);
     ddb_cover_query_t *query = calloc (sizeof (ddb_cover_query_t), 1);
     query->_size = sizeof (ddb_cover_query_t);
+    // covers are requested when drawing, so the track is visible
+    query->flags = DDB_ARTWORK_FLAG_PRIORITY;
     query->track = track;
     deadbeef->pl_item_ref (track);
 
@@ -242,7 +242,9 @@ static NSMutableArray *g_rgControllers;
 
 - (void)progress:(int)current {
     deadbeef->pl_lock ();
-    const char *uri = deadbeef->pl_find_meta (_rg_settings.tracks[current], ":URI");
+    // current is the number of completed tracks, and reaches num_tracks at the end
+    int idx = current < _rg_settings.num_tracks ? current : _rg_settings.num_tracks - 1;
+    const char *uri = deadbeef->pl_find_meta (_rg_settings.tracks[idx], ":URI");
 
     [_progressText setStringValue:[NSString stringWithUTF8String:uri]];
     [_progressIndicator setDoubleValue:(double)current/_rg_settings.num_tracks*100];
@@ -37,6 +37,7 @@
 #include <unistd.h>
 #include <inttypes.h>
 #include <errno.h>
+#include <sys/time.h>
 #include "converter.h"
 #include "../../deadbeef.h"
 #include "../../strdupa.h"
@@ -810,7 +811,8 @@ check_dir (const char *dir, mode_t mode)
             *slash = 0;
         if (-1 == stat (tmp, &stat_buf))
         {
-            if (0 != mkdir (tmp, mode))
+            // another conversion running in parallel may have just created it
+            if (0 != mkdir (tmp, mode) && errno != EEXIST)
             {
                 trace ("Failed to create %s\n", tmp);
                 free (tmp);
@@ -848,12 +850,179 @@ static const unsigned char format_id_pcm[] = {
     0x80, 0x00, 0x00, 0xAA, 0x00, 0x38, 0x9B, 0x71
 };
 
+static double
+_time_now (void) {
+    struct timeval tm;
+    gettimeofday (&tm, NULL);
+    return tm.tv_sec + tm.tv_usec / 1000000.0;
+}
+
+// Size of the buffer between the decoder and the encoder pipe.
+// The data is written to the pipe by a separate thread, so that decoding continues while the encoder is busy.
+#define ENCODER_PIPE_BUFFER_SIZE (1024*1024)
+
+typedef struct {
+    int fd;
+
+    // ring buffer, NULL when writing to fd directly
+    char *buffer;
+    size_t readpos;
+    size_t fill;
+    int eof;
+    int error;
+    intptr_t tid;
+    uintptr_t mutex;
+    uintptr_t cond;
+
+    // stats
+    int64_t written;
+    double write_time; // time spent in write calls
+    double wait_time; // time the decoder was waiting for free buffer space
+} wav_writer_t;
+
+static void
+_wav_writer_thread (void *ctx) {
+    wav_writer_t *w = ctx;
+    deadbeef->mutex_lock (w->mutex);
+    for (;;) {
+        while (!w->fill && !w->eof && !w->error) {
+            deadbeef->cond_wait_locked (w->cond, w->mutex);
+        }
+        if (!w->fill || w->error) {
+            break;
+        }
+        // the buffer space being written isn't touched by the producer until `fill` is decreased
+        size_t len = min (w->fill, ENCODER_PIPE_BUFFER_SIZE - w->readpos);
+        const char *data = w->buffer + w->readpos;
+        deadbeef->mutex_unlock (w->mutex);
+
+        double t = _time_now ();
+        ssize_t res;
+        do {
+            res = write (w->fd, data, len);
+        } while (res < 0 && errno == EINTR);
+        t = _time_now () - t;
+
+        deadbeef->mutex_lock (w->mutex);
+        w->write_time += t;
+        if (res <= 0) {
+            trace ("Write error (%s)\n", strerror (errno));
+            w->error = 1;
+            deadbeef->cond_broadcast (w->cond);
+            break;
+        }
+        w->readpos = (w->readpos + res) % ENCODER_PIPE_BUFFER_SIZE;
+        w->fill -= res;
+        w->written += res;
+        deadbeef->cond_broadcast (w->cond);
+    }
+    deadbeef->mutex_unlock (w->mutex);
+}
+
+static int
+_wav_writer_init (wav_writer_t *w, int fd, int use_thread) {
+    memset (w, 0, sizeof (wav_writer_t));
+    w->fd = fd;
+    if (!use_thread) {
+        return 0;
+    }
+    w->buffer = malloc (ENCODER_PIPE_BUFFER_SIZE);
+    if (!w->buffer) {
+        return 0;
+    }
+    w->mutex = deadbeef->mutex_create ();
+    w->cond = deadbeef->cond_create ();
+    w->tid = deadbeef->thread_start (_wav_writer_thread, w);
+    if (!w->tid) {
+        deadbeef->cond_free (w->cond);
+        w->cond = 0;
+        deadbeef->mutex_free (w->mutex);
+        w->mutex = 0;
+        free (w->buffer);
+        w->buffer = NULL;
+    }
+    return 0;
+}
+
+// returns 0 on success, -1 on write error
+static int
+_wav_writer_write (wav_writer_t *w, const char *data, size_t size) {
+    if (!w->buffer) {
+        double t = _time_now ();
+        ssize_t res = write (w->fd, data, size);
+        w->write_time += _time_now () - t;
+        if (res != size) {
+            trace ("Write error (%"PRId64" bytes written out of %d)\n", (int64_t)res, (int)size);
+            return -1;
+        }
+        w->written += res;
+        return 0;
+    }
+
+    deadbeef->mutex_lock (w->mutex);
+    while (size > 0 && !w->error) {
+        if (w->fill == ENCODER_PIPE_BUFFER_SIZE) {
+            double t = _time_now ();
+            while (w->fill == ENCODER_PIPE_BUFFER_SIZE && !w->error) {
+                deadbeef->cond_wait_locked (w->cond, w->mutex);
+            }
+            w->wait_time += _time_now () - t;
+            continue;
+        }
+        size_t writepos = (w->readpos + w->fill) % ENCODER_PIPE_BUFFER_SIZE;
+        size_t len = min (size, min (ENCODER_PIPE_BUFFER_SIZE - w->fill, ENCODER_PIPE_BUFFER_SIZE - writepos));
+        memcpy (w->buffer + writepos, data, len);
+        w->fill += len;
+        data += len;
+        size -= len;
+        deadbeef->cond_broadcast (w->cond);
+    }
+    int err = w->error ? -1 : 0;
+    deadbeef->mutex_unlock (w->mutex);
+    return err;
+}
+
+// waits until all buffered data is written, returns 0 on success, -1 on write error
+static int
+_wav_writer_finish (wav_writer_t *w) {
+    if (!w->buffer) {
+        return 0;
+    }
+    deadbeef->mutex_lock (w->mutex);
+    w->eof = 1;
+    deadbeef->cond_broadcast (w->cond);
+    deadbeef->mutex_unlock (w->mutex);
+    deadbeef->thread_join (w->tid);
+    w->tid = 0;
+    deadbeef->cond_free (w->cond);
+    w->cond = 0;
+    deadbeef->mutex_free (w->mutex);
+    w->mutex = 0;
+    free (w->buffer);
+    w->buffer = NULL;
+    return w->error ? -1 : 0;
+}
+
 static int64_t
-_write_wav (DB_playItem_t *it, DB_decoder_t *dec, DB_fileinfo_t *fileinfo, ddb_dsp_preset_t *dsp_preset, ddb_encoder_preset_t *encoder_preset, int *abort, int fd, int output_bps, int output_is_float) {
+_write_wav (DB_playItem_t *it, DB_decoder_t *dec, DB_fileinfo_t *fileinfo, ddb_dsp_preset_t *dsp_preset, ddb_encoder_preset_t *encoder_preset, int *abort, ddb_converter_job_t *job, int fd, int output_bps, int output_is_float) {
     int64_t res = -1;
+    uint64_t expected_size = 0;
     char *buffer = NULL;
     char *dspbuffer = NULL;
 
+    // the encoder reads the data from a pipe, so the wav sizes can't be rewritten at the end
+    int streaming = encoder_preset->method == DDB_ENCODER_METHOD_PIPE && encoder_preset->encoder[0];
+
+    wav_writer_t writer;
+    _wav_writer_init (&writer, fd, streaming);
+
+    // stats
+    double start_time = _time_now ();
+    double decode_time = 0;
+    double dsp_time = 0;
+    double convert_time = 0;
+    int64_t decoded_frames = 0;
+
     // write wave header
     int exheader = output_bps > 16 && !output_is_float;
 
@@ -878,14 +1047,18 @@ _write_wav (DB_playItem_t *it, DB_decoder_t *dec, DB_fileinfo_t *fileinfo, ddb_d
         if (eof) {
             break;
         }
-        if (abort && *abort) {
+        if ((abort && *abort) || (job && job->abort)) {
             break;
         }
+        double t = _time_now ();
         int sz = dec->read (fileinfo, buffer, bs);
+        decode_time += _time_now () - t;
+        decoded_frames += sz / samplesize;
 
         if (sz != bs) {
             eof = 1;
         }
+        t = _time_now ();
         if (dsp_preset) {
             ddb_waveformat_t fmt;
             ddb_waveformat_t outfmt;
@@ -894,6 +1067,8 @@ _write_wav (DB_playItem_t *it, DB_decoder_t *dec, DB_fileinfo_t *fileinfo, ddb_d
             fmt.bps = 32;
             fmt.is_float = 1;
             deadbeef->pcm_convert (&fileinfo->fmt, buffer, &fmt, dspbuffer, sz);
+            double dsp_start = _time_now ();
+            convert_time += dsp_start - t;
 
             ddb_dsp_context_t *dsp = dsp_preset->chain;
             int frames = sz / samplesize;
@@ -912,6 +1087,9 @@ _write_wav (DB_playItem_t *it, DB_decoder_t *dec, DB_fileinfo_t *fileinfo, ddb_d
             outsr = fmt.samplerate;
             outch = fmt.channels;
 
+            t = _time_now ();
+            dsp_time += t - dsp_start;
+
             outfmt.bps = output_bps;
             outfmt.is_float = output_is_float;
             outfmt.channels = outch;
@@ -919,6 +1097,7 @@ _write_wav (DB_playItem_t *it, DB_decoder_t *dec, DB_fileinfo_t *fileinfo, ddb_d
 
             int n = deadbeef->pcm_convert (&fmt, dspbuffer, &outfmt, buffer, frames * sizeof (float) * fmt.channels);
             sz = n;
+            convert_time += _time_now () - t;
         }
         else if (fileinfo->fmt.bps != output_bps || fileinfo->fmt.is_float != output_is_float) {
             ddb_waveformat_t outfmt;
@@ -932,6 +1111,7 @@ _write_wav (DB_playItem_t *it, DB_decoder_t *dec, DB_fileinfo_t *fileinfo, ddb_d
             int n = deadbeef->pcm_convert (&fileinfo->fmt, buffer, &outfmt, dspbuffer, frames * samplesize);
             memcpy (buffer, dspbuffer, n);
             sz = n;
+            convert_time += _time_now () - t;
         }
         outsize += sz;
 
@@ -951,6 +1131,8 @@ _write_wav (DB_playItem_t *it, DB_decoder_t *dec, DB_fileinfo_t *fileinfo, ddb_d
                 size  = temp;
             }
 
+            expected_size = size;
+
             uint64_t chunksize;
             chunksize = size + 40;
 
@@ -959,8 +1141,9 @@ _write_wav (DB_playItem_t *it, DB_decoder_t *dec, DB_fileinfo_t *fileinfo, ddb_d
                 chunksize += 36;
             }
 
+            // when streaming, the sizes are unknown
             uint32_t size32 = 0xffffffff;
-            if (chunksize <= 0xffffffff) {
+            if (!streaming && chunksize <= 0xffffffff) {
                 size32 = (uint32_t)chunksize;
             }
 
@@ -996,18 +1179,15 @@ _write_wav (DB_playItem_t *it, DB_decoder_t *dec, DB_fileinfo_t *fileinfo, ddb_d
             }
 
             size32 = 0xffffffff;
-            if (size <= 0xffffffff) {
+            if (!streaming && size <= 0xffffffff) {
                 size32 = (uint32_t)size;
             }
 
-            if (wavehdr_size != write (fd, wavehdr, wavehdr_size)) {
+            if (_wav_writer_write (&writer, wavehdr, wavehdr_size)) {
                 trace ("Wave header write error\n");
                 goto error;
             }
-            if (encoder_preset->method == DDB_ENCODER_METHOD_PIPE) {
-                size32 = 0;
-            }
-            if (write (fd, &size32, sizeof (size32)) != sizeof (size32)) {
+            if (_wav_writer_write (&writer, (const char *)&size32, sizeof (size32))) {
                 trace ("Wave header size write error\n");
                 goto error;
             }
@@ -1022,17 +1202,27 @@ _write_wav (DB_playItem_t *it, DB_decoder_t *dec, DB_fileinfo_t *fileinfo, ddb_d
             }
         }
 
-        int64_t res = write (fd, buffer, sz);
-        if (sz != res) {
-            trace ("Write error (%"PRId64" bytes written out of %d)\n", res, sz);
+        if (_wav_writer_write (&writer, buffer, sz)) {
             goto error;
         }
+
+        if (job && expected_size > 0) {
+            job->progress = min ((float)((double)outsize / expected_size), 1.f);
+        }
+    }
+
+    if (_wav_writer_finish (&writer)) {
+        goto error;
     }
 
     res = outsize;
 
+    double total_time = _time_now () - start_time;
+    trace ("converter: %.1f sec of audio in %.2f sec: decoding %.2f sec, dsp %.2f sec, format conversion %.2f sec, waiting for encoder %.2f sec; %.1f MB written in %.2f sec\n",
+           (double)decoded_frames / fileinfo->fmt.samplerate, total_time, decode_time, dsp_time, convert_time, writer.wait_time, writer.written / (1024.0 * 1024.0), writer.write_time);
+
     // rewrite wave data size
-    if (encoder_preset->method == DDB_ENCODER_METHOD_FILE) {
+    if (!streaming) {
         uint32_t writesize;
 
         // RIFF chunk size
@@ -1064,6 +1254,7 @@ _write_wav (DB_playItem_t *it, DB_decoder_t *dec, DB_fileinfo_t *fileinfo, ddb_d
     }
 
 error:
+    _wav_writer_finish (&writer);
 
     if (buffer) {
         free (buffer);
@@ -1316,7 +1507,13 @@ _converter_write_tags (ddb_encoder_preset_t *encoder_preset, DB_playItem_t *it,
 }
 
 static int
-convert2 (ddb_converter_settings_t *settings, DB_playItem_t *it, const char *out, int *pabort) {
+_is_aborted (int *pabort, ddb_converter_job_t *job) {
+    return (pabort && *pabort) || (job && job->abort);
+}
+
+// job can be NULL, otherwise its abort flag is checked in addition to pabort, and its progress is updated
+static int
+_convert (ddb_converter_settings_t *settings, DB_playItem_t *it, const char *out, int *pabort, ddb_converter_job_t *job) {
     int output_bps = settings->output_bps;
     int output_is_float = settings->output_is_float;
     ddb_encoder_preset_t *encoder_preset = settings->encoder_preset;
@@ -1400,9 +1597,15 @@ convert2 (ddb_converter_settings_t *settings, DB_playItem_t *it, const char *out
                         if (!tmp) {
                             tmp = "/tmp";
                         }
-                        snprintf (input_file_name, sizeof (input_file_name), "%s/ddbconvXXXXXX", tmp);
-                        (void)mktemp (input_file_name);
-                        strcat (input_file_name, ".wav");
+                        // create the file right away, so that the parallel conversions can't get the same name
+                        snprintf (input_file_name, sizeof (input_file_name), "%s/ddbconvXXXXXX.wav", tmp);
+                        int fd = mkstemps (input_file_name, 4);
+                        if (fd == -1) {
+                            trace ("Failed to create temp file %s\n", input_file_name);
+                            input_file_name[0] = 0;
+                            goto error;
+                        }
+                        close (fd);
                     }
                         break;
                     case DDB_ENCODER_METHOD_PIPE:
@@ -1449,13 +1652,13 @@ convert2 (ddb_converter_settings_t *settings, DB_playItem_t *it, const char *out
                 }
 
                 if (temp_file > 0) {
-                    int64_t outsize = _write_wav (it, dec, fileinfo, dsp_preset, encoder_preset, pabort, temp_file, output_bps, output_is_float);
+                    int64_t outsize = _write_wav (it, dec, fileinfo, dsp_preset, encoder_preset, pabort, job, temp_file, output_bps, output_is_float);
 
                     if (outsize < 0) {
                         goto error;
                     }
 
-                    if (pabort && *pabort) {
+                    if (_is_aborted (pabort, job)) {
                         goto error;
                     }
 
@@ -1498,7 +1701,7 @@ error:
         dec->free (fileinfo);
         fileinfo = NULL;
     }
-    if (pabort && *pabort && out[0]) {
+    if (_is_aborted (pabort, job) && out[0]) {
         unlink (out);
     }
     if (input_file_name[0] && strcmp (input_file_name, "-")) {
@@ -1513,6 +1716,262 @@ error:
     return err;
 }
 
+static int
+convert2 (ddb_converter_settings_t *settings, DB_playItem_t *it, const char *out, int *pabort) {
+    return _convert (settings, it, out, pabort, NULL);
+}
+
+#define MAX_CONVERTER_THREADS 64
+
+typedef struct {
+    ddb_converter_settings_t *settings;
+    ddb_converter_job_t *jobs;
+    int count;
+
+    // index of the previous job with the same output path, or -1
+    int *prev_same_out;
+
+    // set after the state_changed callback of the finished job,
+    // so that the next job with the same output path is started after it
+    char *finished;
+
+    // all jobs before this index are started
+    int first_queued;
+
+    ddb_converter_job_prepare_t prepare;
+    ddb_converter_job_state_changed_t state_changed;
+    void *user_data;
+    int *pabort;
+
+    // set when the batch was cancelled from the prepare callback
+    int cancelled;
+
+    int failed;
+
+    uintptr_t mutex;
+    uintptr_t prepare_mutex;
+
+    // signalled when a job finishes, or the batch is cancelled
+    uintptr_t cond;
+} convert_batch_t;
+
+typedef struct {
+    convert_batch_t *batch;
+
+    // each worker needs its own dsp chain instances
+    ddb_converter_settings_t settings;
+} convert_worker_t;
+
+typedef struct {
+    const char *path;
+    int idx;
+} outpath_idx_t;
+
+static int
+_outpath_idx_cmp (const void *a, const void *b) {
+    const outpath_idx_t *x = a;
+    const outpath_idx_t *y = b;
+    int cmp = strcmp (x->path, y->path);
+    if (cmp) {
+        return cmp;
+    }
+    return x->idx - y->idx;
+}
+
+// must be called with batch->mutex locked
+// returns the first queued job, which doesn't have to wait for a previous job with the same output path
+// sets *blocked if there are queued jobs which have to wait
+static ddb_converter_job_t *
+_batch_next_job (convert_batch_t *batch, int *blocked) {
+    *blocked = 0;
+    while (batch->first_queued < batch->count && batch->jobs[batch->first_queued].state != DDB_CONVERTER_JOB_QUEUED) {
+        batch->first_queued++;
+    }
+    for (int i = batch->first_queued; i < batch->count; i++) {
+        ddb_converter_job_t *job = &batch->jobs[i];
+        if (job->state != DDB_CONVERTER_JOB_QUEUED) {
+            continue;
+        }
+        int prev = batch->prev_same_out[i];
+        if (prev >= 0 && !batch->finished[prev]) {
+            *blocked = 1;
+            continue;
+        }
+        return job;
+    }
+    return NULL;
+}
+
+static int
+_batch_is_aborted (convert_batch_t *batch) {
+    return batch->cancelled || (batch->pabort && *batch->pabort);
+}
+
+static void
+_batch_cancel (convert_batch_t *batch) {
+    deadbeef->mutex_lock (batch->mutex);
+    batch->cancelled = 1;
+    for (int i = 0; i < batch->count; i++) {
+        batch->jobs[i].abort = 1;
+    }
+    deadbeef->cond_broadcast (batch->cond);
+    deadbeef->mutex_unlock (batch->mutex);
+}
+
+static void
+_convert_batch_worker (void *ctx) {
+    convert_worker_t *worker = ctx;
+    convert_batch_t *batch = worker->batch;
+
+    deadbeef->mutex_lock (batch->mutex);
+    while (!_batch_is_aborted (batch)) {
+        int blocked;
+        ddb_converter_job_t *job = _batch_next_job (batch, &blocked);
+        if (!job) {
+            if (!blocked) {
+                break;
+            }
+            // wait for the job writing to the same file to finish
+            deadbeef->cond_wait_locked (batch->cond, batch->mutex);
+            continue;
+        }
+        job->state = DDB_CONVERTER_JOB_RUNNING;
+        job->progress = 0;
+        deadbeef->mutex_unlock (batch->mutex);
+
+        int res = 0;
+        if (batch->prepare) {
+            deadbeef->mutex_lock (batch->prepare_mutex);
+            if (!_batch_is_aborted (batch)) {
+                res = batch->prepare (job, batch->user_data);
+            }
+            deadbeef->mutex_unlock (batch->prepare_mutex);
+        }
+        if (res < 0) {
+            _batch_cancel (batch);
+        }
+
+        int state;
+        if (res != 0 || _is_aborted (batch->pabort, job)) {
+            state = res > 0 ? DDB_CONVERTER_JOB_SKIPPED : DDB_CONVERTER_JOB_CANCELLED;
+        }
+        else {
+            if (batch->state_changed) {
+                batch->state_changed (job, batch->user_data);
+            }
+            job->result = _convert (&worker->settings, job->it, job->outpath, batch->pabort, job);
+            if (_is_aborted (batch->pabort, job)) {
+                state = DDB_CONVERTER_JOB_CANCELLED;
+            }
+            else {
+                state = job->result ? DDB_CONVERTER_JOB_FAILED : DDB_CONVERTER_JOB_DONE;
+            }
+        }
+
+        deadbeef->mutex_lock (batch->mutex);
+        job->state = state;
+        if (state == DDB_CONVERTER_JOB_FAILED) {
+            batch->failed++;
+        }
+        deadbeef->mutex_unlock (batch->mutex);
+
+        if (batch->state_changed) {
+            batch->state_changed (job, batch->user_data);
+        }
+
+        deadbeef->mutex_lock (batch->mutex);
+        batch->finished[job - batch->jobs] = 1;
+        deadbeef->cond_broadcast (batch->cond);
+    }
+    deadbeef->mutex_unlock (batch->mutex);
+}
+
+static int
+convert_batch (ddb_converter_settings_t *settings, ddb_converter_job_t *jobs, int count, int num_threads, ddb_converter_job_prepare_t prepare, ddb_converter_job_state_changed_t state_changed, void *user_data, int *pabort) {
+    if (count <= 0) {
+        return 0;
+    }
+
+    if (num_threads <= 0) {
+        num_threads = deadbeef->conf_get_int ("converter.threads", 0);
+    }
+    if (num_threads <= 0) {
+        num_threads = (int)sysconf (_SC_NPROCESSORS_ONLN);
+    }
+    num_threads = min (num_threads, min (count, MAX_CONVERTER_THREADS));
+    if (num_threads < 1) {
+        num_threads = 1;
+    }
+
+    convert_batch_t batch = {
+        .settings = settings,
+        .jobs = jobs,
+        .count = count,
+        .prepare = prepare,
+        .state_changed = state_changed,
+        .user_data = user_data,
+        .pabort = pabort,
+    };
+
+    // jobs writing to the same file must not run at the same time, and must run in order
+    batch.prev_same_out = malloc (count * sizeof (int));
+    batch.finished = calloc (count, 1);
+    outpath_idx_t *sorted = malloc (count * sizeof (outpath_idx_t));
+    for (int i = 0; i < count; i++) {
+        jobs[i].state = DDB_CONVERTER_JOB_QUEUED;
+        sorted[i].path = jobs[i].outpath;
+        sorted[i].idx = i;
+    }
+    qsort (sorted, count, sizeof (outpath_idx_t), _outpath_idx_cmp);
+    for (int i = 0; i < count; i++) {
+        batch.prev_same_out[sorted[i].idx] = (i > 0 && !strcmp (sorted[i-1].path, sorted[i].path)) ? sorted[i-1].idx : -1;
+    }
+    free (sorted);
+
+    batch.mutex = deadbeef->mutex_create_nonrecursive ();
+    batch.prepare_mutex = deadbeef->mutex_create_nonrecursive ();
+    batch.cond = deadbeef->cond_create ();
+
+    convert_worker_t workers[num_threads];
+    intptr_t tids[num_threads];
+    for (int i = 0; i < num_threads; i++) {
+        workers[i].batch = &batch;
+        workers[i].settings = *settings;
+        if (i > 0 && settings->dsp_preset) {
+            workers[i].settings.dsp_preset = dsp_preset_alloc ();
+            dsp_preset_copy (workers[i].settings.dsp_preset, settings->dsp_preset);
+        }
+    }
+
+    // the calling thread is the first worker
+    for (int i = 1; i < num_threads; i++) {
+        tids[i] = deadbeef->thread_start (_convert_batch_worker, &workers[i]);
+    }
+    _convert_batch_worker (&workers[0]);
+    for (int i = 1; i < num_threads; i++) {
+        if (tids[i]) {
+            deadbeef->thread_join (tids[i]);
+        }
+        if (workers[i].settings.dsp_preset) {
+            dsp_preset_free (workers[i].settings.dsp_preset);
+        }
+    }
+
+    for (int i = 0; i < count; i++) {
+        if (jobs[i].state == DDB_CONVERTER_JOB_QUEUED) {
+            jobs[i].state = DDB_CONVERTER_JOB_CANCELLED;
+        }
+    }
+
+    deadbeef->mutex_free (batch.mutex);
+    deadbeef->mutex_free (batch.prepare_mutex);
+    deadbeef->cond_free (batch.cond);
+    free (batch.prev_same_out);
+    free (batch.finished);
+
+    return batch.failed;
+}
+
 static int
 convert (DB_playItem_t *it, const char *out, int output_bps, int output_is_float, ddb_encoder_preset_t *encoder_preset, ddb_dsp_preset_t *dsp_preset, int *abort) {
     ddb_converter_settings_t settings = {
@@ -1552,12 +2011,16 @@ converter_stop (void) {
     return 0;
 }
 
+static const char settings_dlg[] =
+    "property \"Number of simultaneous conversions (0: one per CPU core)\" entry converter.threads 0;\n"
+;
+
 // define plugin interface
 static ddb_converter_t plugin = {
     .misc.plugin.api_vmajor = DB_API_VERSION_MAJOR,
     .misc.plugin.api_vminor = DB_API_VERSION_MINOR,
     .misc.plugin.version_major = 1,
-    .misc.plugin.version_minor = 5,
+    .misc.plugin.version_minor = 6,
     .misc.plugin.flags = DDB_PLUGIN_FLAG_LOGGING,
     .misc.plugin.type = DB_PLUGIN_MISC,
     .misc.plugin.name = "Converter",
@@ -1590,6 +2053,7 @@ static ddb_converter_t plugin = {
     .misc.plugin.start = converter_start,
     .misc.plugin.stop = converter_stop,
     .misc.plugin.command = converter_cmd,
+    .misc.plugin.configdialog = settings_dlg,
     .encoder_preset_alloc = encoder_preset_alloc,
     .encoder_preset_free = encoder_preset_free,
     .encoder_preset_load = encoder_preset_load,
@@ -1624,6 +2088,8 @@ static ddb_converter_t plugin = {
     .get_output_path2 = get_output_path2,
     // 1.5 entry points
     .convert2 = convert2,
+    // 1.6 entry points
+    .convert_batch = convert_batch,
 };
 
 DB_plugin_t *
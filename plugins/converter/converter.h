@@ -26,6 +26,8 @@
 #include <stdint.h>
 #include "../../deadbeef.h"
 
+// changes in 1.6:
+//   added `convert_batch`, for running several conversions in parallel
 // changes in 1.5:
 //   added mp4 tagging support
 //   added converter option to copy files without conversion, if file format isn't changing
@@ -102,6 +104,52 @@ typedef struct ddb_converter_settings_s {
     int rewrite_tags_after_copy;
 } ddb_converter_settings_t;
 
+// since 1.6
+enum {
+    DDB_CONVERTER_JOB_QUEUED = 0,
+    DDB_CONVERTER_JOB_RUNNING = 1,
+    DDB_CONVERTER_JOB_DONE = 2,
+    DDB_CONVERTER_JOB_FAILED = 3,
+    DDB_CONVERTER_JOB_SKIPPED = 4,
+    DDB_CONVERTER_JOB_CANCELLED = 5,
+};
+
+// since 1.6
+// A single track conversion, as a part of `convert_batch`
+typedef struct ddb_converter_job_s {
+    // track to convert
+    DB_playItem_t *it;
+
+    // fully qualified output path with filename and extension
+    const char *outpath;
+
+    // set by the converter
+
+    // DDB_CONVERTER_JOB_*
+    int state;
+
+    // the value returned from convert2
+    int result;
+
+    // 0..1, while the job is running
+    float progress;
+
+    // set to non-zero to interrupt this job only
+    int abort;
+} ddb_converter_job_t;
+
+// since 1.6
+// Called by convert_batch before converting each job, e.g. for checking if the output file exists.
+// Never called concurrently, and the jobs with the same output path are prepared
+// in their order, after the previous one has finished.
+// Return 0 to convert, 1 to skip the job, -1 to cancel the whole batch.
+typedef int (*ddb_converter_job_prepare_t) (ddb_converter_job_t *job, void *user_data);
+
+// since 1.6
+// Called by convert_batch from the worker threads when a job starts or finishes.
+// A job with the same output path as the previous one is started after this was called for the previous one.
+typedef void (*ddb_converter_job_state_changed_t) (ddb_converter_job_t *job, void *user_data);
+
 typedef struct {
     DB_misc_t misc;
 
@@ -266,6 +314,33 @@ typedef struct {
          // *pabort will be checked regularly, conversion will be interrupted if it's non-zero
          int *pabort
     );
+
+    // since 1.6
+    // Converts the jobs using a pool of worker threads, and returns when all of them are finished.
+    // Returns the number of failed jobs.
+    int
+    (*convert_batch) (
+        // converter settings, same for all jobs
+        ddb_converter_settings_t *settings,
+
+        // the jobs to convert, with `it` and `outpath` set, the rest zeroed
+        ddb_converter_job_t *jobs,
+        int count,
+
+        // number of conversions to run at the same time, 0 means the "converter.threads" config setting
+        int num_threads,
+
+        // can be NULL
+        ddb_converter_job_prepare_t prepare,
+
+        // can be NULL
+        ddb_converter_job_state_changed_t state_changed,
+
+        void *user_data,
+
+        // *pabort will be checked regularly, all conversions will be interrupted if it's non-zero
+        int *pabort
+    );
 } ddb_converter_t;
 
 #endif
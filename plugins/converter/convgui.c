@@ -168,6 +168,46 @@ overwrite_prompt (const char *outpath) {
     return ctl.result;
 }
 
+// called by the converter before converting each track, never concurrently
+static int
+converter_job_prepare (ddb_converter_job_t *job, void *user_data) {
+    converter_ctx_t *conv = user_data;
+    int skip = 0;
+    char *real_out = realpath(job->outpath, NULL);
+    if (real_out) {
+        skip = 1;
+        deadbeef->pl_lock();
+        char *real_in = realpath(deadbeef->pl_find_meta(job->it, ":URI"), NULL);
+        deadbeef->pl_unlock();
+        const int paths_match = real_in && !strcmp(real_in, real_out);
+        free(real_in);
+        free(real_out);
+        if (paths_match) {
+            fprintf (stderr, "converter: destination file is the same as source file, skipping\n");
+        }
+        else if (conv->overwrite_action == 2 || (conv->overwrite_action == 1 && overwrite_prompt(job->outpath))) {
+            unlink (job->outpath);
+            skip = 0;
+        }
+    }
+    return skip;
+}
+
+static void
+converter_job_state_changed (ddb_converter_job_t *job, void *user_data) {
+    converter_ctx_t *conv = user_data;
+    if (job->state != DDB_CONVERTER_JOB_RUNNING) {
+        return;
+    }
+    update_progress_info_t *info = malloc (sizeof (update_progress_info_t));
+    info->entry = conv->progress_entry;
+    g_object_ref (info->entry);
+    deadbeef->pl_lock ();
+    info->text = strdup (deadbeef->pl_find_meta (job->it, ":URI"));
+    deadbeef->pl_unlock ();
+    g_idle_add (update_progress_cb, info);
+}
+
 static void
 converter_worker (void *ctx) {
     deadbeef->background_job_increment ();
@@ -218,48 +258,21 @@ converter_worker (void *ctx) {
         .rewrite_tags_after_copy = conv->retag_after_copy,
     };
 
+    ddb_converter_job_t *jobs = calloc (conv->convert_items_count, sizeof (ddb_converter_job_t));
     for (int n = 0; n < conv->convert_items_count; n++) {
-        update_progress_info_t *info = malloc (sizeof (update_progress_info_t));
-        info->entry = conv->progress_entry;
-        g_object_ref (info->entry);
-        deadbeef->pl_lock ();
-        info->text = strdup (deadbeef->pl_find_meta (conv->convert_items[n], ":URI"));
-        deadbeef->pl_unlock ();
-        g_idle_add (update_progress_cb, info);
-
         char outpath[2000];
         converter_plugin->get_output_path2 (conv->convert_items[n], conv->convert_playlist, conv->outfolder, conv->outfile, conv->encoder_preset, conv->preserve_folder_structure, root, conv->write_to_source_folder, outpath, sizeof (outpath));
+        jobs[n].it = conv->convert_items[n];
+        jobs[n].outpath = strdup (outpath);
+    }
 
-        int skip = 0;
-        char *real_out = realpath(outpath, NULL);
-        if (real_out) {
-            skip = 1;
-            deadbeef->pl_lock();
-            char *real_in = realpath(deadbeef->pl_find_meta(conv->convert_items[n], ":URI"), NULL);
-            deadbeef->pl_unlock();
-            const int paths_match = real_in && !strcmp(real_in, real_out);
-            free(real_in);
-            free(real_out);
-            if (paths_match) {
-                fprintf (stderr, "converter: destination file is the same as source file, skipping\n");
-            }
-            else if (conv->overwrite_action == 2 || (conv->overwrite_action == 1 && overwrite_prompt(outpath))) {
-                unlink (outpath);
-                skip = 0;
-            }
-        }
+    converter_plugin->convert_batch (&settings, jobs, conv->convert_items_count, 0, converter_job_prepare, converter_job_state_changed, conv, &conv->cancelled);
 
-        if (!skip) {
-            converter_plugin->convert2 (&settings, conv->convert_items[n], outpath, &conv->cancelled);
-        }
-        if (conv->cancelled) {
-            for (; n < conv->convert_items_count; n++) {
-                deadbeef->pl_item_unref (conv->convert_items[n]);
-            }
-            break;
-        }
+    for (int n = 0; n < conv->convert_items_count; n++) {
+        free ((char *)jobs[n].outpath);
         deadbeef->pl_item_unref (conv->convert_items[n]);
     }
+    free (jobs);
     g_idle_add (destroy_progress_cb, conv->progress);
     if (conv->convert_items) {
         free (conv->convert_items);
@@ -1816,7 +1829,7 @@ convgui_connect (void) {
         fprintf (stderr, "convgui: converter plugin not found\n");
         return -1;
     }
-#define REQ_CONV_VERSION 4
+#define REQ_CONV_VERSION 6
     if (!PLUG_TEST_COMPAT(&converter_plugin->misc.plugin, 1, REQ_CONV_VERSION)) {
         fprintf (stderr, "convgui: need converter>=1.%d, but found %d.%d\n", REQ_CONV_VERSION, converter_plugin->misc.plugin.version_major, converter_plugin->misc.plugin.version_minor);
         return -1;
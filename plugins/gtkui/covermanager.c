@@ -0,0 +1,330 @@
+/*
+    DeaDBeeF -- the music player
+    Copyright (C) 2009-2018 Alexey Yakovenko and other contributors
+
+    This software is provided 'as-is', without any express or implied
+    warranty.  In no event will the authors be held liable for any damages
+    arising from the use of this software.
+
+    Permission is granted to anyone to use this software for any purpose,
+    including commercial applications, and to alter it and redistribute it
+    freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source distribution.
+*/
+
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include "../../deadbeef.h"
+#include "../artwork/artwork.h"
+#include "gtkui.h"
+#include "covermanager.h"
+
+//#define trace(...) { fprintf(stderr, __VA_ARGS__); }
+#define trace(...)
+
+#define CACHE_SIZE 20
+
+typedef struct {
+    char *hash;
+    int width;
+    int height;
+    time_t ts;
+    GdkPixbuf *pixbuf; // NULL if the track has no cover
+} cached_cover_t;
+
+typedef struct covermanager_query_s {
+    ddb_cover_query_t query;
+    ddb_artwork_plugin_t *plugin;
+    char *hash;
+    int width;
+    int height;
+    cover_avail_callback_t callback;
+    void *user_data;
+    int cancelled;
+    int error;
+    GdkPixbuf *pixbuf;
+    struct covermanager_query_s *next;
+} covermanager_query_t;
+
+static ddb_artwork_plugin_t *artwork_plugin;
+static char *name_tf;
+static cached_cover_t cache[CACHE_SIZE];
+
+// the queries which were sent to the artwork plugin, only accessed on the main thread
+static covermanager_query_t *pending;
+
+void
+covermanager_init (void) {
+    DB_plugin_t *plugin = deadbeef->plug_get_for_id ("artwork2");
+    // cancel and DDB_ARTWORK_FLAG_PRIORITY need artwork 2.1
+    if (plugin && PLUG_TEST_COMPAT (plugin, DDB_ARTWORK_MAJOR_VERSION, 1)) {
+        artwork_plugin = (ddb_artwork_plugin_t *)plugin;
+    }
+    if (!artwork_plugin) {
+        return;
+    }
+
+    // Each file may contain its own album art, therefore the covers can't be cached by album/artist
+    name_tf = deadbeef->tf_compile ("%_path_raw%");
+}
+
+int
+covermanager_is_available (void) {
+    return artwork_plugin != NULL;
+}
+
+static char *
+hash_for_track (DB_playItem_t *track) {
+    ddb_tf_context_t ctx = {
+        ._size = sizeof (ddb_tf_context_t),
+        .flags = DDB_TF_CONTEXT_NO_DYNAMIC,
+        .it = track,
+    };
+
+    char buffer[PATH_MAX];
+    deadbeef->tf_eval (&ctx, name_tf, buffer, sizeof (buffer));
+    return strdup (buffer);
+}
+
+static void
+cache_entry_clear (cached_cover_t *c) {
+    free (c->hash);
+    if (c->pixbuf) {
+        g_object_unref (c->pixbuf);
+    }
+    memset (c, 0, sizeof (cached_cover_t));
+}
+
+static void
+cache_add (char *hash, int width, int height, GdkPixbuf *pixbuf) {
+    cached_cover_t *slot = NULL;
+    for (int i = 0; i < CACHE_SIZE; i++) {
+        cached_cover_t *c = &cache[i];
+        if (!c->hash) {
+            if (!slot || slot->hash) {
+                slot = c;
+            }
+            continue;
+        }
+        if (!strcmp (c->hash, hash) && c->width == width && c->height == height) {
+            slot = c;
+            break;
+        }
+        if (!slot || (slot->hash && c->ts < slot->ts)) {
+            slot = c;
+        }
+    }
+
+    trace ("covermanager: add %s @ %dx%d\n", hash, width, height);
+    cache_entry_clear (slot);
+    slot->hash = hash;
+    slot->width = width;
+    slot->height = height;
+    slot->ts = time (NULL);
+    slot->pixbuf = pixbuf;
+}
+
+// returns the entry with the exact size, or the largest one if width is -1
+static cached_cover_t *
+cache_find (const char *hash, int width, int height) {
+    cached_cover_t *found = NULL;
+    for (int i = 0; i < CACHE_SIZE; i++) {
+        cached_cover_t *c = &cache[i];
+        if (!c->hash || strcmp (c->hash, hash)) {
+            continue;
+        }
+        if (width == -1) {
+            if (c->pixbuf && (!found || c->width > found->width)) {
+                found = c;
+            }
+        }
+        else if (c->width == width && c->height == height) {
+            return c;
+        }
+    }
+    return found;
+}
+
+static void
+query_free (covermanager_query_t *cq) {
+    if (cq->pixbuf) {
+        g_object_unref (cq->pixbuf);
+    }
+    free (cq->hash);
+    free (cq);
+}
+
+static gboolean
+query_done_cb (void *user_data) {
+    covermanager_query_t *cq = user_data;
+
+    for (covermanager_query_t **p = &pending; *p; p = &(*p)->next) {
+        if (*p == cq) {
+            *p = cq->next;
+            break;
+        }
+    }
+    deadbeef->pl_item_unref (cq->query.track);
+
+    // a cancelled query gets an error as well, which doesn't mean that the track has no cover
+    if (artwork_plugin && (!cq->error || !cq->cancelled)) {
+        cache_add (cq->hash, cq->width, cq->height, cq->pixbuf);
+        cq->hash = NULL;
+        cq->pixbuf = NULL;
+        if (cq->callback) {
+            cq->callback (cq->user_data);
+        }
+    }
+
+    query_free (cq);
+    return FALSE;
+}
+
+static GdkPixbuf *
+load_pixbuf (ddb_cover_info_t *cover, int width, int height) {
+    if (cover->blob) {
+        GInputStream *stream = g_memory_input_stream_new_from_data (cover->blob + cover->blob_image_offset, cover->blob_image_size, NULL);
+        GdkPixbuf *pixbuf = gdk_pixbuf_new_from_stream_at_scale (stream, width, height, TRUE, NULL, NULL);
+        g_object_unref (stream);
+        if (pixbuf) {
+            return pixbuf;
+        }
+    }
+    if (cover->filename) {
+        return gdk_pixbuf_new_from_file_at_size (cover->filename, width, height, NULL);
+    }
+    return NULL;
+}
+
+static void
+cover_loaded_callback (int error, ddb_cover_query_t *query, ddb_cover_info_t *cover) {
+    covermanager_query_t *cq = query->user_data;
+
+    // decode on the artwork thread, to keep the UI responsive
+    cq->error = error;
+    if (!error && cover) {
+        cq->pixbuf = load_pixbuf (cover, cq->width, cq->height);
+    }
+    if (cover) {
+        cq->plugin->cover_info_free (cover);
+    }
+
+    g_idle_add (query_done_cb, cq);
+}
+
+GdkPixbuf *
+covermanager_cover_for_track (DB_playItem_t *track, int width, int height, cover_avail_callback_t callback, void *user_data) {
+    if (!artwork_plugin) {
+        return NULL;
+    }
+
+    char *hash = hash_for_track (track);
+    cached_cover_t *c = cache_find (hash, width, height);
+    if (c) {
+        free (hash);
+        c->ts = time (NULL);
+        if (!c->pixbuf) {
+            return cover_get_default_pixbuf ();
+        }
+        g_object_ref (c->pixbuf);
+        return c->pixbuf;
+    }
+    if (width == -1) {
+        free (hash);
+        return NULL;
+    }
+
+    // the same cover is redrawn until it's loaded, send only one query
+    for (covermanager_query_t *cq = pending; cq; cq = cq->next) {
+        if (!cq->cancelled && cq->callback == callback && cq->user_data == user_data
+            && cq->width == width && cq->height == height && !strcmp (cq->hash, hash)) {
+            free (hash);
+            return NULL;
+        }
+    }
+
+    covermanager_query_t *cq = calloc (1, sizeof (covermanager_query_t));
+    cq->query._size = sizeof (ddb_cover_query_t);
+    // covers are requested when drawing, so the track is visible
+    cq->query.flags = DDB_ARTWORK_FLAG_PRIORITY;
+    cq->query.track = track;
+    cq->query.user_data = cq;
+    deadbeef->pl_item_ref (track);
+    cq->plugin = artwork_plugin;
+    cq->hash = hash;
+    cq->width = width;
+    cq->height = height;
+    cq->callback = callback;
+    cq->user_data = user_data;
+    cq->next = pending;
+    pending = cq;
+
+    trace ("covermanager: query %s @ %dx%d\n", hash, width, height);
+    artwork_plugin->cover_get (&cq->query, cover_loaded_callback);
+    return NULL;
+}
+
+void
+covermanager_reset_queue (void) {
+    if (!artwork_plugin) {
+        return;
+    }
+    // The queries which are already being processed are not affected,
+    // the rest get their callbacks called with an error before cancel returns.
+    for (covermanager_query_t *cq = pending; cq; cq = cq->next) {
+        if (!cq->cancelled) {
+            cq->cancelled = 1;
+            artwork_plugin->cancel (&cq->query);
+        }
+    }
+}
+
+void
+covermanager_cancel_user_data (void *user_data) {
+    if (!artwork_plugin) {
+        return;
+    }
+    for (covermanager_query_t *cq = pending; cq; cq = cq->next) {
+        if (cq->user_data == user_data) {
+            cq->callback = NULL;
+            cq->user_data = NULL;
+            if (!cq->cancelled) {
+                cq->cancelled = 1;
+                artwork_plugin->cancel (&cq->query);
+            }
+        }
+    }
+}
+
+void
+covermanager_disconnect (void) {
+    covermanager_reset_queue ();
+    for (covermanager_query_t *cq = pending; cq; cq = cq->next) {
+        cq->callback = NULL;
+        cq->user_data = NULL;
+    }
+    // the pending queries will be freed without touching the cache
+    artwork_plugin = NULL;
+}
+
+void
+covermanager_free (void) {
+    artwork_plugin = NULL;
+    for (int i = 0; i < CACHE_SIZE; i++) {
+        cache_entry_clear (&cache[i]);
+    }
+    if (name_tf) {
+        deadbeef->tf_free (name_tf);
+        name_tf = NULL;
+    }
+}
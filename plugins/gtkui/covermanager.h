@@ -0,0 +1,62 @@
+/*
+    DeaDBeeF -- the music player
+    Copyright (C) 2009-2018 Alexey Yakovenko and other contributors
+
+    This software is provided 'as-is', without any express or implied
+    warranty.  In no event will the authors be held liable for any damages
+    arising from the use of this software.
+
+    Permission is granted to anyone to use this software for any purpose,
+    including commercial applications, and to alter it and redistribute it
+    freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source distribution.
+*/
+
+#ifndef __COVERMANAGER_H
+#define __COVERMANAGER_H
+
+#include <gtk/gtk.h>
+#include "../../deadbeef.h"
+#include "coverart.h"
+
+// Loads the covers of the visible tracks using the artwork2 plugin.
+// The covers are requested when drawing, so all queries are sent with DDB_ARTWORK_FLAG_PRIORITY,
+// and the ones which were not processed yet are cancelled by covermanager_reset_queue.
+
+void
+covermanager_init (void);
+
+void
+covermanager_disconnect (void);
+
+void
+covermanager_free (void);
+
+// returns 1 if the artwork2 plugin is loaded, otherwise the coverart.h functions need to be used
+int
+covermanager_is_available (void);
+
+// Returns a new reference to the cover of the track, scaled to fit into width x height,
+// or the largest cached size if width is -1.
+// If the cover is not loaded yet, NULL is returned, and the callback is called on the main thread when it's loaded.
+GdkPixbuf *
+covermanager_cover_for_track (DB_playItem_t *track, int width, int height, cover_avail_callback_t callback, void *user_data);
+
+// Cancels the queries which were not processed yet, e.g. when the tracks were scrolled out of view
+void
+covermanager_reset_queue (void);
+
+// Cancels the queries with this user_data, and makes sure their callbacks won't be called
+void
+covermanager_cancel_user_data (void *user_data);
+
+#endif
@@ -47,6 +47,7 @@
 #include "drawing.h"
 #include "trkproperties.h"
 #include "coverart.h"
+#include "covermanager.h"
 #include "plcommon.h"
 #include "ddbtabstrip.h"
 #include "eq.h"
@@ -1310,6 +1311,7 @@ gtkui_mainwin_init(void) {
     search_playlist_init (mainwin);
     progress_init ();
     cover_art_init ();
+    covermanager_init ();
 
 #ifdef __APPLE__
 #if 0
@@ -1361,6 +1363,7 @@ gtkui_mainwin_free(void) {
 
     clipboard_free_current ();
     cover_art_free ();
+    covermanager_free ();
     eq_window_destroy ();
     trkproperties_destroy ();
     progress_destroy ();
@@ -1538,6 +1541,7 @@ quit_gtk_cb (gpointer nothing) {
     trkproperties_modified = 0;
     trkproperties_destroy ();
     search_destroy ();
+    covermanager_disconnect ();
 #if GTK_CHECK_VERSION(3,10,0) && USE_GTK_APPLICATION
     g_application_quit (G_APPLICATION (gapp));
 #else
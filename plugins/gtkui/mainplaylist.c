@@ -37,6 +37,7 @@
 #include "drawing.h"
 #include "trkproperties.h"
 #include "coverart.h"
+#include "covermanager.h"
 #include "plcommon.h"
 
 //#define trace(...) { fprintf(stderr, __VA_ARGS__); }
@@ -147,6 +148,7 @@ main_columns_changed (DdbListview *listview) {
 static void
 main_vscroll_changed (int pos) {
     coverart_reset_queue ();
+    covermanager_reset_queue ();
     ddb_playlist_t *plt = deadbeef->plt_get_curr ();
     if (plt) {
         deadbeef->plt_set_scroll (plt, pos);
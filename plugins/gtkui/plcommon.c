@@ -28,6 +28,7 @@
 #include "gtkui.h"
 #include "plcommon.h"
 #include "coverart.h"
+#include "covermanager.h"
 #include "drawing.h"
 #include "trkproperties.h"
 #include "support.h"
@@ -200,6 +201,7 @@ pl_common_free_col_info (void *data) {
         free (info->sort_bytecode);
     }
     if (pl_common_is_album_art_column(info)) {
+        covermanager_cancel_user_data (info);
         g_object_ref(info->listview->list);
         queue_cover_callback(coverart_release, info);
         if (info->cover_load_timeout_id) {
@@ -288,6 +290,9 @@ pl_common_is_album_art_column (void *user_data) {
 
 static GdkPixbuf *
 get_cover_art (DB_playItem_t *it, int width, int height, void (*callback)(void *), void *user_data) {
+    if (covermanager_is_available ()) {
+        return covermanager_cover_for_track (it, width, height, callback, user_data);
+    }
     deadbeef->pl_lock();
     const char *uri = deadbeef->pl_find_meta(it, ":URI");
     const char *album = deadbeef->pl_find_meta(it, "album");
@@ -329,8 +334,9 @@ cover_load (void *user_data) {
     GtkAllocation a;
     gtk_widget_get_allocation(info->listview->list, &a);
     int end_pos = info->listview->scrollpos + a.height;
+    cover_avail_callback_t callback = covermanager_is_available () ? cover_invalidate : NULL;
     while (group && group_y < end_pos) {
-        GdkPixbuf *pixbuf = get_cover_art(group->head, info->new_cover_size, info->new_cover_size, NULL, NULL);
+        GdkPixbuf *pixbuf = get_cover_art(group->head, info->new_cover_size, info->new_cover_size, callback, info);
         if (pixbuf) {
             g_object_unref(pixbuf);
         }
@@ -338,7 +344,13 @@ cover_load (void *user_data) {
         group_y += group->height;
         group = group->next;
     }
-    queue_cover_callback(cover_invalidate, info);
+    if (covermanager_is_available ()) {
+        // the covers are drawn as they arrive
+        cover_invalidate (info);
+    }
+    else {
+        queue_cover_callback(cover_invalidate, info);
+    }
 
     return FALSE;
 }
@@ -89,7 +89,9 @@ _formatTime (float sec, int extraPrecise, char *buf, int bufsize) {
 static void
 _ctl_progress (rgs_controller_t *ctl, int current) {
     deadbeef->pl_lock ();
-    const char *uri = deadbeef->pl_find_meta (ctl->_rg_settings.tracks[current], ":URI");
+    // current is the number of completed tracks, and reaches num_tracks at the end
+    int idx = current < ctl->_rg_settings.num_tracks ? current : ctl->_rg_settings.num_tracks - 1;
+    const char *uri = deadbeef->pl_find_meta (ctl->_rg_settings.tracks[idx], ":URI");
 
     GtkWidget *progressText = lookup_widget (ctl->progress_window, "rg_scan_progress_file");
     gtk_entry_set_text (GTK_ENTRY (progressText), uri);
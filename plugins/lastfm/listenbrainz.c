@@ -19,22 +19,27 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdarg.h>
 #include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/stat.h>
 #include <curl/curl.h>
 #include <math.h>
 #include "../../deadbeef.h"
 
 #define trace(...) { deadbeef->log_detailed (&plugin.plugin, 0, __VA_ARGS__); }
 
-#define LFM_TESTMODE 0
 #define LFM_IGNORE_RULES 0
 #define LFM_NOSEND 0
 
 static DB_misc_t plugin;
 static DB_functions_t *deadbeef;
 
-#define LFM_CLIENTID "ddb"
 #define SCROBBLER_URL_LISTENBRAINZ "https://api.listenbrainz.org"
+#define SUBMIT_LISTENS_PATH "/1/submit-listens"
 
 #ifdef __MINGW32__
 #define LOOKUP_URL_FORMAT "cmd /c start http://www.last.fm/music/%s/_/%s"
@@ -42,15 +47,33 @@ static DB_functions_t *deadbeef;
 #define LOOKUP_URL_FORMAT "xdg-open 'http://www.last.fm/music/%s/_/%s' &"
 #endif
 
-static char listenbrainz_pass[100];
+// The listens are appended to a journal file in the config dir, one JSON object per line,
+// and are submitted from there in batches. The offset of the first unsubmitted listen
+// is stored in a separate file, and the journal is deleted once it's fully submitted.
+#define QUEUE_FNAME "listenbrainz_queue"
+#define QUEUE_POS_FNAME "listenbrainz_queue.pos"
+
+// listenbrainz accepts up to 1000 listens per request
+#define MAX_LISTENS_PER_REQUEST 500
 
-static char listenbrainz_submission_url[256];
+// retry delays after failed submissions, in seconds,
+// the first one can be changed with the hidden listenbrainz.retry_delay setting
+#define MIN_BACKOFF 30
+#define MAX_BACKOFF 3600
+
+static char listenbrainz_pass[100];
 
 static uintptr_t listenbrainz_mutex;
-static uintptr_t listenbrainz_cond;
+static uintptr_t listenbrainz_cond; // signalled when the submission thread has something to do
 static int listenbrainz_stopthread;
 static intptr_t listenbrainz_tid;
 
+// set when a listen is added to the journal, or when a submission needs to be retried,
+// protected by listenbrainz_mutex
+static int listenbrainz_queue_dirty;
+
+static CURL *listenbrainz_curl; // reused for all requests, to keep the connection alive
+
 #define META_FIELD_SIZE 200
 
 DB_plugin_t *
@@ -64,22 +87,93 @@ static char listenbrainz_reply[MAX_REPLY];
 static int listenbrainz_reply_sz;
 static char listenbrainz_err[CURL_ERROR_SIZE];
 
-#define LFM_SUBMISSION_QUEUE_SIZE 50
-
 typedef struct {
-    DB_playItem_t *it;
-    time_t started_timestamp;
-    float playtime;
-} subm_item_t;
+    char *data;
+    size_t size;
+    size_t alloc;
+} lb_buffer_t;
+
+// JSON of the now playing track, sent by the submission thread when not empty
+static lb_buffer_t listenbrainz_nowplaying;
+
+// the listens which are not in the journal yet, one per line,
+// written by the submission thread to keep the file I/O off the event thread
+static lb_buffer_t listenbrainz_pending;
+
+static void
+lb_buffer_append (lb_buffer_t *b, const char *s, size_t len) {
+    if (b->size + len + 1 > b->alloc) {
+        size_t alloc = b->alloc ? b->alloc : 1024;
+        while (b->size + len + 1 > alloc) {
+            alloc *= 2;
+        }
+        b->data = realloc (b->data, alloc);
+        b->alloc = alloc;
+    }
+    memcpy (b->data + b->size, s, len);
+    b->size += len;
+    b->data[b->size] = 0;
+}
+
+static void
+lb_buffer_printf (lb_buffer_t *b, const char *fmt, ...) {
+    char s[100];
+    va_list ap;
+    va_start (ap, fmt);
+    int len = vsnprintf (s, sizeof (s), fmt, ap);
+    va_end (ap);
+    if (len > 0) {
+        lb_buffer_append (b, s, len < (int)sizeof (s) ? len : sizeof (s) - 1);
+    }
+}
 
-static subm_item_t listenbrainz_subm_queue[LFM_SUBMISSION_QUEUE_SIZE];
+static void
+lb_buffer_reset (lb_buffer_t *b) {
+    b->size = 0;
+    if (b->data) {
+        b->data[0] = 0;
+    }
+}
+
+static void
+lb_buffer_free (lb_buffer_t *b) {
+    free (b->data);
+    memset (b, 0, sizeof (lb_buffer_t));
+}
+
+// appends the string as a quoted JSON string
+static void
+lb_buffer_append_json_string (lb_buffer_t *b, const char *str) {
+    lb_buffer_append (b, "\"", 1);
+    const char *p = str;
+    while (*p) {
+        const char *start = p;
+        while (*p && *p != '"' && *p != '\\' && (uint8_t)*p >= 0x20) {
+            p++;
+        }
+        lb_buffer_append (b, start, p - start);
+        if (!*p) {
+            break;
+        }
+        if (*p == '"' || *p == '\\') {
+            char esc[2] = { '\\', *p };
+            lb_buffer_append (b, esc, 2);
+        }
+        else {
+            lb_buffer_printf (b, "\\u%04x", (uint8_t)*p);
+        }
+        p++;
+    }
+    lb_buffer_append (b, "\"", 1);
+}
 
 static void
 listenbrainz_update_auth (void) {
     deadbeef->conf_lock ();
     const char *pass = deadbeef->conf_get_str_fast ("listenbrainz.usertoken", "");
-    if (strcmp (pass, listenbrainz_pass))
-        strcpy (listenbrainz_pass, pass);
+    if (strcmp (pass, listenbrainz_pass)) {
+        snprintf (listenbrainz_pass, sizeof (listenbrainz_pass), "%s", pass);
+    }
     deadbeef->conf_unlock ();
 }
 
@@ -91,112 +185,148 @@ listenbrainz_curl_res (void *ptr, size_t size, size_t nmemb, void *stream)
         return 0;
     }
     int len = size * nmemb;
-    if (listenbrainz_reply_sz + len >= MAX_REPLY) {
-        trace ("reply is too large. stopping.\n");
-        return 0;
-    }
-    memcpy (listenbrainz_reply + listenbrainz_reply_sz, ptr, len);
-    listenbrainz_reply_sz += len;
-//    char s[size*nmemb+1];
-//    memcpy (s, ptr, size*nmemb);
-//    s[size*nmemb] = 0;
-//    trace ("got from net: %s\n", s);
+    // only the beginning of the reply is kept, for logging
+    int n = len;
+    if (listenbrainz_reply_sz + n >= MAX_REPLY) {
+        n = MAX_REPLY - 1 - listenbrainz_reply_sz;
+    }
+    memcpy (listenbrainz_reply + listenbrainz_reply_sz, ptr, n);
+    listenbrainz_reply_sz += n;
+    listenbrainz_reply[listenbrainz_reply_sz] = 0;
     return len;
 }
 
+#if LIBCURL_VERSION_NUM >= 0x072000
+static int
+listenbrainz_curl_control (void *stream, curl_off_t dltotal, curl_off_t dlnow, curl_off_t ultotal, curl_off_t ulnow) {
+#else
 static int
 listenbrainz_curl_control (void *stream, double dltotal, double dlnow, double ultotal, double ulnow) {
+#endif
     if (listenbrainz_stopthread) {
         trace ("listenbrainz: aborting current request\n");
         return -1;
     }
     return 0;
 }
-static int
-curl_req_send (const char *req, const char *post) {
-    trace ("sending request: %s\n", req);
-    CURL *curl;
-    curl = curl_easy_init ();
-    if (!curl) {
-        trace ("listenbrainz: failed to init curl\n");
-        return -1;
+
+static void
+curl_req_set_proxy (CURL *curl) {
+    if (!deadbeef->conf_get_int ("network.proxy", 0)) {
+        curl_easy_setopt (curl, CURLOPT_PROXY, NULL);
+        return;
+    }
+    deadbeef->conf_lock ();
+    curl_easy_setopt (curl, CURLOPT_PROXY, deadbeef->conf_get_str_fast ("network.proxy.address", ""));
+    curl_easy_setopt (curl, CURLOPT_PROXYPORT, deadbeef->conf_get_int ("network.proxy.port", 8080));
+    const char *type = deadbeef->conf_get_str_fast ("network.proxy.type", "HTTP");
+    int curlproxytype = CURLPROXY_HTTP;
+    if (!strcasecmp (type, "HTTP")) {
+        curlproxytype = CURLPROXY_HTTP;
     }
-    curl_easy_setopt(curl, CURLOPT_URL, req);
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, listenbrainz_curl_res);
-    memset(listenbrainz_err, 0, sizeof(listenbrainz_err));
-    curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, listenbrainz_err);
-    curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_1_1);
-    curl_easy_setopt (curl, CURLOPT_NOSIGNAL, 1);
-    curl_easy_setopt (curl, CURLOPT_PROGRESSFUNCTION, listenbrainz_curl_control);
-    char ua[100];
-    deadbeef->conf_get_str ("network.http_user_agent", "deadbeef", ua, sizeof (ua));
-    curl_easy_setopt (curl, CURLOPT_USERAGENT, ua);
-    curl_easy_setopt (curl, CURLOPT_NOPROGRESS, 0);
-    if (post) {
-        curl_easy_setopt(curl, CURLOPT_POST, 1);
-        curl_easy_setopt(curl, CURLOPT_POSTFIELDS, post);
-        curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, strlen(post));
-    }
-    if (deadbeef->conf_get_int ("network.proxy", 0)) {
-        deadbeef->conf_lock ();
-        curl_easy_setopt (curl, CURLOPT_PROXY, deadbeef->conf_get_str_fast ("network.proxy.address", ""));
-        curl_easy_setopt (curl, CURLOPT_PROXYPORT, deadbeef->conf_get_int ("network.proxy.port", 8080));
-        const char *type = deadbeef->conf_get_str_fast ("network.proxy.type", "HTTP");
-        int curlproxytype = CURLPROXY_HTTP;
-        if (!strcasecmp (type, "HTTP")) {
-            curlproxytype = CURLPROXY_HTTP;
-        }
 #if LIBCURL_VERSION_MINOR >= 19 && LIBCURL_VERSION_PATCH >= 4
-            else if (!strcasecmp (type, "HTTP_1_0")) {
-            curlproxytype = CURLPROXY_HTTP_1_0;
-        }
+    else if (!strcasecmp (type, "HTTP_1_0")) {
+        curlproxytype = CURLPROXY_HTTP_1_0;
+    }
 #endif
 #if LIBCURL_VERSION_MINOR >= 15 && LIBCURL_VERSION_PATCH >= 2
-            else if (!strcasecmp (type, "SOCKS4")) {
-            curlproxytype = CURLPROXY_SOCKS4;
-        }
+    else if (!strcasecmp (type, "SOCKS4")) {
+        curlproxytype = CURLPROXY_SOCKS4;
+    }
 #endif
-        else if (!strcasecmp (type, "SOCKS5")) {
-            curlproxytype = CURLPROXY_SOCKS5;
-        }
+    else if (!strcasecmp (type, "SOCKS5")) {
+        curlproxytype = CURLPROXY_SOCKS5;
+    }
 #if LIBCURL_VERSION_MINOR >= 18 && LIBCURL_VERSION_PATCH >= 0
-        else if (!strcasecmp (type, "SOCKS4A")) {
-            curlproxytype = CURLPROXY_SOCKS4A;
-        }
-        else if (!strcasecmp (type, "SOCKS5_HOSTNAME")) {
-            curlproxytype = CURLPROXY_SOCKS5_HOSTNAME;
-        }
+    else if (!strcasecmp (type, "SOCKS4A")) {
+        curlproxytype = CURLPROXY_SOCKS4A;
+    }
+    else if (!strcasecmp (type, "SOCKS5_HOSTNAME")) {
+        curlproxytype = CURLPROXY_SOCKS5_HOSTNAME;
+    }
 #endif
-        curl_easy_setopt (curl, CURLOPT_PROXYTYPE, curlproxytype);
+    curl_easy_setopt (curl, CURLOPT_PROXYTYPE, curlproxytype);
 
-        const char *proxyuser = deadbeef->conf_get_str_fast ("network.proxy.username", "");
-        const char *proxypass = deadbeef->conf_get_str_fast ("network.proxy.usertoken", "");
-        if (*proxyuser || *proxypass) {
+    const char *proxyuser = deadbeef->conf_get_str_fast ("network.proxy.username", "");
+    const char *proxypass = deadbeef->conf_get_str_fast ("network.proxy.usertoken", "");
+    if (*proxyuser || *proxypass) {
 #if LIBCURL_VERSION_MINOR >= 19 && LIBCURL_VERSION_PATCH >= 1
-            curl_easy_setopt (curl, CURLOPT_PROXYUSERNAME, proxyuser);
-            curl_easy_setopt (curl, CURLOPT_PROXYUSERNAME, proxypass);
+        curl_easy_setopt (curl, CURLOPT_PROXYUSERNAME, proxyuser);
+        curl_easy_setopt (curl, CURLOPT_PROXYPASSWORD, proxypass);
 #else
-            char pwd[200];
-            snprintf (pwd, sizeof (pwd), "%s:%s", proxyuser, proxypass);
-            curl_easy_setopt (curl, CURLOPT_PROXYUSERPWD, pwd);
+        char pwd[200];
+        snprintf (pwd, sizeof (pwd), "%s:%s", proxyuser, proxypass);
+        curl_easy_setopt (curl, CURLOPT_PROXYUSERPWD, pwd);
 #endif
-        }
-        deadbeef->conf_unlock ();
-    }
-    int status = curl_easy_perform(curl);
-    curl_easy_cleanup (curl);
-    if (!status) {
-        listenbrainz_reply[listenbrainz_reply_sz] = 0;
-    }
-    if (status != 0) {
-        trace ("curl request failed, err:\n%s\n", listenbrainz_err);
     }
-    return status;
+    deadbeef->conf_unlock ();
 }
 
-static void
-curl_req_cleanup (void) {
+// posts the JSON body to the submit-listens endpoint, using the persistent curl handle
+// returns the HTTP status code, or -1 if the request failed
+static int
+curl_req_send (const char *body, size_t size) {
+    if (!listenbrainz_curl) {
+        listenbrainz_curl = curl_easy_init ();
+        if (!listenbrainz_curl) {
+            trace ("listenbrainz: failed to init curl\n");
+            return -1;
+        }
+    }
+    CURL *curl = listenbrainz_curl;
+
+    char url[256];
+    deadbeef->conf_lock ();
+    snprintf (url, sizeof (url), "%s" SUBMIT_LISTENS_PATH, deadbeef->conf_get_str_fast ("listenbrainz.scrobbler_url", SCROBBLER_URL_LISTENBRAINZ));
+    deadbeef->conf_unlock ();
+
+    listenbrainz_update_auth ();
+    char auth[150];
+    snprintf (auth, sizeof (auth), "Authorization: Token %s", listenbrainz_pass);
+    struct curl_slist *headers = NULL;
+    headers = curl_slist_append (headers, auth);
+    headers = curl_slist_append (headers, "Content-Type: application/json");
+
+    trace ("listenbrainz: sending %d bytes to %s\n", (int)size, url);
     listenbrainz_reply_sz = 0;
+    listenbrainz_reply[0] = 0;
+    curl_easy_setopt (curl, CURLOPT_URL, url);
+    curl_easy_setopt (curl, CURLOPT_HTTPHEADER, headers);
+    curl_easy_setopt (curl, CURLOPT_WRITEFUNCTION, listenbrainz_curl_res);
+    memset (listenbrainz_err, 0, sizeof (listenbrainz_err));
+    curl_easy_setopt (curl, CURLOPT_ERRORBUFFER, listenbrainz_err);
+    curl_easy_setopt (curl, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_1_1);
+    curl_easy_setopt (curl, CURLOPT_NOSIGNAL, 1);
+    curl_easy_setopt (curl, CURLOPT_CONNECTTIMEOUT, 30);
+    // give up on a stalled connection, the listens stay in the journal until the next attempt
+    curl_easy_setopt (curl, CURLOPT_LOW_SPEED_LIMIT, 1L);
+    curl_easy_setopt (curl, CURLOPT_LOW_SPEED_TIME, 30L);
+#if LIBCURL_VERSION_NUM >= 0x072000
+    curl_easy_setopt (curl, CURLOPT_XFERINFOFUNCTION, listenbrainz_curl_control);
+#else
+    curl_easy_setopt (curl, CURLOPT_PROGRESSFUNCTION, listenbrainz_curl_control);
+#endif
+    curl_easy_setopt (curl, CURLOPT_NOPROGRESS, 0);
+    char ua[100];
+    deadbeef->conf_get_str ("network.http_user_agent", "deadbeef", ua, sizeof (ua));
+    curl_easy_setopt (curl, CURLOPT_USERAGENT, ua);
+    curl_easy_setopt (curl, CURLOPT_POST, 1);
+    curl_easy_setopt (curl, CURLOPT_POSTFIELDS, body);
+    curl_easy_setopt (curl, CURLOPT_POSTFIELDSIZE, (long)size);
+    curl_req_set_proxy (curl);
+
+    int status = curl_easy_perform (curl);
+    long code = -1;
+    if (status != 0) {
+        trace ("listenbrainz: request failed, err:\n%s\n", listenbrainz_err);
+    }
+    else {
+        curl_easy_getinfo (curl, CURLINFO_RESPONSE_CODE, &code);
+        trace ("listenbrainz: response %d: %s\n", (int)code, listenbrainz_reply);
+    }
+    curl_easy_setopt (curl, CURLOPT_HTTPHEADER, NULL);
+    curl_slist_free_all (headers);
+    return (int)code;
 }
 
 static int
@@ -242,102 +372,262 @@ listenbrainz_fetch_song_info (DB_playItem_t *song, float playtime, char *a, char
     return 0;
 }
 
-// subm is submission idx, or -1 for nowplaying
-// returns number of bytes added, or -1
+// appends the listen as a JSON object, without the timestamp if listened_at is 0
+// returns -1 if the track doesn't have enough metadata
 static int
-listenbrainz_format_uri (int subm, DB_playItem_t *song, char *out, int outl, time_t started_timestamp, float playtime) {
-    if (subm > 50) {
-        trace ("listenbrainz: it's only allowed to send up to 50 submissions at once (got idx=%d)\n", subm);
-        return -1;
-    }
-    int sz = outl;
+listenbrainz_format_listen (lb_buffer_t *out, DB_playItem_t *song, time_t listened_at, float playtime) {
     char a[META_FIELD_SIZE]; // artist
     char t[META_FIELD_SIZE]; // title
     char b[META_FIELD_SIZE]; // album
     float l; // duration
     char n[META_FIELD_SIZE]; // tracknum
-    char m[META_FIELD_SIZE]; // muzicbrainz id
+    char m[META_FIELD_SIZE]; // musicbrainz id
 
-    char ka[6] = "a";
-    char kt[6] = "t";
-    char kb[6] = "b";
-    char kl[6] = "l";
-    char kn[6] = "n";
-    char km[6] = "m";
+    if (listenbrainz_fetch_song_info (song, playtime, a, t, b, &l, n, m) < 0) {
+        return -1;
+    }
 
-    if (subm >= 0) {
-        snprintf (ka+1, 5, "[%d]", subm);
-        strcpy (kt+1, ka+1);
-        strcpy (kb+1, ka+1);
-        strcpy (kl+1, ka+1);
-        strcpy (kn+1, ka+1);
-        strcpy (km+1, ka+1);
+    lb_buffer_append (out, "{", 1);
+    if (listened_at) {
+        lb_buffer_printf (out, "\"listened_at\":%lld,", (long long)listened_at);
+    }
+    lb_buffer_printf (out, "\"track_metadata\":{\"artist_name\":");
+    lb_buffer_append_json_string (out, a);
+    lb_buffer_printf (out, ",\"track_name\":");
+    lb_buffer_append_json_string (out, t);
+    if (*b) {
+        lb_buffer_printf (out, ",\"release_name\":");
+        lb_buffer_append_json_string (out, b);
+    }
+    lb_buffer_printf (out, ",\"additional_info\":{\"listening_from\":\"deadbeef\",\"duration\":%d", (int)l);
+    if (*n) {
+        lb_buffer_printf (out, ",\"tracknumber\":");
+        lb_buffer_append_json_string (out, n);
     }
+    if (*m) {
+        lb_buffer_printf (out, ",\"recording_mbid\":");
+        lb_buffer_append_json_string (out, m);
+    }
+    lb_buffer_append (out, "}}}", 3);
+    return 0;
+}
 
-    if (listenbrainz_fetch_song_info (song, playtime, a, t, b, &l, n, m) == 0) {
-//        trace ("playtime: %f\nartist: %s\ntitle: %s\nalbum: %s\nduration: %f\ntracknum: %s\n---\n", song->playtime, a, t, b, l, n);
+static void
+listenbrainz_queue_path (char *path, size_t size, const char *fname) {
+    snprintf (path, size, "%s/%s", deadbeef->get_system_dir (DDB_SYS_DIR_CONFIG), fname);
+}
+
+static long
+listenbrainz_queue_get_pos (void) {
+    char path[PATH_MAX];
+    listenbrainz_queue_path (path, sizeof (path), QUEUE_POS_FNAME);
+    FILE *fp = fopen (path, "rt");
+    if (!fp) {
+        return 0;
     }
-    else {
-//        trace ("file %s doesn't have enough tags to submit to last.fm\n", song->fname);
-        return -1;
+    long pos = 0;
+    if (fscanf (fp, "%ld", &pos) != 1 || pos < 0) {
+        pos = 0;
     }
+    fclose (fp);
+    return pos;
+}
 
-    if (listenbrainz_add_keyvalue_uri_encoded (&out, &outl, ka, a) < 0) {
-//        trace ("failed to add %s=%s\n", ka, a);
-        return -1;
+static void
+listenbrainz_queue_set_pos (long pos) {
+    char path[PATH_MAX];
+    char temp[PATH_MAX + sizeof (".tmp")];
+    listenbrainz_queue_path (path, sizeof (path), QUEUE_POS_FNAME);
+    snprintf (temp, sizeof (temp), "%s.tmp", path);
+    FILE *fp = fopen (temp, "wt");
+    if (!fp) {
+        trace ("listenbrainz: failed to write %s\n", temp);
+        return;
     }
-    if (listenbrainz_add_keyvalue_uri_encoded (&out, &outl, kt, t) < 0) {
-//        trace ("failed to add %s=%s\n", kt, t);
-        return -1;
+    fprintf (fp, "%ld\n", pos);
+    fflush (fp);
+    fsync (fileno (fp));
+    fclose (fp);
+    rename (temp, path);
+}
+
+// appends the listens, one per line, to the journal
+// the journal files are only accessed by the submission thread
+static void
+listenbrainz_queue_append (const char *listens, size_t size) {
+    char path[PATH_MAX];
+    listenbrainz_queue_path (path, sizeof (path), QUEUE_FNAME);
+    FILE *fp = fopen (path, "ab");
+    if (!fp) {
+        trace ("listenbrainz: failed to open %s\n", path);
+        return;
     }
-    if (listenbrainz_add_keyvalue_uri_encoded (&out, &outl, kb, b) < 0) {
-//        trace ("failed to add %s=%s\n", kb, b);
-        return -1;
+    if (fwrite (listens, 1, size, fp) != size) {
+        trace ("listenbrainz: failed to write to %s\n", path);
     }
-    if (listenbrainz_add_keyvalue_uri_encoded (&out, &outl, kn, n) < 0) {
-//        trace ("failed to add %s=%s\n", kn, n);
-        return -1;
+    fflush (fp);
+    fsync (fileno (fp));
+    fclose (fp);
+}
+
+// Cuts an incomplete last line, left by a crash while writing,
+// which would otherwise be glued to the next listen.
+static void
+listenbrainz_queue_repair (void) {
+    char path[PATH_MAX];
+    listenbrainz_queue_path (path, sizeof (path), QUEUE_FNAME);
+    FILE *fp = fopen (path, "r+b");
+    if (!fp) {
+        return;
     }
-    if (listenbrainz_add_keyvalue_uri_encoded (&out, &outl, km, m) < 0) {
-//        trace ("failed to add %s=%s\n", km, m);
-        return -1;
+    fseek (fp, 0, SEEK_END);
+    long size = ftell (fp);
+    long end = size;
+    while (end > 0) {
+        fseek (fp, end-1, SEEK_SET);
+        if (fgetc (fp) == '\n') {
+            break;
+        }
+        end--;
     }
-    int processed;
-    processed = snprintf (out, outl, "%s=%d&", kl, (int)l);
-    if (processed > outl) {
-//        trace ("failed to add %s=%d\n", kl, (int)l);
-        return -1;
+    fclose (fp);
+    if (end != size) {
+        trace ("listenbrainz: removing incomplete listen from the queue\n");
+        truncate (path, end);
     }
-    out += processed;
-    outl -= processed;
-    if (subm >= 0) {
-        processed = snprintf (out, outl, "i[%d]=%d&o[%d]=P&r[%d]=&", subm, (int)started_timestamp, subm, subm);
-        if (processed > outl) {
-//            trace ("failed to add i[%d]=%d&o[%d]=P&r[%d]=&\n", subm, (int)song->started_timestamp, subm, subm);
-            return -1;
+}
+
+// Reads up to max_count listens from the journal, starting at pos,
+// and wraps them into a submit-listens request.
+// Returns the number of listens, and the position after them in endpos.
+static int
+listenbrainz_queue_read_batch (FILE *fp, long pos, int max_count, lb_buffer_t *body, long *endpos) {
+    if (fseek (fp, pos, SEEK_SET)) {
+        return 0;
+    }
+    lb_buffer_reset (body);
+    lb_buffer_printf (body, "{\"listen_type\":\"import\",\"payload\":[");
+    int count = 0;
+    char line[META_FIELD_SIZE * 40];
+    while (count < max_count && fgets (line, sizeof (line), fp)) {
+        size_t len = strlen (line);
+        if (!len || line[len-1] != '\n') {
+            // too long to be a valid listen, or still being written
+            if (len == sizeof (line) - 1) {
+                int c;
+                while ((c = fgetc (fp)) != EOF && c != '\n') {
+                }
+                trace ("listenbrainz: skipping invalid listen in the queue\n");
+                pos = ftell (fp);
+                continue;
+            }
+            break;
+        }
+        if (count) {
+            lb_buffer_append (body, ",", 1);
         }
-        out += processed;
-        outl -= processed;
+        lb_buffer_append (body, line, len-1);
+        count++;
+        pos += len;
     }
+    lb_buffer_append (body, "]}", 2);
+    *endpos = pos;
+    return count;
+}
+
+// number of listens to send one at a time, to find the one which made the server reject a batch
+static int listenbrainz_isolate_count;
 
-    return sz - outl;
+// Submits the next batch from the journal.
+// Returns the number of listens removed from the journal, -1 if the submission needs to be retried later,
+// or -2 if the server rejected the user token.
+static int
+listenbrainz_submit_batch (void) {
+    char path[PATH_MAX];
+    listenbrainz_queue_path (path, sizeof (path), QUEUE_FNAME);
+
+    FILE *fp = fopen (path, "rb");
+    if (!fp) {
+        return 0;
+    }
+    long pos = listenbrainz_queue_get_pos ();
+    long endpos = pos;
+    lb_buffer_t body = {0};
+    int count = listenbrainz_queue_read_batch (fp, pos, listenbrainz_isolate_count > 0 ? 1 : MAX_LISTENS_PER_REQUEST, &body, &endpos);
+    fclose (fp);
+
+    if (!count) {
+        lb_buffer_free (&body);
+        if (endpos != pos) {
+            listenbrainz_queue_set_pos (endpos);
+        }
+        return 0;
+    }
+
+#if !LFM_NOSEND
+    int code = curl_req_send (body.data, body.size);
+#else
+    int code = 200;
+#endif
+    lb_buffer_free (&body);
+
+    if (code == 400) {
+        // one of the listens was rejected: find it by sending one at a time, and drop it
+        if (count > 1) {
+            listenbrainz_isolate_count = count;
+            deadbeef->mutex_lock (listenbrainz_mutex);
+            listenbrainz_queue_dirty = 1;
+            deadbeef->mutex_unlock (listenbrainz_mutex);
+            return 0;
+        }
+        trace ("listenbrainz: listen rejected by the server, dropping it\n");
+        listenbrainz_isolate_count = 0;
+    }
+    else if (code == 401) {
+        trace ("listenbrainz: invalid user token\n");
+        return -2;
+    }
+    else if (code < 200 || code >= 300) {
+        return -1;
+    }
+    else if (listenbrainz_isolate_count > 0) {
+        listenbrainz_isolate_count--;
+    }
+
+    struct stat st;
+    if (!stat (path, &st) && st.st_size <= endpos) {
+        // fully submitted
+        char pospath[PATH_MAX];
+        listenbrainz_queue_path (pospath, sizeof (pospath), QUEUE_POS_FNAME);
+        unlink (path);
+        unlink (pospath);
+    }
+    else {
+        listenbrainz_queue_set_pos (endpos);
+    }
+    trace ("listenbrainz: submitted %d listens\n", count);
+    return count;
 }
 
 static int
 listenbrainz_songstarted (ddb_event_track_t *ev, uintptr_t data) {
     trace ("listenbrainz songstarted %p\n", ev->track);
-    if (!deadbeef->conf_get_int ("listenbrainz.enable", 0)) {
+    if (!deadbeef->conf_get_int ("listenbrainz.enable", 0) || deadbeef->conf_get_int ("listenbrainz.disable_np", 0)) {
         return 0;
     }
-    deadbeef->mutex_lock (listenbrainz_mutex);
-    if (listenbrainz_format_uri (-1, ev->track, listenbrainz_nowplaying, sizeof (listenbrainz_nowplaying), ev->started_timestamp, 120) < 0) {
-        listenbrainz_nowplaying[0] = 0;
+    lb_buffer_t listen = {0};
+    if (listenbrainz_format_listen (&listen, ev->track, 0, 120) < 0) {
+        lb_buffer_free (&listen);
+        return 0;
     }
-//    trace ("%s\n", listenbrainz_nowplaying);
+    deadbeef->mutex_lock (listenbrainz_mutex);
+    lb_buffer_reset (&listenbrainz_nowplaying);
+    lb_buffer_printf (&listenbrainz_nowplaying, "{\"listen_type\":\"playing_now\",\"payload\":[");
+    lb_buffer_append (&listenbrainz_nowplaying, listen.data, listen.size);
+    lb_buffer_append (&listenbrainz_nowplaying, "]}", 2);
+    deadbeef->cond_signal (listenbrainz_cond);
     deadbeef->mutex_unlock (listenbrainz_mutex);
-    if (listenbrainz_nowplaying[0]) {
-        deadbeef->cond_signal (listenbrainz_cond);
-    }
+    lb_buffer_free (&listen);
 
     return 0;
 }
@@ -378,137 +668,108 @@ listenbrainz_songchanged (ddb_event_trackchange_t *ev, uintptr_t data) {
         trace ("listenbrainz: not enough metadata for submission, artist=%s, title=%s, album=%s\n", deadbeef->pl_find_meta (ev->from, "artist"), deadbeef->pl_find_meta (ev->from, "title"), deadbeef->pl_find_meta (ev->from, "album"));
         return 0;
     }
-    deadbeef->mutex_lock (listenbrainz_mutex);
-    // find free place in queue
-    for (int i = 0; i < LFM_SUBMISSION_QUEUE_SIZE; i++) {
-        if (!listenbrainz_subm_queue[i].it) {
-            trace ("listenbrainz: song is now in queue for submission\n");
-            listenbrainz_subm_queue[i].it = ev->from;
-            listenbrainz_subm_queue[i].started_timestamp = ev->started_timestamp;
-            listenbrainz_subm_queue[i].playtime = ev->playtime;
-            deadbeef->pl_item_ref (ev->from);
-            break;
-        }
+    lb_buffer_t listen = {0};
+    if (listenbrainz_format_listen (&listen, ev->from, ev->started_timestamp, ev->playtime) < 0) {
+        lb_buffer_free (&listen);
+        return 0;
     }
-    deadbeef->mutex_unlock (listenbrainz_mutex);
+    deadbeef->mutex_lock (listenbrainz_mutex);
+    trace ("listenbrainz: song is now in queue for submission\n");
+    lb_buffer_append (&listenbrainz_pending, listen.data, listen.size);
+    lb_buffer_append (&listenbrainz_pending, "\n", 1);
+    listenbrainz_queue_dirty = 1;
     deadbeef->cond_signal (listenbrainz_cond);
+    deadbeef->mutex_unlock (listenbrainz_mutex);
+    lb_buffer_free (&listen);
 
     return 0;
 }
 
 static void
-listenbrainz_send_submissions (void) {
-    trace ("listenbrainz_send_submissions\n");
-    int i;
-    char req[1024*50];
-    int idx = 0;
-    char *r = req;
-    int len = sizeof (req);
-    int res;
-    deadbeef->mutex_lock (listenbrainz_mutex);
-    for (i = 0; i < LFM_SUBMISSION_QUEUE_SIZE; i++) {
-        if (listenbrainz_subm_queue[i].it) {
-            res = listenbrainz_format_uri (idx, listenbrainz_subm_queue[i].it, r, len, listenbrainz_subm_queue[i].started_timestamp, listenbrainz_subm_queue[i].playtime);
-            if (res < 0) {
-                trace ("listenbrainz: failed to format uri\n");
-                return;
-            }
-            len -= res;
-            r += res;
-            idx++;
-        }
-    }
-    deadbeef->mutex_unlock (listenbrainz_mutex);
-    if (!idx) {
-        return;
-    }
-
-    *listenbrainz_submission_url = deadbeef->conf_get_str_fast ("listenbrainz.scrobbler_url", SCROBBLER_URL_LFM);
+listenbrainz_thread (void *ctx) {
+    int backoff = 0;
+    time_t next_attempt = 0;
+    lb_buffer_t listens = {0};
+    char *nowplaying = NULL;
 
-    res = snprintf (r, len, "s=%s&", listenbrainz_sess);
-    if (res > len) {
-        return;
-    }
-    trace ("submission req string:\n%s\n", req);
-#if !LFM_NOSEND
-    for (int attempts = 2; attempts > 0; attempts--) {
-        int status = curl_req_send (listenbrainz_submission_url, req);
-        if (!status) {
-            if (strncmp (listenbrainz_reply, "OK", 2)) {
-                trace ("submission failed, response:\n%s\n", listenbrainz_reply);
-                if (!strncmp (listenbrainz_reply, "BADSESSION", 7)) {
-                    trace ("got badsession; trying to restore session...\n");
-                    listenbrainz_sess[0] = 0;
-                    curl_req_cleanup ();
-                    if (auth () < 0) {
-                        trace ("fail!\n");
-                        break; // total fail
-                    }
-                    trace ("success! retrying send nowplaying...\n");
-                    res = snprintf (r, len, "s=%s&", listenbrainz_sess);
-                    continue; // retry with new session
-                }
+    deadbeef->mutex_lock (listenbrainz_mutex);
+    while (!listenbrainz_stopthread) {
+        int enabled = deadbeef->conf_get_int ("listenbrainz.enable", 0);
+        int submit = enabled && listenbrainz_queue_dirty && time (NULL) >= next_attempt;
+        if (!listenbrainz_pending.size && !listenbrainz_nowplaying.size && !submit) {
+            // Woken up by new listens, the now playing track, config changes and stop,
+            // or when it's time to retry a failed submission
+            time_t now = time (NULL);
+            if (enabled && listenbrainz_queue_dirty && next_attempt > now) {
+                deadbeef->cond_wait_timeout_locked (listenbrainz_cond, listenbrainz_mutex, (int)(next_attempt - now) * 1000);
             }
             else {
-                trace ("submission successful, response:\n%s\n", listenbrainz_reply);
-                deadbeef->mutex_lock (listenbrainz_mutex);
-                for (i = 0; i < LFM_SUBMISSION_QUEUE_SIZE; i++) {
-                    if (listenbrainz_subm_queue[i].it) {
-                        deadbeef->pl_item_unref (listenbrainz_subm_queue[i].it);
-                        listenbrainz_subm_queue[i].it = NULL;
-                        listenbrainz_subm_queue[i].started_timestamp = 0;
-                    }
-                }
-                deadbeef->mutex_unlock (listenbrainz_mutex);
+                deadbeef->cond_wait_locked (listenbrainz_cond, listenbrainz_mutex);
             }
+            continue;
         }
-        curl_req_cleanup ();
-        break;
-    }
-#else
-    trace ("submission successful (NOSEND=1):\n");
-    deadbeef->mutex_lock (listenbrainz_mutex);
-    for (i = 0; i < LFM_SUBMISSION_QUEUE_SIZE; i++) {
-        if (listenbrainz_subm_queue[i].it) {
-            deadbeef->pl_item_unref (listenbrainz_subm_queue[i].it);
-            listenbrainz_subm_queue[i].it = NULL;
-            listenbrainz_subm_queue[i].started_timestamp = 0;
 
+        lb_buffer_t tmp = listens;
+        listens = listenbrainz_pending;
+        listenbrainz_pending = tmp;
+        lb_buffer_reset (&listenbrainz_pending);
+        if (listenbrainz_nowplaying.size) {
+            nowplaying = strdup (listenbrainz_nowplaying.data);
+            lb_buffer_reset (&listenbrainz_nowplaying);
         }
-    }
-    deadbeef->mutex_unlock (listenbrainz_mutex);
-#endif
-}
+        if (submit) {
+            listenbrainz_queue_dirty = 0;
+        }
+        deadbeef->mutex_unlock (listenbrainz_mutex);
 
-static void
-listenbrainz_thread (void *ctx) {
-    //trace ("listenbrainz_thread started\n");
-    for (;;) {
-        if (listenbrainz_stopthread) {
-            deadbeef->mutex_unlock (listenbrainz_mutex);
-            trace ("listenbrainz_thread end\n");
-            return;
+        if (listens.size) {
+            listenbrainz_queue_append (listens.data, listens.size);
+            lb_buffer_reset (&listens);
         }
-        trace ("listenbrainz wating for cond...\n");
-        deadbeef->cond_wait (listenbrainz_cond, listenbrainz_mutex);
-        if (listenbrainz_stopthread) {
-            deadbeef->mutex_unlock (listenbrainz_mutex);
-            trace ("listenbrainz_thread end[2]\n");
-            return;
+
+        if (nowplaying) {
+#if !LFM_NOSEND
+            // now playing notifications are not retried, they're outdated by the time the connection is back
+            if (enabled) {
+                curl_req_send (nowplaying, strlen (nowplaying));
+            }
+#endif
+            free (nowplaying);
+            nowplaying = NULL;
         }
-        trace ("cond signalled!\n");
-        deadbeef->mutex_unlock (listenbrainz_mutex);
 
-        if (!deadbeef->conf_get_int ("listenbrainz.enable", 0)) {
+        int res = submit ? listenbrainz_submit_batch () : 0;
+
+        deadbeef->mutex_lock (listenbrainz_mutex);
+        if (!submit) {
             continue;
         }
-        trace ("listenbrainz sending nowplaying...\n");
-        listenbrainz_send_submissions ();
-        // try to send nowplaying
-        if (listenbrainz_nowplaying[0] && !deadbeef->conf_get_int ("listenbrainz.disable_np", 0)) {
-            listenbrainz_send_nowplaying ();
+        if (res < 0) {
+            // retry after 30 sec, doubling up to an hour while the server is unreachable;
+            // a bad token won't fix itself soon, so wait the maximum time for that
+            backoff = backoff ? backoff * 2 : deadbeef->conf_get_int ("listenbrainz.retry_delay", MIN_BACKOFF);
+            if (backoff < 1) {
+                backoff = 1;
+            }
+            if (backoff > MAX_BACKOFF || res == -2) {
+                backoff = MAX_BACKOFF;
+            }
+            next_attempt = time (NULL) + backoff;
+            trace ("listenbrainz: submission failed, retrying in %d seconds\n", backoff);
+            listenbrainz_queue_dirty = 1;
+        }
+        else {
+            backoff = 0;
+            next_attempt = 0;
+            if (res > 0) {
+                // drain the backlog without waiting
+                listenbrainz_queue_dirty = 1;
+            }
         }
     }
+    deadbeef->mutex_unlock (listenbrainz_mutex);
+    lb_buffer_free (&listens);
+    trace ("listenbrainz_thread end\n");
 }
 
 static int
@@ -520,6 +781,12 @@ listenbrainz_message (uint32_t id, uintptr_t ctx, uint32_t p1, uint32_t p2) {
         case DB_EV_SONGCHANGED:
             listenbrainz_songchanged ((ddb_event_trackchange_t *)ctx, 0);
             break;
+        case DB_EV_CONFIGCHANGED:
+            // the scrobbler could be enabled
+            deadbeef->mutex_lock (listenbrainz_mutex);
+            deadbeef->cond_signal (listenbrainz_cond);
+            deadbeef->mutex_unlock (listenbrainz_mutex);
+            break;
     }
     return 0;
 }
@@ -532,6 +799,9 @@ listenbrainz_start (void) {
     listenbrainz_stopthread = 0;
     listenbrainz_mutex = deadbeef->mutex_create_nonrecursive ();
     listenbrainz_cond = deadbeef->cond_create ();
+    listenbrainz_queue_repair ();
+    // submit the listens left from the previous sessions
+    listenbrainz_queue_dirty = 1;
     listenbrainz_tid = deadbeef->thread_start (listenbrainz_thread, NULL);
 
     return 0;
@@ -541,19 +811,67 @@ static int
 listenbrainz_stop (void) {
     trace ("listenbrainz_stop\n");
     if (listenbrainz_mutex) {
+        deadbeef->mutex_lock (listenbrainz_mutex);
         listenbrainz_stopthread = 1;
-
-        trace ("listenbrainz_stop signalling cond\n");
         deadbeef->cond_signal (listenbrainz_cond);
+        deadbeef->mutex_unlock (listenbrainz_mutex);
+
         trace ("waiting for thread to finish\n");
         deadbeef->thread_join (listenbrainz_tid);
         listenbrainz_tid = 0;
+        if (listenbrainz_curl) {
+            curl_easy_cleanup (listenbrainz_curl);
+            listenbrainz_curl = NULL;
+        }
+        // the listens which came in while stopping are submitted on the next start
+        if (listenbrainz_pending.size) {
+            listenbrainz_queue_append (listenbrainz_pending.data, listenbrainz_pending.size);
+        }
+        lb_buffer_free (&listenbrainz_pending);
+        lb_buffer_free (&listenbrainz_nowplaying);
         deadbeef->cond_free (listenbrainz_cond);
+        listenbrainz_cond = 0;
         deadbeef->mutex_free (listenbrainz_mutex);
+        listenbrainz_mutex = 0;
     }
     return 0;
 }
 
+// returns number of encoded chars on success, or -1 in case of error
+static int
+listenbrainz_uri_encode (char *out, int outl, const char *str) {
+    int l = outl;
+    while (*str && *((uint8_t*)str) >= 32) {
+        if (outl <= 1) {
+            return -1;
+        }
+
+        if (!(
+            (*str >= '0' && *str <= '9') ||
+            (*str >= 'a' && *str <= 'z') ||
+            (*str >= 'A' && *str <= 'Z') ||
+            (*str == ' ')
+        ))
+        {
+            if (outl <= 3) {
+                return -1;
+            }
+            snprintf (out, outl, "%%%02x", (uint8_t)*str);
+            outl -= 3;
+            str++;
+            out += 3;
+        }
+        else {
+            *out = *str == ' ' ? '+' : *str;
+            out++;
+            str++;
+            outl--;
+        }
+    }
+    *out = 0;
+    return l - outl;
+}
+
 static int
 listenbrainz_action_lookup (DB_plugin_action_t *action, int ctx)
 {
@@ -609,7 +927,9 @@ listenbrainz_action_lookup (DB_plugin_action_t *action, int ctx)
         goto out;
     }
 
-    int res = system (command);
+    if (system (command) == -1) {
+        trace ("listenbrainz: failed to run %s\n", command);
+    }
     out:
     if (it) {
         deadbeef->pl_item_unref (it);
@@ -22,18 +22,32 @@
 */
 
 #include <sys/time.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <errno.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <poll.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
 #include <string.h>
 #include <stdlib.h>
 #include <limits.h>
 #include <assert.h>
 #include "../../deadbeef.h"
+#include "medialib.h"
 
-DB_functions_t *deadbeef;
+static DB_functions_t *deadbeef;
 
 static int filter_id;
 
+struct ml_entry_s;
+
 typedef struct ml_string_s {
     const char *text;
+    int count; // number of tracks referencing this string
+    struct ml_entry_s *tracks; // folders only: tracks directly in the folder, linked by folder_next
     struct ml_string_s *bucket_next;
 } ml_string_t;
 
@@ -41,12 +55,15 @@ typedef struct ml_entry_s {
     const char *file;
     const char *title;
     int subtrack;
+    DB_playItem_t *track; // the track in ml_playlist
     ml_string_t *artist;
     ml_string_t *album;
     ml_string_t *genre;
     ml_string_t *folder;
     struct ml_entry_s *next;
+    struct ml_entry_s *prev;
     struct ml_entry_s *bucket_next;
+    struct ml_entry_s *folder_next;
 } ml_entry_t;
 
 #define ML_HASH_SIZE 4096
@@ -54,6 +71,7 @@ typedef struct ml_entry_s {
 typedef struct {
     // plain list of all tracks in the entire collection
     ml_entry_t *tracks;
+    ml_entry_t *tracks_tail;
 
     // hash formed by filename pointer
     // this hash purpose is to quickly check whether the filename is in the library already
@@ -67,9 +85,26 @@ typedef struct {
     ml_string_t *hash_folder[ML_HASH_SIZE];
 } ml_db_t;
 
+// mtime/size signature of a file or folder under medialib.path, as of the last scan
+typedef struct ml_sig_s {
+    char *path;
+    int64_t mtime;
+    int64_t size;
+    uint8_t is_dir;
+    uint8_t seen; // found by the current scan
+    struct ml_sig_s *bucket_next;
+} ml_sig_t;
+
+#define ML_SIG_HASH_SIZE 65536
+
+#define ML_SIG_MAGIC "MLSG"
+#define ML_SIG_VERSION 1
+
+static ml_sig_t *sig_hash[ML_SIG_HASH_SIZE];
+
 static uint32_t
 hash_for_ptr (void *ptr) {
-    return (((uint32_t)(ptr))>>1) & (ML_HASH_SIZE-1);
+    return (((uint32_t)(uintptr_t)(ptr))>>1) & (ML_HASH_SIZE-1);
 }
 
 static ml_string_t *
@@ -84,25 +119,44 @@ hash_find_for_hashkey (ml_string_t **hash, const char *val, uint32_t h) {
     return NULL;
 }
 
-ml_string_t *
+static ml_string_t *
 hash_find (ml_string_t **hash, const char *val) {
     uint32_t h = hash_for_ptr ((void *)val) & (ML_HASH_SIZE-1);
     return hash_find_for_hashkey(hash, val, h);
 }
 
+// Returns the existing or the new string, with the track count increased
 static ml_string_t *
 hash_add (ml_string_t **hash, const char *val) {
     uint32_t h = hash_for_ptr ((void *)val) & (ML_HASH_SIZE-1);
-    if (!hash_find_for_hashkey(hash, val, h)) {
-        deadbeef->metacache_ref (val);
-        ml_string_t *s = calloc (sizeof (ml_string_t), 1);
+    ml_string_t *s = hash_find_for_hashkey(hash, val, h);
+    if (!s) {
+        s = calloc (sizeof (ml_string_t), 1);
         s->bucket_next = hash[h];
         s->text = val;
         deadbeef->metacache_ref (val);
         hash[h] = s;
-        return s;
     }
-    return NULL;
+    s->count++;
+    return s;
+}
+
+// Decreases the track count, and removes the string when it's not used anymore
+static void
+hash_release (ml_string_t **hash, ml_string_t *s) {
+    if (!s || --s->count > 0) {
+        return;
+    }
+    uint32_t h = hash_for_ptr ((void *)s->text) & (ML_HASH_SIZE-1);
+    ml_string_t **pp = &hash[h];
+    while (*pp && *pp != s) {
+        pp = &(*pp)->bucket_next;
+    }
+    if (*pp) {
+        *pp = s->bucket_next;
+    }
+    deadbeef->metacache_unref (s->text);
+    free (s);
 }
 
 static ddb_playlist_t *ml_playlist; // this playlist contains the actual data of the media library in plain list
@@ -110,7 +164,7 @@ static ddb_playlist_t *ml_playlist; // this playlist contains the actual data of
 static ml_db_t db; // this is the index, which can be rebuilt from the playlist at any given time
 
 #define REG_COL_DEF(col)\
-ml_string_t *\
+static ml_string_t *\
 ml_reg_##col (ml_db_t *db, const char *c) {\
     if (!c) {\
         return NULL;\
@@ -123,10 +177,20 @@ REG_COL_DEF(artist);
 REG_COL_DEF(genre);
 REG_COL_DEF(folder);
 
-DB_playItem_t *(*plt_insert_dir) (ddb_playlist_t *plt, DB_playItem_t *after, const char *dirname, int *pabort, int (*cb)(DB_playItem_t *it, void *data), void *user_data);
+static DB_playItem_t *(*plt_insert_dir) (ddb_playlist_t *plt, DB_playItem_t *after, const char *dirname, int *pabort, int (*cb)(DB_playItem_t *it, void *data), void *user_data);
+
+static intptr_t tid;
+static int scanner_terminate;
+static int scanner_state;
+
+#define ML_MAX_LISTENERS 10
+
+static uintptr_t listeners_mutex;
+static ddb_medialib_listener_t listeners[ML_MAX_LISTENERS];
+static void *listeners_user_data[ML_MAX_LISTENERS];
 
-uintptr_t tid;
-int scanner_terminate;
+// the folder which is being rescanned, its subfolders are rejected by ml_fileadd_filter
+static const char *rescan_folder;
 
 static int
 add_file_info_cb (DB_playItem_t *it, void *data) {
@@ -134,6 +198,23 @@ add_file_info_cb (DB_playItem_t *it, void *data) {
     return 0;
 }
 
+static void
+ml_notify_listeners (int event) {
+    deadbeef->mutex_lock (listeners_mutex);
+    for (int i = 0; i < ML_MAX_LISTENERS; i++) {
+        if (listeners[i]) {
+            listeners[i] (event, listeners_user_data[i]);
+        }
+    }
+    deadbeef->mutex_unlock (listeners_mutex);
+}
+
+static void
+ml_set_scanner_state (int state) {
+    __atomic_store_n (&scanner_state, state, __ATOMIC_SEQ_CST);
+    ml_notify_listeners (DDB_MEDIALIB_EVENT_SCANNER);
+}
+
 #define FREE_COL(col)\
     for (int idx_##col = 0; idx_##col < ML_HASH_SIZE; idx_##col++) {\
         ml_string_t *s = db.hash_##col[idx_##col];\
@@ -165,6 +246,9 @@ ml_free_db (void) {
         if (db.tracks->file) {
             deadbeef->metacache_unref (db.tracks->file);
         }
+        if (db.tracks->track) {
+            deadbeef->pl_item_unref (db.tracks->track);
+        }
         free (db.tracks);
         db.tracks = next;
     }
@@ -172,79 +256,146 @@ ml_free_db (void) {
     memset (&db, 0, sizeof (db));
 }
 
-// This should be called only on pre-existing ml playlist.
-// Subsequent indexing should be done on the fly, using fileadd listener.
+// Adds a track from ml_playlist to the index
 static void
-ml_index (void) {
-    ml_free_db();
+ml_index_track (DB_playItem_t *it) {
+    char folder[PATH_MAX];
 
-    fprintf (stderr, "building index...\n");
+    ml_entry_t *en = calloc (sizeof (ml_entry_t), 1);
+
+    const char *uri = deadbeef->pl_find_meta (it, ":URI");
+    const char *title = deadbeef->pl_find_meta (it, "title");
+    const char *artist = deadbeef->pl_find_meta (it, "artist");
+
+    // FIXME: album needs to be a combination of album + artist for indexing / library
+    const char *album = deadbeef->pl_find_meta (it, "album");
+    const char *genre = deadbeef->pl_find_meta (it, "genre");
+    ml_string_t *alb = ml_reg_album (&db, album);
+    ml_string_t *art = ml_reg_artist (&db, artist);
+    ml_string_t *gnr = ml_reg_genre (&db, genre);
+
+    char *fn = strrchr (uri, '/');
+    ml_string_t *fld = NULL;
+    if (fn) {
+        memcpy (folder, uri, fn-uri);
+        folder[fn-uri] = 0;
+        const char *s = deadbeef->metacache_add_string (folder);
+        fld = ml_reg_folder (&db, s);
+        deadbeef->metacache_unref (s);
+    }
 
-    struct timeval tm1, tm2;
-    gettimeofday (&tm1, NULL);
+    // uri and title are not indexed, only a part of track list,
+    // that's why they have an extra ref for each entry
+    deadbeef->metacache_ref (uri);
+    en->file = uri;
+    if (title) {
+        deadbeef->metacache_ref (title);
+    }
+    if (deadbeef->pl_get_item_flags (it) & DDB_IS_SUBTRACK) {
+        en->subtrack = deadbeef->pl_find_meta_int (it, ":TRACKNUM", -1);
+    }
+    else {
+        en->subtrack = -1;
+    }
+    deadbeef->pl_item_ref (it);
+    en->track = it;
+    en->title = title;
+    en->artist = art;
+    en->album = alb;
+    en->genre = gnr;
+    en->folder = fld;
+
+    en->prev = db.tracks_tail;
+    if (db.tracks_tail) {
+        db.tracks_tail->next = en;
+    }
+    else {
+        db.tracks = en;
+    }
+    db.tracks_tail = en;
 
-    ml_entry_t *tail = NULL;
+    if (fld) {
+        en->folder_next = fld->tracks;
+        fld->tracks = en;
+    }
 
-    char folder[PATH_MAX];
+    // add to the hash table
+    // subtracks share the filename, only one entry per file is needed
+    uint32_t hash = hash_for_ptr ((void *)en->file);
+    ml_entry_t *e = db.filename_hash[hash];
+    while (e && e->file != en->file) {
+        e = e->bucket_next;
+    }
+    if (!e) {
+        en->bucket_next = db.filename_hash[hash];
+        db.filename_hash[hash] = en;
+    }
+}
 
-    DB_playItem_t *it = deadbeef->plt_get_first (ml_playlist, PL_MAIN);
-    while (it) {
-        ml_entry_t *en = calloc (sizeof (ml_entry_t), 1);
-
-        const char *uri = deadbeef->pl_find_meta (it, ":URI");
-        const char *title = deadbeef->pl_find_meta (it, "title");
-        const char *artist = deadbeef->pl_find_meta (it, "artist");
-
-        // FIXME: album needs to be a combination of album + artist for indexing / library
-        const char *album = deadbeef->pl_find_meta (it, "album");
-        const char *genre = deadbeef->pl_find_meta (it, "genre");
-        ml_string_t *alb = ml_reg_album (&db, album);
-        ml_string_t *art = ml_reg_artist (&db, artist);
-        ml_string_t *gnr = ml_reg_genre (&db, genre);
-
-        char *fn = strrchr (uri, '/');
-        ml_string_t *fld = NULL;
-        if (fn) {
-            memcpy (folder, uri, fn-uri);
-            folder[fn-uri] = 0;
-            const char *s = deadbeef->metacache_add_string (folder);
-            fld = ml_reg_folder (&db, s);
-            deadbeef->metacache_unref (s);
-        }
-
-        // uri and title are not indexed, only a part of track list,
-        // that's why they have an extra ref for each entry
-        deadbeef->metacache_ref (uri);
-        en->file = uri;
-        if (title) {
-            deadbeef->metacache_ref (title);
-        }
-        if (deadbeef->pl_get_item_flags (it) & DDB_IS_SUBTRACK) {
-            en->subtrack = deadbeef->pl_find_meta_int (it, ":TRACKNUM", -1);
+// Removes all tracks directly in the folder from the index and from ml_playlist
+static void
+ml_remove_folder_tracks (ml_string_t *fld) {
+    ml_entry_t *en = fld->tracks;
+    fld->tracks = NULL;
+
+    while (en) {
+        ml_entry_t *folder_next = en->folder_next;
+
+        if (en->prev) {
+            en->prev->next = en->next;
         }
         else {
-            en->subtrack = -1;
+            db.tracks = en->next;
         }
-        en->title = title;
-        en->artist = art;
-        en->album = alb;
-        en->genre = gnr;
-        en->folder = fld;
-
-        if (tail) {
-            tail->next = en;
-            tail = en;
+        if (en->next) {
+            en->next->prev = en->prev;
         }
         else {
-            tail = db.tracks = en;
+            db.tracks_tail = en->prev;
         }
 
-        // add to the hash table
-        // at this point, we only have unique pointers, and don't need a duplicate check
         uint32_t hash = hash_for_ptr ((void *)en->file);
-        en->bucket_next = db.filename_hash[hash];
-        db.filename_hash[hash] = en;
+        ml_entry_t **pp = &db.filename_hash[hash];
+        while (*pp && *pp != en) {
+            pp = &(*pp)->bucket_next;
+        }
+        if (*pp) {
+            *pp = en->bucket_next;
+        }
+
+        hash_release (db.hash_album, en->album);
+        hash_release (db.hash_artist, en->artist);
+        hash_release (db.hash_genre, en->genre);
+
+        deadbeef->plt_remove_item (ml_playlist, en->track);
+        deadbeef->pl_item_unref (en->track);
+        if (en->title) {
+            deadbeef->metacache_unref (en->title);
+        }
+        deadbeef->metacache_unref (en->file);
+        free (en);
+        en = folder_next;
+    }
+
+    // all tracks referencing the folder are gone
+    fld->count = 1;
+    hash_release (db.hash_folder, fld);
+}
+
+// This should be called only on pre-existing ml playlist.
+// Subsequent indexing is done incrementally, see ml_rescan_folder.
+static void
+ml_index (void) {
+    ml_free_db();
+
+    fprintf (stderr, "building index...\n");
+
+    struct timeval tm1, tm2;
+    gettimeofday (&tm1, NULL);
 
+    DB_playItem_t *it = deadbeef->plt_get_first (ml_playlist, PL_MAIN);
+    while (it) {
+        ml_index_track (it);
         DB_playItem_t *next = deadbeef->pl_get_next (it, PL_MAIN);
         deadbeef->pl_item_unref (it);
         it = next;
@@ -267,120 +418,733 @@ ml_index (void) {
     fprintf (stderr, "index build time: %f seconds (%d albums, %d artists, %d genres, %d folders)\n", ms / 1000.f, nalb, nart, ngnr, nfld);
 }
 
+static uint32_t
+sig_hash_for_path (const char *path) {
+    uint32_t h = 5381;
+    for (const uint8_t *p = (const uint8_t *)path; *p; p++) {
+        h = h * 33 + *p;
+    }
+    return h & (ML_SIG_HASH_SIZE-1);
+}
+
+static ml_sig_t *
+ml_sig_find (const char *path) {
+    for (ml_sig_t *sig = sig_hash[sig_hash_for_path (path)]; sig; sig = sig->bucket_next) {
+        if (!strcmp (sig->path, path)) {
+            return sig;
+        }
+    }
+    return NULL;
+}
+
+static ml_sig_t *
+ml_sig_add (const char *path) {
+    uint32_t h = sig_hash_for_path (path);
+    ml_sig_t *sig = calloc (sizeof (ml_sig_t), 1);
+    sig->path = strdup (path);
+    sig->bucket_next = sig_hash[h];
+    sig_hash[h] = sig;
+    return sig;
+}
+
+// Updates the signature from stat results, and returns 1 if it has changed since the last scan
+static int
+ml_sig_update (const char *path, const struct stat *st) {
+    ml_sig_t *sig = ml_sig_find (path);
+    int changed = 0;
+    if (!sig) {
+        sig = ml_sig_add (path);
+        changed = 1;
+    }
+    int is_dir = S_ISDIR (st->st_mode) ? 1 : 0;
+    // folder sizes are meaningless, folder changes are detected by mtime only
+    int64_t size = is_dir ? 0 : (int64_t)st->st_size;
+    if (sig->mtime != (int64_t)st->st_mtime || sig->size != size || sig->is_dir != is_dir) {
+        changed = 1;
+    }
+    sig->mtime = st->st_mtime;
+    sig->size = size;
+    sig->is_dir = is_dir;
+    sig->seen = 1;
+    return changed;
+}
+
 static void
-scanner_thread (void *none) {
-    char plpath[PATH_MAX];
-    snprintf (plpath, sizeof (plpath), "%s/medialib.dbpl", deadbeef->get_system_dir (DDB_SYS_DIR_CONFIG));
+ml_sig_free (void) {
+    for (int i = 0; i < ML_SIG_HASH_SIZE; i++) {
+        while (sig_hash[i]) {
+            ml_sig_t *next = sig_hash[i]->bucket_next;
+            free (sig_hash[i]->path);
+            free (sig_hash[i]);
+            sig_hash[i] = next;
+        }
+    }
+}
 
-    struct timeval tm1, tm2;
+// Signature file format, in native byte order:
+// "MLSG", uint32 version, uint32 count, then count records of
+// int64 mtime, int64 size, uint8 is_dir, uint16 path length, path
+static void
+ml_sig_load (const char *fname) {
+    FILE *fp = fopen (fname, "rb");
+    if (!fp) {
+        return;
+    }
+    char magic[4];
+    uint32_t version, count;
+    if (fread (magic, 1, 4, fp) != 4 || memcmp (magic, ML_SIG_MAGIC, 4)
+        || fread (&version, 1, 4, fp) != 4 || version != ML_SIG_VERSION
+        || fread (&count, 1, 4, fp) != 4) {
+        fprintf (stderr, "medialib: bad signature file %s\n", fname);
+        fclose (fp);
+        return;
+    }
+    char path[PATH_MAX];
+    for (uint32_t i = 0; i < count; i++) {
+        int64_t mtime, size;
+        uint8_t is_dir;
+        uint16_t l;
+        if (fread (&mtime, 1, 8, fp) != 8
+            || fread (&size, 1, 8, fp) != 8
+            || fread (&is_dir, 1, 1, fp) != 1
+            || fread (&l, 1, 2, fp) != 2
+            || l >= sizeof (path)
+            || fread (path, 1, l, fp) != l) {
+            fprintf (stderr, "medialib: signature file %s is truncated\n", fname);
+            break;
+        }
+        path[l] = 0;
+        ml_sig_t *sig = ml_sig_add (path);
+        sig->mtime = mtime;
+        sig->size = size;
+        sig->is_dir = is_dir;
+    }
+    fclose (fp);
+}
 
-    if (!ml_playlist) {
-        ml_playlist = deadbeef->plt_alloc ("medialib");
+static int
+ml_sig_save (const char *fname) {
+    char tempfile[PATH_MAX];
+    snprintf (tempfile, sizeof (tempfile), "%s.tmp", fname);
+    FILE *fp = fopen (tempfile, "w+b");
+    if (!fp) {
+        return -1;
+    }
+    uint32_t version = ML_SIG_VERSION;
+    uint32_t count = 0;
+    for (int i = 0; i < ML_SIG_HASH_SIZE; i++) {
+        for (ml_sig_t *sig = sig_hash[i]; sig; sig = sig->bucket_next, count++);
+    }
+    if (fwrite (ML_SIG_MAGIC, 1, 4, fp) != 4
+        || fwrite (&version, 1, 4, fp) != 4
+        || fwrite (&count, 1, 4, fp) != 4) {
+        goto save_fail;
+    }
+    for (int i = 0; i < ML_SIG_HASH_SIZE; i++) {
+        for (ml_sig_t *sig = sig_hash[i]; sig; sig = sig->bucket_next) {
+            uint16_t l = strlen (sig->path);
+            if (fwrite (&sig->mtime, 1, 8, fp) != 8
+                || fwrite (&sig->size, 1, 8, fp) != 8
+                || fwrite (&sig->is_dir, 1, 1, fp) != 1
+                || fwrite (&l, 1, 2, fp) != 2
+                || fwrite (sig->path, 1, l, fp) != l) {
+                goto save_fail;
+            }
+        }
+    }
+    fclose (fp);
+    if (rename (tempfile, fname) != 0) {
+        fprintf (stderr, "medialib: rename %s -> %s failed: %s\n", tempfile, fname, strerror (errno));
+        return -1;
+    }
+    return 0;
+save_fail:
+    fclose (fp);
+    unlink (tempfile);
+    return -1;
+}
+
+typedef struct {
+    char **paths;
+    int count;
+    int alloc;
+} ml_pathlist_t;
 
-        printf ("loading %s\n", plpath);
-        gettimeofday (&tm1, NULL);
-        DB_playItem_t *plt_head = deadbeef->plt_load2 (-1, ml_playlist, NULL, plpath, NULL, NULL, NULL);
-        gettimeofday (&tm2, NULL);
-        long ms = (tm2.tv_sec*1000+tm2.tv_usec/1000) - (tm1.tv_sec*1000+tm1.tv_usec/1000);
-        fprintf (stderr, "ml playlist load time: %f seconds\n", ms / 1000.f);
+static void
+ml_pathlist_add (ml_pathlist_t *list, const char *path) {
+    if (list->count == list->alloc) {
+        list->alloc = list->alloc ? list->alloc * 2 : 64;
+        list->paths = realloc (list->paths, list->alloc * sizeof (char *));
+    }
+    list->paths[list->count++] = strdup (path);
+}
 
-        if (plt_head) {
-//            for (int i = 0; i < 100; i++) {
-                ml_index ();
-//            }
+// Adds the path unless it's already in the list
+static void
+ml_pathlist_add_unique (ml_pathlist_t *list, const char *path) {
+    for (int i = 0; i < list->count; i++) {
+        if (!strcmp (list->paths[i], path)) {
+            return;
         }
     }
+    ml_pathlist_add (list, path);
+}
 
-    gettimeofday (&tm1, NULL);
+static void
+ml_pathlist_clear (ml_pathlist_t *list) {
+    for (int i = 0; i < list->count; i++) {
+        free (list->paths[i]);
+    }
+    free (list->paths);
+    memset (list, 0, sizeof (ml_pathlist_t));
+}
 
-    const char *musicdir = deadbeef->conf_get_str_fast ("medialib.path", NULL);
-    if (!musicdir) {
+typedef struct {
+    ml_pathlist_t dirty_folders; // folders with added, removed or modified entries
+    ml_pathlist_t new_folders; // folders which didn't have a signature
+    int follow_symlinks;
+} ml_scan_t;
+
+// Compares the folder and its files with the signatures of the last scan.
+// Subfolders are walked if recursive is set, and new subfolders are always walked.
+// Files are only stat'ed, the tags are not read.
+static void
+ml_walk_folder (ml_scan_t *scan, const char *path, int recursive) {
+    struct stat st;
+    if (stat (path, &st) || !S_ISDIR (st.st_mode)) {
         return;
     }
+    if (!ml_sig_find (path)) {
+        ml_pathlist_add (&scan->new_folders, path);
+    }
+    int dirty = ml_sig_update (path, &st);
 
-    printf ("adding dir: %s\n", musicdir);
-    plt_insert_dir (ml_playlist, NULL, musicdir, &scanner_terminate, add_file_info_cb, NULL);
-
-    gettimeofday (&tm2, NULL);
-    long ms = (tm2.tv_sec*1000+tm2.tv_usec/1000) - (tm1.tv_sec*1000+tm1.tv_usec/1000);
-    fprintf (stderr, "scan time: %f seconds (%d tracks)\n", ms / 1000.f, deadbeef->plt_get_item_count (ml_playlist, PL_MAIN));
+    DIR *dir = opendir (path);
+    if (!dir) {
+        return;
+    }
+    char fullname[PATH_MAX];
+    struct dirent *de;
+    while (!scanner_terminate && (de = readdir (dir))) {
+        // no hidden files, same as plt_insert_dir
+        if (de->d_name[0] == '.') {
+            continue;
+        }
+        snprintf (fullname, sizeof (fullname), "%s/%s", path, de->d_name);
+        if (lstat (fullname, &st)) {
+            continue;
+        }
+        if (S_ISLNK (st.st_mode)) {
+            if (stat (fullname, &st) || (S_ISDIR (st.st_mode) && !scan->follow_symlinks)) {
+                continue;
+            }
+        }
+        if (S_ISDIR (st.st_mode)) {
+            if (recursive || !ml_sig_find (fullname)) {
+                ml_walk_folder (scan, fullname, 1);
+            }
+        }
+        else if (S_ISREG (st.st_mode)) {
+            if (ml_sig_update (fullname, &st)) {
+                dirty = 1;
+            }
+        }
+    }
+    closedir (dir);
 
-    deadbeef->plt_save (ml_playlist, NULL, NULL, plpath, NULL, NULL, NULL);
+    if (dirty) {
+        ml_pathlist_add (&scan->dirty_folders, path);
+    }
 }
 
-//#define FILTER_PERF
+// Removes the tracks of the folder and reads it again, without the subfolders
+static void
+ml_rescan_folder (const char *path) {
+    const char *s = deadbeef->metacache_get_string (path);
+    if (s) {
+        ml_string_t *fld = hash_find (db.hash_folder, s);
+        if (fld) {
+            ml_remove_folder_tracks (fld);
+        }
+        deadbeef->metacache_unref (s);
+    }
+
+    DB_playItem_t *tail = deadbeef->plt_get_last (ml_playlist, PL_MAIN);
+
+    rescan_folder = path;
+    plt_insert_dir (ml_playlist, tail, path, &scanner_terminate, add_file_info_cb, NULL);
+    rescan_folder = NULL;
+
+    // index the new tracks, which were appended after the old tail
+    DB_playItem_t *it = tail ? deadbeef->pl_get_next (tail, PL_MAIN) : deadbeef->plt_get_first (ml_playlist, PL_MAIN);
+    while (it) {
+        ml_index_track (it);
+        DB_playItem_t *next = deadbeef->pl_get_next (it, PL_MAIN);
+        deadbeef->pl_item_unref (it);
+        it = next;
+    }
+    if (tail) {
+        deadbeef->pl_item_unref (tail);
+    }
+}
 
-// intention is to skip the files which are already indexed
-// how to speed this up:
-// first check if a folder exists (early out?)
+// Removes the tracks of the folders which are gone, and the signatures of the files and folders which are gone.
+// Returns the number of removed folders.
 static int
-ml_fileadd_filter (ddb_file_found_data_t *data, void *user_data) {
-    int res = 0;
+ml_remove_unseen (void) {
+    int n = 0;
+    for (int i = 0; i < ML_HASH_SIZE; i++) {
+        ml_string_t *fld = db.hash_folder[i];
+        while (fld) {
+            ml_string_t *next = fld->bucket_next;
+            ml_sig_t *sig = ml_sig_find (fld->text);
+            if (!sig || !sig->seen) {
+                ml_remove_folder_tracks (fld);
+                n++;
+            }
+            fld = next;
+        }
+    }
 
-    if (data->plt != ml_playlist || data->is_dir) {
-        return 0;
+    for (int i = 0; i < ML_SIG_HASH_SIZE; i++) {
+        ml_sig_t **pp = &sig_hash[i];
+        while (*pp) {
+            ml_sig_t *sig = *pp;
+            if (!sig->seen) {
+                *pp = sig->bucket_next;
+                free (sig->path);
+                free (sig);
+            }
+            else {
+                pp = &sig->bucket_next;
+            }
+        }
+    }
+    return n;
+}
+
+// Removes the tracks and the signatures of the folder and of all its subfolders
+static void
+ml_remove_folder_tree (const char *path) {
+    size_t l = strlen (path);
+    for (int i = 0; i < ML_HASH_SIZE; i++) {
+        ml_string_t *fld = db.hash_folder[i];
+        while (fld) {
+            ml_string_t *next = fld->bucket_next;
+            if (!strncmp (fld->text, path, l) && (fld->text[l] == 0 || fld->text[l] == '/')) {
+                ml_remove_folder_tracks (fld);
+            }
+            fld = next;
+        }
     }
 
-#if FILTER_PERF
+    for (int i = 0; i < ML_SIG_HASH_SIZE; i++) {
+        ml_sig_t **pp = &sig_hash[i];
+        while (*pp) {
+            ml_sig_t *sig = *pp;
+            if (!strncmp (sig->path, path, l) && (sig->path[l] == 0 || sig->path[l] == '/')) {
+                *pp = sig->bucket_next;
+                free (sig->path);
+                free (sig);
+            }
+            else {
+                pp = &sig->bucket_next;
+            }
+        }
+    }
+}
+
+static char ml_plpath[PATH_MAX];
+static char ml_sigpath[PATH_MAX];
+
+static void
+ml_save (void) {
+    deadbeef->plt_save (ml_playlist, NULL, NULL, ml_plpath, NULL, NULL, NULL);
+    ml_sig_save (ml_sigpath);
+}
+
+// Rescans the dirty folders found by the walk, returns the number of rescanned folders
+static int
+ml_scan_apply (ml_scan_t *scan) {
+    int n = 0;
+    for (int i = 0; i < scan->dirty_folders.count && !scanner_terminate; i++, n++) {
+        ml_rescan_folder (scan->dirty_folders.paths[i]);
+    }
+    return n;
+}
+
+// Full incremental scan of the library folder
+static void
+ml_scan_library (const char *root) {
     struct timeval tm1, tm2;
     gettimeofday (&tm1, NULL);
-#endif
 
-    const char *s = deadbeef->metacache_get_string (data->filename);
-    if (!s) {
-        return 0;
+    for (int i = 0; i < ML_SIG_HASH_SIZE; i++) {
+        for (ml_sig_t *sig = sig_hash[i]; sig; sig = sig->bucket_next) {
+            sig->seen = 0;
+        }
     }
 
-    uint32_t hash = (((uint32_t)(s))>>1) & (ML_HASH_SIZE-1);
+    printf ("scanning dir: %s\n", root);
+    ml_scan_t scan;
+    memset (&scan, 0, sizeof (scan));
+    scan.follow_symlinks = deadbeef->conf_get_int ("add_folders_follow_symlinks", 0);
+    ml_walk_folder (&scan, root, 1);
 
-    if (!db.filename_hash[hash]) {
-        return 0;
+    int nremoved = 0;
+    if (!scanner_terminate) {
+        nremoved = ml_remove_unseen ();
     }
+    int nchanged = ml_scan_apply (&scan);
 
-    ml_entry_t *en = db.filename_hash[hash];
-    while (en) {
-        if (en->file == s) {
-            res = -1;
+    gettimeofday (&tm2, NULL);
+    long ms = (tm2.tv_sec*1000+tm2.tv_usec/1000) - (tm1.tv_sec*1000+tm1.tv_usec/1000);
+    fprintf (stderr, "scan time: %f seconds (%d changed folders, %d removed folders, %d tracks)\n", ms / 1000.f, nchanged, nremoved, deadbeef->plt_get_item_count (ml_playlist, PL_MAIN));
+
+    if (nchanged || nremoved) {
+        ml_notify_listeners (DDB_MEDIALIB_EVENT_CHANGED);
+    }
+    // an interrupted scan leaves the signatures of unread files updated, so don't save them
+    if (!scanner_terminate && (nchanged || nremoved)) {
+        ml_save ();
+    }
+    ml_pathlist_clear (&scan.dirty_folders);
+    ml_pathlist_clear (&scan.new_folders);
+}
+
+// Watch mode ("medialib.watch" setting).
+// Folders are watched with inotify, and the changed folders are rescanned after the events settle down.
+// Folders which can't be watched, because of the "medialib.watch_limit" setting or the kernel limit,
+// are checked for mtime changes periodically instead, every "medialib.watch_poll_interval" seconds.
+
+// rescan when no events arrived for this long
+#define ML_WATCH_SETTLE_MS 1000
+// rescan at least this often during a continuous stream of events
+#define ML_WATCH_MAX_DELAY_MS 10000
+// default mtime check interval of the folders without a watch, in seconds
+#define ML_WATCH_POLL_INTERVAL 60
+
+typedef struct {
+    int fd; // inotify instance, or -1
+    char **wd_paths; // watched folders by watch descriptor
+    int wd_alloc;
+    int nwatches;
+    int max_watches;
+    ml_pathlist_t polled; // folders without a watch
+    ml_pathlist_t pending; // folders with changes, waiting for the events to settle down
+    ml_pathlist_t removed; // folders which were removed or moved away
+    int overflow; // some events were lost, full scan is needed
+} ml_watch_t;
+
+static long
+ml_time_ms (void) {
+    struct timeval tm;
+    gettimeofday (&tm, NULL);
+    return tm.tv_sec*1000+tm.tv_usec/1000;
+}
+
+static void
+ml_watch_add (ml_watch_t *w, const char *path) {
+#ifdef __linux__
+    if (w->fd >= 0 && w->nwatches < w->max_watches) {
+        int wd = inotify_add_watch (w->fd, path, IN_CREATE | IN_DELETE | IN_CLOSE_WRITE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR);
+        if (wd >= 0) {
+            if (wd >= w->wd_alloc) {
+                int alloc = w->wd_alloc ? w->wd_alloc : 1024;
+                while (alloc <= wd) {
+                    alloc *= 2;
+                }
+                w->wd_paths = realloc (w->wd_paths, alloc * sizeof (char *));
+                memset (w->wd_paths + w->wd_alloc, 0, (alloc - w->wd_alloc) * sizeof (char *));
+                w->wd_alloc = alloc;
+            }
+            if (!w->wd_paths[wd]) {
+                w->nwatches++;
+            }
+            free (w->wd_paths[wd]);
+            w->wd_paths[wd] = strdup (path);
+            return;
+        }
+        if (errno == ENOSPC) {
+            fprintf (stderr, "medialib: inotify watch limit reached, %d folders are watched, the rest will be polled\n", w->nwatches);
+            w->max_watches = w->nwatches;
+        }
+    }
+#endif
+    ml_pathlist_add (&w->polled, path);
+}
+
+// Stops watching the folder and its subfolders
+static void
+ml_watch_remove_tree (ml_watch_t *w, const char *path) {
+    size_t l = strlen (path);
+#ifdef __linux__
+    for (int wd = 0; wd < w->wd_alloc; wd++) {
+        const char *p = w->wd_paths[wd];
+        if (p && !strncmp (p, path, l) && (p[l] == 0 || p[l] == '/')) {
+            inotify_rm_watch (w->fd, wd);
+            free (w->wd_paths[wd]);
+            w->wd_paths[wd] = NULL;
+            w->nwatches--;
+        }
+    }
+#endif
+    for (int i = 0; i < w->polled.count; i++) {
+        const char *p = w->polled.paths[i];
+        if (!strncmp (p, path, l) && (p[l] == 0 || p[l] == '/')) {
+            free (w->polled.paths[i]);
+            w->polled.paths[i--] = w->polled.paths[--w->polled.count];
+        }
+    }
+}
+
+#ifdef __linux__
+static void
+ml_watch_read_events (ml_watch_t *w) {
+    char buf[4096] __attribute__ ((aligned (__alignof__ (struct inotify_event))));
+    for (;;) {
+        ssize_t len = read (w->fd, buf, sizeof (buf));
+        if (len <= 0) {
             break;
         }
-        en = en->bucket_next;
+        for (char *ptr = buf; ptr < buf + len; ptr += sizeof (struct inotify_event) + ((struct inotify_event *)ptr)->len) {
+            const struct inotify_event *ev = (const struct inotify_event *)ptr;
+            if (ev->mask & IN_Q_OVERFLOW) {
+                w->overflow = 1;
+                continue;
+            }
+            if (ev->wd < 0 || ev->wd >= w->wd_alloc || !w->wd_paths[ev->wd]) {
+                continue;
+            }
+            const char *path = w->wd_paths[ev->wd];
+            if (ev->mask & IN_IGNORED) {
+                free (w->wd_paths[ev->wd]);
+                w->wd_paths[ev->wd] = NULL;
+                w->nwatches--;
+            }
+            else if (ev->mask & (IN_DELETE_SELF | IN_MOVE_SELF)) {
+                ml_pathlist_add_unique (&w->removed, path);
+            }
+            else if (!ev->len || ev->name[0] != '.') {
+                // no hidden files
+                ml_pathlist_add_unique (&w->pending, path);
+            }
+        }
     }
+}
+#endif
 
-#if FILTER_PERF
-    gettimeofday (&tm2, NULL);
-    long ms = (tm2.tv_sec*1000+tm2.tv_usec/1000) - (tm1.tv_sec*1000+tm1.tv_usec/1000);
+static void
+ml_watch_poll_folders (ml_watch_t *w) {
+    for (int i = 0; i < w->polled.count; i++) {
+        const char *path = w->polled.paths[i];
+        struct stat st;
+        ml_sig_t *sig = ml_sig_find (path);
+        if (stat (path, &st) || !S_ISDIR (st.st_mode)) {
+            ml_pathlist_add_unique (&w->removed, path);
+        }
+        else if (!sig || sig->mtime != (int64_t)st.st_mtime) {
+            ml_pathlist_add_unique (&w->pending, path);
+        }
+    }
+}
+
+// Applies the coalesced changes to ml_playlist and to the index
+static void
+ml_watch_process (ml_watch_t *w, const char *root) {
+    int changed = 0;
 
-    if (!res) {
-        fprintf (stderr, "ADD %s: file presence check took %f sec\n", s, ms / 1000.f);
+    for (int i = 0; i < w->removed.count; i++) {
+        ml_remove_folder_tree (w->removed.paths[i]);
+        ml_watch_remove_tree (w, w->removed.paths[i]);
+        changed = 1;
     }
-    else {
-        fprintf (stderr, "SKIP %s: file presence check took %f sec\n", s, ms / 1000.f);
+    ml_pathlist_clear (&w->removed);
+
+    if (w->overflow) {
+        // the changes are unknown, start over
+        w->overflow = 0;
+        ml_pathlist_clear (&w->pending);
+        ml_scan_library (root);
+        ml_watch_remove_tree (w, root);
+        for (int i = 0; i < ML_SIG_HASH_SIZE; i++) {
+            for (ml_sig_t *sig = sig_hash[i]; sig; sig = sig->bucket_next) {
+                if (sig->is_dir) {
+                    ml_watch_add (w, sig->path);
+                }
+            }
+        }
+        return;
+    }
+
+    ml_scan_t scan;
+    memset (&scan, 0, sizeof (scan));
+    scan.follow_symlinks = deadbeef->conf_get_int ("add_folders_follow_symlinks", 0);
+    for (int i = 0; i < w->pending.count; i++) {
+        ml_walk_folder (&scan, w->pending.paths[i], 0);
+    }
+    ml_pathlist_clear (&w->pending);
+
+    if (ml_scan_apply (&scan)) {
+        changed = 1;
+    }
+    for (int i = 0; i < scan.new_folders.count; i++) {
+        ml_watch_add (w, scan.new_folders.paths[i]);
+    }
+    ml_pathlist_clear (&scan.dirty_folders);
+    ml_pathlist_clear (&scan.new_folders);
+
+    if (changed) {
+        ml_notify_listeners (DDB_MEDIALIB_EVENT_CHANGED);
+    }
+    if (changed && !scanner_terminate) {
+        fprintf (stderr, "medialib: updated (%d tracks)\n", deadbeef->plt_get_item_count (ml_playlist, PL_MAIN));
+        ml_save ();
+    }
+}
+
+static void
+ml_watch (const char *root) {
+    ml_watch_t w;
+    memset (&w, 0, sizeof (w));
+    w.fd = -1;
+    w.max_watches = deadbeef->conf_get_int ("medialib.watch_limit", 65536);
+    long poll_interval = deadbeef->conf_get_int ("medialib.watch_poll_interval", ML_WATCH_POLL_INTERVAL) * 1000L;
+#ifdef __linux__
+    w.fd = inotify_init1 (IN_NONBLOCK | IN_CLOEXEC);
+    if (w.fd < 0) {
+        fprintf (stderr, "medialib: inotify is not available (%s), folders will be polled\n", strerror (errno));
     }
 #endif
 
-    deadbeef->metacache_unref (s);
+    // all folders found by the scan have signatures
+    for (int i = 0; i < ML_SIG_HASH_SIZE; i++) {
+        for (ml_sig_t *sig = sig_hash[i]; sig; sig = sig->bucket_next) {
+            if (sig->is_dir) {
+                ml_watch_add (&w, sig->path);
+            }
+        }
+    }
+    fprintf (stderr, "medialib: watching %d folders, polling %d folders\n", w.nwatches, w.polled.count);
+    ml_set_scanner_state (DDB_MEDIALIB_STATE_WATCHING);
+
+    long first_event = 0;
+    long last_event = 0;
+    long last_poll = ml_time_ms ();
+
+    while (!scanner_terminate) {
+        struct pollfd pfd = { .fd = w.fd, .events = POLLIN };
+        poll (&pfd, w.fd >= 0 ? 1 : 0, 200);
+
+        long now = ml_time_ms ();
+        int had_changes = w.pending.count || w.removed.count || w.overflow;
+#ifdef __linux__
+        if (w.fd >= 0 && (pfd.revents & POLLIN)) {
+            ml_watch_read_events (&w);
+        }
+#endif
+        if (w.polled.count && now - last_poll >= poll_interval) {
+            ml_watch_poll_folders (&w);
+            last_poll = now;
+        }
 
-    return res;
+        int has_changes = w.pending.count || w.removed.count || w.overflow;
+        if (!has_changes) {
+            continue;
+        }
+        if (!had_changes) {
+            first_event = now;
+        }
+        if (has_changes != had_changes || (pfd.revents & POLLIN)) {
+            last_event = now;
+        }
+        if (now - last_event >= ML_WATCH_SETTLE_MS || now - first_event >= ML_WATCH_MAX_DELAY_MS) {
+            ml_watch_process (&w, root);
+        }
+    }
+
+#ifdef __linux__
+    if (w.fd >= 0) {
+        close (w.fd);
+    }
+#endif
+    for (int wd = 0; wd < w.wd_alloc; wd++) {
+        free (w.wd_paths[wd]);
+    }
+    free (w.wd_paths);
+    ml_pathlist_clear (&w.polled);
+    ml_pathlist_clear (&w.pending);
+    ml_pathlist_clear (&w.removed);
 }
 
-static int
-ml_connect (void) {
-#if 0
-    //tid = deadbeef->thread_start_low_priority (scanner_thread, NULL);
+static void
+scanner_thread (void *none) {
+    snprintf (ml_plpath, sizeof (ml_plpath), "%s/medialib.dbpl", deadbeef->get_system_dir (DDB_SYS_DIR_CONFIG));
+    snprintf (ml_sigpath, sizeof (ml_sigpath), "%s/medialib.sig", deadbeef->get_system_dir (DDB_SYS_DIR_CONFIG));
 
     struct timeval tm1, tm2;
+
+    printf ("loading %s\n", ml_plpath);
     gettimeofday (&tm1, NULL);
-    scanner_thread(NULL);
+    DB_playItem_t *plt_head = deadbeef->plt_load2 (-1, ml_playlist, NULL, ml_plpath, NULL, NULL, NULL);
     gettimeofday (&tm2, NULL);
     long ms = (tm2.tv_sec*1000+tm2.tv_usec/1000) - (tm1.tv_sec*1000+tm1.tv_usec/1000);
-    fprintf (stderr, "whole ml init time: %f seconds\n", ms / 1000.f);
-    exit (0);
-#endif
+    fprintf (stderr, "ml playlist load time: %f seconds\n", ms / 1000.f);
+
+    if (plt_head) {
+        ml_index ();
+    }
+
+    ml_sig_load (ml_sigpath);
+
+    char root[PATH_MAX];
+    deadbeef->conf_get_str ("medialib.path", "", root, sizeof (root));
+    if (!root[0]) {
+        ml_set_scanner_state (DDB_MEDIALIB_STATE_IDLE);
+        return;
+    }
+
+    // strip trailing slashes, to build the same paths as plt_insert_dir
+    size_t l = strlen (root);
+    while (l > 1 && root[l-1] == '/') {
+        root[--l] = 0;
+    }
+
+    ml_scan_library (root);
+
+    if (!scanner_terminate && deadbeef->conf_get_int ("medialib.watch", 0)) {
+        ml_watch (root);
+    }
+    ml_set_scanner_state (DDB_MEDIALIB_STATE_IDLE);
+}
+
+// Only rescanned folders are passed to plt_insert_dir, after removing their tracks,
+// so the files don't need to be checked against the library.
+// Subfolders are rejected, they are rescanned separately if they have changed.
+static int
+ml_fileadd_filter (ddb_file_found_data_t *data, void *user_data) {
+    if (data->plt != ml_playlist || !data->is_dir || !rescan_folder) {
+        return 0;
+    }
+
+    return strcmp (data->filename, rescan_folder) ? -1 : 0;
+}
+
+// The library is loaded and scanned on the scanner thread, after all plugins are connected,
+// so that the decoders are available
+static int
+ml_connect (void) {
+    // the playlist exists while the scanner is running, so get_tracks can be called anytime
+    ml_playlist = deadbeef->plt_alloc ("medialib");
+    scanner_terminate = 0;
+    ml_set_scanner_state (DDB_MEDIALIB_STATE_SCANNING);
+    tid = deadbeef->thread_start_low_priority (scanner_thread, NULL);
     return 0;
 }
 
 static int
 ml_start (void) {
+    listeners_mutex = deadbeef->mutex_create ();
     filter_id = deadbeef->register_fileadd_filter (ml_fileadd_filter, NULL);
     return 0;
 }
@@ -397,22 +1161,83 @@ ml_stop (void) {
         filter_id = 0;
     }
 
+    ml_free_db ();
+    ml_sig_free ();
+
     if (ml_playlist) {
         deadbeef->plt_free (ml_playlist);
+        ml_playlist = NULL;
     }
 
+    if (listeners_mutex) {
+        deadbeef->mutex_free (listeners_mutex);
+        listeners_mutex = 0;
+    }
+    memset (listeners, 0, sizeof (listeners));
+    memset (listeners_user_data, 0, sizeof (listeners_user_data));
+
     return 0;
 }
 
+static int
+ml_add_listener (ddb_medialib_listener_t listener, void *user_data) {
+    deadbeef->mutex_lock (listeners_mutex);
+    for (int i = 0; i < ML_MAX_LISTENERS; i++) {
+        if (!listeners[i]) {
+            listeners[i] = listener;
+            listeners_user_data[i] = user_data;
+            deadbeef->mutex_unlock (listeners_mutex);
+            return i;
+        }
+    }
+    deadbeef->mutex_unlock (listeners_mutex);
+    return -1;
+}
+
+static void
+ml_remove_listener (int listener_id) {
+    if (listener_id < 0 || listener_id >= ML_MAX_LISTENERS) {
+        return;
+    }
+    deadbeef->mutex_lock (listeners_mutex);
+    listeners[listener_id] = NULL;
+    listeners_user_data[listener_id] = NULL;
+    deadbeef->mutex_unlock (listeners_mutex);
+}
+
+static int
+ml_scanner_state (void) {
+    return __atomic_load_n (&scanner_state, __ATOMIC_SEQ_CST);
+}
+
+static DB_playItem_t **
+ml_get_tracks (int *count) {
+    *count = 0;
+    deadbeef->pl_lock ();
+    if (!ml_playlist) {
+        deadbeef->pl_unlock ();
+        return NULL;
+    }
+    int n = deadbeef->plt_get_item_count (ml_playlist, PL_MAIN);
+    DB_playItem_t **tracks = calloc (n ? n : 1, sizeof (DB_playItem_t *));
+    DB_playItem_t *it = deadbeef->plt_get_first (ml_playlist, PL_MAIN);
+    while (it && *count < n) {
+        // the reference is passed to the caller
+        tracks[(*count)++] = it;
+        it = deadbeef->pl_get_next (it, PL_MAIN);
+    }
+    if (it) {
+        deadbeef->pl_item_unref (it);
+    }
+    deadbeef->pl_unlock ();
+    return tracks;
+}
+
 static int
 ml_message (uint32_t id, uintptr_t ctx, uint32_t p1, uint32_t p2) {
     return 0;
 }
 
-typedef struct ddb_medialib_plugin_s {
-    DB_misc_t plugin;
-} ddb_medialib_plugin_t;
-
 // define plugin interface
 static ddb_medialib_plugin_t plugin = {
     .plugin.plugin.api_vmajor = DB_API_VERSION_MAJOR,
@@ -451,6 +1276,10 @@ static ddb_medialib_plugin_t plugin = {
     .plugin.plugin.stop = ml_stop,
 //    .plugin.plugin.configdialog = settings_dlg,
     .plugin.plugin.message = ml_message,
+    .add_listener = ml_add_listener,
+    .remove_listener = ml_remove_listener,
+    .scanner_state = ml_scanner_state,
+    .get_tracks = ml_get_tracks,
 };
 
 DB_plugin_t *
@@ -0,0 +1,58 @@
+/*
+    Media Library plugin for DeaDBeeF Player
+    Copyright (C) 2009-2016 Alexey Yakovenko
+
+    This software is provided 'as-is', without any express or implied
+    warranty.  In no event will the authors be held liable for any damages
+    arising from the use of this software.
+
+    Permission is granted to anyone to use this software for any purpose,
+    including commercial applications, and to alter it and redistribute it
+    freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source distribution.
+*/
+#ifndef __MEDIALIB_H
+#define __MEDIALIB_H
+
+#include "../../deadbeef.h"
+
+enum {
+    DDB_MEDIALIB_EVENT_CHANGED = 1, // tracks were added, removed or re-read
+    DDB_MEDIALIB_EVENT_SCANNER = 2, // scanner_state has changed
+};
+
+enum {
+    DDB_MEDIALIB_STATE_IDLE = 0,
+    DDB_MEDIALIB_STATE_SCANNING = 1, // loading the library and scanning medialib.path
+    DDB_MEDIALIB_STATE_WATCHING = 2, // the scan is finished, and the folders are watched for changes (medialib.watch)
+};
+
+// Called on the scanner thread
+typedef void (*ddb_medialib_listener_t) (int event, void *user_data);
+
+typedef struct ddb_medialib_plugin_s {
+    DB_misc_t plugin;
+
+    // Returns the listener id, or -1 if too many listeners are registered
+    int (*add_listener) (ddb_medialib_listener_t listener, void *user_data);
+
+    void (*remove_listener) (int listener_id);
+
+    // Returns one of DDB_MEDIALIB_STATE_*
+    int (*scanner_state) (void);
+
+    // Returns all tracks of the library, and sets count.
+    // The caller must unref the tracks and free the array.
+    DB_playItem_t **(*get_tracks) (int *count);
+} ddb_medialib_plugin_t;
+
+#endif
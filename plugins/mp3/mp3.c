@@ -69,7 +69,7 @@ cmp3_seek_stream (DB_fileinfo_t *_info, int sample) {
 #endif
 
     mp3info_t mp3info;
-    int res = mp3_parse_file(&mp3info, info->mp3flags, info->file, deadbeef->fgetlength(info->file), info->startoffs, info->endoffs, sample);
+    int res = mp3_parse_file_indexed (&mp3info, info->mp3flags, info->file, deadbeef->fgetlength(info->file), info->startoffs, info->endoffs, sample, &info->seekindex);
 
     if (!res) {
         deadbeef->fseek (info->file, mp3info.packet_offs, SEEK_SET);
@@ -257,7 +257,7 @@ cmp3_init (DB_fileinfo_t *_info, DB_playItem_t *it) {
         if (info->startoffs > 0) {
             trace ("mp3: skipping %d(%xH) bytes of junk\n", info->startoffs, info->endoffs);
         }
-        int res = mp3_parse_file(&info->mp3info, info->mp3flags, info->file, deadbeef->fgetlength(info->file), info->startoffs, info->endoffs, -1);
+        int res = mp3_parse_file_indexed (&info->mp3info, info->mp3flags, info->file, deadbeef->fgetlength(info->file), info->startoffs, info->endoffs, -1, &info->seekindex);
         if (res < 0) {
             trace ("mp3: cmp3_init: initial mp3_parse_file failed\n");
             return -1;
@@ -419,6 +419,7 @@ cmp3_free (DB_fileinfo_t *_info) {
     if (info->conv_buf) {
         free (info->conv_buf);
     }
+    mp3_seekindex_free (&info->seekindex);
     if (info->file) {
         deadbeef->fclose (info->file);
         info->file = NULL;
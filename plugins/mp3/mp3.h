@@ -51,6 +51,7 @@ typedef struct {
 
     mp3info_t mp3info;
     uint32_t mp3flags; // extra flags to pass to mp3parser
+    mp3_seekindex_t seekindex; // packet positions found by the initial scan and the seeks
 
     int64_t currentsample;
     int64_t skipsamples; // how many samples to skip after seek, usually "seek_sample - mp3info.pcmsample"
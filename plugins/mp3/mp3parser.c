@@ -365,8 +365,55 @@ _packet_same_fmt (mp3packet_t *ref_packet, mp3packet_t *packet) {
         && packet->ver == ref_packet->ver;
 }
 
+static void
+_seekindex_add (mp3_seekindex_t *index, int64_t offs, int64_t sample) {
+    if (index->count > 0 && index->points[index->count-1].sample >= sample) {
+        return; // already indexed
+    }
+    if (index->count == index->alloc) {
+        int alloc = index->alloc ? index->alloc * 2 : 256;
+        mp3_seekpoint_t *points = realloc (index->points, alloc * sizeof (mp3_seekpoint_t));
+        if (!points) {
+            return;
+        }
+        index->points = points;
+        index->alloc = alloc;
+    }
+    index->points[index->count].offs = offs;
+    index->points[index->count].sample = sample;
+    index->count++;
+}
+
+// returns the last seek point at or before the sample, or NULL
+static mp3_seekpoint_t *
+_seekindex_find (mp3_seekindex_t *index, int64_t sample) {
+    int l = 0;
+    int r = index->count;
+    while (l < r) {
+        int m = l + (r-l)/2;
+        if (index->points[m].sample <= sample) {
+            l = m+1;
+        }
+        else {
+            r = m;
+        }
+    }
+    return l > 0 ? &index->points[l-1] : NULL;
+}
+
+void
+mp3_seekindex_free (mp3_seekindex_t *index) {
+    free (index->points);
+    memset (index, 0, sizeof (mp3_seekindex_t));
+}
+
 int
 mp3_parse_file (mp3info_t *info, uint32_t flags, DB_FILE *fp, int64_t fsize, int startoffs, int endoffs, int64_t seek_to_sample) {
+    return mp3_parse_file_indexed (info, flags, fp, fsize, startoffs, endoffs, seek_to_sample, NULL);
+}
+
+int
+mp3_parse_file_indexed (mp3info_t *info, uint32_t flags, DB_FILE *fp, int64_t fsize, int startoffs, int endoffs, int64_t seek_to_sample, mp3_seekindex_t *index) {
     memset (info, 0, sizeof (mp3info_t));
     info->fsize = fsize;
     info->datasize = fsize-startoffs-endoffs;
@@ -401,6 +448,24 @@ mp3_parse_file (mp3info_t *info, uint32_t flags, DB_FILE *fp, int64_t fsize, int
     int prev_br = -1;
     int vbr = 0;
 
+    int64_t scanstart = startoffs;
+    int64_t cursample = 0; // sample position of the current packet, counted the same way as pcmsample when seeking
+
+    if (fsize < 0) {
+        index = NULL;
+    }
+
+    // start from the nearest indexed packet
+    mp3_seekpoint_t *seekpoint = NULL;
+    if (index && seek_to_sample > 0) {
+        seekpoint = _seekindex_find (index, seek_to_sample);
+    }
+    if (seekpoint && seekpoint->sample > 0) {
+        offs = scanstart = seekpoint->offs;
+        info->pcmsample = cursample = seekpoint->sample;
+        info->checked_xing_header = 1;
+    }
+
     while (fsize > 0 || fsize < 0) {
         int64_t readsize = 4; // fe ff + frame header
         if (fsize > 0 && offs + readsize >= fsize) {
@@ -425,7 +490,7 @@ mp3_parse_file (mp3info_t *info, uint32_t flags, DB_FILE *fp, int64_t fsize, int
         int res = _parse_packet (&packet, fhdr);
         if (res < 0 || (info->npackets && !_packet_same_fmt (&info->ref_packet, &packet))) {
             // bail if a valid packet could not be found at the start of stream
-            if (!info->valid_packets && offs - startoffs > MAX_INVALID_BYTES) {
+            if (!info->valid_packets && offs - scanstart > MAX_INVALID_BYTES) {
                 goto error;
             }
 
@@ -502,9 +567,14 @@ mp3_parse_file (mp3info_t *info, uint32_t flags, DB_FILE *fp, int64_t fsize, int
                     goto end;
                 }
 
+                if (index && (!index->count || cursample >= index->points[index->count-1].sample + MP3_SEEKINDEX_INTERVAL * packet.samples_per_frame)) {
+                    _seekindex_add (index, offs, cursample);
+                }
+
                 if (_process_packet (info, &packet, seek_to_sample) > 0) {
                     goto end;
                 }
+                cursample += packet.samples_per_frame;
                 memcpy (&info->prev_packet, &packet, sizeof (packet));
             }
 
@@ -518,12 +588,13 @@ mp3_parse_file (mp3info_t *info, uint32_t flags, DB_FILE *fp, int64_t fsize, int
             // Even if we already got everything we need from lame header,
             // we still need to fetch a few packets to get averages right.
             // 200 packets give a pretty accurate value, and correspond
-            // to less than 40KB or data
-            if (info->have_xing_header && !(flags & MP3_PARSE_FULLSCAN) && info->npackets >= 200) {
+            // to less than 40KB or data.
+            // When seeking, keep going until the packet is found, instead of making the decoder skip the rest.
+            if (seek_to_sample < 0 && info->have_xing_header && !(flags & MP3_PARSE_FULLSCAN) && info->npackets >= 200) {
                 goto end;
             }
             // Calculate CBR duration from file size
-            else if (!vbr && !info->have_xing_header && !(flags & MP3_PARSE_FULLSCAN) && info->npackets >= 200) {
+            else if (seek_to_sample < 0 && !vbr && !info->have_xing_header && !(flags & MP3_PARSE_FULLSCAN) && info->npackets >= 200) {
                 // calculate total number of packets from file size
                 int64_t npackets = ceil(fsize/(float)info->ref_packet.packetlength);
                 info->totalsamples = npackets * info->ref_packet.samples_per_frame;
@@ -54,6 +54,22 @@ typedef struct {
     int packetlength;
 } mp3packet_t;
 
+// A sparse list of packet positions, recorded while scanning the stream,
+// which allows seeking to start scanning from the nearest known packet instead of the start of stream.
+typedef struct {
+    int64_t offs; // stream position of the packet
+    int64_t sample; // sample position corresponding to offs
+} mp3_seekpoint_t;
+
+typedef struct {
+    mp3_seekpoint_t *points; // sorted by sample
+    int count;
+    int alloc;
+} mp3_seekindex_t;
+
+// a seek point is recorded every MP3_SEEKINDEX_INTERVAL packets
+#define MP3_SEEKINDEX_INTERVAL 64
+
 typedef struct {
     // outputs
     int64_t packet_offs; // stream position of the packet corresponding to the requested seek position
@@ -108,4 +124,13 @@ typedef struct {
 int
 mp3_parse_file (mp3info_t *info, uint32_t flags, DB_FILE *fp, int64_t fsize, int startoffs, int endoffs, int64_t seek_to_sample);
 
+// Same as mp3_parse_file, but also adds the scanned packets to the seek index,
+// and when seeking, starts scanning from the nearest indexed packet.
+// The index must be zero-initialized before the first use, and only used with the same stream.
+int
+mp3_parse_file_indexed (mp3info_t *info, uint32_t flags, DB_FILE *fp, int64_t fsize, int startoffs, int endoffs, int64_t seek_to_sample, mp3_seekindex_t *index);
+
+void
+mp3_seekindex_free (mp3_seekindex_t *index);
+
 #endif /* mp3parser_h */
@@ -41,7 +41,7 @@ static char *tf_title;
 static char *tf_content;
 
 static void
-notify_thread (void *ctx) {
+notify_job (void *ctx, ddb_cancellation_token_t *token) {
 
     DBusMessage *msg = (DBusMessage*) ctx;
     DBusMessage *reply = NULL;
@@ -53,7 +53,7 @@ notify_thread (void *ctx) {
         fprintf(stderr, "connection failed: %s",error.message);
         dbus_error_free(&error);
         dbus_message_unref (msg);
-        deadbeef->thread_exit(NULL);
+        return;
     }
 
     reply = dbus_connection_send_with_reply_and_block (conn, msg, -1, &error);
@@ -61,7 +61,8 @@ notify_thread (void *ctx) {
         fprintf(stderr, "send_with_reply_and_block error: (%s)\n", error.message); 
         dbus_error_free(&error);
         dbus_message_unref (msg);
-        deadbeef->thread_exit(NULL);
+        dbus_connection_unref (conn);
+        return;
     }
 
     if (reply != NULL) {
@@ -86,8 +87,6 @@ notify_thread (void *ctx) {
 
     dbus_message_unref (msg);
     dbus_connection_unref (conn);
-    deadbeef->thread_exit(NULL);
-
 }
 
 static void
@@ -239,10 +238,9 @@ static void show_notification (DB_playItem_t *track) {
 
     dbus_message_iter_append_basic(&iter, DBUS_TYPE_INT32, &v_timeout);
 
-    intptr_t tid = 0;
-    if ((tid=deadbeef->thread_start(notify_thread, msg)) != 0) {
-        dbus_message_ref (msg);
-        deadbeef->thread_detach (tid);  
+    dbus_message_ref (msg);
+    if (deadbeef->job_submit (DDB_JOB_PRIORITY_NORMAL, NULL, notify_job, NULL, msg) < 0) {
+        dbus_message_unref (msg);
     }
     dbus_message_unref (msg);
     if (v_iconname) {
@@ -224,118 +224,154 @@ error:
     }
 }
 
-static int
-_update_album_gain (ddb_rg_scanner_settings_t *settings, int i, int album_start, char *current_album, char *album, double loudness, ebur128_state **gain_state) {
-    if (strcmp (album, current_album)) {
-        if (i > 0) {
-            // update current album gain/peak
-            float album_peak = 0;
-
-            for (int n = album_start; n < i; ++n) {
-                if (album_peak < settings->results[n].track_peak) {
-                    album_peak = settings->results[n].track_peak;
-                }
-            }
+typedef struct {
+    int start; // index of the first track
+    int count;
+    int remaining; // number of tracks not scanned yet
+} album_t;
 
-            // calculate gain of all tracks of the current album
-            ebur128_loudness_global_multiple(&gain_state[album_start], (size_t)i-album_start, &loudness);
+typedef struct {
+    ddb_rg_scanner_settings_t *settings;
+    ebur128_state **gain_state;
+    ebur128_state **peak_state;
 
-            float album_gain = -23 - (float)loudness + settings->ref_loudness - 84;
+    // album index of each track, NULL in track mode
+    int *track_album;
+    album_t *albums;
 
-            for (int n = album_start; n < i; ++n) {
-                settings->results[n].album_gain = album_gain;
-                settings->results[n].album_peak = album_peak;
-            }
-        }
+    // cancelled on abort and on player shutdown
+    ddb_cancellation_token_t *token;
 
-        // proceed to next album
-        strcpy (current_album, album);
+    // protected by settings->sync_mutex
+    int next_track;
+    int completed;
+} scan_state_t;
 
-        //trace ("next album found %d -> %d\n", album_start, i);
-        return i;
+// called when all tracks of the album are scanned
+static void
+_calc_album_gain (scan_state_t *scan, album_t *album) {
+    ddb_rg_scanner_settings_t *settings = scan->settings;
+    float album_peak = 0;
+    ebur128_state **states = calloc (album->count, sizeof (ebur128_state *));
+    int nstates = 0;
+
+    for (int n = album->start; n < album->start + album->count; ++n) {
+        if (album_peak < settings->results[n].track_peak) {
+            album_peak = settings->results[n].track_peak;
+        }
+        // tracks which failed to decode have no state
+        if (scan->gain_state[n]) {
+            states[nstates++] = scan->gain_state[n];
+        }
     }
-    return album_start;
-}
 
-int
-rg_scan (ddb_rg_scanner_settings_t *settings) {
-    if (settings->_size != sizeof (ddb_rg_scanner_settings_t)) {
-        return -1;
+    // calculate gain of all tracks of the album combined
+    double loudness = settings->ref_loudness;
+    if (nstates > 0) {
+        ebur128_loudness_global_multiple (states, (size_t)nstates, &loudness);
     }
+    free (states);
 
-    settings->sync_mutex = deadbeef->mutex_create ();
+    float album_gain = -23 - (float)loudness + settings->ref_loudness - 84;
 
-    if (settings->num_threads <= 0) {
-        settings->num_threads = 4;
+    for (int n = album->start; n < album->start + album->count; ++n) {
+        settings->results[n].album_gain = album_gain;
+        settings->results[n].album_peak = album_peak;
     }
+}
 
-    char *album_signature_tf = NULL;
-    if (settings->mode == DDB_RG_SCAN_MODE_ALBUMS_FROM_TAGS) {
-        album_signature_tf = deadbeef->tf_compile (album_signature);
-        deadbeef->sort_track_array (NULL, settings->tracks, settings->num_tracks, album_signature, DDB_SORT_ASCENDING);
+static int
+_scan_aborted (scan_state_t *scan) {
+    ddb_rg_scanner_settings_t *settings = scan->settings;
+    if (settings->pabort && *(settings->pabort)) {
+        // drop the workers which haven't started yet
+        deadbeef->cancellation_token_cancel (scan->token);
+        return 1;
     }
+    return deadbeef->cancellation_token_is_cancelled (scan->token);
+}
 
-    //trace ("rg_scanner: using %d thread(s)\n", settings->num_threads);
-
-    ebur128_state **gain_state = NULL;
-    ebur128_state **peak_state = NULL;
-
-    if (settings->ref_loudness == 0) {
-        settings->ref_loudness = DDB_RG_SCAN_DEFAULT_LOUDNESS;
-    }
+// Each worker takes the next unscanned track from the list until there are none left,
+// so that a long track doesn't hold up the others.
+static void
+rg_worker_job (void *ctx, ddb_cancellation_token_t *token) {
+    scan_state_t *scan = ctx;
+    ddb_rg_scanner_settings_t *settings = scan->settings;
 
-    double loudness = settings->ref_loudness;
+    for (;;) {
+        if (_scan_aborted (scan)) {
+            break;
+        }
 
-    // allocate status array
-    gain_state = calloc (settings->num_tracks, sizeof (ebur128_state *));
-    peak_state = calloc (settings->num_tracks, sizeof (ebur128_state *));
+        deadbeef->mutex_lock (settings->sync_mutex);
+        int i = scan->next_track++;
+        deadbeef->mutex_unlock (settings->sync_mutex);
+        if (i >= settings->num_tracks) {
+            break;
+        }
 
-    // used for joining threads
-    intptr_t *rg_threads = calloc (settings->num_tracks, sizeof (intptr_t));
-    track_state_t *track_states = calloc (settings->num_tracks, sizeof (track_state_t));
+        track_state_t st = {
+            .track_index = i,
+            .settings = settings,
+            .gain_state = scan->gain_state,
+            .peak_state = scan->peak_state,
+        };
+        rg_calc_thread (&st);
 
-    // calculate gain for each track and album
-    for (int i = 0; i < settings->num_tracks; ++i) {
-        if (settings->progress_callback) {
-            settings->progress_callback (i, settings->progress_cb_user_data);
+        if (_scan_aborted (scan)) {
+            break;
         }
-        // limit number of parallel threads
-        if (i >= settings->num_threads) {
-            // simple blocking mechanism: join the 'oldest' thread
-            deadbeef->thread_join(rg_threads[i - settings->num_threads]);
-            rg_threads[i - settings->num_threads] = 0;
+
+        album_t *album = NULL;
+        deadbeef->mutex_lock (settings->sync_mutex);
+        if (scan->track_album) {
+            album = &scan->albums[scan->track_album[i]];
+            if (--album->remaining > 0) {
+                album = NULL;
+            }
         }
+        deadbeef->mutex_unlock (settings->sync_mutex);
 
-        if (settings->pabort && *(settings->pabort)) {
-            goto cleanup;
+        if (album) {
+            _calc_album_gain (scan, album);
         }
 
-        // initialize arguments
-        track_states[i].track_index = i;
-        track_states[i].settings = settings;
-        track_states[i].gain_state = gain_state;
-        track_states[i].peak_state = peak_state;
+        deadbeef->mutex_lock (settings->sync_mutex);
+        scan->completed++;
+        if (settings->progress_callback) {
+            settings->progress_callback (scan->completed, settings->progress_cb_user_data);
+        }
+        deadbeef->mutex_unlock (settings->sync_mutex);
+    }
+}
 
-        // run thread
-        rg_threads[i] = deadbeef->thread_start(&rg_calc_thread, (void*)(&track_states[i]));
+int
+rg_scan (ddb_rg_scanner_settings_t *settings) {
+    if (settings->_size != sizeof (ddb_rg_scanner_settings_t)) {
+        return -1;
     }
 
-    // wait for remaining threads to join
-    int remaining_thread_id = settings->num_tracks - settings->num_threads;
-    if (remaining_thread_id < 0) {
-        remaining_thread_id = 0;
+    settings->sync_mutex = deadbeef->mutex_create ();
+
+    if (settings->num_threads <= 0) {
+        settings->num_threads = 4;
     }
-    for (int i = remaining_thread_id; i < settings->num_tracks; ++i) {
-        deadbeef->thread_join(rg_threads[i]);
-        rg_threads[i] = 0;
 
-        if (settings->pabort && *(settings->pabort)) {
-            goto cleanup;
-        }
+    if (settings->ref_loudness == 0) {
+        settings->ref_loudness = DDB_RG_SCAN_DEFAULT_LOUDNESS;
     }
 
-    if (settings->mode == DDB_RG_SCAN_MODE_ALBUMS_FROM_TAGS) {
-        int album_start = -1;
+    scan_state_t scan;
+    memset (&scan, 0, sizeof (scan));
+    scan.settings = settings;
+    scan.gain_state = calloc (settings->num_tracks, sizeof (ebur128_state *));
+    scan.peak_state = calloc (settings->num_tracks, sizeof (ebur128_state *));
+
+    // split the tracks into albums, so that album gain can be calculated as soon as each album is scanned
+    if (settings->mode == DDB_RG_SCAN_MODE_ALBUMS_FROM_TAGS && settings->num_tracks > 0) {
+        deadbeef->sort_track_array (NULL, settings->tracks, settings->num_tracks, album_signature, DDB_SORT_ASCENDING);
+
+        char *album_signature_tf = deadbeef->tf_compile (album_signature);
         char current_album[1000] = "";
         char album[1000];
 
@@ -347,83 +383,67 @@ rg_scan (ddb_rg_scanner_settings_t *settings) {
         ctx.idx = -1;
         ctx.id = -1;
 
-        for (int i = 0; i <= settings->num_tracks; i++) {
-            // set album gain when the album change is detected
-            if (i < settings->num_tracks) {
-                ctx.it = settings->tracks[i];
-                deadbeef->tf_eval(&ctx, album_signature_tf, album, sizeof (album));
-            }
-            else {
-                *album = 0;
+        scan.track_album = calloc (settings->num_tracks, sizeof (int));
+        scan.albums = calloc (settings->num_tracks, sizeof (album_t));
+        int nalbums = 0;
+        for (int i = 0; i < settings->num_tracks; i++) {
+            ctx.it = settings->tracks[i];
+            deadbeef->tf_eval (&ctx, album_signature_tf, album, sizeof (album));
+            if (i == 0 || strcmp (album, current_album)) {
+                strcpy (current_album, album);
+                scan.albums[nalbums].start = i;
+                nalbums++;
             }
-            album_start = _update_album_gain (settings, i, album_start, current_album, album, loudness, gain_state);
+            scan.albums[nalbums-1].count++;
+            scan.albums[nalbums-1].remaining++;
+            scan.track_album[i] = nalbums-1;
         }
-    }
 
-    if (settings->mode == DDB_RG_SOURCE_MODE_ALBUM) {
-        float album_peak = 0;
-
-        for (int i = 0; i < settings->num_tracks; ++i) {
-            if (album_peak < settings->results[i].track_peak) {
-                album_peak = settings->results[i].track_peak;
-            }
-        }
+        deadbeef->tf_free (album_signature_tf);
+    }
+    else if (settings->mode == DDB_RG_SCAN_MODE_SINGLE_ALBUM && settings->num_tracks > 0) {
+        scan.track_album = calloc (settings->num_tracks, sizeof (int));
+        scan.albums = calloc (1, sizeof (album_t));
+        scan.albums[0].count = scan.albums[0].remaining = settings->num_tracks;
+    }
 
-        // calculate gain of all tracks combined
-        ebur128_loudness_global_multiple(gain_state, (size_t)settings->num_tracks, &loudness);
+    int num_threads = settings->num_threads;
+    if (num_threads > settings->num_tracks) {
+        num_threads = settings->num_tracks;
+    }
 
-        float album_gain = -23 - (float)loudness + settings->ref_loudness - 84;
+    //trace ("rg_scanner: using %d thread(s)\n", num_threads);
 
-        for (int i = 0; i < settings->num_tracks; ++i) {
-            settings->results[i].album_gain = album_gain;
-            settings->results[i].album_peak = album_peak;
-        }
+    if (settings->progress_callback && settings->num_tracks > 0) {
+        settings->progress_callback (0, settings->progress_cb_user_data);
     }
 
-cleanup:
-    // free thread storage
-    if (rg_threads) {
-        // join the still-active threads
-        for (int i = 0; i < settings->num_tracks; i++) {
-            if (rg_threads[i]) {
-                deadbeef->thread_join (rg_threads[i]);
-                rg_threads[i] = 0;
-            }
+    // The calling thread is one of the workers, the others run in the shared job pool.
+    // When the pool is busy, the calling thread may end up scanning all of the tracks by itself.
+    scan.token = deadbeef->cancellation_token_alloc ();
+    for (int i = 1; i < num_threads; i++) {
+        if (deadbeef->job_submit (DDB_JOB_PRIORITY_NORMAL, scan.token, rg_worker_job, NULL, &scan)) {
+            break;
         }
-
-        free (rg_threads);
-        rg_threads = NULL;
     }
-
-    if (track_states) {
-        free (track_states);
-        track_states = NULL;
+    if (num_threads > 0) {
+        rg_worker_job (&scan, scan.token);
     }
+    deadbeef->job_wait (scan.token);
+    deadbeef->cancellation_token_unref (scan.token);
 
-    if (gain_state) {
-        for (int i = 0; i < settings->num_tracks; ++i) {
-            if (gain_state[i]) {
-                ebur128_destroy (&gain_state[i]);
-            }
+    for (int i = 0; i < settings->num_tracks; ++i) {
+        if (scan.gain_state[i]) {
+            ebur128_destroy (&scan.gain_state[i]);
         }
-        free (gain_state);
-        gain_state = NULL;
-    }
-
-    if (peak_state) {
-        for (int i = 0; i < settings->num_tracks; ++i) {
-            if (peak_state[i]) {
-                ebur128_destroy (&peak_state[i]);
-            }
+        if (scan.peak_state[i]) {
+            ebur128_destroy (&scan.peak_state[i]);
         }
-        free (peak_state);
-        peak_state = NULL;
-    }
-
-    if (album_signature_tf) {
-        deadbeef->tf_free (album_signature_tf);
-        album_signature_tf = NULL;
     }
+    free (scan.gain_state);
+    free (scan.peak_state);
+    free (scan.track_album);
+    free (scan.albums);
 
     if (settings->sync_mutex) {
         deadbeef->mutex_free (settings->sync_mutex);
@@ -70,13 +70,15 @@ typedef struct {
     // Preferred config variable: rg_scanner.target_db=89
     float ref_loudness;
 
-    // Max number of concurrent threads
+    // Max number of concurrent threads, including the calling thread.
+    // The other threads are taken from the player's job pool.
     int num_threads;
 
     // Optional pointer to the abort flag; the scanner will abort if the pointed value is non-zero
     int *pabort;
 
-    // Optional progress callback, with the current track index.
+    // Optional progress callback, with the number of completed tracks.
+    // Called from the scanner threads, first with 0, and last with num_tracks.
     void (*progress_callback) (int current_track, void *user_data);
 
     // An additional user-defined parameter, which will be passed to the progress_callback.
@@ -25,11 +25,19 @@
 #include <string.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <errno.h>
 #include <assert.h>
+#include <limits.h>
 #include <curl/curlver.h>
 #include <time.h>
 #include "../../deadbeef.h"
+#include "vfs_curl_cache.h"
+
+// the event loop needs curl_multi_wait (7.28.0), and CURL_WRITEFUNC_PAUSE (7.18.0)
+#if LIBCURL_VERSION_NUM < 0x071c00
+#error "vfs_curl requires libcurl 7.28.0 or newer"
+#endif
 
 #define trace(...) { deadbeef->log_detailed (&plugin.plugin, 0, __VA_ARGS__); }
 
@@ -45,6 +53,10 @@ static DB_functions_t *deadbeef;
 
 #define TIMEOUT 10 // in seconds
 
+// when reading from the cache, wait for the running download if it's at most this far behind the read position,
+// otherwise restart it at the read position
+#define CACHE_READAHEAD_WINDOW 0x40000
+
 enum {
     STATUS_INITIAL  = 0,
     STATUS_READING  = 1,
@@ -54,7 +66,14 @@ enum {
     STATUS_DESTROY  = 5,
 };
 
-typedef struct {
+// ICY metadata received by the event loop, to be applied to the track by the reader
+typedef struct http_meta_s {
+    char *key; // NULL for the StreamTitle
+    char *value;
+    struct http_meta_s *next;
+} http_meta_t;
+
+typedef struct HTTP_FILE_s {
     DB_vfs_t *vfs;
     char *url;
     uint8_t buffer[BUFFER_SIZE];
@@ -64,11 +83,12 @@ typedef struct {
     int64_t length;
     int32_t remaining; // remaining bytes in buffer read from stream
     int64_t skipbytes;
-    intptr_t tid; // thread id which does http requests
     intptr_t mutex;
     uint8_t nheaderpackets;
     char *content_type;
     CURL *curl;
+    struct curl_slist *headers;
+    int paused_size; // size of the data which didn't fit into the ringbuffer
     struct timeval last_read_time;
     uint8_t status;
     int icy_metaint;
@@ -77,17 +97,43 @@ typedef struct {
     char metadata[MAX_METADATA];
     int metadata_size; // size of metadata in stream
     int metadata_have_size; // amount which is already in metadata buffer
+    http_meta_t *pending_meta; // protected by mutex
 
     char http_err[CURL_ERROR_SIZE];
 
     float prev_playtime;
     time_t started_timestamp;
 
+    // disk cache, NULL if disabled
+    vfs_curl_cache_t *cache;
+    int64_t dl_pos; // position of the next downloaded byte in cache mode
+    int64_t dl_end; // end of the range being downloaded
+    int64_t range_start; // from Content-Range of the current response
+    int64_t range_end;
+    char *etag; // validators of the current response
+    char *last_modified;
+
     // flags (bitfields to save some space)
     unsigned seektoend : 1; // indicates that next tell must return length
     unsigned gotheader : 1; // tells that all headers (including ICY) were processed (to start reading body)
     unsigned icyheader : 1; // tells that we're currently reading ICY headers
     unsigned gotsomeheader : 1; // tells that we got some headers before body started
+    unsigned gotcontentrange : 1; // current response has Content-Range header
+
+    // flags shared between the reader and the event loop, these are not bitfields,
+    // to avoid clobbering each other when written from different threads
+    uint8_t cache_active; // the body is written to the cache, and read from it
+    uint8_t cache_validated; // the cached data was validated against the server in this session
+    uint8_t cache_failed; // the resource can't be cached, don't use the cache anymore
+    uint8_t cache_range_request; // the current request asks for a range of the cached resource
+    uint8_t cache_no_ranges; // the server doesn't support range requests, don't restart the download
+    uint8_t started; // the stream was passed to the event loop
+    uint8_t detached; // the event loop is done with the stream
+    uint8_t in_multi; // curl handle is added to the multi handle
+    uint8_t paused; // transfer is paused, because the ringbuffer is full
+    uint8_t idle; // no transfer is running, waiting for seek
+
+    struct HTTP_FILE_s *next; // in the event loop lists
 } HTTP_FILE;
 
 static DB_vfs_t plugin;
@@ -120,48 +166,68 @@ http_reg_open_file (DB_FILE *fp);
 static void
 http_unreg_open_file (DB_FILE *fp);
 
+static int64_t
+http_getlength (DB_FILE *stream);
+
+// Stores the received data in the cache, the download runs ahead of the reader without waiting
+static size_t
+http_cache_write (HTTP_FILE *fp, void *ptr, size_t size) {
+    deadbeef->mutex_lock (fp->mutex);
+    if (fp->status == STATUS_SEEK) {
+        trace ("vfs_curl seek request, aborting current request\n");
+        deadbeef->mutex_unlock (fp->mutex);
+        return 0;
+    }
+    if (http_need_abort ((DB_FILE*)fp)) {
+        fp->status = STATUS_ABORTED;
+        trace ("vfs_curl STATUS_ABORTED in the middle of packet\n");
+        deadbeef->mutex_unlock (fp->mutex);
+        return 0;
+    }
+    int64_t sz = min ((int64_t)size, fp->dl_end - fp->dl_pos);
+    if (sz > 0 && vfs_curl_cache_write (fp->cache, fp->dl_pos, ptr, sz) < 0) {
+        trace ("vfs_curl: failed to write cache file %s\n", fp->cache->path);
+        deadbeef->mutex_unlock (fp->mutex);
+        return 0;
+    }
+    fp->dl_pos += sz;
+    deadbeef->mutex_unlock (fp->mutex);
+    return size;
+}
+
 static size_t
 http_curl_write_wrapper (HTTP_FILE *fp, void *ptr, size_t size) {
-    size_t avail = size;
-    while (avail > 0) {
-        deadbeef->mutex_lock (fp->mutex);
-        if (fp->status == STATUS_SEEK) {
-            trace ("vfs_curl seek request, aborting current request\n");
-            deadbeef->mutex_unlock (fp->mutex);
-            return 0;
-        }
-        if (http_need_abort ((DB_FILE*)fp)) {
-            fp->status = STATUS_ABORTED;
-            trace ("vfs_curl STATUS_ABORTED in the middle of packet\n");
-            deadbeef->mutex_unlock (fp->mutex);
-            break;
-        }
-        int sz = BUFFER_SIZE/2 - fp->remaining; // number of bytes free in buffer
-                                                // don't allow to fill more than half -- used for seeking backwards
-
-        if (sz > 5000) { // wait until there are at least 5k bytes free
-            int cp = min (avail, sz);
-            int writepos = (fp->pos + fp->remaining) & BUFFER_MASK;
-            // copy 1st portion (before end of buffer
-            int part1 = BUFFER_SIZE - writepos;
-            // may not be more than total
-            part1 = min (part1, cp);
-            memcpy (fp->buffer+writepos, ptr, part1);
-            ptr += part1;
-            avail -= part1;
-            fp->remaining += part1;
-            cp -= part1;
-            if (cp > 0) {
-                memcpy (fp->buffer, ptr, cp);
-                ptr += cp;
-                avail -= cp;
-                fp->remaining += cp;
-            }
-        }
+    if (fp->cache_active) {
+        return http_cache_write (fp, ptr, size);
+    }
+    deadbeef->mutex_lock (fp->mutex);
+    if (fp->status == STATUS_SEEK) {
+        trace ("vfs_curl seek request, aborting current request\n");
         deadbeef->mutex_unlock (fp->mutex);
-        usleep (3000);
+        return 0;
     }
-    return size - avail;
+    if (http_need_abort ((DB_FILE*)fp)) {
+        fp->status = STATUS_ABORTED;
+        trace ("vfs_curl STATUS_ABORTED in the middle of packet\n");
+        deadbeef->mutex_unlock (fp->mutex);
+        return 0;
+    }
+    // http_curl_write pauses the transfer when there's not enough space, so this never needs to wait
+    int cp = min (size, BUFFER_SIZE - fp->remaining);
+    int writepos = (fp->pos + fp->remaining) & BUFFER_MASK;
+    // copy 1st portion (before end of buffer
+    int part1 = BUFFER_SIZE - writepos;
+    // may not be more than total
+    part1 = min (part1, cp);
+    memcpy (fp->buffer+writepos, ptr, part1);
+    ptr += part1;
+    fp->remaining += part1;
+    if (cp > part1) {
+        memcpy (fp->buffer, ptr, cp - part1);
+        fp->remaining += cp - part1;
+    }
+    deadbeef->mutex_unlock (fp->mutex);
+    return cp;
 }
 
 void
@@ -186,6 +252,146 @@ vfs_curl_set_meta (DB_playItem_t *it, const char *meta, const char *value) {
     deadbeef->event_send ((ddb_event_t *)ev, 0, 0);
 }
 
+// Updates the track metadata from the StreamTitle, and emulates a track change, if the title has changed
+static void
+http_set_stream_title (HTTP_FILE *fp, char *title) {
+    int songstarted = 0;
+    char *tit = strstr (title, " - ");
+    deadbeef->pl_lock ();
+    int emulate_trackchange = 1;
+    // create dummy track with previous meta
+    DB_playItem_t *from = NULL;
+    if (emulate_trackchange) {
+        from = deadbeef->pl_item_alloc ();
+        deadbeef->pl_items_copy_junk (fp->track, from, from);
+    }
+
+    if (tit) {
+        *tit = 0;
+        tit += 3;
+
+        const char *orig_title = deadbeef->pl_find_meta (fp->track, "title");
+        const char *orig_artist = deadbeef->pl_find_meta (fp->track, "artist");
+
+        if (!orig_title || strcasecmp (orig_title, tit)) {
+            vfs_curl_set_meta (fp->track, "!title", tit);
+            songstarted = 1;
+        }
+        if (!orig_artist || strcasecmp (orig_artist, title)) {
+            vfs_curl_set_meta (fp->track, "!artist", title);
+            songstarted = 1;
+        }
+    }
+    else {
+        const char *orig_title = deadbeef->pl_find_meta (fp->track, "title");
+        if (!orig_title || strcasecmp (orig_title, title)) {
+            deadbeef->pl_delete_meta (fp->track, "!artist");
+            vfs_curl_set_meta (fp->track, "!title", title);
+            songstarted = 1;
+        }
+    }
+    deadbeef->pl_unlock ();
+    ddb_playlist_t *plt = deadbeef->plt_get_curr ();
+    if (plt) {
+        deadbeef->plt_modified (plt);
+        deadbeef->plt_unref (plt);
+    }
+    deadbeef->sendmessage (DB_EV_PLAYLISTCHANGED, 0, DDB_PLAYLIST_CHANGE_CONTENT, 0);
+    if (songstarted) {
+
+        float playpos = deadbeef->streamer_get_playpos ();
+        if (emulate_trackchange)
+        {
+            ddb_event_trackchange_t *ev = (ddb_event_trackchange_t *)deadbeef->event_alloc (DB_EV_SONGCHANGED);
+
+            ev->from = from;
+            ev->to = fp->track;
+            ev->playtime = playpos - fp->prev_playtime;
+            ev->started_timestamp = fp->started_timestamp;
+            deadbeef->pl_item_ref (ev->from);
+            deadbeef->pl_item_ref (ev->to);
+            deadbeef->event_send ((ddb_event_t *)ev, 0, 0);
+        }
+
+        ddb_event_track_t *ev = (ddb_event_track_t *)deadbeef->event_alloc (DB_EV_SONGSTARTED);
+        ev->track = fp->track;
+        fp->started_timestamp = time(NULL);
+        ev->started_timestamp = fp->started_timestamp;
+        if (ev->track) {
+            deadbeef->pl_item_ref (ev->track);
+        }
+        deadbeef->event_send ((ddb_event_t *)ev, 0, 0);
+        fp->prev_playtime = playpos;
+    }
+    if (from) {
+        deadbeef->pl_item_unref (from);
+        from = NULL;
+    }
+}
+
+// called on the event loop thread
+static void
+http_meta_append (HTTP_FILE *fp, const char *key, const char *value) {
+    http_meta_t *m = calloc (1, sizeof (http_meta_t));
+    m->key = key ? strdup (key) : NULL;
+    m->value = strdup (value);
+    deadbeef->mutex_lock (fp->mutex);
+    http_meta_t **tail = &fp->pending_meta;
+    while (*tail) {
+        tail = &(*tail)->next;
+    }
+    *tail = m;
+    deadbeef->mutex_unlock (fp->mutex);
+}
+
+static void
+http_meta_free (http_meta_t *m) {
+    while (m) {
+        http_meta_t *next = m->next;
+        free (m->key);
+        free (m->value);
+        free (m);
+        m = next;
+    }
+}
+
+// Applies the ICY metadata received by the event loop.
+// This is done on the reader thread, so that locking the playlist and sending the events
+// doesn't hold up the transfers of the other streams.
+static void
+http_apply_pending_meta (HTTP_FILE *fp) {
+    deadbeef->mutex_lock (fp->mutex);
+    http_meta_t *meta = fp->pending_meta;
+    fp->pending_meta = NULL;
+    deadbeef->mutex_unlock (fp->mutex);
+
+    if (!meta || !fp->track) {
+        http_meta_free (meta);
+        return;
+    }
+
+    int refresh_playlist = 0;
+    for (http_meta_t *m = meta; m; m = m->next) {
+        if (m->key) {
+            vfs_curl_set_meta (fp->track, m->key, m->value);
+            refresh_playlist = 1;
+        }
+        else {
+            http_set_stream_title (fp, m->value);
+        }
+    }
+    http_meta_free (meta);
+
+    if (refresh_playlist) {
+        ddb_playlist_t *plt = deadbeef->plt_get_curr ();
+        if (plt) {
+            deadbeef->plt_modified (plt);
+            deadbeef->plt_unref (plt);
+        }
+        deadbeef->sendmessage (DB_EV_PLAYLISTCHANGED, 0, DDB_PLAYLIST_CHANGE_CONTENT, 0);
+    }
+}
+
 int
 http_parse_shoutcast_meta (HTTP_FILE *fp, const char *meta, int size) {
 //    trace ("reading %d bytes of metadata\n", size);
@@ -209,80 +415,7 @@ http_parse_shoutcast_meta (HTTP_FILE *fp, const char *meta, int size) {
             memcpy (title, meta, s);
             title[s] = 0;
             trace ("got stream title: %s\n", title);
-            if (fp->track) {
-                int songstarted = 0;
-                char *tit = strstr (title, " - ");
-                deadbeef->pl_lock ();
-                int emulate_trackchange = 1;
-                // create dummy track with previous meta
-                DB_playItem_t *from = NULL;
-                if (emulate_trackchange) {
-                    from = deadbeef->pl_item_alloc ();
-                    deadbeef->pl_items_copy_junk (fp->track, from, from);
-                }
-
-                if (tit) {
-                    *tit = 0;
-                    tit += 3;
-
-                    const char *orig_title = deadbeef->pl_find_meta (fp->track, "title");
-                    const char *orig_artist = deadbeef->pl_find_meta (fp->track, "artist");
-
-                    if (!orig_title || strcasecmp (orig_title, tit)) {
-                        vfs_curl_set_meta (fp->track, "!title", tit);
-                        songstarted = 1;
-                    }
-                    if (!orig_artist || strcasecmp (orig_artist, title)) {
-                        vfs_curl_set_meta (fp->track, "!artist", title);
-                        songstarted = 1;
-                    }
-                }
-                else {
-                    const char *orig_title = deadbeef->pl_find_meta (fp->track, "title");
-                    if (!orig_title || strcasecmp (orig_title, title)) {
-                        deadbeef->pl_delete_meta (fp->track, "!artist");
-                        vfs_curl_set_meta (fp->track, "!title", title);
-                        songstarted = 1;
-                    }
-                }
-                deadbeef->pl_unlock ();
-                ddb_playlist_t *plt = deadbeef->plt_get_curr ();
-                if (plt) {
-                    deadbeef->plt_modified (plt);
-                    deadbeef->plt_unref (plt);
-                }
-                deadbeef->sendmessage (DB_EV_PLAYLISTCHANGED, 0, DDB_PLAYLIST_CHANGE_CONTENT, 0);
-                if (songstarted) {
-
-                    float playpos = deadbeef->streamer_get_playpos ();
-                    if (emulate_trackchange)
-                    {
-                        ddb_event_trackchange_t *ev = (ddb_event_trackchange_t *)deadbeef->event_alloc (DB_EV_SONGCHANGED);
-
-                        ev->from = from;
-                        ev->to = fp->track;
-                        ev->playtime = playpos - fp->prev_playtime;
-                        ev->started_timestamp = fp->started_timestamp;
-                        deadbeef->pl_item_ref (ev->from);
-                        deadbeef->pl_item_ref (ev->to);
-                        deadbeef->event_send ((ddb_event_t *)ev, 0, 0);
-                    }
-
-                    ddb_event_track_t *ev = (ddb_event_track_t *)deadbeef->event_alloc (DB_EV_SONGSTARTED);
-                    ev->track = fp->track;
-                    fp->started_timestamp = time(NULL);
-                    ev->started_timestamp = fp->started_timestamp;
-                    if (ev->track) {
-                        deadbeef->pl_item_ref (ev->track);
-                    }
-                    deadbeef->event_send ((ddb_event_t *)ev, 0, 0);
-                    fp->prev_playtime = playpos;
-                }
-                if (from) {
-                    deadbeef->pl_item_unref (from);
-                    from = NULL;
-                }
-            }
+            http_meta_append (fp, NULL, title);
             return 0;
         }
         while (meta < e && *meta != ';') {
@@ -310,6 +443,71 @@ http_stream_reset (HTTP_FILE *fp) {
     fp->wait_meta = 0;
 }
 
+// Returns 1 if the response has the same validator, which was sent in If-Range
+static int
+http_cache_validators_match (HTTP_FILE *fp) {
+    vfs_curl_cache_t *cache = fp->cache;
+    if (cache->etag) {
+        return fp->etag && !strcmp (fp->etag, cache->etag);
+    }
+    return cache->last_modified && fp->last_modified && !strcmp (fp->last_modified, cache->last_modified);
+}
+
+// Decides whether the response body goes to the cache, must be called under fp->mutex
+static void
+http_cache_response_started (HTTP_FILE *fp) {
+    vfs_curl_cache_t *cache = fp->cache;
+    long response = 0;
+    curl_easy_getinfo (fp->curl, CURLINFO_RESPONSE_CODE, &response);
+
+    if (response == 206 && fp->gotcontentrange && fp->length == cache->length) {
+        // the request had If-Range, so the cached data is still valid
+        trace ("vfs_curl: cache validated, downloading range %lld-%lld\n", fp->range_start, fp->range_end);
+        fp->cache_validated = 1;
+        fp->cache_active = 1;
+        fp->dl_pos = fp->range_start;
+        fp->dl_end = min (fp->range_end, cache->length);
+        return;
+    }
+
+    if (response == 200 && fp->cache_range_request && fp->length == cache->length && http_cache_validators_match (fp)) {
+        // The resource didn't change, but the server ignored the Range header.
+        // Every other range request would start from the beginning again,
+        // so the whole resource is downloaded sequentially, and the reader waits for it instead of restarting.
+        trace ("vfs_curl: server ignores range requests, downloading %s sequentially\n", fp->url);
+        fp->cache_no_ranges = 1;
+        fp->cache_validated = 1;
+        fp->cache_active = 1;
+        fp->dl_pos = 0;
+        fp->dl_end = cache->length;
+        return;
+    }
+
+    if (response == 200 && fp->length > 0 && !fp->icyheader && !fp->icy_metaint && (fp->etag || fp->last_modified)) {
+        // new or modified resource, start over
+        trace ("vfs_curl: caching %s (%lld bytes)\n", fp->url, fp->length);
+        vfs_curl_cache_reset (cache, fp->length, fp->etag, fp->last_modified);
+        if (cache->length == fp->length) {
+            fp->cache_validated = 1;
+            fp->cache_active = 1;
+            fp->dl_pos = 0;
+            fp->dl_end = fp->length;
+            return;
+        }
+    }
+
+    trace ("vfs_curl: response %d can't be cached\n", (int)response);
+    fp->cache_failed = 1;
+    fp->cache_active = 0;
+    vfs_curl_cache_reset (cache, 0, NULL, NULL);
+    if (response == 200 && fp->pos > 0) {
+        // the ringbuffer is filled from the start of the file
+        fp->skipbytes = fp->pos;
+        fp->pos = 0;
+        fp->remaining = 0;
+    }
+}
+
 static size_t
 http_curl_write (void *ptr, size_t size, size_t nmemb, void *stream) {
     int avail = size * nmemb;
@@ -322,6 +520,18 @@ http_curl_write (void *ptr, size_t size, size_t nmemb, void *stream) {
         trace ("vfs_curl STATUS_ABORTED at start of packet\n");
         return 0;
     }
+    if (!fp->cache_active) {
+        // don't allow to fill more than half of the ringbuffer -- used for seeking backwards
+        deadbeef->mutex_lock (fp->mutex);
+        int full = fp->remaining > 0 && BUFFER_SIZE/2 - fp->remaining < avail;
+        deadbeef->mutex_unlock (fp->mutex);
+        if (full) {
+            // curl will pass the same data again after the loop resumes the transfer
+            fp->paused = 1;
+            fp->paused_size = avail;
+            return CURL_WRITEFUNC_PAUSE;
+        }
+    }
 //    if (fp->gotsomeheader) {
 //        fp->gotheader = 1;
 //    }
@@ -365,6 +575,9 @@ http_curl_write (void *ptr, size_t size, size_t nmemb, void *stream) {
 
     deadbeef->mutex_lock (fp->mutex);
     if (fp->status == STATUS_INITIAL && fp->gotheader) {
+        if (fp->cache && !fp->cache_failed) {
+            http_cache_response_started (fp);
+        }
         fp->status = STATUS_READING;
     }
     deadbeef->mutex_unlock (fp->mutex);
@@ -507,12 +720,20 @@ http_content_header_handler (void *ptr, size_t size, size_t nmemb, void *stream)
     const uint8_t *end = p + size*nmemb;
     uint8_t key[256];
     uint8_t value[256];
-    int refresh_playlist = 0;
 
     if (fp->length == 0) {
         fp->length = -1;
     }
 
+    if (!fp->icyheader && p <= end - 5 && !memcmp (p, "HTTP/", 5)) {
+        // status line of a new response, e.g. after redirect
+        fp->gotcontentrange = 0;
+        free (fp->etag);
+        fp->etag = NULL;
+        free (fp->last_modified);
+        fp->last_modified = NULL;
+    }
+
     while (p < end) {
         if (p <= end - 4) {
             if (!memcmp (p, "\r\n\r\n", 4)) {
@@ -533,19 +754,33 @@ http_content_header_handler (void *ptr, size_t size, size_t nmemb, void *stream)
             fp->content_type = strdup (value);
         }
         else if (!strcasecmp (key, "Content-Length")) {
-            fp->length = atoi (value);
+            // for partial responses, this is the length of the range
+            if (!fp->gotcontentrange) {
+                fp->length = atoll (value);
+            }
         }
-        else if (!strcasecmp (key, "icy-name")) {
-            if (fp->track) {
-                vfs_curl_set_meta (fp->track, "title", value);
-                refresh_playlist = 1;
+        else if (!strcasecmp (key, "Content-Range")) {
+            long long start, end, total;
+            if (3 == sscanf (value, "bytes %lld-%lld/%lld", &start, &end, &total)) {
+                fp->gotcontentrange = 1;
+                fp->range_start = start;
+                fp->range_end = end + 1;
+                fp->length = total;
             }
         }
+        else if (!strcasecmp (key, "ETag")) {
+            free (fp->etag);
+            fp->etag = strdup (value);
+        }
+        else if (!strcasecmp (key, "Last-Modified")) {
+            free (fp->last_modified);
+            fp->last_modified = strdup (value);
+        }
+        else if (!strcasecmp (key, "icy-name")) {
+            http_meta_append (fp, "title", value);
+        }
         else if (!strcasecmp (key, "icy-genre")) {
-            if (fp->track) {
-                vfs_curl_set_meta (fp->track, "genre", value);
-                refresh_playlist = 1;
-            }
+            http_meta_append (fp, "genre", value);
         }
         else if (!strcasecmp (key, "icy-metaint")) {
             //printf ("icy-metaint: %d\n", atoi (value));
@@ -553,10 +788,7 @@ http_content_header_handler (void *ptr, size_t size, size_t nmemb, void *stream)
             fp->wait_meta = fp->icy_metaint; 
         }
         else if (!strcasecmp (key, "icy-url")) {
-            if (fp->track) {
-                vfs_curl_set_meta (fp->track, "url", value);
-                refresh_playlist = 1;
-            }
+            http_meta_append (fp, "url", value);
         }
 
         // for icy streams, reset length
@@ -564,14 +796,6 @@ http_content_header_handler (void *ptr, size_t size, size_t nmemb, void *stream)
             fp->length = -1;
         }
     }
-    ddb_playlist_t *plt = deadbeef->plt_get_curr ();
-    if (plt) {
-        deadbeef->plt_modified (plt);
-        deadbeef->plt_unref (plt);
-    }
-    if (refresh_playlist) {
-        deadbeef->sendmessage (DB_EV_PLAYLISTCHANGED, 0, DDB_PLAYLIST_CHANGE_CONTENT, 0);
-    }
     if (!fp->icyheader) {
         fp->gotsomeheader = 1;
     }
@@ -621,154 +845,440 @@ http_destroy (HTTP_FILE *fp) {
     if (fp->url) {
         free (fp->url);
     }
+    free (fp->etag);
+    free (fp->last_modified);
+    http_meta_free (fp->pending_meta);
     if (fp->mutex) {
         deadbeef->mutex_free (fp->mutex);
     }
     free (fp);
 }
 
-static void
-http_thread_func (void *ctx) {
-    HTTP_FILE *fp = (HTTP_FILE *)ctx;
-    CURL *curl;
-    curl = curl_easy_init ();
-    fp->length = -1;
-    fp->status = STATUS_INITIAL;
-    fp->curl = curl;
+enum {
+    CACHE_REQUEST_NONE, // cache is not used, request the whole resource
+    CACHE_REQUEST_RANGE, // request the range missing from the cache
+    CACHE_REQUEST_IDLE, // nothing to download after the read position
+};
 
-    int status;
+// Finds the next range to download, must be called under fp->mutex
+static int
+http_cache_next_request (HTTP_FILE *fp, char *range, size_t size) {
+    vfs_curl_cache_t *cache = fp->cache;
+    if (!cache || fp->cache_failed || cache->length <= 0) {
+        return CACHE_REQUEST_NONE;
+    }
+    int64_t start, end;
+    if (!vfs_curl_cache_find_gap (cache, fp->pos, &start, &end)) {
+        snprintf (range, size, "%lld-%lld", (long long)start, (long long)(end-1));
+        return CACHE_REQUEST_RANGE;
+    }
+    if (!fp->cache_validated) {
+        // everything after pos is cached, request the last byte to validate
+        snprintf (range, size, "%lld-%lld", (long long)(cache->length-1), (long long)(cache->length-1));
+        return CACHE_REQUEST_RANGE;
+    }
+    return CACHE_REQUEST_IDLE;
+}
 
-    trace ("vfs_curl: started loading data %s\n", fp->url);
-    for (;;) {
-        struct curl_slist *headers = NULL;
-        curl_easy_reset (curl);
-        curl_easy_setopt (curl, CURLOPT_URL, fp->url);
-        char ua[100];
-        deadbeef->conf_get_str ("network.http_user_agent", "deadbeef", ua, sizeof (ua));
-        curl_easy_setopt (curl, CURLOPT_USERAGENT, ua);
-        curl_easy_setopt (curl, CURLOPT_NOPROGRESS, 1);
-        curl_easy_setopt (curl, CURLOPT_WRITEFUNCTION, http_curl_write);
-        curl_easy_setopt (curl, CURLOPT_WRITEDATA, ctx);
-        curl_easy_setopt (curl, CURLOPT_ERRORBUFFER, fp->http_err);
-        curl_easy_setopt (curl, CURLOPT_BUFFERSIZE, BUFFER_SIZE/2);
-        curl_easy_setopt (curl, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_1_1);
-        curl_easy_setopt (curl, CURLOPT_HEADERFUNCTION, http_content_header_handler);
-        curl_easy_setopt (curl, CURLOPT_HEADERDATA, ctx);
-        curl_easy_setopt (curl, CURLOPT_NOSIGNAL, 1);
-        curl_easy_setopt (curl, CURLOPT_PROGRESSFUNCTION, http_curl_control);
-        curl_easy_setopt (curl, CURLOPT_NOPROGRESS, 0);
-        curl_easy_setopt (curl, CURLOPT_PROGRESSDATA, ctx);
-        // enable up to 10 redirects
-        curl_easy_setopt (curl, CURLOPT_FOLLOWLOCATION, 1);
-        curl_easy_setopt (curl, CURLOPT_MAXREDIRS, 10);
-        headers = curl_slist_append (headers, "Icy-Metadata:1");
-        curl_easy_setopt (curl, CURLOPT_HTTPHEADER, headers);
-        if (fp->pos > 0 && fp->length >= 0) {
-            curl_easy_setopt (curl, CURLOPT_RESUME_FROM, (long)fp->pos);
-        }
-        if (deadbeef->conf_get_int ("network.proxy", 0)) {
-            deadbeef->conf_lock ();
-            curl_easy_setopt (curl, CURLOPT_PROXY, deadbeef->conf_get_str_fast ("network.proxy.address", ""));
-            curl_easy_setopt (curl, CURLOPT_PROXYPORT, deadbeef->conf_get_int ("network.proxy.port", 8080));
-            const char *type = deadbeef->conf_get_str_fast ("network.proxy.type", "HTTP");
-            int curlproxytype = CURLPROXY_HTTP;
-            if (!strcasecmp (type, "HTTP")) {
-                curlproxytype = CURLPROXY_HTTP;
-            }
+// The event loop, which runs the transfers of all streams on a single curl multi handle,
+// so that the connections, DNS lookups and TLS sessions are reused between the streams.
+// The streams are added to the pending list by the reader threads, all other loop state
+// is only accessed by the loop thread.
+static CURLM *http_multi;
+static CURLSH *http_share;
+static intptr_t http_loop_tid;
+static uintptr_t http_loop_mutex;
+static HTTP_FILE *http_loop_pending; // streams waiting to be picked up by the loop
+static HTTP_FILE *http_loop_streams; // streams owned by the loop
+static int http_loop_wake_fds[2] = { -1, -1 };
+static int http_loop_terminate;
+
+#define MAX_HOST_CONNECTIONS 4
+
+static void
+http_loop_wake (void) {
+    if (http_loop_wake_fds[1] >= 0) {
+        char c = 0;
+        if (write (http_loop_wake_fds[1], &c, 1) < 0) {
+            // the pipe is non-blocking, a full pipe means that the loop is going to wake up anyway
+        }
+    }
+}
+
+static void
+http_setup_request (HTTP_FILE *fp, int cache_request, const char *range) {
+    CURL *curl = fp->curl;
+    curl_easy_reset (curl);
+    curl_easy_setopt (curl, CURLOPT_URL, fp->url);
+    char ua[100];
+    deadbeef->conf_get_str ("network.http_user_agent", "deadbeef", ua, sizeof (ua));
+    curl_easy_setopt (curl, CURLOPT_USERAGENT, ua);
+    curl_easy_setopt (curl, CURLOPT_NOPROGRESS, 1);
+    curl_easy_setopt (curl, CURLOPT_WRITEFUNCTION, http_curl_write);
+    curl_easy_setopt (curl, CURLOPT_WRITEDATA, fp);
+    curl_easy_setopt (curl, CURLOPT_ERRORBUFFER, fp->http_err);
+    curl_easy_setopt (curl, CURLOPT_BUFFERSIZE, BUFFER_SIZE/2);
+    curl_easy_setopt (curl, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_1_1);
+    curl_easy_setopt (curl, CURLOPT_HEADERFUNCTION, http_content_header_handler);
+    curl_easy_setopt (curl, CURLOPT_HEADERDATA, fp);
+    curl_easy_setopt (curl, CURLOPT_NOSIGNAL, 1);
+    curl_easy_setopt (curl, CURLOPT_PROGRESSFUNCTION, http_curl_control);
+    curl_easy_setopt (curl, CURLOPT_NOPROGRESS, 0);
+    curl_easy_setopt (curl, CURLOPT_PROGRESSDATA, fp);
+    curl_easy_setopt (curl, CURLOPT_PRIVATE, fp);
+    if (http_share) {
+        curl_easy_setopt (curl, CURLOPT_SHARE, http_share);
+    }
+    // enable up to 10 redirects
+    curl_easy_setopt (curl, CURLOPT_FOLLOWLOCATION, 1);
+    curl_easy_setopt (curl, CURLOPT_MAXREDIRS, 10);
+    fp->headers = curl_slist_append (fp->headers, "Icy-Metadata:1");
+    fp->cache_range_request = cache_request == CACHE_REQUEST_RANGE;
+    if (cache_request == CACHE_REQUEST_RANGE) {
+        trace ("vfs_curl: requesting range %s\n", range);
+        char if_range[300];
+        snprintf (if_range, sizeof (if_range), "If-Range: %s", fp->cache->etag ? fp->cache->etag : fp->cache->last_modified);
+        fp->headers = curl_slist_append (fp->headers, if_range);
+        curl_easy_setopt (curl, CURLOPT_RANGE, range);
+    }
+    else if (fp->pos > 0 && fp->length >= 0) {
+        curl_easy_setopt (curl, CURLOPT_RESUME_FROM, (long)fp->pos);
+    }
+    curl_easy_setopt (curl, CURLOPT_HTTPHEADER, fp->headers);
+    if (deadbeef->conf_get_int ("network.proxy", 0)) {
+        deadbeef->conf_lock ();
+        curl_easy_setopt (curl, CURLOPT_PROXY, deadbeef->conf_get_str_fast ("network.proxy.address", ""));
+        curl_easy_setopt (curl, CURLOPT_PROXYPORT, deadbeef->conf_get_int ("network.proxy.port", 8080));
+        const char *type = deadbeef->conf_get_str_fast ("network.proxy.type", "HTTP");
+        int curlproxytype = CURLPROXY_HTTP;
+        if (!strcasecmp (type, "HTTP")) {
+            curlproxytype = CURLPROXY_HTTP;
+        }
 #if LIBCURL_VERSION_MINOR >= 19 && LIBCURL_VERSION_PATCH >= 4
-            else if (!strcasecmp (type, "HTTP_1_0")) {
-                curlproxytype = CURLPROXY_HTTP_1_0;
-            }
+        else if (!strcasecmp (type, "HTTP_1_0")) {
+            curlproxytype = CURLPROXY_HTTP_1_0;
+        }
 #endif
 #if LIBCURL_VERSION_MINOR >= 15 && LIBCURL_VERSION_PATCH >= 2
-            else if (!strcasecmp (type, "SOCKS4")) {
-                curlproxytype = CURLPROXY_SOCKS4;
-            }
+        else if (!strcasecmp (type, "SOCKS4")) {
+            curlproxytype = CURLPROXY_SOCKS4;
+        }
 #endif
-            else if (!strcasecmp (type, "SOCKS5")) {
-                curlproxytype = CURLPROXY_SOCKS5;
-            }
+        else if (!strcasecmp (type, "SOCKS5")) {
+            curlproxytype = CURLPROXY_SOCKS5;
+        }
 #if LIBCURL_VERSION_MINOR >= 18 && LIBCURL_VERSION_PATCH >= 0
-            else if (!strcasecmp (type, "SOCKS4A")) {
-                curlproxytype = CURLPROXY_SOCKS4A;
-            }
-            else if (!strcasecmp (type, "SOCKS5_HOSTNAME")) {
-                curlproxytype = CURLPROXY_SOCKS5_HOSTNAME;
-            }
+        else if (!strcasecmp (type, "SOCKS4A")) {
+            curlproxytype = CURLPROXY_SOCKS4A;
+        }
+        else if (!strcasecmp (type, "SOCKS5_HOSTNAME")) {
+            curlproxytype = CURLPROXY_SOCKS5_HOSTNAME;
+        }
 #endif
-            curl_easy_setopt (curl, CURLOPT_PROXYTYPE, curlproxytype);
+        curl_easy_setopt (curl, CURLOPT_PROXYTYPE, curlproxytype);
 
-            const char *proxyuser = deadbeef->conf_get_str_fast ("network.proxy.username", "");
-            const char *proxypass = deadbeef->conf_get_str_fast ("network.proxy.password", "");
-            if (*proxyuser || *proxypass) {
+        const char *proxyuser = deadbeef->conf_get_str_fast ("network.proxy.username", "");
+        const char *proxypass = deadbeef->conf_get_str_fast ("network.proxy.password", "");
+        if (*proxyuser || *proxypass) {
 #if LIBCURL_VERSION_MINOR >= 19 && LIBCURL_VERSION_PATCH >= 1
-                curl_easy_setopt (curl, CURLOPT_PROXYUSERNAME, proxyuser);
-                curl_easy_setopt (curl, CURLOPT_PROXYPASSWORD, proxypass);
+            curl_easy_setopt (curl, CURLOPT_PROXYUSERNAME, proxyuser);
+            curl_easy_setopt (curl, CURLOPT_PROXYPASSWORD, proxypass);
 #else
-                char pwd[200];
-                snprintf (pwd, sizeof (pwd), "%s:%s", proxyuser, proxypass);
-                curl_easy_setopt (curl, CURLOPT_PROXYUSERPWD, pwd);
+            char pwd[200];
+            snprintf (pwd, sizeof (pwd), "%s:%s", proxyuser, proxypass);
+            curl_easy_setopt (curl, CURLOPT_PROXYUSERPWD, pwd);
 #endif
+        }
+        deadbeef->conf_unlock ();
+    }
+}
+
+// Called on the loop thread when the stream is aborted, the stream must not be touched by the loop after that
+static void
+http_stream_finish (HTTP_FILE *fp) {
+    if (fp->curl) {
+        curl_easy_cleanup (fp->curl);
+        fp->curl = NULL;
+    }
+    curl_slist_free_all (fp->headers);
+    fp->headers = NULL;
+
+    deadbeef->mutex_lock (fp->mutex);
+    trace ("vfs_curl: stream released\n");
+    fp->status = STATUS_ABORTED;
+    fp->detached = 1;
+    deadbeef->mutex_unlock (fp->mutex);
+}
+
+// Called on the loop thread when there's nothing more to download.
+// The stream stays in the loop, so that it can be restarted by seeking.
+static void
+http_stream_set_idle (HTTP_FILE *fp, int finished) {
+    deadbeef->mutex_lock (fp->mutex);
+    if (finished && fp->status != STATUS_ABORTED && fp->status != STATUS_SEEK) {
+        trace ("vfs_curl: stream finished\n");
+        fp->status = STATUS_FINISHED;
+    }
+    else if (fp->status == STATUS_INITIAL) {
+        // no request is pending, don't block the reader
+        fp->status = STATUS_READING;
+    }
+    fp->idle = 1;
+    deadbeef->mutex_unlock (fp->mutex);
+}
+
+// Starts the next request of the stream
+static void
+http_stream_next_request (HTTP_FILE *fp) {
+    char range[100];
+    deadbeef->mutex_lock (fp->mutex);
+    int cache_request = http_cache_next_request (fp, range, sizeof (range));
+    deadbeef->mutex_unlock (fp->mutex);
+    if (cache_request == CACHE_REQUEST_IDLE) {
+        // wait until the reader requests another position
+        int complete = vfs_curl_cache_is_complete (fp->cache);
+        if (complete) {
+            trace ("vfs_curl: %s is fully cached\n", fp->url);
+        }
+        http_stream_set_idle (fp, complete);
+        return;
+    }
+
+    http_setup_request (fp, cache_request, range);
+    trace ("vfs_curl: starting request (status=%d)...\n", fp->status);
+    gettimeofday (&fp->last_read_time, NULL);
+    if (curl_multi_add_handle (http_multi, fp->curl) != CURLM_OK) {
+        http_stream_set_idle (fp, 1);
+        return;
+    }
+    fp->in_multi = 1;
+}
+
+// Prepares the stream to be restarted after seek, must be called under fp->mutex
+static void
+http_stream_prepare_restart (HTTP_FILE *fp) {
+    trace ("vfs_curl: restart request\n");
+    fp->skipbytes = 0;
+    fp->status = STATUS_INITIAL;
+    trace ("seeking to %lld\n", fp->pos);
+    if (fp->length < 0) {
+        // icy -- need full restart
+        fp->pos = 0;
+        if (fp->content_type) {
+            free (fp->content_type);
+            fp->content_type = NULL;
+        }
+        fp->seektoend = 0;
+        fp->gotheader = 0;
+        fp->icyheader = 0;
+        fp->gotsomeheader = 0;
+        fp->wait_meta = 0;
+        fp->icy_metaint = 0;
+    }
+}
+
+// Handles the end of a request
+static void
+http_transfer_done (HTTP_FILE *fp, CURLcode status) {
+    curl_multi_remove_handle (http_multi, fp->curl);
+    fp->in_multi = 0;
+    fp->paused = 0;
+    curl_slist_free_all (fp->headers);
+    fp->headers = NULL;
+
+    trace ("vfs_curl: transfer retval=%d\n", status);
+    if (status != 0) {
+        trace ("curl error:\n%s\n", fp->http_err);
+    }
+    deadbeef->mutex_lock (fp->mutex);
+    if (status == 0 && fp->cache_active && fp->status == STATUS_READING) {
+        // range is done, continue with the next one
+        http_stream_reset (fp);
+        fp->status = STATUS_INITIAL;
+        deadbeef->mutex_unlock (fp->mutex);
+        http_stream_next_request (fp);
+        return;
+    }
+    if (fp->status != STATUS_SEEK) {
+        deadbeef->mutex_unlock (fp->mutex);
+        http_stream_set_idle (fp, 1);
+        return;
+    }
+    http_stream_prepare_restart (fp);
+    deadbeef->mutex_unlock (fp->mutex);
+    http_stream_next_request (fp);
+}
+
+// Handles the requests from the reader, which can't wait for the curl callbacks:
+// abort, seek while idle or paused, and resuming paused transfers.
+// Returns -1 if the stream was aborted.
+static int
+http_stream_poll (HTTP_FILE *fp) {
+    deadbeef->mutex_lock (fp->mutex);
+    if (http_need_abort ((DB_FILE *)fp) || http_loop_terminate) {
+        fp->status = STATUS_ABORTED;
+        deadbeef->mutex_unlock (fp->mutex);
+        if (fp->in_multi) {
+            curl_multi_remove_handle (http_multi, fp->curl);
+            fp->in_multi = 0;
+        }
+        return -1;
+    }
+    if (fp->status == STATUS_SEEK) {
+        if (fp->idle) {
+            fp->idle = 0;
+            http_stream_prepare_restart (fp);
+            deadbeef->mutex_unlock (fp->mutex);
+            http_stream_next_request (fp);
+        }
+        else {
+            deadbeef->mutex_unlock (fp->mutex);
+            if (fp->in_multi) {
+                http_transfer_done (fp, CURLE_ABORTED_BY_CALLBACK);
             }
-            deadbeef->conf_unlock ();
         }
-//        fp->status = STATUS_INITIAL;
-        trace ("vfs_curl: calling curl_easy_perform (status=%d)...\n", fp->status);
+        return 0;
+    }
+    int resume = fp->paused && (fp->remaining == 0 || BUFFER_SIZE/2 - fp->remaining >= fp->paused_size);
+    if (fp->paused) {
+        // the reader is not consuming the data, this is not a network timeout
         gettimeofday (&fp->last_read_time, NULL);
-        status = curl_easy_perform (curl);
-        trace ("vfs_curl: curl_easy_perform retval=%d\n", status);
-        if (status != 0) {
-            trace ("curl error:\n%s\n", fp->http_err);
+    }
+    deadbeef->mutex_unlock (fp->mutex);
+    if (resume) {
+        fp->paused = 0;
+        // this may call the write callback
+        curl_easy_pause (fp->curl, CURLPAUSE_CONT);
+    }
+    return 0;
+}
+
+static void
+http_loop_thread (void *ctx) {
+    for (;;) {
+        // pick up the new streams
+        deadbeef->mutex_lock (http_loop_mutex);
+        HTTP_FILE *pending = http_loop_pending;
+        http_loop_pending = NULL;
+        int terminate = http_loop_terminate;
+        deadbeef->mutex_unlock (http_loop_mutex);
+
+        while (pending) {
+            HTTP_FILE *fp = pending;
+            pending = pending->next;
+            trace ("vfs_curl: started loading data %s\n", fp->url);
+            fp->curl = curl_easy_init ();
+            if (!fp->curl) {
+                http_stream_finish (fp);
+                continue;
+            }
+            http_stream_next_request (fp);
+            fp->next = http_loop_streams;
+            http_loop_streams = fp;
         }
-        deadbeef->mutex_lock (fp->mutex);
-        if (fp->status != STATUS_SEEK) {
-            trace ("vfs_curl: break loop\n");
-            deadbeef->mutex_unlock (fp->mutex);
+
+        for (HTTP_FILE **pfp = &http_loop_streams; *pfp; ) {
+            HTTP_FILE *fp = *pfp;
+            if (http_stream_poll (fp) < 0) {
+                *pfp = fp->next;
+                http_stream_finish (fp);
+                continue;
+            }
+            pfp = &fp->next;
+        }
+
+        if (terminate && !http_loop_streams) {
             break;
         }
-        else {
-            trace ("vfs_curl: restart loop\n");
-            fp->skipbytes = 0;
-            fp->status = STATUS_INITIAL;
-            trace ("seeking to %lld\n", fp->pos);
-            if (fp->length < 0) {
-                // icy -- need full restart
-                fp->pos = 0;
-                if (fp->content_type) {
-                    free (fp->content_type);
-                    fp->content_type = NULL;
-                }
-                fp->seektoend = 0;
-                fp->gotheader = 0;
-                fp->icyheader = 0;
-                fp->gotsomeheader = 0;
-                fp->wait_meta = 0;
-                fp->icy_metaint = 0;
+
+        int running;
+        curl_multi_perform (http_multi, &running);
+
+        CURLMsg *msg;
+        int msgs;
+        while ((msg = curl_multi_info_read (http_multi, &msgs))) {
+            if (msg->msg != CURLMSG_DONE) {
+                continue;
             }
+            HTTP_FILE *fp = NULL;
+            curl_easy_getinfo (msg->easy_handle, CURLINFO_PRIVATE, (char **)&fp);
+            http_transfer_done (fp, msg->data.result);
+        }
+
+        struct curl_waitfd wfd;
+        wfd.fd = http_loop_wake_fds[0];
+        wfd.events = CURL_WAIT_POLLIN;
+        wfd.revents = 0;
+        curl_multi_wait (http_multi, &wfd, 1, 1000, NULL);
+        if (wfd.revents) {
+            char buf[100];
+            while (read (http_loop_wake_fds[0], buf, sizeof (buf)) > 0);
         }
-        deadbeef->mutex_unlock (fp->mutex);
-        curl_slist_free_all (headers);
     }
-    fp->curl = NULL;
-    curl_easy_cleanup (curl);
+}
 
-    deadbeef->mutex_lock (fp->mutex);
+static int
+http_loop_start (void) {
+    if (pipe (http_loop_wake_fds)) {
+        return -1;
+    }
+    for (int i = 0; i < 2; i++) {
+        fcntl (http_loop_wake_fds[i], F_SETFL, fcntl (http_loop_wake_fds[i], F_GETFL) | O_NONBLOCK);
+    }
+    http_multi = curl_multi_init ();
+#if LIBCURL_VERSION_NUM >= 0x071e00
+    curl_multi_setopt (http_multi, CURLMOPT_MAX_HOST_CONNECTIONS, (long)MAX_HOST_CONNECTIONS);
+#endif
+    // the multi handle already shares the connections and the DNS cache, TLS sessions need a share handle
+    http_share = curl_share_init ();
+    if (http_share) {
+        curl_share_setopt (http_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+    }
+    http_loop_terminate = 0;
+    http_loop_tid = deadbeef->thread_start (http_loop_thread, NULL);
+    return 0;
+}
 
-    if (fp->status == STATUS_ABORTED) {
-        trace ("vfs_curl: thread ended due to abort signal\n");
+static void
+http_loop_stop (void) {
+    if (!http_loop_tid) {
+        return;
     }
-    else {
-        trace ("vfs_curl: thread ended normally\n");
-        fp->status = STATUS_FINISHED;
+    deadbeef->mutex_lock (http_loop_mutex);
+    http_loop_terminate = 1;
+    deadbeef->mutex_unlock (http_loop_mutex);
+    http_loop_wake ();
+    deadbeef->thread_join (http_loop_tid);
+    http_loop_tid = 0;
+    curl_multi_cleanup (http_multi);
+    http_multi = NULL;
+    if (http_share) {
+        curl_share_cleanup (http_share);
+        http_share = NULL;
     }
-    deadbeef->mutex_unlock (fp->mutex);
+    close (http_loop_wake_fds[0]);
+    close (http_loop_wake_fds[1]);
+    http_loop_wake_fds[0] = http_loop_wake_fds[1] = -1;
 }
 
 static void
 http_start_streamer (HTTP_FILE *fp) {
     fp->mutex = deadbeef->mutex_create ();
-    fp->tid = deadbeef->thread_start (http_thread_func, fp);
-//    deadbeef->thread_detach (fp->tid);
+    fp->length = -1;
+    fp->status = STATUS_INITIAL;
+    fp->started = 1;
+
+    deadbeef->mutex_lock (http_loop_mutex);
+    if (!http_loop_tid && http_loop_start () < 0) {
+        fp->status = STATUS_ABORTED;
+        fp->detached = 1;
+        deadbeef->mutex_unlock (http_loop_mutex);
+        return;
+    }
+    fp->next = http_loop_pending;
+    http_loop_pending = fp;
+    deadbeef->mutex_unlock (http_loop_mutex);
+    http_loop_wake ();
 }
 
 static DB_FILE *
@@ -789,6 +1299,15 @@ http_open (const char *fname) {
     memset (fp, 0, sizeof (HTTP_FILE));
     fp->vfs = &plugin;
     fp->url = strdup (fname);
+    if (deadbeef->conf_get_int ("vfs_curl.cache", 0) && strncasecmp (fname, "ftp://", 6)) {
+        char cache_dir[PATH_MAX];
+        snprintf (cache_dir, sizeof (cache_dir), "%s/vfs_curl", deadbeef->get_system_dir (DDB_SYS_DIR_CACHE));
+        fp->cache = vfs_curl_cache_open (cache_dir, fname);
+        if (!fp->cache) {
+            // e.g. the same url is already open by another handle, read it without the cache
+            trace ("vfs_curl: failed to open cache in %s, or it's in use\n", cache_dir);
+        }
+    }
     return (DB_FILE*)fp;
 }
 
@@ -808,15 +1327,66 @@ http_close (DB_FILE *stream) {
     HTTP_FILE *fp = (HTTP_FILE *)stream;
 
     http_abort (stream);
-    if (fp->tid) {
-        deadbeef->thread_join (fp->tid);
+    if (fp->started) {
+        // wait until the event loop releases the stream
+        for (;;) {
+            deadbeef->mutex_lock (fp->mutex);
+            int detached = fp->detached;
+            deadbeef->mutex_unlock (fp->mutex);
+            if (detached) {
+                break;
+            }
+            usleep (3000);
+        }
     }
     http_cancel_abort ((DB_FILE *)fp);
+    if (fp->cache) {
+        int64_t max_size = (int64_t)deadbeef->conf_get_int ("vfs_curl.cache_size_mb", 512) * 1024 * 1024;
+        vfs_curl_cache_close (fp->cache, max_size);
+        fp->cache = NULL;
+    }
     http_destroy (fp);
     http_unreg_open_file ((DB_FILE *)fp);
     trace ("http_close done\n");
 }
 
+// Reads from the cache, until the request is satisfied, or the cache is not used anymore.
+// Returns the number of bytes read.
+static size_t
+http_cache_read (HTTP_FILE *fp, uint8_t *ptr, size_t sz) {
+    size_t total = 0;
+    deadbeef->mutex_lock (fp->mutex);
+    while (sz > 0 && fp->cache_active && fp->status != STATUS_ABORTED) {
+        int64_t avail = vfs_curl_cache_avail (fp->cache, fp->pos);
+        if (avail > 0) {
+            ssize_t rd = vfs_curl_cache_read (fp->cache, fp->pos, ptr, min ((int64_t)sz, avail));
+            if (rd <= 0) {
+                break;
+            }
+            fp->pos += rd;
+            ptr += rd;
+            sz -= rd;
+            total += rd;
+            continue;
+        }
+        if (fp->pos >= fp->cache->length || fp->status == STATUS_FINISHED) {
+            break;
+        }
+        if (fp->status == STATUS_READING && !fp->cache_no_ranges && (fp->pos < fp->dl_pos || fp->pos >= min (fp->dl_end, fp->dl_pos + CACHE_READAHEAD_WINDOW))) {
+            // the running download won't reach pos soon
+            trace ("vfs_curl: restarting download at %lld\n", fp->pos);
+            http_stream_reset (fp);
+            fp->status = STATUS_SEEK;
+            http_loop_wake ();
+        }
+        deadbeef->mutex_unlock (fp->mutex);
+        usleep (3000);
+        deadbeef->mutex_lock (fp->mutex);
+    }
+    deadbeef->mutex_unlock (fp->mutex);
+    return total;
+}
+
 static size_t
 http_read (void *ptr, size_t size, size_t nmemb, DB_FILE *stream) {
     assert (stream);
@@ -824,15 +1394,33 @@ http_read (void *ptr, size_t size, size_t nmemb, DB_FILE *stream) {
     HTTP_FILE *fp = (HTTP_FILE *)stream;
 //    trace ("http_read %d (status=%d)\n", size*nmemb, fp->status);
     fp->seektoend = 0;
-    if (fp->status == STATUS_ABORTED || (fp->status == STATUS_FINISHED && fp->remaining == 0)) {
+    if (fp->status == STATUS_ABORTED || (fp->status == STATUS_FINISHED && fp->remaining == 0 && !fp->cache_active)) {
         errno = ECONNABORTED;
         return 0;
     }
-    if (!fp->tid) {
+    if (!fp->started) {
         http_start_streamer (fp);
     }
+    http_apply_pending_meta (fp);
 
     size_t sz = size * nmemb;
+    if (fp->cache) {
+        // wait for the response, to know whether it's cached
+        while (fp->status == STATUS_INITIAL) {
+            usleep (3000);
+        }
+        size_t rd = http_cache_read (fp, ptr, sz);
+        ptr += rd;
+        sz -= rd;
+        if (fp->cache_active) {
+            // EOF or abort
+            if (fp->status == STATUS_ABORTED) {
+                errno = ECONNABORTED;
+                return 0;
+            }
+            return (size * nmemb - sz) / size;
+        }
+    }
     while ((fp->remaining > 0 || fp->status != STATUS_FINISHED && fp->status != STATUS_ABORTED) && sz > 0)
     {
         // wait until data is available
@@ -849,6 +1437,7 @@ http_read (void *ptr, size_t size, size_t nmemb, DB_FILE *stream) {
                     http_stream_reset (fp);
                     fp->status = STATUS_SEEK;
                     deadbeef->mutex_unlock (fp->mutex);
+                    http_loop_wake ();
                     if (fp->track) { // don't touch streamer if the stream is not assosiated with a track
                         deadbeef->streamer_reset (1);
                         continue;
@@ -865,6 +1454,10 @@ http_read (void *ptr, size_t size, size_t nmemb, DB_FILE *stream) {
                 fp->skipbytes -= skip;
             }
             deadbeef->mutex_unlock (fp->mutex);
+            if (skip > 0 && fp->paused) {
+                // the skipped data made room in the ringbuffer
+                http_loop_wake ();
+            }
             usleep (3000);
         }
     //    trace ("buffer remaining: %d\n", fp->remaining);
@@ -889,6 +1482,10 @@ http_read (void *ptr, size_t size, size_t nmemb, DB_FILE *stream) {
             ptr += cp;
         }
         deadbeef->mutex_unlock (fp->mutex);
+        if (fp->paused) {
+            // let the event loop resume the transfer
+            http_loop_wake ();
+        }
     }
     if (fp->status == STATUS_ABORTED) {
         errno = ECONNABORTED;
@@ -900,6 +1497,48 @@ http_read (void *ptr, size_t size, size_t nmemb, DB_FILE *stream) {
     return (size * nmemb - sz) / size;
 }
 
+// Seeking in cache mode only moves the read position, the download is restarted by http_cache_read if needed.
+// Returns 1 if the response turned out to be not cacheable, and the seek needs to be done in the ringbuffer,
+// in this case offset is converted to SEEK_SET.
+static int
+http_cache_seek (HTTP_FILE *fp, int64_t *offset, int *whence) {
+    if (*whence == SEEK_END) {
+        int64_t length = http_getlength ((DB_FILE *)fp);
+        if (length < 0) {
+            trace ("vfs_curl: can't seek in curl stream relative to EOF\n");
+            return -1;
+        }
+        *offset += length;
+    }
+    else if (*whence == SEEK_CUR) {
+        *offset += fp->pos + fp->skipbytes;
+    }
+    *whence = SEEK_SET;
+    if (*offset < 0) {
+        return -1;
+    }
+    if (!fp->started) {
+        // the first request will start at this position
+        fp->pos = *offset;
+        return 0;
+    }
+
+    // wait for the response, to know whether it's cached
+    while (fp->status == STATUS_INITIAL) {
+        usleep (3000);
+    }
+
+    deadbeef->mutex_lock (fp->mutex);
+    if (fp->cache_active) {
+        fp->pos = *offset;
+        fp->skipbytes = 0;
+        deadbeef->mutex_unlock (fp->mutex);
+        return 0;
+    }
+    deadbeef->mutex_unlock (fp->mutex);
+    return 1;
+}
+
 static int
 http_seek (DB_FILE *stream, int64_t offset, int whence) {
     //trace ("http_seek %lld %d\n", offset, whence);
@@ -911,10 +1550,18 @@ http_seek (DB_FILE *stream, int64_t offset, int whence) {
             fp->seektoend = 1;
             return 0;
         }
-        trace ("vfs_curl: can't seek in curl stream relative to EOF\n");
-        return -1;
+        if (!fp->cache || fp->cache_failed) {
+            trace ("vfs_curl: can't seek in curl stream relative to EOF\n");
+            return -1;
+        }
     }
-    if (!fp->tid) {
+    if (fp->cache && !fp->cache_failed) {
+        int res = http_cache_seek (fp, &offset, &whence);
+        if (res <= 0) {
+            return res;
+        }
+    }
+    if (!fp->started) {
         if (offset == 0 && (whence == SEEK_SET || whence == SEEK_CUR)) {
             return 0;
         }
@@ -953,6 +1600,7 @@ http_seek (DB_FILE *stream, int64_t offset, int whence) {
     fp->status = STATUS_SEEK;
 
     deadbeef->mutex_unlock (fp->mutex);
+    http_loop_wake ();
     return 0;
 }
 
@@ -971,12 +1619,18 @@ http_rewind (DB_FILE *stream) {
     trace ("http_rewind\n");
     assert (stream);
     HTTP_FILE *fp = (HTTP_FILE *)stream;
-    if (fp->tid) {
+    if (fp->started) {
         deadbeef->mutex_lock (fp->mutex);
-        fp->status = STATUS_SEEK;
-        http_stream_reset (fp);
+        if (!fp->cache_active) {
+            fp->status = STATUS_SEEK;
+            http_stream_reset (fp);
+        }
         fp->pos = 0;
         deadbeef->mutex_unlock (fp->mutex);
+        http_loop_wake ();
+    }
+    else if (fp->cache) {
+        fp->pos = 0;
     }
 }
 
@@ -989,7 +1643,7 @@ http_getlength (DB_FILE *stream) {
         trace ("length: -1\n");
         return -1;
     }
-    if (!fp->tid) {
+    if (!fp->started) {
         http_start_streamer (fp);
     }
     while (fp->status == STATUS_INITIAL) {
@@ -1010,7 +1664,7 @@ http_get_content_type (DB_FILE *stream) {
     if (fp->gotheader) {
         return fp->content_type;
     }
-    if (!fp->tid) {
+    if (!fp->started) {
         http_start_streamer (fp);
     }
     trace ("http_get_content_type waiting for response...\n");
@@ -1046,6 +1700,7 @@ http_abort (DB_FILE *fp) {
         }
     }
     deadbeef->mutex_unlock (biglock);
+    http_loop_wake ();
 }
 
 static int
@@ -1132,12 +1787,18 @@ static int
 vfs_curl_start (void) {
     allow_new_streams = 1;
     biglock = deadbeef->mutex_create ();
+    http_loop_mutex = deadbeef->mutex_create ();
     return 0;
 }
 
 static int
 vfs_curl_stop (void) {
     allow_new_streams = 0;
+    if (http_loop_mutex) {
+        http_loop_stop ();
+        deadbeef->mutex_free (http_loop_mutex);
+        http_loop_mutex = 0;
+    }
     if (biglock) {
         deadbeef->mutex_free (biglock);
         biglock = 0;
@@ -1158,6 +1819,8 @@ http_is_streaming (void) {
 }
 
 static const char settings_dlg[] =
+    "property \"Cache downloaded files on disk\" checkbox vfs_curl.cache 0;\n"
+    "property \"Disk cache size (MB)\" entry vfs_curl.cache_size_mb 512;\n"
     "property \"Enable logging\" checkbox vfs_curl.trace 0;\n"
 ;
 
@@ -0,0 +1,479 @@
+/*
+    CURL VFS plugin for DeaDBeeF Player
+    Copyright (C) 2009-2014 Alexey Yakovenko
+
+    This software is provided 'as-is', without any express or implied
+    warranty.  In no event will the authors be held liable for any damages
+    arising from the use of this software.
+
+    Permission is granted to anyone to use this software for any purpose,
+    including commercial applications, and to alter it and redistribute it
+    freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source distribution.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include "vfs_curl_cache.h"
+
+#define INDEX_EXT ".idx"
+#define DATA_EXT ".data"
+#define MAX_LINE 4096
+
+static char *
+str_dup_or_null (const char *s) {
+    return s && *s ? strdup (s) : NULL;
+}
+
+// FNV-1a, used to make a file name from the url
+static uint64_t
+url_hash (const char *url) {
+    uint64_t h = 14695981039346656037ULL;
+    for (const uint8_t *p = (const uint8_t *)url; *p; p++) {
+        h ^= *p;
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+static void
+cache_clear_info (vfs_curl_cache_t *cache) {
+    free (cache->etag);
+    cache->etag = NULL;
+    free (cache->last_modified);
+    cache->last_modified = NULL;
+    cache->length = -1;
+    cache->nranges = 0;
+}
+
+void
+vfs_curl_cache_add_range (vfs_curl_cache_t *cache, int64_t start, int64_t end) {
+    if (start >= end) {
+        return;
+    }
+
+    // find the first range which ends at or after start, it may be merged with the new one
+    int i = 0;
+    while (i < cache->nranges && cache->ranges[i].end < start) {
+        i++;
+    }
+
+    // merge all ranges which overlap or touch the new one
+    int j = i;
+    while (j < cache->nranges && cache->ranges[j].start <= end) {
+        if (cache->ranges[j].start < start) {
+            start = cache->ranges[j].start;
+        }
+        if (cache->ranges[j].end > end) {
+            end = cache->ranges[j].end;
+        }
+        j++;
+    }
+
+    if (i == j) {
+        // insert a new range at i
+        if (cache->nranges == cache->alloc_ranges) {
+            int alloc = cache->alloc_ranges ? cache->alloc_ranges * 2 : 16;
+            vfs_curl_range_t *ranges = realloc (cache->ranges, alloc * sizeof (vfs_curl_range_t));
+            if (!ranges) {
+                return;
+            }
+            cache->ranges = ranges;
+            cache->alloc_ranges = alloc;
+        }
+        memmove (&cache->ranges[i+1], &cache->ranges[i], (cache->nranges - i) * sizeof (vfs_curl_range_t));
+        cache->nranges++;
+    }
+    else if (j - i > 1) {
+        // ranges i..j-1 are replaced by one
+        memmove (&cache->ranges[i+1], &cache->ranges[j], (cache->nranges - j) * sizeof (vfs_curl_range_t));
+        cache->nranges -= j - i - 1;
+    }
+    cache->ranges[i].start = start;
+    cache->ranges[i].end = end;
+}
+
+static char *
+make_path (const vfs_curl_cache_t *cache, const char *ext) {
+    size_t len = strlen (cache->path) + strlen (ext) + 1;
+    char *path = malloc (len);
+    snprintf (path, len, "%s%s", cache->path, ext);
+    return path;
+}
+
+// Loads the index into cache, returns 0 if the index belongs to the same url.
+static int
+load_index (vfs_curl_cache_t *cache, const char *fname) {
+    FILE *fp = fopen (fname, "rt");
+    if (!fp) {
+        return -1;
+    }
+
+    char *line = malloc (MAX_LINE);
+    int res = 0;
+    while (fgets (line, MAX_LINE, fp)) {
+        size_t len = strlen (line);
+        while (len > 0 && (line[len-1] == '\n' || line[len-1] == '\r')) {
+            line[--len] = 0;
+        }
+        char *value = strchr (line, ' ');
+        if (!value) {
+            continue;
+        }
+        *value++ = 0;
+
+        if (!strcmp (line, "url")) {
+            if (strcmp (value, cache->url)) {
+                // hash collision
+                res = -1;
+                break;
+            }
+        }
+        else if (!strcmp (line, "etag")) {
+            free (cache->etag);
+            cache->etag = str_dup_or_null (value);
+        }
+        else if (!strcmp (line, "last-modified")) {
+            free (cache->last_modified);
+            cache->last_modified = str_dup_or_null (value);
+        }
+        else if (!strcmp (line, "length")) {
+            cache->length = strtoll (value, NULL, 10);
+        }
+        else if (!strcmp (line, "range")) {
+            long long start, end;
+            if (2 == sscanf (value, "%lld %lld", &start, &end) && start >= 0 && end <= cache->length) {
+                vfs_curl_cache_add_range (cache, start, end);
+            }
+        }
+    }
+    free (line);
+    fclose (fp);
+    return res;
+}
+
+static int
+save_index (vfs_curl_cache_t *cache) {
+    char *fname = make_path (cache, INDEX_EXT);
+    char tmp[PATH_MAX];
+    snprintf (tmp, sizeof (tmp), "%s.part", fname);
+    FILE *fp = fopen (tmp, "w+t");
+    if (!fp) {
+        free (fname);
+        return -1;
+    }
+    fprintf (fp, "url %s\n", cache->url);
+    if (cache->etag) {
+        fprintf (fp, "etag %s\n", cache->etag);
+    }
+    if (cache->last_modified) {
+        fprintf (fp, "last-modified %s\n", cache->last_modified);
+    }
+    fprintf (fp, "length %lld\n", (long long)cache->length);
+    for (int i = 0; i < cache->nranges; i++) {
+        fprintf (fp, "range %lld %lld\n", (long long)cache->ranges[i].start, (long long)cache->ranges[i].end);
+    }
+    int err = ferror (fp);
+    if (fclose (fp) || err || rename (tmp, fname)) {
+        unlink (tmp);
+        free (fname);
+        return -1;
+    }
+    free (fname);
+    return 0;
+}
+
+static int
+mkdir_recursive (const char *path) {
+    char tmp[PATH_MAX];
+    snprintf (tmp, sizeof (tmp), "%s", path);
+    for (char *p = tmp + 1; *p; p++) {
+        if (*p == '/') {
+            *p = 0;
+            if (mkdir (tmp, 0755) && errno != EEXIST) {
+                return -1;
+            }
+            *p = '/';
+        }
+    }
+    if (mkdir (tmp, 0755) && errno != EEXIST) {
+        return -1;
+    }
+    return 0;
+}
+
+// Opens the data file, and locks it for exclusive use.
+// Returns -1 if the file is locked by another handle.
+static int
+open_locked (const char *fname) {
+    for (;;) {
+        int fd = open (fname, O_RDWR | O_CREAT, 0644);
+        if (fd < 0) {
+            return -1;
+        }
+        if (flock (fd, LOCK_EX | LOCK_NB)) {
+            close (fd);
+            return -1;
+        }
+        // the file could be evicted between open and flock, then the lock is on a deleted file
+        struct stat st1, st2;
+        if (!fstat (fd, &st1) && !stat (fname, &st2) && st1.st_dev == st2.st_dev && st1.st_ino == st2.st_ino) {
+            return fd;
+        }
+        close (fd);
+    }
+}
+
+vfs_curl_cache_t *
+vfs_curl_cache_open (const char *cache_dir, const char *url) {
+    if (mkdir_recursive (cache_dir)) {
+        return NULL;
+    }
+
+    vfs_curl_cache_t *cache = calloc (1, sizeof (vfs_curl_cache_t));
+    cache->url = strdup (url);
+    cache->length = -1;
+    size_t len = strlen (cache_dir) + 18;
+    cache->path = malloc (len);
+    snprintf (cache->path, len, "%s/%016llx", cache_dir, (unsigned long long)url_hash (url));
+
+    char *data_fname = make_path (cache, DATA_EXT);
+    char *index_fname = make_path (cache, INDEX_EXT);
+
+    // the index is only loaded under the lock, so that it can't be changed by another handle
+    cache->fd = open_locked (data_fname);
+    if (cache->fd >= 0) {
+        struct stat st;
+        if (load_index (cache, index_fname) || fstat (cache->fd, &st) || st.st_size != cache->length) {
+            cache_clear_info (cache);
+        }
+    }
+    free (data_fname);
+    free (index_fname);
+
+    if (cache->fd < 0) {
+        cache_clear_info (cache);
+        free (cache->url);
+        free (cache->path);
+        free (cache);
+        return NULL;
+    }
+
+    return cache;
+}
+
+typedef struct {
+    char name[NAME_MAX+1]; // without extension
+    time_t mtime;
+    int64_t size;
+} cache_entry_t;
+
+static int
+entry_cmp (const void *a, const void *b) {
+    const cache_entry_t *e1 = a;
+    const cache_entry_t *e2 = b;
+    return e1->mtime < e2->mtime ? -1 : (e1->mtime > e2->mtime ? 1 : 0);
+}
+
+static void
+evict (const char *cache_dir, const char *keep_path, int64_t max_size) {
+    DIR *dir = opendir (cache_dir);
+    if (!dir) {
+        return;
+    }
+
+    cache_entry_t *entries = NULL;
+    int count = 0;
+    int alloc = 0;
+    int64_t total = 0;
+    struct dirent *de;
+    while ((de = readdir (dir))) {
+        size_t len = strlen (de->d_name);
+        if (len <= sizeof (INDEX_EXT)-1 || strcmp (de->d_name + len - (sizeof (INDEX_EXT)-1), INDEX_EXT)) {
+            continue;
+        }
+        if (count == alloc) {
+            alloc = alloc ? alloc * 2 : 64;
+            entries = realloc (entries, alloc * sizeof (cache_entry_t));
+        }
+        cache_entry_t *e = &entries[count];
+        memcpy (e->name, de->d_name, len - (sizeof (INDEX_EXT)-1));
+        e->name[len - (sizeof (INDEX_EXT)-1)] = 0;
+
+        char path[PATH_MAX];
+        struct stat st;
+        snprintf (path, sizeof (path), "%s/%s", cache_dir, de->d_name);
+        if (stat (path, &st)) {
+            continue;
+        }
+        e->mtime = st.st_mtime;
+        snprintf (path, sizeof (path), "%s/%s" DATA_EXT, cache_dir, e->name);
+        // the data files are sparse, count the blocks which are actually used
+        e->size = stat (path, &st) ? 0 : (int64_t)st.st_blocks * 512;
+        total += e->size;
+        count++;
+    }
+    closedir (dir);
+
+    qsort (entries, count, sizeof (cache_entry_t), entry_cmp);
+
+    const char *keep_name = strrchr (keep_path, '/');
+    keep_name = keep_name ? keep_name + 1 : keep_path;
+    for (int i = 0; i < count && total > max_size; i++) {
+        if (!strcmp (entries[i].name, keep_name)) {
+            continue;
+        }
+        char path[PATH_MAX];
+        snprintf (path, sizeof (path), "%s/%s" DATA_EXT, cache_dir, entries[i].name);
+        // the entry is in use by another handle
+        int fd = open (path, O_RDONLY);
+        if (fd >= 0 && flock (fd, LOCK_EX | LOCK_NB)) {
+            close (fd);
+            continue;
+        }
+        unlink (path);
+        snprintf (path, sizeof (path), "%s/%s" INDEX_EXT, cache_dir, entries[i].name);
+        unlink (path);
+        if (fd >= 0) {
+            close (fd);
+        }
+        total -= entries[i].size;
+    }
+    free (entries);
+}
+
+void
+vfs_curl_cache_close (vfs_curl_cache_t *cache, int64_t max_size) {
+    // the lock is held until the index is saved
+    if (cache->nranges > 0) {
+        save_index (cache);
+    }
+    else {
+        // nothing was cached, e.g. a live stream
+        char *data_fname = make_path (cache, DATA_EXT);
+        unlink (data_fname);
+        free (data_fname);
+    }
+    close (cache->fd);
+
+    char *cache_dir = strdup (cache->path);
+    char *slash = strrchr (cache_dir, '/');
+    if (slash) {
+        *slash = 0;
+        evict (cache_dir, cache->path, max_size);
+    }
+    free (cache_dir);
+
+    cache_clear_info (cache);
+    free (cache->ranges);
+    free (cache->url);
+    free (cache->path);
+    free (cache);
+}
+
+void
+vfs_curl_cache_reset (vfs_curl_cache_t *cache, int64_t length, const char *etag, const char *last_modified) {
+    cache_clear_info (cache);
+    cache->length = length;
+    cache->etag = str_dup_or_null (etag);
+    cache->last_modified = str_dup_or_null (last_modified);
+
+    // the file is extended without writing, so that it stays sparse
+    if (ftruncate (cache->fd, 0) || (length > 0 && ftruncate (cache->fd, length))) {
+        cache->length = -1;
+    }
+
+    // the old index is not valid anymore
+    char *index_fname = make_path (cache, INDEX_EXT);
+    unlink (index_fname);
+    free (index_fname);
+}
+
+int64_t
+vfs_curl_cache_avail (vfs_curl_cache_t *cache, int64_t pos) {
+    for (int i = 0; i < cache->nranges && cache->ranges[i].start <= pos; i++) {
+        if (cache->ranges[i].end > pos) {
+            return cache->ranges[i].end - pos;
+        }
+    }
+    return 0;
+}
+
+int
+vfs_curl_cache_find_gap (vfs_curl_cache_t *cache, int64_t pos, int64_t *start, int64_t *end) {
+    if (cache->length < 0 || pos >= cache->length) {
+        return -1;
+    }
+    for (int i = 0; i < cache->nranges; i++) {
+        if (cache->ranges[i].end <= pos) {
+            continue;
+        }
+        if (cache->ranges[i].start > pos) {
+            *start = pos;
+            *end = cache->ranges[i].start;
+            return 0;
+        }
+        pos = cache->ranges[i].end;
+    }
+    if (pos >= cache->length) {
+        return -1;
+    }
+    *start = pos;
+    *end = cache->length;
+    return 0;
+}
+
+int
+vfs_curl_cache_is_complete (vfs_curl_cache_t *cache) {
+    int64_t start, end;
+    return cache->length >= 0 && vfs_curl_cache_find_gap (cache, 0, &start, &end) < 0;
+}
+
+int
+vfs_curl_cache_write (vfs_curl_cache_t *cache, int64_t pos, const void *data, size_t size) {
+    if (cache->length < 0 || pos + (int64_t)size > cache->length) {
+        return -1;
+    }
+    const char *p = data;
+    size_t remaining = size;
+    while (remaining > 0) {
+        ssize_t res = pwrite (cache->fd, p, remaining, pos);
+        if (res < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        p += res;
+        pos += res;
+        remaining -= res;
+    }
+    vfs_curl_cache_add_range (cache, pos - size, pos);
+    return 0;
+}
+
+ssize_t
+vfs_curl_cache_read (vfs_curl_cache_t *cache, int64_t pos, void *data, size_t size) {
+    ssize_t res;
+    do {
+        res = pread (cache->fd, data, size, pos);
+    } while (res < 0 && errno == EINTR);
+    return res;
+}
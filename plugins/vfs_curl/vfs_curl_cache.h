@@ -0,0 +1,100 @@
+/*
+    CURL VFS plugin for DeaDBeeF Player
+    Copyright (C) 2009-2014 Alexey Yakovenko
+
+    This software is provided 'as-is', without any express or implied
+    warranty.  In no event will the authors be held liable for any damages
+    arising from the use of this software.
+
+    Permission is granted to anyone to use this software for any purpose,
+    including commercial applications, and to alter it and redistribute it
+    freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source distribution.
+*/
+
+#ifndef __VFS_CURL_CACHE_H
+#define __VFS_CURL_CACHE_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+// On-disk cache of the downloaded byte ranges of a single URL.
+// The data is stored in a sparse file, which has the same size as the remote file,
+// and the list of downloaded ranges is stored in an index file next to it,
+// together with the ETag / Last-Modified validators.
+//
+// The data file is locked while the entry is open, so each entry is used by one handle at a time,
+// also across processes.
+// The functions are not thread safe, the caller needs to serialize access to each cache object.
+
+typedef struct {
+    int64_t start;
+    int64_t end; // exclusive
+} vfs_curl_range_t;
+
+typedef struct {
+    char *url;
+    char *path; // path of the cache files, without extension
+    char *etag;
+    char *last_modified;
+    int64_t length; // -1 when unknown
+    vfs_curl_range_t *ranges; // sorted, non-overlapping and non-adjacent
+    int nranges;
+    int alloc_ranges;
+    int fd; // data file
+} vfs_curl_cache_t;
+
+// Opens the cache entry for the url in cache_dir, creating the directory if needed.
+// If there's a matching index, the cached ranges are loaded, but they need to be validated
+// against the server before use.
+// Returns NULL on failure, or if the entry is already open by another handle.
+vfs_curl_cache_t *
+vfs_curl_cache_open (const char *cache_dir, const char *url);
+
+// Saves the index, and frees the cache object.
+// Then evicts the least recently used entries from the cache_dir, until the total size fits into max_size.
+// The entries which are open by other handles are not evicted.
+void
+vfs_curl_cache_close (vfs_curl_cache_t *cache, int64_t max_size);
+
+// Drops all cached data, and sets the new validators.
+void
+vfs_curl_cache_reset (vfs_curl_cache_t *cache, int64_t length, const char *etag, const char *last_modified);
+
+// Returns the number of cached bytes starting at pos.
+int64_t
+vfs_curl_cache_avail (vfs_curl_cache_t *cache, int64_t pos);
+
+// Finds the first range, which is not cached, at or after pos.
+// Returns 0 if found, -1 if everything after pos is cached.
+int
+vfs_curl_cache_find_gap (vfs_curl_cache_t *cache, int64_t pos, int64_t *start, int64_t *end);
+
+// Returns 1 if the whole file is cached.
+int
+vfs_curl_cache_is_complete (vfs_curl_cache_t *cache);
+
+// Stores the data at pos, and marks the range as cached.
+// Returns 0 on success.
+int
+vfs_curl_cache_write (vfs_curl_cache_t *cache, int64_t pos, const void *data, size_t size);
+
+// Reads the cached data at pos.
+// The range must be cached, see vfs_curl_cache_avail.
+ssize_t
+vfs_curl_cache_read (vfs_curl_cache_t *cache, int64_t pos, void *data, size_t size);
+
+// Marks the range as cached.
+void
+vfs_curl_cache_add_range (vfs_curl_cache_t *cache, int64_t start, int64_t end);
+
+#endif
@@ -448,15 +448,15 @@ pcm_write_samples_float_to_32 (const ddb_waveformat_t * restrict inputfmt, const
             if (channelmap[c] < 0) {
                 continue;
             }
-            float fsample = (*((float*)(input + channelmap[c] * 4)));
-            if (fsample > (float)0x7fffffff/0x80000000) {
-                fsample = (float)0x7fffffff/0x80000000;
+            float fsample = (*((float*)(input + channelmap[c] * 4))) * (float)0x80000000;
+            // 0x7fffffff is not representable as float, clip to the largest float below 2^31
+            if (fsample > 2147483520.f) {
+                fsample = 2147483520.f;
             }
-            else if (fsample < -1.f) {
-                fsample = -1.f;
+            else if (fsample < -2147483648.f) {
+                fsample = -2147483648.f;
             }
-            int32_t sample = fsample * (float)0x80000000;
-            *((int32_t *)(output + 4 * c)) = sample;
+            *((int32_t *)(output + 4 * c)) = (int32_t)fsample;
         }
         input += 4 * inputfmt->channels;
         output += outputsamplesize;
@@ -525,6 +525,411 @@ remap_fn_t remappers[8][8] = {
     }
 };
 
+// Vectorized conversions for the common case where the channel layout is unchanged.
+// These operate on `count` interleaved samples, and produce the same output as the scalar remappers above.
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define PCM_SIMD_X86 1
+#include <immintrin.h>
+#elif defined(__GNUC__) && defined(__aarch64__) && defined(__ARM_NEON)
+#define PCM_SIMD_ARM 1
+#include <arm_neon.h>
+#endif
+
+typedef void (*pcm_kernel_fn_t) (const char * restrict input, char * restrict output, int count);
+
+// Converts the samples which don't fill a whole vector, using the scalar code
+static void
+_convert_tail (int inidx, int outidx, const char * restrict input, char * restrict output, int count) {
+    ddb_waveformat_t inputfmt = { .bps = inidx == 7 ? 32 : (inidx + 1) * 8, .is_float = inidx == 7, .channels = 1 };
+    ddb_waveformat_t outputfmt = { .bps = outidx == 7 ? 32 : (outidx + 1) * 8, .is_float = outidx == 7, .channels = 1 };
+    int channelmap[1] = { 0 };
+    remappers[inidx][outidx] (&inputfmt, input, &outputfmt, output, count, channelmap, outputfmt.bps >> 3);
+}
+
+static int _simd_enabled = 1;
+static int _simd_level = -1;
+
+int
+pcm_simd_level (void) {
+    if (!_simd_enabled) {
+        return PCM_SIMD_NONE;
+    }
+    // benign race: every thread computes the same value
+    if (_simd_level < 0) {
+        int level = PCM_SIMD_NONE;
+#if PCM_SIMD_X86
+        __builtin_cpu_init ();
+        if (__builtin_cpu_supports ("avx2")) {
+            level = PCM_SIMD_AVX2;
+        }
+        else if (__builtin_cpu_supports ("sse2")) {
+            level = PCM_SIMD_SSE2;
+        }
+#elif PCM_SIMD_ARM
+        level = PCM_SIMD_NEON;
+#endif
+        _simd_level = level;
+    }
+    return _simd_level;
+}
+
+void
+pcm_simd_set_enabled (int enabled) {
+    _simd_enabled = enabled;
+}
+
+#if PCM_SIMD_X86
+__attribute__((target("sse2"))) static void
+pcm_kernel_16_to_float_sse2 (const char * restrict input, char * restrict output, int count) {
+    const int16_t *in = (const int16_t *)input;
+    float *out = (float *)output;
+    const __m128 scale = _mm_set1_ps (1.f / 0x8000);
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m128i v = _mm_loadu_si128 ((const __m128i *)(in + i));
+        __m128i lo = _mm_srai_epi32 (_mm_unpacklo_epi16 (v, v), 16);
+        __m128i hi = _mm_srai_epi32 (_mm_unpackhi_epi16 (v, v), 16);
+        _mm_storeu_ps (out + i, _mm_mul_ps (_mm_cvtepi32_ps (lo), scale));
+        _mm_storeu_ps (out + i + 4, _mm_mul_ps (_mm_cvtepi32_ps (hi), scale));
+    }
+    for (; i < count; i++) {
+        out[i] = in[i] / (float)0x8000;
+    }
+}
+
+__attribute__((target("sse2"))) static void
+pcm_kernel_float_to_16_sse2 (const char * restrict input, char * restrict output, int count) {
+    const float *in = (const float *)input;
+    int16_t *out = (int16_t *)output;
+    const __m128 scale = _mm_set1_ps (0x8000);
+    const __m128 maxval = _mm_set1_ps (0x7fff);
+    const __m128 minval = _mm_set1_ps (-0x8000);
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m128 a = _mm_mul_ps (_mm_loadu_ps (in + i), scale);
+        __m128 b = _mm_mul_ps (_mm_loadu_ps (in + i + 4), scale);
+        a = _mm_max_ps (_mm_min_ps (a, maxval), minval);
+        b = _mm_max_ps (_mm_min_ps (b, maxval), minval);
+        __m128i v = _mm_packs_epi32 (_mm_cvtps_epi32 (a), _mm_cvtps_epi32 (b));
+        _mm_storeu_si128 ((__m128i *)(out + i), v);
+    }
+    if (i < count) {
+        _convert_tail (7, 1, (const char *)(in + i), (char *)(out + i), count - i);
+    }
+}
+
+__attribute__((target("sse2"))) static void
+pcm_kernel_32_to_float_sse2 (const char * restrict input, char * restrict output, int count) {
+    const int32_t *in = (const int32_t *)input;
+    float *out = (float *)output;
+    const __m128 scale = _mm_set1_ps (1.f / 0x80000000);
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128i v = _mm_loadu_si128 ((const __m128i *)(in + i));
+        _mm_storeu_ps (out + i, _mm_mul_ps (_mm_cvtepi32_ps (v), scale));
+    }
+    for (; i < count; i++) {
+        out[i] = in[i] / (float)0x80000000;
+    }
+}
+
+__attribute__((target("sse2"))) static void
+pcm_kernel_float_to_32_sse2 (const char * restrict input, char * restrict output, int count) {
+    const float *in = (const float *)input;
+    int32_t *out = (int32_t *)output;
+    const __m128 scale = _mm_set1_ps ((float)0x80000000);
+    // the largest float below 2^31, to avoid overflowing on full scale positive samples
+    const __m128 maxval = _mm_set1_ps (2147483520.f);
+    const __m128 minval = _mm_set1_ps (-2147483648.f);
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128 v = _mm_mul_ps (_mm_loadu_ps (in + i), scale);
+        v = _mm_max_ps (_mm_min_ps (v, maxval), minval);
+        _mm_storeu_si128 ((__m128i *)(out + i), _mm_cvttps_epi32 (v));
+    }
+    if (i < count) {
+        _convert_tail (7, 3, (const char *)(in + i), (char *)(out + i), count - i);
+    }
+}
+
+__attribute__((target("avx2"))) static void
+pcm_kernel_16_to_float_avx2 (const char * restrict input, char * restrict output, int count) {
+    const int16_t *in = (const int16_t *)input;
+    float *out = (float *)output;
+    const __m256 scale = _mm256_set1_ps (1.f / 0x8000);
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256i v = _mm256_cvtepi16_epi32 (_mm_loadu_si128 ((const __m128i *)(in + i)));
+        _mm256_storeu_ps (out + i, _mm256_mul_ps (_mm256_cvtepi32_ps (v), scale));
+    }
+    for (; i < count; i++) {
+        out[i] = in[i] / (float)0x8000;
+    }
+}
+
+__attribute__((target("avx2"))) static void
+pcm_kernel_float_to_16_avx2 (const char * restrict input, char * restrict output, int count) {
+    const float *in = (const float *)input;
+    int16_t *out = (int16_t *)output;
+    const __m256 scale = _mm256_set1_ps (0x8000);
+    const __m256 maxval = _mm256_set1_ps (0x7fff);
+    const __m256 minval = _mm256_set1_ps (-0x8000);
+    int i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m256 a = _mm256_mul_ps (_mm256_loadu_ps (in + i), scale);
+        __m256 b = _mm256_mul_ps (_mm256_loadu_ps (in + i + 8), scale);
+        a = _mm256_max_ps (_mm256_min_ps (a, maxval), minval);
+        b = _mm256_max_ps (_mm256_min_ps (b, maxval), minval);
+        // packs works within 128 bit lanes, restore the sample order afterwards
+        __m256i v = _mm256_packs_epi32 (_mm256_cvtps_epi32 (a), _mm256_cvtps_epi32 (b));
+        v = _mm256_permute4x64_epi64 (v, 0xd8);
+        _mm256_storeu_si256 ((__m256i *)(out + i), v);
+    }
+    if (i < count) {
+        _convert_tail (7, 1, (const char *)(in + i), (char *)(out + i), count - i);
+    }
+}
+
+__attribute__((target("avx2"))) static void
+pcm_kernel_24_to_float_avx2 (const char * restrict input, char * restrict output, int count) {
+    float *out = (float *)output;
+    // move each 3 byte sample into the upper bytes of a 32 bit int, and sign-extend by shifting back
+    const __m128i shuf = _mm_setr_epi8 (-1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11);
+    const __m256 scale = _mm256_set1_ps (1.f / 0x800000);
+    int i = 0;
+    // each 16 byte load covers 4 samples and reads 4 bytes past them
+    for (; i + 10 <= count; i += 8) {
+        __m128i a = _mm_shuffle_epi8 (_mm_loadu_si128 ((const __m128i *)(input + i * 3)), shuf);
+        __m128i b = _mm_shuffle_epi8 (_mm_loadu_si128 ((const __m128i *)(input + i * 3 + 12)), shuf);
+        __m256i v = _mm256_srai_epi32 (_mm256_setr_m128i (a, b), 8);
+        _mm256_storeu_ps (out + i, _mm256_mul_ps (_mm256_cvtepi32_ps (v), scale));
+    }
+    for (; i < count; i++) {
+        const char *in = input + i * 3;
+        int32_t sample = ((unsigned char)in[0]) | ((unsigned char)in[1]<<8) | ((signed char)in[2]<<16);
+        out[i] = sample / (float)0x800000;
+    }
+}
+
+__attribute__((target("avx2"))) static void
+pcm_kernel_float_to_24_avx2 (const char * restrict input, char * restrict output, int count) {
+    const float *in = (const float *)input;
+    const __m128i shuf = _mm_setr_epi8 (0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+    const __m256 scale = _mm256_set1_ps (0x800000);
+    const __m256 maxval = _mm256_set1_ps (0x7fffff);
+    const __m256 minval = _mm256_set1_ps (-0x800000);
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256 f = _mm256_mul_ps (_mm256_loadu_ps (in + i), scale);
+        f = _mm256_max_ps (_mm256_min_ps (f, maxval), minval);
+        __m256i v = _mm256_cvtps_epi32 (f);
+        char *out = output + i * 3;
+        __m128i a = _mm_shuffle_epi8 (_mm256_castsi256_si128 (v), shuf);
+        __m128i b = _mm_shuffle_epi8 (_mm256_extracti128_si256 (v, 1), shuf);
+        // 12 bytes from each half, without writing past the last sample
+        _mm_storel_epi64 ((__m128i *)out, a);
+        int32_t tail = _mm_cvtsi128_si32 (_mm_srli_si128 (a, 8));
+        memcpy (out + 8, &tail, 4);
+        _mm_storel_epi64 ((__m128i *)(out + 12), b);
+        tail = _mm_cvtsi128_si32 (_mm_srli_si128 (b, 8));
+        memcpy (out + 20, &tail, 4);
+    }
+    if (i < count) {
+        _convert_tail (7, 2, (const char *)(in + i), output + i * 3, count - i);
+    }
+}
+__attribute__((target("sse2"))) static int
+pcm_gain_float32_sse2 (float *s, int count, float gain) {
+    const __m128 v = _mm_set1_ps (gain);
+    const __m128 maxval = _mm_set1_ps (1.f);
+    const __m128 minval = _mm_set1_ps (-1.f);
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128 x = _mm_mul_ps (_mm_loadu_ps (s + i), v);
+        _mm_storeu_ps (s + i, _mm_max_ps (_mm_min_ps (x, maxval), minval));
+    }
+    return i;
+}
+
+__attribute__((target("avx2"))) static int
+pcm_gain_float32_avx2 (float *s, int count, float gain) {
+    const __m256 v = _mm256_set1_ps (gain);
+    const __m256 maxval = _mm256_set1_ps (1.f);
+    const __m256 minval = _mm256_set1_ps (-1.f);
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256 x = _mm256_mul_ps (_mm256_loadu_ps (s + i), v);
+        _mm256_storeu_ps (s + i, _mm256_max_ps (_mm256_min_ps (x, maxval), minval));
+    }
+    return i;
+}
+#endif
+
+#if PCM_SIMD_ARM
+static int
+pcm_gain_float32_neon (float *s, int count, float gain) {
+    const float32x4_t maxval = vdupq_n_f32 (1.f);
+    const float32x4_t minval = vdupq_n_f32 (-1.f);
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        float32x4_t x = vmulq_n_f32 (vld1q_f32 (s + i), gain);
+        vst1q_f32 (s + i, vmaxq_f32 (vminq_f32 (x, maxval), minval));
+    }
+    return i;
+}
+
+static void
+pcm_kernel_16_to_float_neon (const char * restrict input, char * restrict output, int count) {
+    const int16_t *in = (const int16_t *)input;
+    float *out = (float *)output;
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        int16x8_t v = vld1q_s16 (in + i);
+        // fixed point conversion with 15 fractional bits is the same as dividing by 0x8000
+        vst1q_f32 (out + i, vcvtq_n_f32_s32 (vmovl_s16 (vget_low_s16 (v)), 15));
+        vst1q_f32 (out + i + 4, vcvtq_n_f32_s32 (vmovl_s16 (vget_high_s16 (v)), 15));
+    }
+    for (; i < count; i++) {
+        out[i] = in[i] / (float)0x8000;
+    }
+}
+
+static void
+pcm_kernel_float_to_16_neon (const char * restrict input, char * restrict output, int count) {
+    const float *in = (const float *)input;
+    int16_t *out = (int16_t *)output;
+    const float32x4_t scale = vdupq_n_f32 (0x8000);
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        int32x4_t a = vcvtnq_s32_f32 (vmulq_f32 (vld1q_f32 (in + i), scale));
+        int32x4_t b = vcvtnq_s32_f32 (vmulq_f32 (vld1q_f32 (in + i + 4), scale));
+        vst1q_s16 (out + i, vcombine_s16 (vqmovn_s32 (a), vqmovn_s32 (b)));
+    }
+    if (i < count) {
+        _convert_tail (7, 1, (const char *)(in + i), (char *)(out + i), count - i);
+    }
+}
+
+static void
+pcm_kernel_32_to_float_neon (const char * restrict input, char * restrict output, int count) {
+    const int32_t *in = (const int32_t *)input;
+    float *out = (float *)output;
+    const float32x4_t scale = vdupq_n_f32 (1.f / 0x80000000);
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        vst1q_f32 (out + i, vmulq_f32 (vcvtq_f32_s32 (vld1q_s32 (in + i)), scale));
+    }
+    for (; i < count; i++) {
+        out[i] = in[i] / (float)0x80000000;
+    }
+}
+#endif
+
+// [inidx][outidx], same indexing as the remappers
+static pcm_kernel_fn_t
+_simd_kernel (int inidx, int outidx) {
+    int level = pcm_simd_level ();
+    if (level == PCM_SIMD_NONE) {
+        return NULL;
+    }
+    int in_bps = inidx == 7 ? 0 : (inidx + 1) * 8;
+    int out_bps = outidx == 7 ? 0 : (outidx + 1) * 8;
+#if PCM_SIMD_X86
+    if (out_bps == 0) {
+        if (in_bps == 16) {
+            return level >= PCM_SIMD_AVX2 ? pcm_kernel_16_to_float_avx2 : pcm_kernel_16_to_float_sse2;
+        }
+        if (in_bps == 24 && level >= PCM_SIMD_AVX2) {
+            return pcm_kernel_24_to_float_avx2;
+        }
+        if (in_bps == 32) {
+            return pcm_kernel_32_to_float_sse2;
+        }
+    }
+    else if (in_bps == 0) {
+        if (out_bps == 16) {
+            return level >= PCM_SIMD_AVX2 ? pcm_kernel_float_to_16_avx2 : pcm_kernel_float_to_16_sse2;
+        }
+        if (out_bps == 24 && level >= PCM_SIMD_AVX2) {
+            return pcm_kernel_float_to_24_avx2;
+        }
+        if (out_bps == 32) {
+            return pcm_kernel_float_to_32_sse2;
+        }
+    }
+#elif PCM_SIMD_ARM
+    if (out_bps == 0) {
+        if (in_bps == 16) {
+            return pcm_kernel_16_to_float_neon;
+        }
+        if (in_bps == 32) {
+            return pcm_kernel_32_to_float_neon;
+        }
+    }
+    else if (in_bps == 0 && out_bps == 16) {
+        return pcm_kernel_float_to_16_neon;
+    }
+#endif
+    return NULL;
+}
+
+void
+pcm_gain_float32 (float *samples, int count, float gain) {
+    int i = 0;
+#if PCM_SIMD_X86
+    switch (pcm_simd_level ()) {
+    case PCM_SIMD_AVX2:
+        i = pcm_gain_float32_avx2 (samples, count, gain);
+        break;
+    case PCM_SIMD_SSE2:
+        i = pcm_gain_float32_sse2 (samples, count, gain);
+        break;
+    }
+#elif PCM_SIMD_ARM
+    if (pcm_simd_level () == PCM_SIMD_NEON) {
+        i = pcm_gain_float32_neon (samples, count, gain);
+    }
+#endif
+    for (; i < count; i++) {
+        float sample = samples[i] * gain;
+        if (sample > 1.f) {
+            sample = 1.f;
+        }
+        else if (sample < -1.f) {
+            sample = -1.f;
+        }
+        samples[i] = sample;
+    }
+}
+
+// Handles conversions which keep every channel in place.
+// @returns 1 if the conversion was done
+static int
+pcm_convert_contiguous (const ddb_waveformat_t * restrict inputfmt, const char * restrict input, const ddb_waveformat_t * restrict outputfmt, char * restrict output, int nsamples, const int *channelmap, int inidx, int outidx) {
+    if (!_simd_enabled || inputfmt->channels != outputfmt->channels) {
+        return 0;
+    }
+    for (int c = 0; c < inputfmt->channels; c++) {
+        if (channelmap[c] != c) {
+            return 0;
+        }
+    }
+
+    int count = nsamples * inputfmt->channels;
+    if (inidx == outidx) {
+        memcpy (output, input, count * (inputfmt->bps >> 3));
+        return 1;
+    }
+
+    pcm_kernel_fn_t kernel = _simd_kernel (inidx, outidx);
+    if (!kernel) {
+        return 0;
+    }
+    kernel (input, output, count);
+    return 1;
+}
+
 int
 pcm_convert (const ddb_waveformat_t * restrict inputfmt, const char * restrict input, const ddb_waveformat_t * restrict outputfmt, char * restrict output, int inputsize) {
     // calculate output size
@@ -581,6 +986,10 @@ pcm_convert (const ddb_waveformat_t * restrict inputfmt, const char * restrict i
 
         int outidx = ((outputfmt->bps >> 3) - 1) | (outputfmt->is_float << 2);
         int inidx = ((inputfmt->bps >> 3) - 1) | (inputfmt->is_float << 2);
+        if (outchannels == outputfmt->channelmask
+            && pcm_convert_contiguous (inputfmt, input, outputfmt, output, nsamples, channelmap, inidx, outidx)) {
+            return nsamples * outputsamplesize;
+        }
         if (remappers[inidx][outidx]) {
             remappers[inidx][outidx] (inputfmt, input, outputfmt, output, nsamples, channelmap, outputsamplesize);
         }
@@ -591,3 +1000,66 @@ pcm_convert (const ddb_waveformat_t * restrict inputfmt, const char * restrict i
     return nsamples * outputsamplesize;
 }
 
+static int
+_fmt_index (const ddb_waveformat_t *fmt) {
+    if (fmt->is_float) {
+        return fmt->bps == 32 ? 7 : -1;
+    }
+    if (fmt->bps != 8 && fmt->bps != 16 && fmt->bps != 24 && fmt->bps != 32) {
+        return -1;
+    }
+    return (fmt->bps >> 3) - 1;
+}
+
+int
+pcm_convert_with_gain (const ddb_waveformat_t *inputfmt, const char *input, const ddb_waveformat_t *outputfmt, char *output, int inputsize, float gain) {
+    int inidx = _fmt_index (inputfmt);
+    int outidx = _fmt_index (outputfmt);
+    if (inidx < 0 || outidx < 0
+        || inputfmt->channels != outputfmt->channels
+        || inputfmt->channelmask != outputfmt->channelmask) {
+        return -1;
+    }
+
+    int insamplesize = inputfmt->bps >> 3;
+    int outsamplesize = outputfmt->bps >> 3;
+    int count = inputsize / (insamplesize * inputfmt->channels) * inputfmt->channels;
+
+    pcm_kernel_fn_t to_float = inidx == 7 ? NULL : _simd_kernel (inidx, 7);
+    pcm_kernel_fn_t from_float = outidx == 7 ? NULL : _simd_kernel (7, outidx);
+
+    // small enough to stay in L1 cache between the steps
+    float chunk[1024];
+    for (int i = 0; i < count; ) {
+        int n = count - i;
+        if (n > (int)(sizeof (chunk) / sizeof (float))) {
+            n = (int)(sizeof (chunk) / sizeof (float));
+        }
+        const char *in = input + i * insamplesize;
+        char *out = output + i * outsamplesize;
+
+        if (inidx == 7) {
+            memcpy (chunk, in, n * sizeof (float));
+        }
+        else if (to_float) {
+            to_float (in, (char *)chunk, n);
+        }
+        else {
+            _convert_tail (inidx, 7, in, (char *)chunk, n);
+        }
+
+        pcm_gain_float32 (chunk, n, gain);
+
+        if (outidx == 7) {
+            memcpy (out, chunk, n * sizeof (float));
+        }
+        else if (from_float) {
+            from_float ((const char *)chunk, out, n);
+        }
+        else {
+            _convert_tail (7, outidx, (const char *)chunk, out, n);
+        }
+        i += n;
+    }
+    return count * outsamplesize;
+}
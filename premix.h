@@ -32,4 +32,31 @@
 int
 pcm_convert (const ddb_waveformat_t * restrict inputfmt, const char * restrict input, const ddb_waveformat_t * restrict outputfmt, char * restrict output, int inputsize);
 
+// Converts the samples like pcm_convert, scaling them by `gain` and clipping in the same pass.
+// The channel layout of both formats must match.
+// `input` and `output` may point to the same buffer when both formats have the same sample size.
+// @returns number of output bytes, or -1 if the formats are not supported
+int
+pcm_convert_with_gain (const ddb_waveformat_t *inputfmt, const char *input, const ddb_waveformat_t *outputfmt, char *output, int inputsize, float gain);
+
+// Multiplies float samples by `gain`, clipping to [-1, 1]
+void
+pcm_gain_float32 (float *samples, int count, float gain);
+
+// SIMD instruction sets used for sample conversion and gain
+enum {
+    PCM_SIMD_NONE,
+    PCM_SIMD_SSE2,
+    PCM_SIMD_AVX2,
+    PCM_SIMD_NEON,
+};
+
+// @returns the best PCM_SIMD_* supported by the CPU, or PCM_SIMD_NONE if disabled
+int
+pcm_simd_level (void);
+
+// Allows to disable the vectorized code paths, e.g. to compare with the scalar code
+void
+pcm_simd_set_enabled (int enabled);
+
 #endif
@@ -31,6 +31,12 @@
 #include "replaygain.h"
 #include "conf.h"
 #include "common.h"
+#include "premix.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define RG_SIMD_X86 1
+#include <immintrin.h>
+#endif
 
 static ddb_replaygain_settings_t current_settings;
 
@@ -177,6 +183,63 @@ get_int_volume (ddb_replaygain_settings_t *settings) {
     return vol == 1000 ? -1 : vol;
 }
 
+#if RG_SIMD_X86
+// The product is exact in double precision, so the truncated quotient matches the integer division
+__attribute__((target("sse2"))) static int
+apply_gain_int16_sse2 (int16_t *s, int count, int vol) {
+    const __m128d v = _mm_set1_pd (vol);
+    const __m128d d = _mm_set1_pd (1000);
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m128i in = _mm_loadu_si128 ((const __m128i *)(s + i));
+        __m128i lo = _mm_srai_epi32 (_mm_unpacklo_epi16 (in, in), 16);
+        __m128i hi = _mm_srai_epi32 (_mm_unpackhi_epi16 (in, in), 16);
+        __m128i r[4];
+        __m128i src[4] = { lo, _mm_srli_si128 (lo, 8), hi, _mm_srli_si128 (hi, 8) };
+        for (int k = 0; k < 4; k++) {
+            __m128d x = _mm_div_pd (_mm_mul_pd (_mm_cvtepi32_pd (src[k]), v), d);
+            r[k] = _mm_cvttpd_epi32 (x);
+        }
+        lo = _mm_unpacklo_epi64 (r[0], r[1]);
+        hi = _mm_unpacklo_epi64 (r[2], r[3]);
+        // packs clips to the int16 range
+        _mm_storeu_si128 ((__m128i *)(s + i), _mm_packs_epi32 (lo, hi));
+    }
+    return i;
+}
+
+__attribute__((target("avx2"))) static int
+apply_gain_int16_avx2 (int16_t *s, int count, int vol) {
+    const __m256d v = _mm256_set1_pd (vol);
+    const __m256d d = _mm256_set1_pd (1000);
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256i in = _mm256_cvtepi16_epi32 (_mm_loadu_si128 ((const __m128i *)(s + i)));
+        __m256d a = _mm256_div_pd (_mm256_mul_pd (_mm256_cvtepi32_pd (_mm256_castsi256_si128 (in)), v), d);
+        __m256d b = _mm256_div_pd (_mm256_mul_pd (_mm256_cvtepi32_pd (_mm256_extracti128_si256 (in, 1)), v), d);
+        __m128i out = _mm_packs_epi32 (_mm256_cvttpd_epi32 (a), _mm256_cvttpd_epi32 (b));
+        _mm_storeu_si128 ((__m128i *)(s + i), out);
+    }
+    return i;
+}
+
+#endif
+
+// Vectorized gain, when supported by the CPU.
+// @returns the number of samples processed, the rest must be done by the scalar code
+static int
+apply_gain_int16_simd (int16_t *s, int count, int vol) {
+#if RG_SIMD_X86
+    switch (pcm_simd_level ()) {
+    case PCM_SIMD_AVX2:
+        return apply_gain_int16_avx2 (s, count, vol);
+    case PCM_SIMD_SSE2:
+        return apply_gain_int16_sse2 (s, count, vol);
+    }
+#endif
+    return 0;
+}
+
 void
 apply_replay_gain_int8 (ddb_replaygain_settings_t *settings, char *bytes, int size) {
     int vol = get_int_volume (settings);
@@ -204,7 +267,9 @@ apply_replay_gain_int16 (ddb_replaygain_settings_t *settings, char *bytes, int s
         return;
     }
     int16_t *s = (int16_t*)bytes;
-    for (int j = 0; j < size/2; j++) {
+    int j = apply_gain_int16_simd (s, size/2, vol);
+    s += j;
+    for (; j < size/2; j++) {
         int32_t sample = ((int32_t)(*s)) * vol / 1000;
         if (sample > 0x7fff) {
             sample = 0x7fff;
@@ -254,8 +319,12 @@ apply_replay_gain_int32 (ddb_replaygain_settings_t *settings, char *bytes, int s
     }
 }
 
-void
-apply_replay_gain_float32 (ddb_replaygain_settings_t *settings, char *bytes, int size) {
+float
+replaygain_get_scale (ddb_replaygain_settings_t *settings) {
+    if (settings->processing_flags == 0) {
+        return 1.f;
+    }
+
     float vol = 1.f;
     int mode = _get_source_mode (settings->source_mode);
     switch (mode) {
@@ -286,21 +355,14 @@ apply_replay_gain_float32 (ddb_replaygain_settings_t *settings, char *bytes, int
     default:
         break;
     }
+    return vol;
+}
 
+void
+apply_replay_gain_float32 (ddb_replaygain_settings_t *settings, char *bytes, int size) {
+    float vol = replaygain_get_scale (settings);
     if (vol == 1) {
         return;
     }
-
-    float *s = (float*)bytes;
-    for (int j = 0; j < size/4; j++) {
-        float sample = ((float)*s) * vol;
-        if (sample > 1.f) {
-            sample = 1.f;
-        }
-        else if (sample < -1.f) {
-            sample = -1.f;
-        }
-        *s = sample;
-        s++;
-    }
+    pcm_gain_float32 ((float *)bytes, size/4, vol);
 }
@@ -41,6 +41,10 @@ replaygain_apply_with_settings (ddb_replaygain_settings_t *settings, ddb_wavefor
 void
 replaygain_set_current (ddb_replaygain_settings_t *settings);
 
+// @returns the gain factor for the settings, or 1 if replaygain is disabled
+float
+replaygain_get_scale (ddb_replaygain_settings_t *settings);
+
 void
 apply_replay_gain_int8 (ddb_replaygain_settings_t *settings, char *bytes, int size);
 
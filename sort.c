@@ -25,11 +25,14 @@
 #include <ctype.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
 #include "utf8.h"
 #include "sort.h"
 #include "tf.h"
 #include "pltmeta.h"
 #include "messagepump.h"
+#include "threading.h"
 
 //#define trace(...) { fprintf(stderr, __VA_ARGS__); }
 #define trace(fmt,...)
@@ -57,85 +60,271 @@ static const char *pl_sort_format;
 static char *pl_sort_tf_bytecode;
 static ddb_tf_context_t pl_sort_tf_ctx;
 
-static int
-strcasecmp_numeric (const char *a, const char *b) {
-    if (isdigit (*a) && isdigit (*b)) {
-        int anum = *a-'0';
-        const char *ae = a+1;
-        while (*ae && isdigit (*ae)) {
-            anum *= 10;
-            anum += *ae-'0';
-            ae++;
-        }
-        int bnum = *b-'0';
-        const char *be = b+1;
-        while (*be && isdigit (*be)) {
-            bnum *= 10;
-            bnum += *be-'0';
-            be++;
-        }
-        if (anum == bnum) {
-            return u8_strcasecmp (ae, be);
+// Sort keys are computed once per track before sorting, instead of formatting
+// both tracks on every comparison.
+// The text is case folded with u8_tolower, so that strcmp orders it the same
+// way as u8_strcasecmp; a leading number is parsed separately, to keep the
+// numeric ordering of strcasecmp_numeric.
+typedef struct {
+    playItem_t *it;
+    int64_t num; // leading number of the text, or the duration / track number
+    int text; // offset of the folded text in the key pool, -1 if none
+    int rest; // offset of the text following the leading number
+    int has_num;
+    int idx; // original position, makes the sort stable
+} pl_sort_key_t;
+
+typedef struct {
+    char *pool;
+    size_t size;
+    size_t alloc;
+} pl_sort_key_pool_t;
+
+// sorting is split across threads above this number of tracks
+#define SORT_PARALLEL_MIN_COUNT 16384
+#define SORT_MAX_THREADS 8
+
+static void
+pl_sort_key_append (pl_sort_key_pool_t *pool, const char *s, int len) {
+    if (pool->size + len + 1 > pool->alloc) {
+        size_t alloc = pool->alloc ? pool->alloc : 65536;
+        while (pool->size + len + 1 > alloc) {
+            alloc *= 2;
         }
-        return anum - bnum;
+        pool->pool = realloc (pool->pool, alloc);
+        pool->alloc = alloc;
     }
-    return u8_strcasecmp (a,b);
+    memcpy (pool->pool + pool->size, s, len);
+    pool->size += len;
+    pool->pool[pool->size] = 0;
 }
 
-static int
-pl_sort_compare_str (playItem_t *a, playItem_t *b) {
+static void
+pl_sort_key_set_text (pl_sort_key_t *key, pl_sort_key_pool_t *pool, const char *text) {
+    key->has_num = 0;
+    key->num = 0;
+    if (isdigit (*text)) {
+        key->has_num = 1;
+        const char *p = text;
+        while (*p && isdigit (*p)) {
+            if (key->num < INT64_MAX / 10 - 10) {
+                key->num = key->num * 10 + (*p - '0');
+            }
+            p++;
+        }
+        key->rest = (int)(p - text);
+    }
+
+    key->text = (int)pool->size;
+    const char *p = text;
+    while (*p) {
+        int32_t i = 0;
+        char lower[10];
+        u8_nextchar (p, &i);
+        int l = u8_tolower ((const signed char *)p, i, lower);
+        pl_sort_key_append (pool, lower, l);
+        p += i;
+    }
+    // the digits are folded to themselves, so the rest offset stays valid
+    pl_sort_key_append (pool, "", 0);
+    pool->size++;
+}
+
+static void
+pl_sort_make_key (pl_sort_key_t *key, pl_sort_key_pool_t *pool, playItem_t *it, int idx) {
+    key->it = it;
+    key->idx = idx;
+    key->text = -1;
+    key->rest = 0;
     if (pl_sort_is_duration) {
-        float dur_a = a->_duration * 100000;
-        float dur_b = b->_duration * 100000;
-        return !pl_sort_ascending ? dur_b - dur_a : dur_a - dur_b;
+        key->has_num = 1;
+        key->num = (int64_t)(it->_duration * 100000);
     }
     else if (pl_sort_is_track) {
-        int t1;
-        int t2;
-        const char *t;
-        t = pl_find_meta_raw (a, "track");
-        if (t && !isdigit (*t)) {
-            t1 = 999999;
-        }
-        else {
-            t1 = t ? atoi (t) : -1;
-        }
-        t = pl_find_meta_raw (b, "track");
+        key->has_num = 1;
+        const char *t = pl_find_meta_raw (it, "track");
         if (t && !isdigit (*t)) {
-            t2 = 999999;
+            key->num = 999999;
         }
         else {
-            t2 = t ? atoi (t) : -1;
+            key->num = t ? atoi (t) : -1;
         }
-        return !pl_sort_ascending ? t2 - t1 : t1 - t2;
     }
     else {
-        char tmp1[1024];
-        char tmp2[1024];
+        char tmp[1024];
         if (pl_sort_version == 0) {
-            pl_format_title (a, -1, tmp1, sizeof (tmp1), pl_sort_id, pl_sort_format);
-            pl_format_title (b, -1, tmp2, sizeof (tmp2), pl_sort_id, pl_sort_format);
+            pl_format_title (it, -1, tmp, sizeof (tmp), pl_sort_id, pl_sort_format);
         }
         else {
             pl_sort_tf_ctx.id = pl_sort_id;
-            pl_sort_tf_ctx.it = (ddb_playItem_t *)a;
-            tf_eval(&pl_sort_tf_ctx, pl_sort_tf_bytecode, tmp1, sizeof(tmp1));
-            pl_sort_tf_ctx.it = (ddb_playItem_t *)b;
-            tf_eval(&pl_sort_tf_ctx, pl_sort_tf_bytecode, tmp2, sizeof(tmp2));
+            pl_sort_tf_ctx.it = (ddb_playItem_t *)it;
+            if (tf_eval (&pl_sort_tf_ctx, pl_sort_tf_bytecode, tmp, sizeof (tmp)) < 0) {
+                *tmp = 0;
+            }
         }
-        int res = strcasecmp_numeric (tmp1, tmp2);
-        if (!pl_sort_ascending) {
-            res = -res;
+        pl_sort_key_set_text (key, pool, tmp);
+    }
+}
+
+static const char *pl_sort_key_pool;
+
+static int
+pl_sort_key_compare (const pl_sort_key_t *a, const pl_sort_key_t *b) {
+    int res;
+    if (a->has_num && b->has_num) {
+        res = a->num < b->num ? -1 : (a->num > b->num ? 1 : 0);
+        if (!res && a->text >= 0) {
+            res = strcmp (pl_sort_key_pool + a->text + a->rest, pl_sort_key_pool + b->text + b->rest);
         }
-        return res;
     }
+    else {
+        res = strcmp (pl_sort_key_pool + a->text, pl_sort_key_pool + b->text);
+    }
+    if (!pl_sort_ascending) {
+        res = -res;
+    }
+    if (!res) {
+        res = a->idx - b->idx;
+    }
+    return res;
 }
 
 static int
 qsort_cmp_func (const void *a, const void *b) {
-    playItem_t *aa = *((playItem_t **)a);
-    playItem_t *bb = *((playItem_t **)b);
-    return pl_sort_compare_str (aa, bb);
+    return pl_sort_key_compare (a, b);
+}
+
+typedef struct {
+    pl_sort_key_t *keys;
+    pl_sort_key_t *tmp;
+    int start;
+    int middle;
+    int end;
+} pl_sort_job_t;
+
+static void
+pl_sort_job_sort (void *ctx) {
+    pl_sort_job_t *job = ctx;
+    qsort (job->keys + job->start, job->end - job->start, sizeof (pl_sort_key_t), qsort_cmp_func);
+}
+
+static void
+pl_sort_job_merge (void *ctx) {
+    pl_sort_job_t *job = ctx;
+    int a = job->start;
+    int b = job->middle;
+    int o = job->start;
+    while (a < job->middle && b < job->end) {
+        if (pl_sort_key_compare (&job->keys[a], &job->keys[b]) <= 0) {
+            job->tmp[o++] = job->keys[a++];
+        }
+        else {
+            job->tmp[o++] = job->keys[b++];
+        }
+    }
+    while (a < job->middle) {
+        job->tmp[o++] = job->keys[a++];
+    }
+    while (b < job->end) {
+        job->tmp[o++] = job->keys[b++];
+    }
+    memcpy (job->keys + job->start, job->tmp + job->start, (job->end - job->start) * sizeof (pl_sort_key_t));
+}
+
+static int
+pl_sort_thread_count (int count) {
+    if (count < SORT_PARALLEL_MIN_COUNT) {
+        return 1;
+    }
+    long ncpu = sysconf (_SC_NPROCESSORS_ONLN);
+    if (ncpu < 1) {
+        return 1;
+    }
+    return ncpu > SORT_MAX_THREADS ? SORT_MAX_THREADS : (int)ncpu;
+}
+
+// runs the jobs on separate threads, the last one on the calling thread
+static void
+pl_sort_run_jobs (void (*fn)(void *ctx), pl_sort_job_t *jobs, int njobs) {
+    intptr_t tids[SORT_MAX_THREADS];
+    for (int i = 0; i < njobs - 1; i++) {
+        tids[i] = thread_start (fn, &jobs[i]);
+        if (!tids[i]) {
+            fn (&jobs[i]);
+        }
+    }
+    fn (&jobs[njobs-1]);
+    for (int i = 0; i < njobs - 1; i++) {
+        if (tids[i]) {
+            thread_join (tids[i]);
+        }
+    }
+}
+
+// sorts the keys with a merge sort, which runs on multiple cores for large arrays
+static void
+pl_sort_keys (pl_sort_key_t *keys, int count, const char *pool) {
+    pl_sort_key_pool = pool;
+
+    int nthreads = pl_sort_thread_count (count);
+    if (nthreads == 1) {
+        qsort (keys, count, sizeof (pl_sort_key_t), qsort_cmp_func);
+        pl_sort_key_pool = NULL;
+        return;
+    }
+
+    pl_sort_key_t *tmp = malloc (count * sizeof (pl_sort_key_t));
+    int bounds[SORT_MAX_THREADS+1];
+    for (int i = 0; i <= nthreads; i++) {
+        bounds[i] = (int)((int64_t)count * i / nthreads);
+    }
+
+    pl_sort_job_t jobs[SORT_MAX_THREADS];
+    for (int i = 0; i < nthreads; i++) {
+        jobs[i].keys = keys;
+        jobs[i].tmp = tmp;
+        jobs[i].start = bounds[i];
+        jobs[i].end = bounds[i+1];
+    }
+    pl_sort_run_jobs (pl_sort_job_sort, jobs, nthreads);
+
+    // merge the sorted runs pairwise, until one remains
+    for (int width = 1; width < nthreads; width *= 2) {
+        int njobs = 0;
+        for (int i = 0; i + width < nthreads; i += width * 2) {
+            int last = i + width * 2 < nthreads ? i + width * 2 : nthreads;
+            jobs[njobs].keys = keys;
+            jobs[njobs].tmp = tmp;
+            jobs[njobs].start = bounds[i];
+            jobs[njobs].middle = bounds[i+width];
+            jobs[njobs].end = bounds[last];
+            njobs++;
+        }
+        pl_sort_run_jobs (pl_sort_job_merge, jobs, njobs);
+    }
+
+    free (tmp);
+    pl_sort_key_pool = NULL;
+}
+
+// sorts the tracks in place, using the current pl_sort_* settings
+static void
+pl_sort_tracks (playItem_t **tracks, int count) {
+    pl_sort_key_t *keys = malloc (count * sizeof (pl_sort_key_t));
+    pl_sort_key_pool_t pool = {0};
+
+    for (int i = 0; i < count; i++) {
+        pl_sort_make_key (&keys[i], &pool, tracks[i], i);
+    }
+
+    pl_sort_keys (keys, count, pool.pool);
+
+    for (int i = 0; i < count; i++) {
+        tracks[i] = keys[i].it;
+    }
+
+    free (pool.pool);
+    free (keys);
 }
 
 void
@@ -184,6 +373,7 @@ plt_sort_random (playlist_t *playlist, int iter) {
         prev = it;
     }
     playlist->tail[iter] = array[playlist->count[iter]-1];
+    plt_index_invalidate (playlist, iter);
 
     free (array);
 
@@ -260,11 +450,7 @@ plt_sort_internal (playlist_t *playlist, int iter, int id, const char *format, i
         array[idx] = it;
     }
 
-#if HAVE_MERGESORT
-    mergesort (array, playlist->count[iter], sizeof (playItem_t *), qsort_cmp_func);
-#else
-    qsort (array, playlist->count[iter], sizeof (playItem_t *), qsort_cmp_func);
-#endif
+    pl_sort_tracks (array, playlist->count[iter]);
     playItem_t *prev = NULL;
     playlist->head[iter] = 0;
     for (idx = 0; idx < playlist->count[iter]; idx++) {
@@ -281,6 +467,7 @@ plt_sort_internal (playlist_t *playlist, int iter, int id, const char *format, i
     }
 
     playlist->tail[iter] = array[playlist->count[iter]-1];
+    plt_index_invalidate (playlist, iter);
 
     free (array);
 
@@ -350,11 +537,7 @@ sort_track_array (playlist_t *playlist, playItem_t **tracks, int num_tracks, con
         pl_sort_is_track = 0;
     }
 
-#if HAVE_MERGESORT
-    mergesort (tracks, num_tracks, sizeof (playItem_t *), qsort_cmp_func);
-#else
-    qsort (tracks, num_tracks, sizeof (playItem_t *), qsort_cmp_func);
-#endif
+    pl_sort_tracks (tracks, num_tracks);
 
     tf_free (pl_sort_tf_bytecode);
     pl_sort_tf_bytecode = NULL;
@@ -115,6 +115,23 @@ static DB_FILE *fileinfo_file;
 static DB_fileinfo_t *new_fileinfo;
 static DB_FILE *new_fileinfo_file;
 
+// Next track preloading:
+// when the streaming track is about to end, the preload thread opens and initializes
+// the decoder of the track which is expected to play next,
+// so that stream_track doesn't stall on opening the file at the track boundary.
+static int conf_streamer_preload_seconds = 5;
+static intptr_t preload_tid;
+static uintptr_t preload_mutex;
+static uintptr_t preload_cond;
+static int preload_terminate;
+static playItem_t *preload_track; // requested track
+static DB_fileinfo_t *preload_fileinfo; // initialized decoder for preload_track
+static DB_FILE *preload_file; // file being opened by the preload thread
+static int preload_pending; // preload_track is waiting to be opened
+static int preload_busy; // preload thread is opening a track
+static unsigned preload_generation; // incremented to reject the result of an in-flight open
+static int preload_dirty = 1; // the next track needs to be re-evaluated, set on playlist, order and playqueue changes
+
 // This counter is incremented by one for each streamer_read call, which returns -1,
 // which means audio should stop, but we need to wait a bit until buffered data has finished playing,
 // so we wait AUDIO_STALL_WAIT periods
@@ -128,11 +145,6 @@ static DB_FILE *streamer_file;
 #include "equalizer.h"
 #endif
 
-static float freq_data[DDB_FREQ_BANDS * DDB_FREQ_MAX_CHANNELS];
-static float audio_data[DDB_FREQ_BANDS * 2 * DDB_FREQ_MAX_CHANNELS];
-static int audio_data_fill = 0;
-static int audio_data_channels = 0;
-
 // message queue
 static struct handler_s *handler;
 
@@ -146,6 +158,216 @@ typedef struct wavedata_listener_s {
 static wavedata_listener_t *waveform_listeners;
 static wavedata_listener_t *spectrum_listeners;
 
+#ifndef ANDROID
+// Audio tap for the visualization listeners.
+// streamer_read only copies the output data into the tap, which is a single-producer single-consumer ring buffer.
+// The vis thread converts the data, runs the FFT and calls the listeners,
+// so that a slow visualization can't cause output underruns.
+#define VIS_TAP_SIZE (1024*1024) // must be a power of 2
+// if the vis thread falls behind by more than this, the oldest data is skipped
+#define VIS_TAP_MAX_LATENCY_MS 200
+
+typedef struct {
+    ddb_waveformat_t fmt;
+    int size;
+} vis_tap_chunk_t;
+
+static char vis_tap[VIS_TAP_SIZE];
+static size_t vis_tap_write_pos; // total bytes written, only updated by streamer_read
+static size_t vis_tap_read_pos; // total bytes read, only updated by the vis thread
+static size_t vis_tap_flush_pos; // the data before this position is discarded by the vis thread
+static intptr_t vis_tid;
+static int vis_terminate;
+static int vis_waiting; // the vis thread is waiting for data
+static uintptr_t vis_mutex;
+static uintptr_t vis_cond;
+
+// only accessed by the vis thread
+static float freq_data[DDB_FREQ_BANDS * DDB_FREQ_MAX_CHANNELS];
+static float audio_data[DDB_FREQ_BANDS * 2 * DDB_FREQ_MAX_CHANNELS];
+static int audio_data_fill = 0;
+static int audio_data_channels = 0;
+
+static void
+vis_tap_copy_in (size_t pos, const void *data, size_t size) {
+    size_t offs = pos % VIS_TAP_SIZE;
+    size_t n = min (size, VIS_TAP_SIZE - offs);
+    memcpy (vis_tap + offs, data, n);
+    memcpy (vis_tap, (const char *)data + n, size - n);
+}
+
+static void
+vis_tap_copy_out (size_t pos, void *data, size_t size) {
+    size_t offs = pos % VIS_TAP_SIZE;
+    size_t n = min (size, VIS_TAP_SIZE - offs);
+    memcpy (data, vis_tap + offs, n);
+    memcpy ((char *)data + n, vis_tap, size - n);
+}
+
+// Never blocks: if the tap is full, the chunk is dropped.
+// The vis thread keeps the tap from filling up, by skipping the data older than VIS_TAP_MAX_LATENCY_MS.
+static void
+vis_tap_write (const ddb_waveformat_t *fmt, const char *bytes, int size) {
+    size_t wpos = vis_tap_write_pos;
+    size_t rpos = __atomic_load_n (&vis_tap_read_pos, __ATOMIC_ACQUIRE);
+    size_t chunk_size = sizeof (vis_tap_chunk_t) + size;
+    if (chunk_size > VIS_TAP_SIZE - (wpos - rpos)) {
+        return;
+    }
+
+    vis_tap_chunk_t chunk;
+    memset (&chunk, 0, sizeof (chunk));
+    chunk.fmt = *fmt;
+    chunk.size = size;
+    vis_tap_copy_in (wpos, &chunk, sizeof (chunk));
+    vis_tap_copy_in (wpos + sizeof (chunk), bytes, size);
+    __atomic_store_n (&vis_tap_write_pos, wpos + chunk_size, __ATOMIC_SEQ_CST);
+
+    // only take the lock if the vis thread may be waiting, see vis_thread
+    if (__atomic_load_n (&vis_waiting, __ATOMIC_SEQ_CST)) {
+        mutex_lock (vis_mutex);
+        cond_signal (vis_cond);
+        mutex_unlock (vis_mutex);
+    }
+}
+
+// Discards the data which wasn't processed yet, e.g. after seeking or stopping.
+static void
+vis_tap_flush (void) {
+    __atomic_store_n (&vis_tap_flush_pos, __atomic_load_n (&vis_tap_write_pos, __ATOMIC_ACQUIRE), __ATOMIC_RELEASE);
+}
+
+static size_t
+vis_tap_max_latency_bytes (const ddb_waveformat_t *fmt) {
+    size_t bytes_per_sec = (size_t)(fmt->bps >> 3) * fmt->channels * fmt->samplerate;
+    return bytes_per_sec * VIS_TAP_MAX_LATENCY_MS / 1000;
+}
+
+static void
+vis_process (fft_t *fft, const ddb_waveformat_t *fmt, const char *bytes, int size, float *temp_audio_data) {
+    int in_frame_size = (fmt->bps >> 3) * fmt->channels;
+    int in_frames = size / in_frame_size;
+    ddb_waveformat_t out_fmt = {
+        .bps = 32,
+        .channels = fmt->channels,
+        .samplerate = fmt->samplerate,
+        .channelmask = fmt->channelmask,
+        .is_float = 1,
+        .is_bigendian = 0
+    };
+
+    pcm_convert (fmt, bytes, &out_fmt, (char *)temp_audio_data, size);
+    ddb_audio_data_t data;
+    data.fmt = &out_fmt;
+    data.data = temp_audio_data;
+    data.nframes = in_frames;
+    mutex_lock (wdl_mutex);
+    for (wavedata_listener_t *l = waveform_listeners; l; l = l->next) {
+        l->callback (l->ctx, &data);
+    }
+    mutex_unlock (wdl_mutex);
+
+    if (out_fmt.channels != audio_data_channels || !spectrum_listeners) {
+        audio_data_fill = 0;
+        audio_data_channels = out_fmt.channels;
+    }
+
+    if (spectrum_listeners && audio_data_channels <= DDB_FREQ_MAX_CHANNELS) {
+        int remaining = in_frames;
+        do {
+            int sz = DDB_FREQ_BANDS * 2 -audio_data_fill;
+            sz = min (sz, remaining);
+            for (int c = 0; c < audio_data_channels; c++) {
+                for (int s = 0; s < sz; s++) {
+                    audio_data[DDB_FREQ_BANDS * 2 * c + audio_data_fill + s] = temp_audio_data[(in_frames-remaining + s) * audio_data_channels + c];
+                }
+            }
+            audio_data_fill += sz;
+            remaining -= sz;
+            if (audio_data_fill == DDB_FREQ_BANDS * 2) {
+                for (int c = 0; c < audio_data_channels; c++) {
+                    fft_calc_freq (fft, &audio_data[DDB_FREQ_BANDS * 2 * c], &freq_data[DDB_FREQ_BANDS * c]);
+                }
+                ddb_audio_data_t data;
+                data.fmt = &out_fmt;
+                data.data = freq_data;
+                data.nframes = DDB_FREQ_BANDS;
+                mutex_lock (wdl_mutex);
+                for (wavedata_listener_t *l = spectrum_listeners; l; l = l->next) {
+                    l->callback (l->ctx, &data);
+                }
+                mutex_unlock (wdl_mutex);
+                audio_data_fill = 0;
+            }
+        } while (remaining > 0);
+    }
+}
+
+static void
+vis_thread (void *unused) {
+#if defined(__linux__)
+    prctl (PR_SET_NAME, "deadbeef-vis", 0, 0, 0, 0);
+#endif
+    // the spectrum listeners always get DDB_FREQ_BANDS bands
+    fft_t *fft = fft_alloc (DDB_FREQ_BANDS * 2);
+    char *bytes = NULL;
+    float *temp_audio_data = NULL;
+    int alloc_size = 0;
+
+    for (;;) {
+        size_t rpos = vis_tap_read_pos;
+        size_t wpos = __atomic_load_n (&vis_tap_write_pos, __ATOMIC_SEQ_CST);
+        if (rpos == wpos) {
+            // the writer checks vis_waiting after publishing the data, so no signal can be missed
+            mutex_lock (vis_mutex);
+            __atomic_store_n (&vis_waiting, 1, __ATOMIC_SEQ_CST);
+            while (!vis_terminate && rpos == __atomic_load_n (&vis_tap_write_pos, __ATOMIC_SEQ_CST)) {
+                cond_wait_locked (vis_cond, vis_mutex);
+            }
+            __atomic_store_n (&vis_waiting, 0, __ATOMIC_SEQ_CST);
+            mutex_unlock (vis_mutex);
+            if (vis_terminate) {
+                break;
+            }
+            continue;
+        }
+
+        size_t fpos = __atomic_load_n (&vis_tap_flush_pos, __ATOMIC_ACQUIRE);
+        if ((ssize_t)(fpos - rpos) > 0) {
+            __atomic_store_n (&vis_tap_read_pos, fpos, __ATOMIC_RELEASE);
+            audio_data_fill = 0;
+            continue;
+        }
+
+        vis_tap_chunk_t chunk;
+        vis_tap_copy_out (rpos, &chunk, sizeof (chunk));
+        size_t chunk_end = rpos + sizeof (chunk) + chunk.size;
+        if (wpos - chunk_end > vis_tap_max_latency_bytes (&chunk.fmt)) {
+            // too far behind, skip to the recent data
+            __atomic_store_n (&vis_tap_read_pos, chunk_end, __ATOMIC_RELEASE);
+            audio_data_fill = 0;
+            continue;
+        }
+        if (chunk.size > alloc_size) {
+            alloc_size = chunk.size;
+            free (bytes);
+            free (temp_audio_data);
+            bytes = malloc (alloc_size);
+            // enough for the smallest input sample size
+            temp_audio_data = malloc (alloc_size * 4);
+        }
+        vis_tap_copy_out (rpos + sizeof (chunk), bytes, chunk.size);
+        __atomic_store_n (&vis_tap_read_pos, chunk_end, __ATOMIC_RELEASE);
+
+        vis_process (fft, &chunk.fmt, bytes, chunk.size, temp_audio_data);
+    }
+
+    free (bytes);
+    free (temp_audio_data);
+    fft_free (fft);
+}
+#endif
+
 #if DETECT_PL_LOCK_RC
 volatile pthread_t streamer_lock_tid = 0;
 #endif
@@ -208,6 +430,17 @@ streamer_abort_files (void) {
         deadbeef->fabort (strfile);
     }
 
+    if (preload_mutex) {
+        mutex_lock (preload_mutex);
+        if (preload_busy) {
+            preload_generation++;
+            if (preload_file) {
+                deadbeef->fabort (preload_file);
+            }
+            cond_broadcast (preload_cond);
+        }
+        mutex_unlock (preload_mutex);
+    }
 }
 
 static void
@@ -298,10 +531,12 @@ streamer_start_playback (playItem_t *from, playItem_t *it) {
 
 playItem_t *
 streamer_get_streaming_track (void) {
-    if (streaming_track) {
-        pl_item_ref (streaming_track);
+    // read once, the streamer thread can change it meanwhile
+    playItem_t *it = streaming_track;
+    if (it) {
+        pl_item_ref (it);
     }
-    return streaming_track;
+    return it;
 }
 
 playItem_t *
@@ -330,16 +565,7 @@ str_get_idx_of (playItem_t *it) {
         streamer_set_streamer_playlist (plt);
         plt_unref (plt);
     }
-    playItem_t *c = streamer_playlist->head[PL_MAIN];
-    int idx = 0;
-    while (c && c != it) {
-        c = c->next[PL_MAIN];
-        idx++;
-    }
-    if (!c) {
-        pl_unlock ();
-        return -1;
-    }
+    int idx = plt_get_item_idx (streamer_playlist, it, PL_MAIN);
     pl_unlock ();
     return idx;
 }
@@ -352,17 +578,7 @@ str_get_for_idx (int idx) {
         streamer_set_streamer_playlist (plt);
         plt_unref (plt);
     }
-    playItem_t *it = streamer_playlist->head[PL_MAIN];
-    while (idx--) {
-        if (!it) {
-            pl_unlock ();
-            return NULL;
-        }
-        it = it->next[PL_MAIN];
-    }
-    if (it) {
-        pl_item_ref (it);
-    }
+    playItem_t *it = plt_get_item_for_idx (streamer_playlist, idx, PL_MAIN);
     pl_unlock ();
     return it;
 }
@@ -451,10 +667,16 @@ get_random_track (void) {
     return plt_get_item_for_idx (plt, r, PL_MAIN);
 }
 
+// When peek is set, returns NULL instead of doing anything which changes the state,
+// such as reshuffling, or picking a random track.
 static playItem_t *
-get_next_track (playItem_t *curr) {
+_get_next_track (playItem_t *curr, int peek) {
     pl_lock ();
     if (!streamer_playlist) {
+        if (peek) {
+            pl_unlock ();
+            return NULL;
+        }
         playlist_t *plt = plt_get_curr ();
         streamer_set_streamer_playlist (plt);
         plt_unref (plt);
@@ -495,7 +717,7 @@ get_next_track (playItem_t *curr) {
             it = pmin;
             if (!it) {
                 // all songs played, reshuffle and try again
-                if (pl_loop_mode == PLAYBACK_MODE_LOOP_ALL) { // loop
+                if (pl_loop_mode == PLAYBACK_MODE_LOOP_ALL && !peek) { // loop
                     plt_reshuffle (streamer_playlist, &it, NULL);
                 }
             }
@@ -519,14 +741,16 @@ get_next_track (playItem_t *curr) {
             it = pmin;
             if (!it) {
                 // all songs played, reshuffle and try again
-                if (pl_loop_mode == PLAYBACK_MODE_LOOP_ALL) { // loop
+                if (pl_loop_mode == PLAYBACK_MODE_LOOP_ALL && !peek) { // loop
                     trace ("all songs played! reshuffle\n");
                     plt_reshuffle (streamer_playlist, &it, NULL);
                 }
             }
             if (!it) {
-                playItem_t *temp;
-                plt_reshuffle (streamer_playlist, &temp, NULL);
+                if (!peek) {
+                    playItem_t *temp;
+                    plt_reshuffle (streamer_playlist, &temp, NULL);
+                }
                 pl_unlock ();
                 return NULL;
             }
@@ -571,12 +795,20 @@ get_next_track (playItem_t *curr) {
     }
     else if (pl_order == PLAYBACK_ORDER_RANDOM) { // random
         pl_unlock ();
+        if (peek) {
+            return NULL;
+        }
         return get_random_track ();
     }
     pl_unlock ();
     return NULL;
 }
 
+static playItem_t *
+get_next_track (playItem_t *curr) {
+    return _get_next_track (curr, 0);
+}
+
 static playItem_t *
 get_prev_track (playItem_t *curr) {
     pl_lock ();
@@ -875,6 +1107,205 @@ fileinfo_free (DB_fileinfo_t *fileinfo) {
     }
 }
 
+// Opens the decoder for the track, which must already have the decoder assigned.
+// Content-type detection and error reporting are left to stream_track.
+static DB_fileinfo_t *
+preload_open (playItem_t *it) {
+    DB_decoder_t *dec = NULL;
+    pl_lock ();
+    const char *decoder_id = pl_find_meta (it, ":DECODER");
+    if (decoder_id) {
+        dec = plug_get_decoder_for_id (decoder_id);
+    }
+    pl_unlock ();
+    if (!dec) {
+        return NULL;
+    }
+
+    trace ("\033[0;33mpreloading %s (%s)\033[37;0m\n", pl_find_meta (it, ":URI"), dec->plugin.id);
+    DB_fileinfo_t *fi = dec_open (dec, STREAMER_HINTS, it);
+    if (!fi) {
+        return NULL;
+    }
+    mutex_lock (preload_mutex);
+    preload_file = fi->file;
+    mutex_unlock (preload_mutex);
+
+    int res = dec->init (fi, DB_PLAYITEM (it));
+
+    mutex_lock (preload_mutex);
+    preload_file = NULL;
+    mutex_unlock (preload_mutex);
+
+    if (res != 0) {
+        trace ("\033[0;31mfailed to preload decoder\033[37;0m\n");
+        dec->free (fi);
+        return NULL;
+    }
+    return fi;
+}
+
+static void
+preload_thread (void *unused) {
+#if defined(__linux__) && !defined(ANDROID)
+    prctl (PR_SET_NAME, "deadbeef-preload", 0, 0, 0, 0);
+#endif
+    mutex_lock (preload_mutex);
+    for (;;) {
+        while (!preload_terminate && !preload_pending) {
+            cond_wait_locked (preload_cond, preload_mutex);
+        }
+        if (preload_terminate) {
+            break;
+        }
+        playItem_t *it = preload_track;
+        pl_item_ref (it);
+        unsigned generation = preload_generation;
+        preload_pending = 0;
+        preload_busy = 1;
+        mutex_unlock (preload_mutex);
+
+        DB_fileinfo_t *fi = preload_open (it);
+        pl_item_unref (it);
+
+        mutex_lock (preload_mutex);
+        if (fi && generation == preload_generation) {
+            preload_fileinfo = fi;
+            fi = NULL;
+        }
+        preload_busy = 0;
+        cond_broadcast (preload_cond);
+
+        if (fi) {
+            // the request was cancelled while opening
+            mutex_unlock (preload_mutex);
+            fileinfo_free (fi);
+            mutex_lock (preload_mutex);
+        }
+    }
+    mutex_unlock (preload_mutex);
+}
+
+// Cancels preloading, and returns the preloaded fileinfo if it was opened for the track `it`.
+// If the track is still being opened, waits for it, instead of opening the same file twice.
+static DB_fileinfo_t *
+preload_take (playItem_t *it) {
+    mutex_lock (preload_mutex);
+    if (it && it == preload_track && preload_busy) {
+        unsigned generation = preload_generation;
+        while (preload_busy && generation == preload_generation) {
+            cond_wait_locked (preload_cond, preload_mutex);
+        }
+    }
+
+    DB_fileinfo_t *fi = NULL;
+    if (it && it == preload_track) {
+        fi = preload_fileinfo;
+        preload_fileinfo = NULL;
+    }
+
+    DB_fileinfo_t *stale = preload_fileinfo;
+    playItem_t *track = preload_track;
+    preload_fileinfo = NULL;
+    preload_track = NULL;
+    preload_pending = 0;
+    if (preload_busy) {
+        preload_generation++;
+        if (preload_file) {
+            deadbeef->fabort (preload_file);
+        }
+    }
+    mutex_unlock (preload_mutex);
+
+    if (stale) {
+        fileinfo_free (stale);
+    }
+    if (track) {
+        pl_item_unref (track);
+    }
+    return fi;
+}
+
+// Starts preloading the track, discarding any other preloaded track.
+// Passing NULL only discards.
+static void
+preload_request (playItem_t *it) {
+    mutex_lock (preload_mutex);
+    int same = it == preload_track;
+    mutex_unlock (preload_mutex);
+    if (same) {
+        return;
+    }
+
+    preload_take (NULL);
+    if (!it) {
+        return;
+    }
+
+    mutex_lock (preload_mutex);
+    preload_track = it;
+    pl_item_ref (it);
+    preload_pending = 1;
+    cond_broadcast (preload_cond);
+    mutex_unlock (preload_mutex);
+}
+
+// Same as streamer_next would pick, but without side effects.
+// Returns NULL when the next track can't be known in advance.
+static playItem_t *
+peek_next_track (void) {
+    if (stop_after_current || stop_after_album) {
+        return NULL;
+    }
+
+    // A queued track stays in the playqueue until it starts playing,
+    // the next track is picked again when it's popped
+    playItem_t *qnext = playqueue_getnext ();
+    if (qnext) {
+        pl_item_unref (qnext);
+        if (qnext == streaming_track) {
+            return NULL;
+        }
+    }
+
+    playItem_t *next = NULL;
+    streamer_lock ();
+    if (playing_track && conf_get_int ("playback.loop", 0) == PLAYBACK_MODE_LOOP_SINGLE) {
+        next = playing_track;
+        pl_item_ref (next);
+    }
+    streamer_unlock ();
+    if (!next) {
+        next = _get_next_track (streaming_track, 1);
+    }
+    return next;
+}
+
+// Called by the streamer thread on every iteration.
+// Once the streaming track is within the preload time of its end,
+// picks the track to preload, and picks it again after each playlist, order or playqueue change.
+static void
+streamer_preload_update (void) {
+    if (!__atomic_load_n (&preload_dirty, __ATOMIC_SEQ_CST)) {
+        return;
+    }
+    if (conf_streamer_preload_seconds <= 0 || !streaming_track || !fileinfo) {
+        return;
+    }
+    float dur = pl_get_item_duration (streaming_track);
+    if (dur <= 0 || dur - fileinfo->readpos > conf_streamer_preload_seconds) {
+        return;
+    }
+
+    // cleared before peeking, so that a change made meanwhile is not missed
+    __atomic_store_n (&preload_dirty, 0, __ATOMIC_SEQ_CST);
+    playItem_t *next = peek_next_track ();
+    preload_request (next);
+    if (next) {
+        pl_item_unref (next);
+    }
+}
+
 static int
 stream_track (playItem_t *it, int startpaused) {
     if (fileinfo) {
@@ -914,10 +1345,22 @@ stream_track (playItem_t *it, int startpaused) {
         paused_stream = is_remote_stream (it);
     }
 
+    DB_fileinfo_t *preloaded = preload_take (paused_stream ? NULL : it);
+    streamer_notify_playlist_changed ();
+
     if (!it || paused_stream) {
         goto success;
     }
 
+    if (preloaded) {
+        trace ("\033[0;33musing preloaded decoder for %s\033[37;0m\n", pl_find_meta (it, ":URI"));
+        new_fileinfo = preloaded;
+        new_fileinfo_file = preloaded->file;
+        streaming_track = it;
+        pl_item_ref (streaming_track);
+        goto success;
+    }
+
     char decoder_id[100] = "";
     char filetype[100] = "";
     pl_lock ();
@@ -1466,6 +1909,7 @@ streamer_thread (void *unused) {
     uint32_t id;
     uintptr_t ctx;
     uint32_t p1, p2;
+    time_t last_fill_trace_time = 0;
     while (!streaming_terminate) {
         struct timeval tm1;
         DB_output_t *output = plug_get_output ();
@@ -1545,6 +1989,8 @@ streamer_thread (void *unused) {
             continue;
         }
 
+        streamer_preload_update ();
+
         streamblock_t *block = streamreader_get_next_block ();
 
         if (!block) {
@@ -1559,6 +2005,12 @@ streamer_thread (void *unused) {
         if (res >= 0) {
             streamreader_enqueue_block (block);
             last = block->last;
+            if (trace_bufferfill && tm1.tv_sec != last_fill_trace_time) {
+                last_fill_trace_time = tm1.tv_sec;
+                streamreader_fill_t fill;
+                streamreader_get_fill (&fill);
+                fprintf (stderr, "streamer: buffer fill %d/%d blocks, %d/%d bytes, %.2f sec\n", fill.blocks_ready, fill.blocks_total, (int)fill.bytes_ready, (int)fill.bytes_total, fill.seconds_ready);
+            }
             streamer_unlock ();
         }
 
@@ -1640,7 +2092,18 @@ streamer_init (void) {
     deadbeef->conf_get_str ("network.ctmapping", DDB_DEFAULT_CTMAPPING, conf_network_ctmapping, sizeof (conf_network_ctmapping));
     ctmap_init ();
 
+    preload_terminate = 0;
+    preload_mutex = mutex_create ();
+    preload_cond = cond_create ();
+    preload_tid = thread_start (preload_thread, NULL);
+
     streamer_tid = thread_start (streamer_thread, NULL);
+#ifndef ANDROID
+    vis_terminate = 0;
+    vis_mutex = mutex_create ();
+    vis_cond = cond_create ();
+    vis_tid = thread_start_low_priority (vis_thread, NULL);
+#endif
     return 0;
 }
 
@@ -1654,6 +2117,33 @@ streamer_free (void) {
     streaming_terminate = 1;
     thread_join (streamer_tid);
 
+    mutex_lock (preload_mutex);
+    preload_terminate = 1;
+    cond_broadcast (preload_cond);
+    mutex_unlock (preload_mutex);
+    thread_join (preload_tid);
+    preload_tid = 0;
+    preload_take (NULL);
+    cond_free (preload_cond);
+    preload_cond = 0;
+    mutex_free (preload_mutex);
+    preload_mutex = 0;
+
+#ifndef ANDROID
+    mutex_lock (vis_mutex);
+    vis_terminate = 1;
+    cond_signal (vis_cond);
+    mutex_unlock (vis_mutex);
+    if (vis_tid) {
+        thread_join (vis_tid);
+        vis_tid = 0;
+    }
+    cond_free (vis_cond);
+    vis_cond = 0;
+    mutex_free (vis_mutex);
+    vis_mutex = 0;
+#endif
+
     streamreader_free ();
 
     if (first_failed_track) {
@@ -1722,18 +2212,23 @@ streamer_reset (int full) { // must be called when current song changes by exter
     dsp_reset ();
     outbuffer_remaining = 0;
     streamer_unlock();
+#ifndef ANDROID
+    vis_tap_flush ();
+#endif
 }
 
 static int
 process_output_block (streamblock_t *block, char *bytes) {
     DB_output_t *output = plug_get_output ();
 
-    // handle change of track
-    if (block->last) {
-        update_stop_after_current ();
-    }
-    if (block->first) {
-        handle_track_change (playing_track, block->track);
+    // handle change of track, unless the block was partially consumed by process_output_block_direct
+    if (block->pos == 0) {
+        if (block->last) {
+            update_stop_after_current ();
+        }
+        if (block->first) {
+            handle_track_change (playing_track, block->track);
+        }
     }
 
     // A block with 0 size is a valid block, and needs to be processed as usual (code above this line).
@@ -1744,6 +2239,8 @@ process_output_block (streamblock_t *block, char *bytes) {
         return 0;
     }
 
+    streamreader_apply_pending_replaygain (block);
+
     int sz = block->size - block->pos;
     assert (sz);
 
@@ -1815,6 +2312,72 @@ process_output_block (streamblock_t *block, char *bytes) {
     return sz;
 }
 
+#if !defined(ANDROID) && !defined(HAVE_XGUI)
+// When the DSP chain can be bypassed, and the channel layout doesn't change,
+// convert the samples straight into the output plugin buffer, skipping the outbuffer.
+// The pending replaygain and the `volume` factor are applied in the same pass.
+// The block may be consumed partially.
+// Returns the number of bytes written, or -1 if the block needs to be processed normally.
+static int
+process_output_block_direct (streamblock_t *block, char *bytes, int size, float volume) {
+    DB_output_t *output = plug_get_output ();
+
+    if (!block->size
+        || output->fmt.samplerate != block->fmt.samplerate
+        || output->fmt.channels != block->fmt.channels
+        || output->fmt.channelmask != block->fmt.channelmask
+        || !dsp_can_bypass (&block->fmt)) {
+        return -1;
+    }
+
+    int in_ss = block->fmt.channels * block->fmt.bps / 8;
+    int out_ss = output->fmt.channels * output->fmt.bps / 8;
+    int frames = min (size / out_ss, (block->size - block->pos) / in_ss);
+    if (!frames) {
+        return -1;
+    }
+
+    char *input = block->buf + block->pos;
+    float gain = block->rg_scale * volume;
+    int sz;
+    if (gain == 1 && !memcmp (&output->fmt, &block->fmt, sizeof (ddb_waveformat_t))) {
+        sz = frames * out_ss;
+        memcpy (bytes, input, sz);
+    }
+    else if (gain == 1) {
+        sz = pcm_convert (&block->fmt, input, &output->fmt, bytes, frames * in_ss);
+    }
+    else {
+        sz = pcm_convert_with_gain (&block->fmt, input, &output->fmt, bytes, frames * in_ss, gain);
+        if (sz < 0) {
+            return -1;
+        }
+    }
+
+    // handle change of track
+    if (block->pos == 0) {
+        if (block->last) {
+            update_stop_after_current ();
+        }
+        if (block->first) {
+            handle_track_change (playing_track, block->track);
+        }
+    }
+
+    block->pos += frames * in_ss;
+
+    playpos += (float)frames/output->fmt.samplerate;
+    playtime += (float)frames/output->fmt.samplerate;
+
+    if (block->pos >= block->size) {
+        streamreader_next_block ();
+        _update_buffering_state ();
+    }
+
+    return sz;
+}
+#endif
+
 
 static float (*streamer_volume_modifier) (float delta_time);
 
@@ -1946,8 +2509,31 @@ streamer_read (char *bytes, int size) {
 
     int block_bitrate = -1;
 
+    int direct = 0;
+    int volume_applied = 0;
+#if !defined(ANDROID) && !defined(HAVE_XGUI)
+    // The soft volume can be applied while converting, unless the listeners need the data before volume,
+    // or a volume modifier needs to see each chunk
+    float volume = 1.f;
+    if (!output->has_volume && !streamer_volume_modifier && !waveform_listeners && !spectrum_listeners) {
+        volume = volume_get_amp () * (1-audio_is_mute ());
+        volume_applied = 1;
+    }
+
+    // pass-through blocks go straight to the output buffer
+    while (!outbuffer_remaining && block != NULL && direct < size && !memcmp (&block->fmt, &last_block_fmt, sizeof (ddb_waveformat_t))) {
+        int rb = process_output_block_direct (block, bytes + direct, size - direct, volume);
+        if (rb <= 0) {
+            break;
+        }
+        direct += rb;
+        block_bitrate = block->bitrate;
+        block = streamreader_get_curr_block();
+    }
+#endif
+
     // only decode until the next format change
-    if (!memcmp (&block->fmt, &last_block_fmt, sizeof (ddb_waveformat_t))) {
+    if (!direct && !memcmp (&block->fmt, &last_block_fmt, sizeof (ddb_waveformat_t))) {
         // decode enough blocks to fill the output buffer
         while (block != NULL && outbuffer_remaining < size && !memcmp (&block->fmt, &last_block_fmt, sizeof (ddb_waveformat_t))) {
             int rb = process_output_block (block, outbuffer + outbuffer_remaining);
@@ -1961,7 +2547,7 @@ streamer_read (char *bytes, int size) {
     }
     // empty buffer and the next block format differs? request format change!
 
-    if (!outbuffer_remaining && block && memcmp (&block->fmt, &last_block_fmt, sizeof (ddb_waveformat_t))) {
+    if (!direct && !outbuffer_remaining && block && memcmp (&block->fmt, &last_block_fmt, sizeof (ddb_waveformat_t))) {
         _format_change_wait = 1;
         streamer_unlock();
         memset (bytes, 0, size);
@@ -1969,25 +2555,28 @@ streamer_read (char *bytes, int size) {
     }
     streamer_unlock ();
 
-    // consume decoded data
-    int sz = min (size, outbuffer_remaining);
-    if (!sz) {
-        // no data available
-        memset (bytes, 0, size);
-        return size;
-    }
+    int sz = direct;
+    if (!direct) {
+        // consume decoded data
+        sz = min (size, outbuffer_remaining);
+        if (!sz) {
+            // no data available
+            memset (bytes, 0, size);
+            return size;
+        }
 
-    // clip to frame size
-    int ss = output->fmt.channels * output->fmt.bps / 8;
-    if ((sz % ss) != 0) {
-        sz -= (sz % ss);
-    }
+        // clip to frame size
+        int ss = output->fmt.channels * output->fmt.bps / 8;
+        if ((sz % ss) != 0) {
+            sz -= (sz % ss);
+        }
 
-    memcpy (bytes, outbuffer, sz);
-    if (sz < outbuffer_remaining) {
-        memmove (outbuffer, outbuffer + sz, outbuffer_remaining - sz);
+        memcpy (bytes, outbuffer, sz);
+        if (sz < outbuffer_remaining) {
+            memmove (outbuffer, outbuffer + sz, outbuffer_remaining - sz);
+        }
+        outbuffer_remaining -= sz;
     }
-    outbuffer_remaining -= sz;
 
     // approximate bitrate
     if (block_bitrate != -1) {
@@ -2022,68 +2611,13 @@ streamer_read (char *bytes, int size) {
 #ifndef ANDROID
 
     if (waveform_listeners || spectrum_listeners) {
-        int in_frame_size = (output->fmt.bps >> 3) * output->fmt.channels;
-        int in_frames = sz / in_frame_size;
-        ddb_waveformat_t out_fmt = {
-            .bps = 32,
-            .channels = output->fmt.channels,
-            .samplerate = output->fmt.samplerate,
-            .channelmask = output->fmt.channelmask,
-            .is_float = 1,
-            .is_bigendian = 0
-        };
-
-        float temp_audio_data[in_frames * out_fmt.channels];
-        pcm_convert (&output->fmt, bytes, &out_fmt, (char *)temp_audio_data, sz);
-        ddb_audio_data_t data;
-        data.fmt = &out_fmt;
-        data.data = temp_audio_data;
-        data.nframes = in_frames;
-        mutex_lock (wdl_mutex);
-        for (wavedata_listener_t *l = waveform_listeners; l; l = l->next) {
-            l->callback (l->ctx, &data);
-        }
-        mutex_unlock (wdl_mutex);
-
-        if (out_fmt.channels != audio_data_channels || !spectrum_listeners) {
-            audio_data_fill = 0;
-            audio_data_channels = out_fmt.channels;
-        }
-
-        if (spectrum_listeners) {
-            int remaining = in_frames;
-            do {
-                int sz = DDB_FREQ_BANDS * 2 -audio_data_fill;
-                sz = min (sz, remaining);
-                for (int c = 0; c < audio_data_channels; c++) {
-                    for (int s = 0; s < sz; s++) {
-                        audio_data[DDB_FREQ_BANDS * 2 * c + audio_data_fill + s] = temp_audio_data[(in_frames-remaining + s) * audio_data_channels + c];
-                    }
-                }
-                //            memcpy (&audio_data[audio_data_fill], &temp_audio_data[in_frames-remaining], sz * sizeof (float));
-                audio_data_fill += sz;
-                remaining -= sz;
-                if (audio_data_fill == DDB_FREQ_BANDS * 2) {
-                    for (int c = 0; c < audio_data_channels; c++) {
-                        calc_freq (&audio_data[DDB_FREQ_BANDS * 2 * c], &freq_data[DDB_FREQ_BANDS * c]);
-                    }
-                    ddb_audio_data_t data;
-                    data.fmt = &out_fmt;
-                    data.data = freq_data;
-                    data.nframes = DDB_FREQ_BANDS;
-                    mutex_lock (wdl_mutex);
-                    for (wavedata_listener_t *l = spectrum_listeners; l; l = l->next) {
-                        l->callback (l->ctx, &data);
-                    }
-                    mutex_unlock (wdl_mutex);
-                    audio_data_fill = 0;
-                }
-            } while (remaining > 0);
-        }
+        vis_tap_write (&output->fmt, bytes, sz);
     }
 #endif
 
-    streamer_apply_soft_volume (bytes, sz);
+    if (!direct || !volume_applied) {
+        streamer_apply_soft_volume (bytes, sz);
+    }
 
     return sz;
 }
@@ -2126,10 +2660,14 @@ streamer_configchanged (void) {
     }
 
     trace_bufferfill = conf_get_int ("streamer.trace_buffer_fill",0);
+    conf_streamer_preload_seconds = conf_get_int ("streamer.preload_seconds", 5);
 
     stop_after_current = conf_get_int ("playlist.stop_after_current", 0);
     stop_after_album = conf_get_int ("playlist.stop_after_album", 0);
 
+    // the loop mode, or the stop after current/album flags could change the next track
+    streamer_notify_playlist_changed ();
+
     char mapstr[2048];
     deadbeef->conf_get_str ("network.ctmapping", DDB_DEFAULT_CTMAPPING, mapstr, sizeof (mapstr));
     if (strcmp (mapstr, conf_network_ctmapping)) {
@@ -2164,6 +2702,9 @@ streamer_configchanged (void) {
 
 static void
 _handle_playback_stopped (void) {
+#ifndef ANDROID
+    vis_tap_flush ();
+#endif
     if (playing_track) {
         playItem_t *trk = playing_track;
         pl_item_ref (trk);
@@ -2386,6 +2927,7 @@ streamer_set_current_playlist_real (int plt) {
     }
     streamer_playlist = plt_get_for_idx (plt);
     pl_unlock ();
+    streamer_notify_playlist_changed ();
 }
 
 void
@@ -2451,6 +2993,9 @@ _streamer_mark_album_played_up_to (playItem_t *item) {
 
 static void
 streamer_notify_order_changed_real (int prev_order, int new_order) {
+    preload_request (NULL);
+    streamer_notify_playlist_changed ();
+
     if (prev_order != PLAYBACK_ORDER_SHUFFLE_ALBUMS && new_order == PLAYBACK_ORDER_SHUFFLE_ALBUMS) {
         streamer_lock ();
 
@@ -2468,6 +3013,11 @@ streamer_notify_order_changed (int prev_order, int new_order) {
     handler_push (handler, STR_EV_ORDER_CHANGED, 0, prev_order, new_order);
 }
 
+void
+streamer_notify_playlist_changed (void) {
+    __atomic_store_n (&preload_dirty, 1, __ATOMIC_SEQ_CST);
+}
+
 void
 vis_waveform_listen (void *ctx, void (*callback)(void *ctx, ddb_audio_data_t *data)) {
     mutex_lock (wdl_mutex);
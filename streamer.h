@@ -144,6 +144,11 @@ streamer_dsp_chain_save (void);
 void
 streamer_notify_order_changed (int prev_order, int new_order);
 
+// Must be called when the content of a playlist or the playqueue changes,
+// makes the streamer pick the next track to preload again
+void
+streamer_notify_playlist_changed (void);
+
 void
 audio_get_waveform_data (int type, float *data);
 
@@ -27,10 +27,16 @@
 #include "streamreader.h"
 #include "replaygain.h"
 #include "threading.h"
+#include "conf.h"
+#include "dsp.h"
+#include "premix.h"
 
-// read ahead about 5 sec at 44100/16/2
 #define BLOCK_SIZE 16384
-#define BLOCK_COUNT 48
+// the ring is sized to hold "streamer.buffer_seconds" of the current format,
+// but never less than about 5 sec at 44100/16/2
+#define MIN_BLOCK_COUNT 48
+#define MAX_BLOCK_COUNT 2048
+#define DEFAULT_BUFFER_SECONDS 5.f
 
 static streamblock_t *blocks; // list of all blocks
 
@@ -40,23 +46,100 @@ static streamblock_t *block_next; // next block available to be read into / queu
 
 static int numblocks_ready;
 
+static int numblocks; // total number of blocks in the ring
+
+static float buffer_seconds = DEFAULT_BUFFER_SECONDS;
+
+static ddb_waveformat_t ring_fmt; // the format which the ring was last sized for
+
 static int curr_block_bitrate;
 
 static playItem_t *_prev_rg_track;
+static float _rg_scale = 1;
 static int _rg_settingschanged = 1;
 static int _firstblock = 0;
 
+static streamblock_t *
+_block_alloc (void) {
+    streamblock_t *b = calloc (1, sizeof (streamblock_t));
+    b->pos = -1;
+    b->buf = malloc (BLOCK_SIZE);
+    return b;
+}
+
+// Number of blocks needed to buffer the configured duration of the specified format
+static int
+_block_count_for_format (const ddb_waveformat_t *fmt) {
+    int64_t bytes_per_sec = (int64_t)fmt->samplerate * fmt->channels * (fmt->bps >> 3);
+    int64_t count = (int64_t)(bytes_per_sec * buffer_seconds) / BLOCK_SIZE + 1;
+    if (count < MIN_BLOCK_COUNT) {
+        count = MIN_BLOCK_COUNT;
+    }
+    else if (count > MAX_BLOCK_COUNT) {
+        count = MAX_BLOCK_COUNT;
+    }
+    return (int)count;
+}
+
+// Adds free blocks to the ring, right before block_next.
+// This keeps the queued blocks in order, and makes the first new block the next one to be read into.
+static void
+_grow_ring (int count) {
+    if (count <= numblocks) {
+        return;
+    }
+
+    streamblock_t *head = NULL;
+    streamblock_t *tail = NULL;
+    for (int i = numblocks; i < count; i++) {
+        streamblock_t *b = _block_alloc ();
+        if (tail) {
+            tail->next = b;
+        }
+        else {
+            head = b;
+        }
+        tail = b;
+    }
+
+    // find the block preceding block_next in the ring
+    streamblock_t *prev = NULL;
+    for (streamblock_t *b = blocks; b; b = b->next) {
+        if (b->next == block_next) {
+            prev = b;
+            break;
+        }
+        if (!b->next && block_next == blocks) {
+            prev = b; // block_next is the list head, the ring wraps after the last block
+            break;
+        }
+    }
+
+    tail->next = (block_next == blocks) ? NULL : block_next;
+    if (prev) {
+        prev->next = head;
+    }
+    else {
+        blocks = head;
+    }
+    block_next = head;
+    numblocks = count;
+}
+
 void
 streamreader_init (void) {
     _prev_rg_track = NULL;
     _rg_settingschanged = 1;
-    for (int i = 0; i < BLOCK_COUNT; i++) {
-        streamblock_t *b = calloc (1, sizeof (streamblock_t));
-        b->pos = -1;
-        b->buf = malloc (BLOCK_SIZE);
+    buffer_seconds = conf_get_float ("streamer.buffer_seconds", DEFAULT_BUFFER_SECONDS);
+    if (buffer_seconds < 1) {
+        buffer_seconds = 1;
+    }
+    for (int i = 0; i < MIN_BLOCK_COUNT; i++) {
+        streamblock_t *b = _block_alloc ();
         b->next = blocks;
         blocks = b;
     }
+    numblocks = MIN_BLOCK_COUNT;
     block_next = blocks;
     numblocks_ready = 0;
     _firstblock = 0;
@@ -73,6 +156,8 @@ streamreader_free (void) {
     }
     block_next = block_data = NULL;
     numblocks_ready = 0;
+    numblocks = 0;
+    memset (&ring_fmt, 0, sizeof (ring_fmt));
     _prev_rg_track = NULL;
     _rg_settingschanged = 1;
     _firstblock = 0;
@@ -89,6 +174,11 @@ streamreader_get_next_block (void) {
 void
 streamreader_configchanged (void) {
     _rg_settingschanged = 1;
+    buffer_seconds = conf_get_float ("streamer.buffer_seconds", DEFAULT_BUFFER_SECONDS);
+    if (buffer_seconds < 1) {
+        buffer_seconds = 1;
+    }
+    memset (&ring_fmt, 0, sizeof (ring_fmt)); // resize for the new duration on the next block
 }
 
 int
@@ -119,6 +209,7 @@ streamreader_read_block (streamblock_t *block, playItem_t *track, DB_fileinfo_t
         rg_settings._size = sizeof (rg_settings);
         replaygain_init_settings (&rg_settings, track);
         replaygain_set_current (&rg_settings);
+        _rg_scale = replaygain_get_scale (&rg_settings);
     }
 
     // NOTE: streamer_set_bitrate may be called during decoder->read, and set immediated bitrate of the block
@@ -138,9 +229,20 @@ streamreader_read_block (streamblock_t *block, playItem_t *track, DB_fileinfo_t
     memcpy (&block->fmt, &fileinfo->fmt, sizeof (ddb_waveformat_t));
     block->track = track;
 
+    block->rg_scale = 1;
     int input_does_rg = fileinfo->plugin->plugin.flags & DDB_PLUGIN_FLAG_REPLAYGAIN;
     if (!input_does_rg) {
-        replaygain_apply (&fileinfo->fmt, block->buf, block->size);
+#if !defined(ANDROID) && !defined(HAVE_XGUI)
+        // without DSP, the streamer applies the gain while converting to the output format,
+        // which goes through float, and would lose precision with 32 bit integer samples
+        if (_rg_scale != 1 && (block->fmt.bps <= 24 || block->fmt.is_float) && dsp_can_bypass (&block->fmt)) {
+            block->rg_scale = _rg_scale;
+        }
+        else
+#endif
+        {
+            replaygain_apply (&fileinfo->fmt, block->buf, block->size);
+        }
     }
 
     if (_firstblock) {
@@ -162,6 +264,16 @@ streamreader_read_block (streamblock_t *block, playItem_t *track, DB_fileinfo_t
     return 0;
 }
 
+void
+streamreader_apply_pending_replaygain (streamblock_t *block) {
+    if (block->rg_scale == 1) {
+        return;
+    }
+    char *data = block->buf + block->pos;
+    pcm_convert_with_gain (&block->fmt, data, &block->fmt, data, block->size - block->pos, block->rg_scale);
+    block->rg_scale = 1;
+}
+
 void
 streamreader_enqueue_block (streamblock_t *block) {
     // block is passed just for sanity checking
@@ -177,6 +289,12 @@ streamreader_enqueue_block (streamblock_t *block) {
 
     block->queued = 1;
     numblocks_ready++;
+
+    // the ring only grows, so that the blocks are not reallocated on every track change
+    if (block->size && memcmp (&block->fmt, &ring_fmt, sizeof (ddb_waveformat_t))) {
+        memcpy (&ring_fmt, &block->fmt, sizeof (ddb_waveformat_t));
+        _grow_ring (_block_count_for_format (&block->fmt));
+    }
 }
 
 void
@@ -233,3 +351,22 @@ int
 streamreader_num_blocks_ready (void) {
     return numblocks_ready;
 }
+
+void
+streamreader_get_fill (streamreader_fill_t *fill) {
+    memset (fill, 0, sizeof (streamreader_fill_t));
+    fill->blocks_total = numblocks;
+    fill->bytes_total = (int64_t)numblocks * BLOCK_SIZE;
+
+    streamblock_t *b = block_data;
+    for (int i = 0; b && b->queued && i < numblocks_ready; i++) {
+        int remaining = b->size - (b->pos > 0 ? b->pos : 0);
+        int bytes_per_sec = b->fmt.samplerate * b->fmt.channels * (b->fmt.bps >> 3);
+        fill->blocks_ready++;
+        fill->bytes_ready += remaining;
+        if (bytes_per_sec > 0) {
+            fill->seconds_ready += (float)remaining / bytes_per_sec;
+        }
+        b = b->next ? b->next : blocks;
+    }
+}
@@ -27,6 +27,15 @@
 #include "deadbeef.h"
 #include "playlist.h"
 
+// buffer fill level, see streamreader_get_fill
+typedef struct {
+    int blocks_ready; // number of blocks with data
+    int blocks_total; // number of blocks in the ring, which depends on the stream format
+    int64_t bytes_ready; // unplayed bytes in the queued blocks
+    int64_t bytes_total; // ring capacity in bytes
+    float seconds_ready; // duration of the unplayed data
+} streamreader_fill_t;
+
 typedef struct streamblock_s {
     struct streamblock_s *next;
     char *buf;
@@ -39,6 +48,8 @@ typedef struct streamblock_s {
     playItem_t *track;
     ddb_waveformat_t fmt;
 
+    float rg_scale; // replaygain which still needs to be applied to the data, or 1
+
     int queued;
 } streamblock_t;
 
@@ -81,6 +92,16 @@ streamreader_reset (void);
 int
 streamreader_num_blocks_ready (void);
 
+// Fills in the buffer fill level.
+// Must be called with the streamer mutex locked.
+void
+streamreader_get_fill (streamreader_fill_t *fill);
+
+// Applies the replaygain which was deferred to the output stage, to the unread part of the block.
+// Used when the output can't do it while converting.
+void
+streamreader_apply_pending_replaygain (streamblock_t *block);
+
 // Notify streamreader that some configuration has changed
 void
 streamreader_configchanged (void);
@@ -123,6 +123,161 @@ static playlist_t empty_playlist;
 // empty code is used when "code" argument is null
 static char empty_code[4] = {0};
 
+// Set in ctx->flags during evaluation, when the output depends on something other than
+// the track and its metadata, e.g. on the playback state, the queue, or the playlist.
+// Such results are not cached.
+#define TF_CONTEXT_VOLATILE 0x80000000
+
+#define TF_CACHE_MIN_BUCKETS 1024
+#define TF_CACHE_MAX_ENTRIES 65536
+
+// Cached result of evaluating a script for a track.
+// The bytecode is identified by a serial number, which tf_compile stores after the code,
+// because the plugins are allowed to free the bytecode with free().
+typedef struct tf_cache_entry_s {
+    struct tf_cache_entry_s *next;
+    uint32_t serial;
+    playItem_t *it;
+    uint32_t modification_gen;
+    ddb_playlist_t *plt;
+    uint32_t flags;
+    int idx;
+    int id;
+    int iter;
+    int outlen;
+    int dimmed;
+    int len;
+    char text[];
+} tf_cache_entry_t;
+
+static uint32_t tf_code_serial;
+
+// protected by pl_lock
+static tf_cache_entry_t **tf_cache;
+static int tf_cache_buckets;
+static int tf_cache_count;
+
+static uint32_t
+tf_cache_hash (uint32_t serial, playItem_t *it, int idx) {
+    uint64_t h = (uint64_t)(uintptr_t)it * 0x9e3779b97f4a7c15ULL;
+    h ^= (uint64_t)serial * 0xff51afd7ed558ccdULL;
+    h ^= (uint64_t)(uint32_t)idx * 0xc4ceb9fe1a85ec53ULL;
+    return (uint32_t)(h >> 32);
+}
+
+static int
+tf_cache_match (tf_cache_entry_t *e, uint32_t serial, ddb_tf_context_t *ctx, int outlen) {
+    playItem_t *it = (playItem_t *)ctx->it;
+    return e->serial == serial
+        && e->it == it
+        && e->modification_gen == it->modification_gen
+        && e->plt == ctx->plt
+        && e->flags == ctx->flags
+        && e->idx == ((ctx->flags & DDB_TF_CONTEXT_HAS_INDEX) ? ctx->idx : -1)
+        && e->id == ((ctx->flags & DDB_TF_CONTEXT_HAS_ID) ? ctx->id : -1)
+        && e->iter == ctx->iter
+        && e->outlen == outlen;
+}
+
+static void
+tf_cache_flush (void) {
+    for (int i = 0; i < tf_cache_buckets; i++) {
+        while (tf_cache[i]) {
+            tf_cache_entry_t *next = tf_cache[i]->next;
+            free (tf_cache[i]);
+            tf_cache[i] = next;
+        }
+    }
+    tf_cache_count = 0;
+}
+
+static void
+tf_cache_resize (int buckets) {
+    tf_cache_entry_t **table = calloc (buckets, sizeof (tf_cache_entry_t *));
+    for (int i = 0; i < tf_cache_buckets; i++) {
+        tf_cache_entry_t *e = tf_cache[i];
+        while (e) {
+            tf_cache_entry_t *next = e->next;
+            uint32_t h = tf_cache_hash (e->serial, e->it, e->idx) & (buckets - 1);
+            e->next = table[h];
+            table[h] = e;
+            e = next;
+        }
+    }
+    free (tf_cache);
+    tf_cache = table;
+    tf_cache_buckets = buckets;
+}
+
+// must be called with pl_lock held
+static tf_cache_entry_t *
+tf_cache_find (uint32_t serial, ddb_tf_context_t *ctx, int outlen) {
+    if (!tf_cache) {
+        return NULL;
+    }
+    int idx = (ctx->flags & DDB_TF_CONTEXT_HAS_INDEX) ? ctx->idx : -1;
+    uint32_t h = tf_cache_hash (serial, (playItem_t *)ctx->it, idx) & (tf_cache_buckets - 1);
+    for (tf_cache_entry_t *e = tf_cache[h]; e; e = e->next) {
+        if (tf_cache_match (e, serial, ctx, outlen)) {
+            return e;
+        }
+    }
+    return NULL;
+}
+
+// must be called with pl_lock held
+// modification_gen is the value of the track's modification_gen before the script was evaluated
+static void
+tf_cache_add (uint32_t serial, ddb_tf_context_t *ctx, uint32_t modification_gen, int outlen, const char *text, int len, int dimmed) {
+    if (tf_cache_count >= TF_CACHE_MAX_ENTRIES) {
+        // the entries of freed bytecode and deleted tracks are never looked up again, so start over
+        tf_cache_flush ();
+    }
+    if (!tf_cache) {
+        tf_cache_resize (TF_CACHE_MIN_BUCKETS);
+    }
+    else if (tf_cache_count >= tf_cache_buckets) {
+        tf_cache_resize (tf_cache_buckets * 2);
+    }
+
+    size_t textsize = len + 1;
+    tf_cache_entry_t *e = malloc (sizeof (tf_cache_entry_t) + textsize);
+    e->serial = serial;
+    e->it = (playItem_t *)ctx->it;
+    e->modification_gen = modification_gen;
+    e->plt = ctx->plt;
+    e->flags = ctx->flags;
+    e->idx = (ctx->flags & DDB_TF_CONTEXT_HAS_INDEX) ? ctx->idx : -1;
+    e->id = (ctx->flags & DDB_TF_CONTEXT_HAS_ID) ? ctx->id : -1;
+    e->iter = ctx->iter;
+    e->outlen = outlen;
+    e->dimmed = dimmed;
+    e->len = len;
+    memcpy (e->text, text, textsize);
+
+    // replace an outdated entry for the same cell, if any
+    uint32_t h = tf_cache_hash (serial, e->it, e->idx) & (tf_cache_buckets - 1);
+    tf_cache_entry_t *prev = NULL;
+    for (tf_cache_entry_t *c = tf_cache[h]; c; prev = c, c = c->next) {
+        if (c->serial == serial && c->it == e->it && c->idx == e->idx && c->plt == e->plt
+            && c->flags == e->flags && c->id == e->id && c->iter == e->iter && c->outlen == outlen) {
+            if (prev) {
+                prev->next = c->next;
+            }
+            else {
+                tf_cache[h] = c->next;
+            }
+            free (c);
+            tf_cache_count--;
+            break;
+        }
+    }
+
+    e->next = tf_cache[h];
+    tf_cache[h] = e;
+    tf_cache_count++;
+}
+
 static int
 snprintf_clip (char *buf, size_t len, const char *fmt, ...) {
     va_list ap;
@@ -168,20 +323,53 @@ tf_eval (ddb_tf_context_t *ctx, const char *code, char *out, int outlen) {
     }
 
     int32_t codelen = *((int32_t *)code);
-    code += 4;
-    memset (out, 0, outlen);
-    int l = 0;
 
-    int bool_out = 0;
     int id = -1;
     if (ctx->flags & DDB_TF_CONTEXT_HAS_ID) {
         id = ctx->id;
     }
 
+    // results for real tracks are cached, keyed by the bytecode serial number
+    uint32_t serial = 0;
+    if (code != empty_code && !null_it && id != DB_COLUMN_FILENUMBER && id != DB_COLUMN_PLAYING) {
+        memcpy (&serial, code + 4 + codelen + 4, sizeof (serial));
+    }
+
+    code += 4;
+    memset (out, 0, outlen);
+    int l = 0;
+
+    // the evaluation runs unlocked, so a metadata change during it must not be cached as current
+    uint32_t modification_gen = 0;
+
+    if (serial) {
+        pl_lock ();
+        modification_gen = ((playItem_t *)ctx->it)->modification_gen;
+        tf_cache_entry_t *e = tf_cache_find (serial, ctx, outlen);
+        if (e) {
+            memcpy (out, e->text, e->len + 1);
+            l = e->len;
+            if (HAS_DIMMED (ctx)) {
+                ctx->dimmed = e->dimmed;
+            }
+        }
+        pl_unlock ();
+        if (e) {
+            if (null_plt) {
+                ctx->plt = NULL;
+            }
+            return l;
+        }
+    }
+
+    int bool_out = 0;
+
     if (HAS_DIMMED (ctx)) {
         ctx->dimmed = 0;
     }
 
+    char *start = out;
+
     switch (id) {
     case DB_COLUMN_FILENUMBER:
         if (ctx->flags & DDB_TF_CONTEXT_HAS_INDEX) {
@@ -197,7 +385,18 @@ tf_eval (ddb_tf_context_t *ctx, const char *code, char *out, int outlen) {
         break;
     default:
         // tf_eval_int expects outlen to not include the terminating zero
-        TF_EVAL_CHECK(l, ctx, code, codelen, out, outlen - 1, 0);
+        l = tf_eval_int (ctx, code, codelen, out, outlen - 1, &bool_out, 0);
+        if (l < 0) {
+            *out = 0;
+            ctx->flags &= ~TF_CONTEXT_VOLATILE;
+            if (null_it) {
+                ctx->it = NULL;
+            }
+            if (null_plt) {
+                ctx->plt = NULL;
+            }
+            return -1;
+        }
         break;
     }
 
@@ -213,6 +412,15 @@ tf_eval (ddb_tf_context_t *ctx, const char *code, char *out, int outlen) {
         }
     }
 
+    if (ctx->flags & TF_CONTEXT_VOLATILE) {
+        ctx->flags &= ~TF_CONTEXT_VOLATILE;
+    }
+    else if (serial) {
+        pl_lock ();
+        tf_cache_add (serial, ctx, modification_gen, outlen, start, l, HAS_DIMMED (ctx) ? ctx->dimmed : 0);
+        pl_unlock ();
+    }
+
     if (null_it) {
         ctx->it = NULL;
     }
@@ -222,6 +430,49 @@ tf_eval (ddb_tf_context_t *ctx, const char *code, char *out, int outlen) {
     return l;
 }
 
+int
+tf_eval_playlist (ddb_tf_context_t *ctx, const char *code, int outlen, char ***out) {
+    if (out) {
+        *out = NULL;
+    }
+    playlist_t *plt = (playlist_t *)ctx->plt;
+    if (!plt || outlen <= 0) {
+        return -1;
+    }
+
+    ddb_playItem_t *orig_it = ctx->it;
+    int orig_idx = ctx->idx;
+    char *buffer = malloc (outlen);
+
+    pl_lock ();
+    // the count can't change while the lock is held, so the array can't overflow
+    int count = plt->count[ctx->iter];
+    char **results = NULL;
+    if (out && count > 0) {
+        results = calloc (count, sizeof (char *));
+    }
+    int idx = 0;
+    for (playItem_t *it = plt->head[ctx->iter]; it && idx < count; it = it->next[ctx->iter], idx++) {
+        ctx->it = (ddb_playItem_t *)it;
+        ctx->idx = idx;
+        if (tf_eval (ctx, code, buffer, outlen) < 0) {
+            *buffer = 0;
+        }
+        if (results) {
+            results[idx] = strdup (buffer);
+        }
+    }
+    pl_unlock ();
+
+    free (buffer);
+    ctx->it = orig_it;
+    ctx->idx = orig_idx;
+    if (out) {
+        *out = results;
+    }
+    return idx;
+}
+
 // $greater(a,b) returns true if a is greater than b, otherwise false
 int
 tf_func_greater (ddb_tf_context_t *ctx, int argc, const uint16_t *arglens, const char *args, char *out, int outlen, int fail_on_undef) {
@@ -1929,6 +2180,7 @@ tf_func_rand (ddb_tf_context_t *ctx, int argc, const uint16_t *arglens, const ch
         return -1;
     }
 
+    ctx->flags |= TF_CONTEXT_VOLATILE;
     int outval = rand ();
 
     int res = snprintf_clip (out, outlen, "%d", outval);
@@ -2716,6 +2968,7 @@ tf_eval_int (ddb_tf_context_t *ctx, const char *code, int size, char *out, int o
                     val = pl_find_meta_raw (it, ":SAMPLERATE");
                 }
                 else if (!strcmp (name, "playback_bitrate")) {
+                    ctx->flags |= TF_CONTEXT_VOLATILE;
                     playItem_t *playing_track = streamer_get_playing_track();
                     if (playing_track) {
                         int br = streamer_get_apx_bitrate();
@@ -2778,6 +3031,7 @@ tf_eval_int (ddb_tf_context_t *ctx, const char *code, int size, char *out, int o
                     val = pl_find_meta_raw (it, ":REPLAYGAIN_TRACKPEAK");
                 }
                 else if ((tmp_a = !strcmp (name, "playback_time")) || (tmp_b = !strcmp (name, "playback_time_seconds")) || (tmp_c = !strcmp (name, "playback_time_remaining")) || (tmp_d = !strcmp (name, "playback_time_remaining_seconds")) || (tmp_e = !strcmp (name, "playback_time_ms"))) {
+                    ctx->flags |= TF_CONTEXT_VOLATILE;
                     playItem_t *playing = streamer_get_playing_track ();
                     if (it && playing == it && !(ctx->flags & DDB_TF_CONTEXT_NO_DYNAMIC)) {
                         float t = streamer_get_playpos ();
@@ -2881,6 +3135,7 @@ tf_eval_int (ddb_tf_context_t *ctx, const char *code, int size, char *out, int o
                     skip_out = 1;
                 }
                 else if ((tmp_a = !strcmp (name, "isplaying")) || (tmp_b = !strcmp (name, "ispaused"))) {
+                    ctx->flags |= TF_CONTEXT_VOLATILE;
                     playItem_t *playing = streamer_get_playing_track ();
                     
                     if (playing && 
@@ -3019,6 +3274,7 @@ tf_eval_int (ddb_tf_context_t *ctx, const char *code, int size, char *out, int o
                 }
                 // index of track in playlist (zero-padded)
                 else if (!strcmp (name, "list_index")) {
+                    ctx->flags |= TF_CONTEXT_VOLATILE;
                     if (it) {
                         int total_tracks = plt_get_item_count ((playlist_t *)ctx->plt, ctx->iter);
                         int digits = 0;
@@ -3042,6 +3298,7 @@ tf_eval_int (ddb_tf_context_t *ctx, const char *code, int size, char *out, int o
                 }
                 // total number of tracks in playlist
                 else if (!strcmp (name, "list_total")) {
+                    ctx->flags |= TF_CONTEXT_VOLATILE;
                     int total_tracks = -1;
                     if (ctx->plt) {
                         total_tracks = plt_get_item_count ((playlist_t *)ctx->plt, ctx->iter);
@@ -3062,6 +3319,7 @@ tf_eval_int (ddb_tf_context_t *ctx, const char *code, int size, char *out, int o
                 }
                 // index of track in queue
                 else if (!strcmp (name, "queue_index")) {
+                    ctx->flags |= TF_CONTEXT_VOLATILE;
                     if (it) {
                         int idx = playqueue_test (it) + 1;
                         if (idx >= 1) {
@@ -3074,6 +3332,7 @@ tf_eval_int (ddb_tf_context_t *ctx, const char *code, int size, char *out, int o
                 }
                 // indexes of track in queue
                 else if (!strcmp (name, "queue_indexes")) {
+                    ctx->flags |= TF_CONTEXT_VOLATILE;
                     if (it) {
                         int idx = playqueue_test (it) + 1;
                         if (idx >= 1) {
@@ -3098,6 +3357,7 @@ tf_eval_int (ddb_tf_context_t *ctx, const char *code, int size, char *out, int o
                 }
                 // total amount of tracks in queue
                 else if (!strcmp (name, "queue_total")) {
+                    ctx->flags |= TF_CONTEXT_VOLATILE;
                     int count = playqueue_getcount ();
                     if (count >= 0) {
                         int len = snprintf_clip (out, outlen, "%d", count);
@@ -3110,9 +3370,11 @@ tf_eval_int (ddb_tf_context_t *ctx, const char *code, int size, char *out, int o
                     val = VERSION;
                 }
                 else if (!strcmp (name, "_playlist_name")) {
+                    ctx->flags |= TF_CONTEXT_VOLATILE;
                     val = ((playlist_t *)ctx->plt)->title;
                 }
                 else if (!strcmp (name, "selection_playback_time")) {
+                    ctx->flags |= TF_CONTEXT_VOLATILE;
                     float seltime = plt_get_selection_playback_time((playlist_t *)ctx->plt);
 
                     int len = format_playback_time (out, outlen, seltime);
@@ -3572,10 +3834,17 @@ tf_compile (const char *script) {
     }
 
     size_t size = c.o - code;
-    char *out = malloc (size + 8);
+    char *out = malloc (size + 12);
     memcpy (out + 4, code, size);
     memset (out + 4 + size, 0, 4); // FIXME: this is the padding for possible buffer overflow bug fix
     *((int32_t *)out) = (int32_t)(size);
+
+    // identifies the bytecode in the result cache, never 0
+    uint32_t serial;
+    do {
+        serial = __atomic_add_fetch (&tf_code_serial, 1, __ATOMIC_RELAXED);
+    } while (!serial);
+    memcpy (out + 4 + size + 4, &serial, sizeof (serial));
     return out;
 }
 
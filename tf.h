@@ -39,9 +39,20 @@ tf_free (char *code);
 // out: buffer allocated by the caller, must be big enough to fit the output string
 // outlen: the size of out buffer
 // returns -1 on fail, output size on success
+// the results are cached per track, until its metadata changes,
+// except for scripts using fields which depend on the playback state or the playlist (e.g. %playback_time%)
 int
 tf_eval (ddb_tf_context_t *ctx, const char *code, char *out, int outlen);
 
+// evaluate the script for every track of ctx->plt in ctx->iter, in one call
+// the results are cached, so that the following tf_eval calls for the same tracks don't re-evaluate the script
+// ctx->idx is set to the index of each track, and used if DDB_TF_CONTEXT_HAS_INDEX is set
+// out: NULL, or receives an array of pointers to the results, one per evaluated track;
+// the array and each string are to be freed by the caller
+// returns the number of evaluated tracks (the size of the array), or -1 on fail
+int
+tf_eval_playlist (ddb_tf_context_t *ctx, const char *code, int outlen, char ***out);
+
 // convert legacy title formatting to the new format, usable with tf_compile
 void
 tf_import_legacy (const char *fmt, char *out, int outsize);
@@ -68,6 +68,15 @@ cond_free (uintptr_t cond);
 int
 cond_wait (uintptr_t cond, uintptr_t mutex);
 
+// same as cond_wait, but the mutex must be already locked once by the caller,
+// which allows checking the wait condition without missing a signal
+int
+cond_wait_locked (uintptr_t cond, uintptr_t mutex);
+
+// same as cond_wait_locked, but returns ETIMEDOUT if not signalled within timeout_ms
+int
+cond_wait_timeout_locked (uintptr_t cond, uintptr_t mutex, int timeout_ms);
+
 int
 cond_signal (uintptr_t cond);
 
@@ -29,6 +29,7 @@
 #include <stdlib.h>
 #include <errno.h>
 #include <string.h>
+#include <sys/time.h>
 #include "threading.h"
 #ifdef HAVE_CONFIG_H
 #include <config.h>
@@ -225,6 +226,37 @@ cond_wait (uintptr_t c, uintptr_t m) {
     return err;
 }
 
+int
+cond_wait_locked (uintptr_t c, uintptr_t m) {
+    pthread_cond_t *cond = (pthread_cond_t *)c;
+    pthread_mutex_t *mutex = (pthread_mutex_t *)m;
+    int err = pthread_cond_wait (cond, mutex);
+    if (err != 0) {
+        fprintf (stderr, "pthread_cond_wait failed: %s\n", strerror (err));
+    }
+    return err;
+}
+
+int
+cond_wait_timeout_locked (uintptr_t c, uintptr_t m, int timeout_ms) {
+    pthread_cond_t *cond = (pthread_cond_t *)c;
+    pthread_mutex_t *mutex = (pthread_mutex_t *)m;
+    struct timeval now;
+    gettimeofday (&now, NULL);
+    struct timespec deadline;
+    deadline.tv_sec = now.tv_sec + timeout_ms / 1000;
+    deadline.tv_nsec = now.tv_usec * 1000 + (long)(timeout_ms % 1000) * 1000000;
+    if (deadline.tv_nsec >= 1000000000) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+    }
+    int err = pthread_cond_timedwait (cond, mutex, &deadline);
+    if (err != 0 && err != ETIMEDOUT) {
+        fprintf (stderr, "pthread_cond_timedwait failed: %s\n", strerror (err));
+    }
+    return err;
+}
+
 int
 cond_signal (uintptr_t c) {
     pthread_cond_t *cond = (pthread_cond_t *)c;